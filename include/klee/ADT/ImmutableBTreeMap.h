@@ -0,0 +1,570 @@
+//===-- ImmutableBTreeMap.h -------------------------------------*- C++ -*-===//
+//
+//                     The KLEE Symbolic Virtual Machine
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef KLEE_IMMUTABLEBTREEMAP_H
+#define KLEE_IMMUTABLEBTREEMAP_H
+
+#include "llvm/Support/Compiler.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <functional>
+#include <iterator>
+#include <utility>
+#include <vector>
+
+namespace klee {
+
+/// An ordered map with the interface of ImmutableMap, stored in a B+-tree of
+/// reference-counted nodes. Elements are kept in leaves of up to Capacity
+/// elements, so lookups and iteration touch few cache lines.
+///
+/// Copies share all their nodes, which makes copying O(1). Besides the
+/// persistent operations returning a new map (insert, replace, remove), the
+/// map can be modified in place with set and erase: these only duplicate the
+/// nodes on the path to the element that are shared with another map or with
+/// a live iterator. Like those of ImmutableMap, iterators keep the map they
+/// were created from alive and are unaffected by later modifications.
+///
+/// K and D must be default constructible.
+template <class K, class D, class CMP = std::less<K>> class ImmutableBTreeMap {
+public:
+  typedef K key_type;
+  typedef std::pair<K, D> value_type;
+  class iterator;
+
+private:
+  static constexpr unsigned Capacity = 32;
+  /// Nodes other than the root hold at least this many entries
+  static constexpr unsigned MinEntries = Capacity / 2;
+  /// Enough for more elements than fit into memory
+  static constexpr unsigned MaxDepth = 12;
+
+  struct Node {
+    unsigned references = 1;
+    unsigned count = 0;
+    const bool leaf;
+
+    explicit Node(bool leaf) : leaf(leaf) {}
+  };
+
+  struct Leaf : Node {
+    typedef value_type Entry;
+    Entry entries[Capacity];
+
+    Leaf() : Node(true) {}
+  };
+
+  struct Inner : Node {
+    /// The smallest key in each child, and the child
+    typedef std::pair<K, Node *> Entry;
+    Entry entries[Capacity];
+
+    Inner() : Node(false) {}
+  };
+
+  Node *root = nullptr;
+  std::size_t numElements = 0;
+
+  static bool less(const K &a, const K &b) { return CMP()(a, b); }
+
+  static const K &minKey(const Node *n) {
+    return n->leaf ? static_cast<const Leaf *>(n)->entries[0].first
+                   : static_cast<const Inner *>(n)->entries[0].first;
+  }
+
+  /// Index of the first entry of `n` whose key is not less than `key`
+  template <class NodeT>
+  static unsigned lowerBound(const NodeT *n, const K &key) {
+    return std::lower_bound(n->entries, n->entries + n->count, key,
+                            [](const typename NodeT::Entry &e, const K &k) {
+                              return less(e.first, k);
+                            }) -
+           n->entries;
+  }
+
+  /// Index of the first entry of `n` whose key is greater than `key`
+  template <class NodeT>
+  static unsigned upperBound(const NodeT *n, const K &key) {
+    return std::upper_bound(n->entries, n->entries + n->count, key,
+                            [](const K &k, const typename NodeT::Entry &e) {
+                              return less(k, e.first);
+                            }) -
+           n->entries;
+  }
+
+  /// The child of `n` whose subtree holds `key` if it is in the map
+  static unsigned childIndex(const Inner *n, const K &key) {
+    unsigned i = upperBound(n, key);
+    return i ? i - 1 : 0;
+  }
+
+  static Node *acquire(Node *n) {
+    if (n)
+      ++n->references;
+    return n;
+  }
+
+  static void release(Node *n) {
+    if (n && !--n->references)
+      destroy(n);
+  }
+
+  LLVM_ATTRIBUTE_NOINLINE static void destroy(Node *n) {
+    if (n->leaf) {
+      delete static_cast<Leaf *>(n);
+    } else {
+      Inner *inner = static_cast<Inner *>(n);
+      for (unsigned i = 0; i < inner->count; ++i)
+        release(inner->entries[i].second);
+      delete inner;
+    }
+  }
+
+  /// Make the node in `slot` exclusively owned by the caller, duplicating
+  /// it if it is shared
+  static void makeUnique(Node *&slot) {
+    if (slot->references == 1)
+      return;
+    Node *copy;
+    if (slot->leaf) {
+      copy = new Leaf(*static_cast<Leaf *>(slot));
+    } else {
+      Inner *inner = new Inner(*static_cast<Inner *>(slot));
+      for (unsigned i = 0; i < inner->count; ++i)
+        acquire(inner->entries[i].second);
+      copy = inner;
+    }
+    copy->references = 1;
+    --slot->references;
+    slot = copy;
+  }
+
+  /// Insert `entry` at index `i` of `n`. If `n` is full, it is split and
+  /// the new right half is returned.
+  template <class NodeT>
+  static NodeT *insertAt(NodeT *n, unsigned i,
+                         const typename NodeT::Entry &entry) {
+    if (n->count < Capacity) {
+      std::move_backward(n->entries + i, n->entries + n->count,
+                         n->entries + n->count + 1);
+      n->entries[i] = entry;
+      ++n->count;
+      return nullptr;
+    }
+
+    NodeT *right = new NodeT;
+    std::move(n->entries + MinEntries, n->entries + Capacity, right->entries);
+    std::fill(n->entries + MinEntries, n->entries + Capacity,
+              typename NodeT::Entry());
+    n->count = MinEntries;
+    right->count = Capacity - MinEntries;
+    if (i <= MinEntries)
+      insertAt(n, i, entry);
+    else
+      insertAt(right, i - MinEntries, entry);
+    return right;
+  }
+
+  template <class NodeT> static void eraseAt(NodeT *n, unsigned i) {
+    std::move(n->entries + i + 1, n->entries + n->count, n->entries + i);
+    n->entries[--n->count] = typename NodeT::Entry();
+  }
+
+  /// Move entries between two neighbouring nodes: into `left` if they fit,
+  /// otherwise so that both end up with about the same number.
+  template <class NodeT> static void rebalance(NodeT *left, NodeT *right) {
+    unsigned total = left->count + right->count;
+    unsigned target = total <= Capacity ? total : total / 2;
+    if (left->count < target) {
+      unsigned n = target - left->count;
+      std::move(right->entries, right->entries + n,
+                left->entries + left->count);
+      std::move(right->entries + n, right->entries + right->count,
+                right->entries);
+      std::fill(right->entries + right->count - n,
+                right->entries + right->count, typename NodeT::Entry());
+      left->count += n;
+      right->count -= n;
+    } else {
+      unsigned n = left->count - target;
+      std::move_backward(right->entries, right->entries + right->count,
+                         right->entries + right->count + n);
+      std::move(left->entries + target, left->entries + left->count,
+                right->entries);
+      std::fill(left->entries + target, left->entries + left->count,
+                typename NodeT::Entry());
+      left->count -= n;
+      right->count += n;
+    }
+  }
+
+  /// Insert `value` into the subtree in `slot`, overwriting an element with
+  /// the same key iff `overwrite`. If the node in `slot` is split, the new
+  /// right half is returned.
+  static Node *insert(Node *&slot, const value_type &value, bool overwrite,
+                      bool &added) {
+    makeUnique(slot);
+
+    if (slot->leaf) {
+      Leaf *leaf = static_cast<Leaf *>(slot);
+      unsigned i = lowerBound(leaf, value.first);
+      if (i < leaf->count && !less(value.first, leaf->entries[i].first)) {
+        if (overwrite)
+          leaf->entries[i] = value;
+        added = false;
+        return nullptr;
+      }
+      added = true;
+      return insertAt(leaf, i, value);
+    }
+
+    Inner *inner = static_cast<Inner *>(slot);
+    unsigned i = childIndex(inner, value.first);
+    Node *&child = inner->entries[i].second;
+    Node *split = insert(child, value, overwrite, added);
+    inner->entries[i].first = minKey(child);
+    if (!split)
+      return nullptr;
+    return insertAt(inner, i + 1, typename Inner::Entry(minKey(split), split));
+  }
+
+  /// Remove `key`, which must be in the subtree in `slot`. Afterwards the
+  /// node in `slot` may hold fewer than MinEntries entries.
+  static void remove(Node *&slot, const K &key) {
+    makeUnique(slot);
+
+    if (slot->leaf) {
+      Leaf *leaf = static_cast<Leaf *>(slot);
+      unsigned i = lowerBound(leaf, key);
+      assert(i < leaf->count && !less(key, leaf->entries[i].first));
+      eraseAt(leaf, i);
+      return;
+    }
+
+    Inner *inner = static_cast<Inner *>(slot);
+    unsigned i = childIndex(inner, key);
+    remove(inner->entries[i].second, key);
+
+    Node *child = inner->entries[i].second;
+    if (child->count >= MinEntries || inner->count == 1) {
+      if (child->count)
+        inner->entries[i].first = minKey(child);
+      return;
+    }
+
+    // refill the child from a neighbour, or merge them
+    unsigned l = i + 1 < inner->count ? i : i - 1;
+    makeUnique(inner->entries[l].second);
+    makeUnique(inner->entries[l + 1].second);
+    Node *left = inner->entries[l].second, *right = inner->entries[l + 1].second;
+    if (left->leaf)
+      rebalance(static_cast<Leaf *>(left), static_cast<Leaf *>(right));
+    else
+      rebalance(static_cast<Inner *>(left), static_cast<Inner *>(right));
+
+    inner->entries[l].first = minKey(left);
+    if (right->count) {
+      inner->entries[l + 1].first = minKey(right);
+    } else {
+      release(right);
+      eraseAt(inner, l + 1);
+    }
+  }
+
+  template <class Fn> static void forEachUnshared(const Node *n, Fn &fn) {
+    if (n->references != 1)
+      return;
+    if (n->leaf) {
+      const Leaf *leaf = static_cast<const Leaf *>(n);
+      for (unsigned i = 0; i < leaf->count; ++i)
+        fn(leaf->entries[i]);
+    } else {
+      const Inner *inner = static_cast<const Inner *>(n);
+      for (unsigned i = 0; i < inner->count; ++i)
+        forEachUnshared(inner->entries[i].second, fn);
+    }
+  }
+
+public:
+  ImmutableBTreeMap() = default;
+  ImmutableBTreeMap(const ImmutableBTreeMap &b)
+      : root(acquire(b.root)), numElements(b.numElements) {}
+  ~ImmutableBTreeMap() { release(root); }
+
+  ImmutableBTreeMap &operator=(const ImmutableBTreeMap &b) {
+    acquire(b.root);
+    release(root);
+    root = b.root;
+    numElements = b.numElements;
+    return *this;
+  }
+
+  bool empty() const { return !numElements; }
+  std::size_t size() const { return numElements; }
+  std::size_t count(const key_type &key) const { return lookup(key) ? 1 : 0; }
+
+  const value_type *lookup(const key_type &key) const {
+    const value_type *result = lookup_previous(key);
+    return result && !less(result->first, key) ? result : nullptr;
+  }
+
+  /// The element with the greatest key not greater than `key`
+  const value_type *lookup_previous(const key_type &key) const {
+    if (!root || less(key, minKey(root)))
+      return nullptr;
+    const Node *n = root;
+    while (!n->leaf) {
+      const Inner *inner = static_cast<const Inner *>(n);
+      n = inner->entries[upperBound(inner, key) - 1].second;
+    }
+    const Leaf *leaf = static_cast<const Leaf *>(n);
+    return &leaf->entries[upperBound(leaf, key) - 1];
+  }
+
+  const value_type &min() const {
+    assert(root && "empty map");
+    return *begin();
+  }
+  const value_type &max() const {
+    assert(root && "empty map");
+    const Node *n = root;
+    while (!n->leaf) {
+      const Inner *inner = static_cast<const Inner *>(n);
+      n = inner->entries[inner->count - 1].second;
+    }
+    return static_cast<const Leaf *>(n)->entries[n->count - 1];
+  }
+
+  /// Add `value` unless its key is in the map already
+  ImmutableBTreeMap insert(const value_type &value) const {
+    ImmutableBTreeMap result(*this);
+    result.set(value, false);
+    return result;
+  }
+  /// Add `value`, replacing the element with the same key
+  ImmutableBTreeMap replace(const value_type &value) const {
+    ImmutableBTreeMap result(*this);
+    result.set(value);
+    return result;
+  }
+  ImmutableBTreeMap remove(const key_type &key) const {
+    ImmutableBTreeMap result(*this);
+    result.erase(key);
+    return result;
+  }
+
+  /// Add `value` in place, replacing the element with the same key iff
+  /// `overwrite`
+  void set(const value_type &value, bool overwrite = true) {
+    if (!root)
+      root = new Leaf;
+    bool added;
+    Node *split = insert(root, value, overwrite, added);
+    if (split) {
+      Inner *inner = new Inner;
+      inner->entries[0] = typename Inner::Entry(minKey(root), root);
+      inner->entries[1] = typename Inner::Entry(minKey(split), split);
+      inner->count = 2;
+      root = inner;
+    }
+    numElements += added;
+  }
+
+  /// Remove the element with key `key` in place, if there is one
+  void erase(const key_type &key) {
+    if (!lookup(key))
+      return;
+    remove(root, key);
+    --numElements;
+    while (!root->leaf && root->count == 1) {
+      // the only child takes over the reference of the root
+      Inner *inner = static_cast<Inner *>(root);
+      root = inner->entries[0].second;
+      inner->count = 0;
+      release(inner);
+    }
+    if (!root->count) {
+      release(root);
+      root = nullptr;
+    }
+  }
+
+  iterator begin() const {
+    iterator it(root);
+    if (root)
+      it.descend(root, false);
+    return it;
+  }
+  iterator end() const { return iterator(root); }
+
+  iterator find(const key_type &key) const {
+    iterator it = lower_bound(key);
+    return it != end() && !less(key, it->first) ? it : end();
+  }
+
+  /// The first element whose key is not less than `key`
+  iterator lower_bound(const key_type &key) const {
+    return bound(key, [](const Leaf *leaf, const K &key) {
+      return lowerBound(leaf, key);
+    });
+  }
+
+  /// The first element whose key is greater than `key`
+  iterator upper_bound(const key_type &key) const {
+    return bound(key, [](const Leaf *leaf, const K &key) {
+      return upperBound(leaf, key);
+    });
+  }
+
+  /// Calls fn(value) for every element that is not shared with any other
+  /// map, i.e. whose leaf and all its ancestors have a single reference.
+  template <typename Fn> void forEachUnshared(Fn fn) const {
+    if (root)
+      forEachUnshared(root, fn);
+  }
+
+  /// The number of nodes from the root to the leaves
+  unsigned getDepth() const {
+    unsigned depth = 0;
+    for (const Node *n = root; n;
+         n = n->leaf ? nullptr : static_cast<const Inner *>(n)->entries[0].second)
+      ++depth;
+    return depth;
+  }
+
+private:
+  template <class LeafBound>
+  iterator bound(const key_type &key, LeafBound leafBound) const {
+    iterator it(root);
+    if (!root)
+      return it;
+    const Node *n = root;
+    while (!n->leaf) {
+      const Inner *inner = static_cast<const Inner *>(n);
+      unsigned i = childIndex(inner, key);
+      it.push(n, i);
+      n = inner->entries[i].second;
+    }
+    unsigned i = leafBound(static_cast<const Leaf *>(n), key);
+    if (i < n->count) {
+      it.push(n, i);
+    } else {
+      // the element is in the next leaf, if any
+      it.push(n, n->count - 1);
+      ++it;
+    }
+    return it;
+  }
+};
+
+template <class K, class D, class CMP>
+class ImmutableBTreeMap<K, D, CMP>::iterator {
+  friend class ImmutableBTreeMap<K, D, CMP>;
+
+  struct Level {
+    const Node *node;
+    unsigned index;
+  };
+
+  /// Keeps the nodes on the path alive
+  Node *root;
+  /// The path from the root to the current element, empty at the end
+  Level path[MaxDepth];
+  unsigned depth = 0;
+
+  explicit iterator(Node *root) : root(acquire(root)) {}
+
+  void push(const Node *n, unsigned index) {
+    assert(depth < MaxDepth && "tree too deep");
+    path[depth++] = {n, index};
+  }
+
+  /// Go to the first (or last) element of the subtree of `n`
+  void descend(const Node *n, bool last) {
+    while (true) {
+      unsigned i = last ? n->count - 1 : 0;
+      push(n, i);
+      if (n->leaf)
+        return;
+      n = static_cast<const Inner *>(n)->entries[i].second;
+    }
+  }
+
+public:
+  typedef std::bidirectional_iterator_tag iterator_category;
+  typedef typename ImmutableBTreeMap::value_type value_type;
+  typedef std::ptrdiff_t difference_type;
+  typedef const value_type *pointer;
+  typedef const value_type &reference;
+
+  iterator(const iterator &b) : root(acquire(b.root)), depth(b.depth) {
+    std::copy(b.path, b.path + depth, path);
+  }
+  ~iterator() { release(root); }
+
+  iterator &operator=(const iterator &b) {
+    acquire(b.root);
+    release(root);
+    root = b.root;
+    depth = b.depth;
+    std::copy(b.path, b.path + depth, path);
+    return *this;
+  }
+
+  reference operator*() const {
+    const Level &level = path[depth - 1];
+    return static_cast<const Leaf *>(level.node)->entries[level.index];
+  }
+  pointer operator->() const { return &**this; }
+
+  iterator &operator++() {
+    assert(depth && "incrementing end iterator");
+    while (depth && path[depth - 1].index + 1 == path[depth - 1].node->count)
+      --depth;
+    if (!depth)
+      return *this;
+    Level &level = path[depth - 1];
+    ++level.index;
+    if (!level.node->leaf)
+      descend(static_cast<const Inner *>(level.node)->entries[level.index].second,
+              false);
+    return *this;
+  }
+
+  iterator &operator--() {
+    if (!depth) {
+      assert(root && "decrementing begin iterator");
+      descend(root, true);
+      return *this;
+    }
+    while (depth && path[depth - 1].index == 0)
+      --depth;
+    assert(depth && "decrementing begin iterator");
+    Level &level = path[depth - 1];
+    --level.index;
+    if (!level.node->leaf)
+      descend(static_cast<const Inner *>(level.node)->entries[level.index].second,
+              true);
+    return *this;
+  }
+
+  bool operator==(const iterator &b) const {
+    if (depth != b.depth)
+      return false;
+    return !depth || (path[depth - 1].node == b.path[depth - 1].node &&
+                      path[depth - 1].index == b.path[depth - 1].index);
+  }
+  bool operator!=(const iterator &b) const { return !(*this == b); }
+};
+
+} // namespace klee
+
+#endif /* KLEE_IMMUTABLEBTREEMAP_H */
@@ -96,6 +96,12 @@ namespace klee {
       return elts.upper_bound(key); 
     }
 
+    /// Calls fn(value) for every element that is not shared with any other
+    /// map.
+    template <typename Fn> void forEachUnshared(Fn fn) const {
+      elts.forEachUnshared(fn);
+    }
+
     static size_t getAllocated() { return Tree::allocated; }
   };
 
@@ -59,6 +59,10 @@ namespace klee {
 
     static size_t getAllocated() { return allocated; }
 
+    /// Calls fn(value) for every value whose node is not shared with any
+    /// other tree, i.e. that is only reachable through this tree.
+    template <typename Fn> void forEachUnshared(Fn fn) const;
+
   private:
     class Node;
 
@@ -528,6 +532,23 @@ namespace klee {
     return node->size();
   }
 
+  template<class K, class V, class KOV, class CMP>
+  template <typename Fn>
+  void ImmutableTree<K,V,KOV,CMP>::forEachUnshared(Fn fn) const {
+    // a node is unshared if it and all its ancestors have one reference
+    std::vector<Node *> stack;
+    if (!node->isTerminator() && node->references == 1)
+      stack.push_back(node);
+    while (!stack.empty()) {
+      Node *n = stack.back();
+      stack.pop_back();
+      fn(n->value);
+      for (Node *kid : {n->left, n->right})
+        if (!kid->isTerminator() && kid->references == 1)
+          stack.push_back(kid);
+    }
+  }
+
   template<class K, class V, class KOV, class CMP>
   ImmutableTree<K,V,KOV,CMP> 
   ImmutableTree<K,V,KOV,CMP>::insert(const value_type &value) const { 
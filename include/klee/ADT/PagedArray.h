@@ -0,0 +1,246 @@
+//===-- PagedArray.h --------------------------------------------*- C++ -*-===//
+//
+//                     The KLEE Symbolic Virtual Machine
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef KLEE_PAGEDARRAY_H
+#define KLEE_PAGEDARRAY_H
+
+#include "llvm/ADT/SmallVector.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <memory>
+#include <new>
+
+namespace klee {
+
+/// A fixed-size array stored in reference-counted pages of PageSize
+/// elements. Copies share their pages, and a page is only duplicated when a
+/// copy modifies it, so writing a single element of a copied array costs at
+/// most one page. Pages that were never written are not allocated at all and
+/// read as the default value of the array.
+template <typename T, unsigned PageSize> class PagedArray {
+  static_assert((PageSize & (PageSize - 1)) == 0,
+                "page size must be a power of two");
+
+  struct Page {
+    unsigned refCount;
+    unsigned size;
+
+    T *data() { return reinterpret_cast<T *>(this + 1); }
+    const T *data() const { return reinterpret_cast<const T *>(this + 1); }
+  };
+  static_assert(sizeof(Page) % alignof(T) == 0, "misaligned page contents");
+
+  llvm::SmallVector<Page *, 1> pages;
+  unsigned size;
+  T defaultValue;
+
+  static Page *allocatePage(unsigned size) {
+    Page *page = static_cast<Page *>(
+        ::operator new(sizeof(Page) + size * sizeof(T)));
+    page->refCount = 1;
+    page->size = size;
+    return page;
+  }
+
+  static void release(Page *page) {
+    if (!page || --page->refCount)
+      return;
+    for (unsigned i = 0; i < page->size; ++i)
+      page->data()[i].~T();
+    ::operator delete(page);
+  }
+
+public:
+  PagedArray(unsigned size, const T &defaultValue = T())
+      : pages((size + PageSize - 1) / PageSize, nullptr), size(size),
+        defaultValue(defaultValue) {}
+
+  PagedArray(const PagedArray &other)
+      : pages(other.pages), size(other.size),
+        defaultValue(other.defaultValue) {
+    for (Page *page : pages)
+      if (page)
+        ++page->refCount;
+  }
+
+  PagedArray &operator=(const PagedArray &other) {
+    if (this == &other)
+      return *this;
+    for (Page *page : other.pages)
+      if (page)
+        ++page->refCount;
+    for (Page *page : pages)
+      release(page);
+    pages = other.pages;
+    size = other.size;
+    defaultValue = other.defaultValue;
+    return *this;
+  }
+
+  ~PagedArray() {
+    for (Page *page : pages)
+      release(page);
+  }
+
+  unsigned getSize() const { return size; }
+
+  unsigned getNumPages() const { return pages.size(); }
+
+  /// Number of elements on the page with the given index
+  unsigned pageSize(unsigned index) const {
+    return std::min(PageSize, size - index * PageSize);
+  }
+
+  /// Returns the contents of the page with the given index, or null if the
+  /// page was never written.
+  const T *getPage(unsigned index) const {
+    return pages[index] ? pages[index]->data() : nullptr;
+  }
+
+  /// Whether the page with the given index is allocated and not shared with
+  /// any other array.
+  bool isPageExclusive(unsigned index) const {
+    return pages[index] && pages[index]->refCount == 1;
+  }
+
+  /// Drops the page with the given index. Its elements read as the default
+  /// value until it is written again.
+  void releasePage(unsigned index) {
+    release(pages[index]);
+    pages[index] = nullptr;
+  }
+
+  /// Returns the page with the given index for modification
+  T *getWritablePage(unsigned index) {
+    Page *&page = pages[index];
+    if (!page) {
+      page = allocatePage(pageSize(index));
+      std::uninitialized_fill_n(page->data(), page->size, defaultValue);
+    } else if (page->refCount > 1) {
+      Page *copy = allocatePage(page->size);
+      std::uninitialized_copy_n(page->data(), page->size, copy->data());
+      --page->refCount;
+      page = copy;
+    }
+    return page->data();
+  }
+
+  const T &operator[](unsigned i) const {
+    assert(i < size && "index out of bounds");
+    const Page *page = pages[i / PageSize];
+    return page ? page->data()[i % PageSize] : defaultValue;
+  }
+
+  /// Returns a modifiable reference to the element, duplicating its page if
+  /// it is shared with another array.
+  T &getWritable(unsigned i) {
+    assert(i < size && "index out of bounds");
+    return getWritablePage(i / PageSize)[i % PageSize];
+  }
+
+  void set(unsigned i, const T &value) { getWritable(i) = value; }
+
+  /// Sets all elements to value, releasing all pages.
+  void fill(const T &value) {
+    for (Page *&page : pages) {
+      release(page);
+      page = nullptr;
+    }
+    defaultValue = value;
+  }
+
+  /// Copies count elements starting at offset to dst.
+  void read(unsigned offset, unsigned count, T *dst) const {
+    assert(offset + count <= size && "range out of bounds");
+    while (count) {
+      unsigned index = offset / PageSize, begin = offset % PageSize;
+      unsigned n = std::min(count, pageSize(index) - begin);
+      if (const Page *page = pages[index])
+        std::copy_n(page->data() + begin, n, dst);
+      else
+        std::fill_n(dst, n, defaultValue);
+      offset += n;
+      dst += n;
+      count -= n;
+    }
+  }
+
+  /// Whether the count elements starting at offset equal those at src.
+  bool equals(unsigned offset, unsigned count, const T *src) const {
+    assert(offset + count <= size && "range out of bounds");
+    while (count) {
+      unsigned index = offset / PageSize, begin = offset % PageSize;
+      unsigned n = std::min(count, pageSize(index) - begin);
+      if (const Page *page = pages[index]) {
+        if (!std::equal(src, src + n, page->data() + begin))
+          return false;
+      } else if (std::any_of(src, src + n, [this](const T &value) {
+                   return !(value == defaultValue);
+                 })) {
+        return false;
+      }
+      offset += n;
+      src += n;
+      count -= n;
+    }
+    return true;
+  }
+
+  /// Copies count elements from src to the array starting at offset. Pages
+  /// whose contents do not change are left alone (and shared).
+  void write(unsigned offset, unsigned count, const T *src) {
+    assert(offset + count <= size && "range out of bounds");
+    while (count) {
+      unsigned index = offset / PageSize, begin = offset % PageSize;
+      unsigned n = std::min(count, pageSize(index) - begin);
+      if (!equals(offset, n, src))
+        std::copy_n(src, n, getWritablePage(index) + begin);
+      offset += n;
+      src += n;
+      count -= n;
+    }
+  }
+};
+
+/// A fixed-size array of bits stored in copy-on-write pages, see PagedArray.
+class PagedBitArray {
+  /// 4096 bits per page
+  PagedArray<std::uint32_t, 128> words;
+
+  static unsigned length(unsigned size) { return (size + 31) / 32; }
+
+public:
+  PagedBitArray(unsigned size, bool value = false)
+      : words(length(size), value ? ~UINT32_C(0) : 0) {}
+
+  bool get(unsigned idx) const { return (words[idx / 32] >> (idx & 0x1F)) & 1; }
+  void set(unsigned idx) {
+    if (!get(idx))
+      words.getWritable(idx / 32) |= UINT32_C(1) << (idx & 0x1F);
+  }
+  void unset(unsigned idx) {
+    if (get(idx))
+      words.getWritable(idx / 32) &= ~(UINT32_C(1) << (idx & 0x1F));
+  }
+  void set(unsigned idx, bool value) {
+    if (value)
+      set(idx);
+    else
+      unset(idx);
+  }
+
+  /// The underlying words, for page-wise access
+  PagedArray<std::uint32_t, 128> &getWords() { return words; }
+};
+
+} // namespace klee
+
+#endif /* KLEE_PAGEDARRAY_H */
@@ -10,6 +10,8 @@
 #ifndef KLEE_RNG_H
 #define KLEE_RNG_H
 
+#include <vector>
+
 namespace klee {
   class RNG {
   private:
@@ -31,6 +33,10 @@ namespace klee {
     /* set seed value */
     void seed(unsigned int seed);
 
+    /* save and restore the generator state, e.g. for checkpoints */
+    std::vector<unsigned int> getState() const;
+    bool setState(const std::vector<unsigned int> &state);
+
     /* generates a random number on [0,0xffffffff]-interval */
     unsigned int getInt32();
     /* generates a random number on [0,0x7fffffff]-interval */
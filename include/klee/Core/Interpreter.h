@@ -9,6 +9,7 @@
 #ifndef KLEE_INTERPRETER_H
 #define KLEE_INTERPRETER_H
 
+#include <cstdint>
 #include <map>
 #include <memory>
 #include <set>
@@ -46,6 +47,10 @@ public:
   virtual void processTestCase(const ExecutionState &state,
                                const char *err,
                                const char *suffix) = 0;
+
+  /// Called periodically during exploration so that the handler can
+  /// exchange work with other KLEE processes (see Interpreter::donateState).
+  virtual void handleWorkRequests() {}
 };
 
 class Interpreter {
@@ -128,6 +133,17 @@ public:
   // a user specified path. use null to reset.
   virtual void setReplayPath(const std::vector<bool> *path) = 0;
 
+  // supply a list of branch decisions, as recorded for every fork and
+  // multi-way branch, which the initial state follows before exploring on
+  // its own. this is used to continue exploring a state that was given
+  // away by another process. use null to reset.
+  virtual void setReplayDecisions(const std::vector<std::uint32_t> *decisions) = 0;
+
+  // stop exploring one of the pending states and return the branch
+  // decisions leading to it, so that it can be explored elsewhere. returns
+  // false if no state can be given away.
+  virtual bool donateState(std::vector<std::uint32_t> &decisions) = 0;
+
   // supply a set of symbolic bindings that will be used as "seeds"
   // for the search. use null to reset.
   virtual void useSeeds(const std::vector<struct KTest *> *seeds) = 0;
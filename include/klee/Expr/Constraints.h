@@ -12,17 +12,87 @@
 
 #include "klee/Expr/Expr.h"
 
+#include <cstddef>
+#include <iterator>
+#include <memory>
+#include <vector>
+
 namespace klee {
 
+class IndependentConstraintGroups;
+
 /// Resembles a set of constraints that can be passed around
 ///
+/// The constraints are stored as a list of chunks, each linked to the chunk
+/// before it, so that copies share their common prefix and copying is
+/// constant time. A copy appends to a shared chunk in place as long as no
+/// other copy has done so; otherwise it starts a new chunk of its own.
 class ConstraintSet {
   friend class ConstraintManager;
 
+  struct Chunk {
+    std::shared_ptr<Chunk> parent;
+    /// Number of constraints before this chunk
+    std::size_t offset;
+    std::vector<ref<Expr>> constraints;
+
+    Chunk(std::shared_ptr<Chunk> parent, std::size_t offset)
+        : parent(std::move(parent)), offset(offset) {}
+    ~Chunk();
+  };
+
 public:
   using constraints_ty = std::vector<ref<Expr>>;
-  using iterator = constraints_ty::iterator;
-  using const_iterator = constraints_ty::const_iterator;
+
+  class const_iterator {
+    friend class ConstraintSet;
+
+  public:
+    using iterator_category = std::forward_iterator_tag;
+    using value_type = ref<Expr>;
+    using difference_type = std::ptrdiff_t;
+    using pointer = const ref<Expr> *;
+    using reference = const ref<Expr> &;
+
+    const_iterator() = default;
+
+    reference operator*() const {
+      return (*chunks)[chunk]->constraints[index];
+    }
+    pointer operator->() const { return &**this; }
+
+    const_iterator &operator++() {
+      ++position;
+      if (++index == limit(chunk) && chunk + 1 < chunks->size()) {
+        ++chunk;
+        index = 0;
+      }
+      return *this;
+    }
+    const_iterator operator++(int) {
+      const_iterator it = *this;
+      ++*this;
+      return it;
+    }
+
+    bool operator==(const const_iterator &b) const {
+      return position == b.position;
+    }
+    bool operator!=(const const_iterator &b) const { return !(*this == b); }
+
+  private:
+    /// Chunks from the first one, each used up to the offset of the next
+    std::shared_ptr<std::vector<const Chunk *>> chunks;
+    std::size_t end = 0;
+    std::size_t chunk = 0;
+    std::size_t index = 0;
+    std::size_t position = 0;
+
+    std::size_t limit(std::size_t c) const {
+      std::size_t next = c + 1 < chunks->size() ? (*chunks)[c + 1]->offset : end;
+      return next - (*chunks)[c]->offset;
+    }
+  };
 
   using constraint_iterator = const_iterator;
 
@@ -31,17 +101,33 @@ public:
   constraint_iterator end() const;
   size_t size() const noexcept;
 
-  explicit ConstraintSet(constraints_ty cs) : constraints(std::move(cs)) {}
+  explicit ConstraintSet(constraints_ty cs);
   ConstraintSet() = default;
 
   void push_back(const ref<Expr> &e);
 
-  bool operator==(const ConstraintSet &b) const {
-    return constraints == b.constraints;
+  /// Partition of the constraints into independent groups, if the set is
+  /// managed by a ConstraintManager and --use-independent-solver is on,
+  /// otherwise null
+  const IndependentConstraintGroups *getIndependentGroups() const {
+    return groups.get();
   }
 
+  bool operator==(const ConstraintSet &b) const;
+
+  /// Removes and returns the trailing constraints that are not shared with
+  /// any copy of this set. Pushing them back restores the set.
+  constraints_ty takeUnsharedSuffix();
+
 private:
-  constraints_ty constraints;
+  std::shared_ptr<Chunk> last;
+  std::size_t count = 0;
+
+  /// Shared between copies until one of them is modified
+  std::shared_ptr<IndependentConstraintGroups> groups;
+
+  /// Start maintaining the independent groups of the constraints
+  void trackIndependence();
 };
 
 class ExprVisitor;
@@ -179,6 +179,18 @@ public:
 protected:  
   unsigned hashValue;
 
+private:
+  /// Whether this node is the representative of its structure in the
+  /// hash-consing table (see createCachedExpr()).
+  bool cached = false;
+  /// Set while a cached node is being destroyed, so that removing it from
+  /// the table does not look at its (already destroyed) contents.
+  bool toBeCleared = false;
+  friend struct ExprCacheInfo;
+  friend class ConstantExpr;
+
+protected:
+
   /// Compares `b` to `this` Expr and determines how they are ordered
   /// (ignoring their kid expressions - i.e. those returned by `getKid()`).
   ///
@@ -205,7 +217,11 @@ protected:
 
 public:
   Expr() { Expr::count++; }
-  virtual ~Expr() { Expr::count--; } 
+  virtual ~Expr();
+
+  /// Nodes are carved out of slabs when hash-consing is enabled.
+  static void *operator new(std::size_t size);
+  static void operator delete(void *ptr, std::size_t size);
 
   virtual Kind getKind() const = 0;
   virtual Width getWidth() const = 0;
@@ -240,6 +256,15 @@ public:
   /// `<` and `>` are binary relations that express the total order.
   int compare(const Expr &b) const;
 
+  /// Whether this node is shared by all structurally equal cached nodes,
+  /// in which case equality with another cached node is pointer equality.
+  bool isCached() const { return cached; }
+
+  /// Computes the hash of the freshly allocated `e` and, if hash-consing is
+  /// enabled (--expr-hash-consing), returns the node structurally equal to
+  /// `e` that was created first, registering `e` itself if there is none.
+  static ref<Expr> createCachedExpr(ref<Expr> e);
+
   // Given an array of new kids return a copy of the expression
   // but using those children. 
   virtual ref<Expr> rebuild(ref<Expr> kids[/* getNumKids() */]) const = 0;
@@ -304,6 +329,8 @@ struct Expr::CreateArg {
 // Comparison operators
 
 inline bool operator==(const Expr &lhs, const Expr &rhs) {
+  if (lhs.isCached() && rhs.isCached())
+    return &lhs == &rhs;
   return lhs.compare(rhs) == 0;
 }
 
@@ -415,9 +442,7 @@ public:
   ref<Expr> src;
 
   static ref<Expr> alloc(const ref<Expr> &src) {
-    ref<Expr> r(new NotOptimizedExpr(src));
-    r->computeHash();
-    return r;
+    return createCachedExpr(new NotOptimizedExpr(src));
   }
   
   static ref<Expr> create(ref<Expr> src);
@@ -573,9 +598,7 @@ public:
 
 public:
   static ref<Expr> alloc(const UpdateList &updates, const ref<Expr> &index) {
-    ref<Expr> r(new ReadExpr(updates, index));
-    r->computeHash();
-    return r;
+    return createCachedExpr(new ReadExpr(updates, index));
   }
   
   static ref<Expr> create(const UpdateList &updates, ref<Expr> i);
@@ -618,9 +641,7 @@ public:
 public:
   static ref<Expr> alloc(const ref<Expr> &c, const ref<Expr> &t, 
                          const ref<Expr> &f) {
-    ref<Expr> r(new SelectExpr(c, t, f));
-    r->computeHash();
-    return r;
+    return createCachedExpr(new SelectExpr(c, t, f));
   }
   
   static ref<Expr> create(ref<Expr> c, ref<Expr> t, ref<Expr> f);
@@ -681,9 +702,7 @@ private:
 
 public:
   static ref<Expr> alloc(const ref<Expr> &l, const ref<Expr> &r) {
-    ref<Expr> c(new ConcatExpr(l, r));
-    c->computeHash();
-    return c;
+    return createCachedExpr(new ConcatExpr(l, r));
   }
   
   static ref<Expr> create(const ref<Expr> &l, const ref<Expr> &r);
@@ -748,9 +767,7 @@ public:
 
 public:  
   static ref<Expr> alloc(const ref<Expr> &e, unsigned o, Width w) {
-    ref<Expr> r(new ExtractExpr(e, o, w));
-    r->computeHash();
-    return r;
+    return createCachedExpr(new ExtractExpr(e, o, w));
   }
   
   /// Creates an ExtractExpr with the given bit offset and width
@@ -799,9 +816,7 @@ public:
 
 public:  
   static ref<Expr> alloc(const ref<Expr> &e) {
-    ref<Expr> r(new NotExpr(e));
-    r->computeHash();
-    return r;
+    return createCachedExpr(new NotExpr(e));
   }
   
   static ref<Expr> create(const ref<Expr> &e);
@@ -876,9 +891,7 @@ public:                                                          \
 public:                                                          \
     _class_kind ## Expr(ref<Expr> e, Width w) : CastExpr(e,w) {} \
     static ref<Expr> alloc(const ref<Expr> &e, Width w) {        \
-      ref<Expr> r(new _class_kind ## Expr(e, w));                \
-      r->computeHash();                                          \
-      return r;                                                  \
+      return createCachedExpr(new _class_kind ## Expr(e, w));    \
     }                                                            \
     static ref<Expr> create(const ref<Expr> &e, Width w);        \
     Kind getKind() const { return _class_kind; }                 \
@@ -909,9 +922,7 @@ CAST_EXPR_CLASS(ZExt)
     _class_kind##Expr(const ref<Expr> &l, const ref<Expr> &r)                  \
         : BinaryExpr(l, r) {}                                                  \
     static ref<Expr> alloc(const ref<Expr> &l, const ref<Expr> &r) {           \
-      ref<Expr> res(new _class_kind##Expr(l, r));                              \
-      res->computeHash();                                                      \
-      return res;                                                              \
+      return createCachedExpr(new _class_kind##Expr(l, r));                    \
     }                                                                          \
     static ref<Expr> create(const ref<Expr> &l, const ref<Expr> &r);           \
     Width getWidth() const { return left->getWidth(); }                        \
@@ -958,9 +969,7 @@ ARITHMETIC_EXPR_CLASS(AShr)
     _class_kind##Expr(const ref<Expr> &l, const ref<Expr> &r)                  \
         : CmpExpr(l, r) {}                                                     \
     static ref<Expr> alloc(const ref<Expr> &l, const ref<Expr> &r) {           \
-      ref<Expr> res(new _class_kind##Expr(l, r));                              \
-      res->computeHash();                                                      \
-      return res;                                                              \
+      return createCachedExpr(new _class_kind##Expr(l, r));                    \
     }                                                                          \
     static ref<Expr> create(const ref<Expr> &l, const ref<Expr> &r);           \
     Kind getKind() const { return _class_kind; }                               \
@@ -1003,6 +1012,10 @@ private:
 
   ConstantExpr(const llvm::APInt &v) : value(v) {}
 
+  /// Returns a node for the constant of width `w` (at most 64 bits) with
+  /// the (truncated) value `v`, reusing an existing node where possible.
+  static ref<ConstantExpr> intern(uint64_t v, Width w);
+
 public:
   ~ConstantExpr() {}
 
@@ -1063,9 +1076,10 @@ public:
   void toMemory(void *address);
 
   static ref<ConstantExpr> alloc(const llvm::APInt &v) {
-    ref<ConstantExpr> r(new ConstantExpr(v));
-    r->computeHash();
-    return r;
+    if (v.getBitWidth() <= 64)
+      return intern(v.getZExtValue(), v.getBitWidth());
+    ref<Expr> r = createCachedExpr(new ConstantExpr(v));
+    return cast<ConstantExpr>(r.get());
   }
 
   static ref<ConstantExpr> alloc(const llvm::APFloat &f) {
@@ -1073,6 +1087,8 @@ public:
   }
 
   static ref<ConstantExpr> alloc(uint64_t v, Width w) {
+    if (w <= 64)
+      return intern(bits64::truncateToNBits(v, w), w);
     return alloc(llvm::APInt(w, v));
   }
 
@@ -24,6 +24,8 @@ namespace klee {
     
     struct ExprCmp {
       bool operator()(const ref<Expr> &a, const ref<Expr> &b) const {
+        if (a->isCached() && b->isCached())
+          return a.get() == b.get();
         return a==b;
       }
     };
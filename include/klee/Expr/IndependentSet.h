@@ -0,0 +1,182 @@
+//===-- IndependentSet.h ----------------------------------------*- C++ -*-===//
+//
+//                     The KLEE Symbolic Virtual Machine
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef KLEE_INDEPENDENTSET_H
+#define KLEE_INDEPENDENTSET_H
+
+#include "klee/ADT/ImmutableBTreeMap.h"
+#include "klee/Expr/Expr.h"
+
+#include "llvm/Support/raw_ostream.h"
+
+#include <map>
+#include <memory>
+#include <set>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+namespace klee {
+
+template<class T>
+class DenseSet {
+  typedef std::set<T> set_ty;
+  set_ty s;
+
+public:
+  DenseSet() {}
+
+  void add(T x) {
+    s.insert(x);
+  }
+  void add(T start, T end) {
+    for (; start<end; start++)
+      s.insert(start);
+  }
+
+  // returns true iff set is changed by addition
+  bool add(const DenseSet &b) {
+    bool modified = false;
+    for (typename set_ty::const_iterator it = b.s.begin(), ie = b.s.end();
+         it != ie; ++it) {
+      if (modified || !s.count(*it)) {
+        modified = true;
+        s.insert(*it);
+      }
+    }
+    return modified;
+  }
+
+  bool intersects(const DenseSet &b) {
+    for (typename set_ty::iterator it = s.begin(), ie = s.end();
+         it != ie; ++it)
+      if (b.s.count(*it))
+        return true;
+    return false;
+  }
+
+  typename set_ty::const_iterator begin() const { return s.begin(); }
+  typename set_ty::const_iterator end() const { return s.end(); }
+
+  void print(llvm::raw_ostream &os) const {
+    bool first = true;
+    os << "{";
+    for (typename set_ty::iterator it = s.begin(), ie = s.end();
+         it != ie; ++it) {
+      if (first) {
+        first = false;
+      } else {
+        os << ",";
+      }
+      os << *it;
+    }
+    os << "}";
+  }
+};
+
+template <class T>
+inline llvm::raw_ostream &operator<<(llvm::raw_ostream &os,
+                                     const DenseSet<T> &dis) {
+  dis.print(os);
+  return os;
+}
+
+class IndependentElementSet {
+public:
+  typedef std::map<const Array*, DenseSet<unsigned> > elements_ty;
+  elements_ty elements;                 // Represents individual elements of array accesses (arr[1])
+  std::set<const Array*> wholeObjects;  // Represents symbolically accessed arrays (arr[x])
+  std::vector<ref<Expr> > exprs;        // All expressions that are associated with this factor
+                                        // Although order doesn't matter, we use a vector to match
+                                        // the ConstraintManager constructor that will eventually
+                                        // be invoked.
+
+  IndependentElementSet() {}
+  IndependentElementSet(ref<Expr> e);
+
+  void print(llvm::raw_ostream &os) const;
+
+  // more efficient when this is the smaller set
+  bool intersects(const IndependentElementSet &b);
+
+  // returns true iff set is changed by addition
+  bool add(const IndependentElementSet &b);
+};
+
+inline llvm::raw_ostream &operator<<(llvm::raw_ostream &os,
+                                     const IndependentElementSet &ies) {
+  ies.print(os);
+  return os;
+}
+
+/// Partitions a sequence of constraints into groups of constraints that
+/// (transitively) access common array bytes, so that the constraints
+/// relevant to an expression can be looked up without examining the rest.
+///
+/// Groups are kept in a union-find structure keyed by the accessed array
+/// bytes (or whole arrays for symbolic accesses). All tables are persistent
+/// B-trees, so copies are O(1) and only the paths a copy modifies are
+/// copied.
+class IndependentConstraintGroups {
+public:
+  /// Add the next constraint of the sequence
+  void add(const ref<Expr> &constraint);
+
+  /// Number of constraints added so far
+  unsigned size() const { return numConstraints; }
+
+  /// Collect the constraints that expr depends on into result, in the order
+  /// they were added.
+  /// \return the elements accessed by expr and the collected constraints
+  IndependentElementSet getIndependentConstraints(
+      const ref<Expr> &expr, std::vector<ref<Expr>> &result) const;
+
+  /// Collect all groups as independent factors. Unless expr is constant, it
+  /// is added as an additional constraint to the factor it depends on, which
+  /// comes first.
+  void getAllIndependentSets(const ref<Expr> &expr,
+                             std::vector<IndependentElementSet> &result) const;
+
+private:
+  /// Byte number standing for a symbolic access, which covers all bytes
+  static const unsigned WholeArray = ~0u;
+
+  struct GroupInfo {
+    unsigned parent;
+    /// Number of constraints, only maintained for representatives
+    unsigned size;
+  };
+
+  typedef std::tuple<unsigned, const Array *, unsigned> element_ty;
+
+  /// Union-find forest of all groups
+  ImmutableBTreeMap<unsigned, GroupInfo> groups;
+  /// Constraints of the representatives, by group and position
+  ImmutableBTreeMap<std::pair<unsigned, unsigned>, ref<Expr>> members;
+  /// Bytes accessed by the constraints of the representatives
+  ImmutableBTreeMap<element_ty, bool> elements;
+  /// A group accessing each byte, not necessarily its representative
+  ImmutableBTreeMap<std::pair<const Array *, unsigned>, unsigned> index;
+  unsigned numConstraints = 0;
+
+  unsigned find(unsigned group) const;
+  /// Representatives of all groups accessing any of the given elements
+  std::vector<unsigned> getGroups(const IndependentElementSet &elements) const;
+  /// Add the elements accessed by a group to result
+  void addElements(unsigned root, IndependentElementSet &result) const;
+  /// Move the constraints and elements of group from into group to
+  void merge(unsigned from, unsigned to);
+  /// Append the constraints of the given groups in their original order
+  void collect(const std::vector<unsigned> &roots,
+               std::vector<ref<Expr>> &result) const;
+};
+
+} // namespace klee
+
+#endif /* KLEE_INDEPENDENTSET_H */
@@ -41,6 +41,9 @@ namespace klee {
     int *operands;
     /// Destination register index.
     unsigned dest;
+    /// Size in bits of the value the instruction produces, as given by the
+    /// module's data layout; 0 if it does not produce a sized value.
+    unsigned width;
 
   public:
     virtual ~KInstruction();
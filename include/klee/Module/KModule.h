@@ -14,6 +14,7 @@
 #include "klee/Core/Interpreter.h"
 
 #include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/DenseMap.h"
 
 #include <map>
 #include <memory>
@@ -47,7 +48,7 @@ namespace klee {
     unsigned numInstructions;
     KInstruction **instructions;
 
-    std::map<llvm::BasicBlock*, unsigned> basicBlockEntry;
+    llvm::DenseMap<llvm::BasicBlock*, unsigned> basicBlockEntry;
 
     /// Whether instructions in this function should count as
     /// "coverable" for statistics and search heuristics.
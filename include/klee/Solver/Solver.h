@@ -243,6 +243,14 @@ namespace klee {
   /// \param s - The underlying solver to use.
   Solver *createCexCachingSolver(Solver *s);
 
+  /// createPersistentCachingSolver - Create a solver which caches query
+  /// results and counterexamples in a file, so that they can be reused by
+  /// later runs and by concurrently running processes.
+  ///
+  /// \param s - The underlying solver to use.
+  /// \param path - The cache file, which is created if it does not exist.
+  Solver *createPersistentCachingSolver(Solver *s, std::string path);
+
   /// createFastCexSolver - Create a "fast counterexample solver", which tries
   /// to quickly compute a satisfying assignment for a constraint set using
   /// value propogation and range analysis.
@@ -274,6 +282,12 @@ namespace klee {
   /// fails.
   Solver *createDummySolver();
 
+  /// createPortfolioSolver - Create a solver which runs every query on all
+  /// given solvers in parallel and takes the first answer.
+  ///
+  /// \param solvers - The core solvers to race, owned by the new solver.
+  Solver *createPortfolioSolver(const std::vector<Solver *> &solvers);
+
   // Create a solver based on the supplied ``CoreSolverType``.
   Solver *createCoreSolver(CoreSolverType cst);
 }
@@ -16,6 +16,8 @@ namespace klee {
 namespace stats {
 
   extern Statistic cexCacheTime;
+  extern Statistic portfolioDirectQueries;
+  extern Statistic portfolioRaces;
   extern Statistic queries;
   extern Statistic queriesInvalid;
   extern Statistic queriesValid;
@@ -25,6 +27,9 @@ namespace stats {
   extern Statistic queryCexCacheMisses;
   extern Statistic queryConstructs;
   extern Statistic queryCounterexamples;
+  extern Statistic queryPersistentCacheHits;
+  extern Statistic queryPersistentCacheMisses;
+  extern Statistic queryReusedConstraints;
   extern Statistic queryTime;
   
 #ifdef KLEE_ARRAY_DEBUG
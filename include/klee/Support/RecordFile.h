@@ -0,0 +1,74 @@
+//===-- RecordFile.h --------------------------------------------*- C++ -*-===//
+//
+//                     The KLEE Symbolic Virtual Machine
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// Encoding of the records that KLEE writes to files (checkpoints, the
+// persistent solver cache, offloaded states). Payloads are sequences of
+// LEB128 integers, strings and raw bytes. Files that records are only ever
+// appended to frame each payload with a RecordHeader, so that a record torn
+// by a crash is detected.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef KLEE_RECORDFILE_H
+#define KLEE_RECORDFILE_H
+
+#include "llvm/ADT/StringRef.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace klee {
+
+/// Appends integers (as LEB128), strings and raw bytes to a buffer
+class RecordWriter {
+public:
+  std::string buffer;
+
+  void writeInt(std::uint64_t value);
+  void writeString(const std::string &s);
+  void writeBytes(const void *data, std::size_t size);
+};
+
+/// Reads what a RecordWriter wrote, remembering whether the data was
+/// shorter than expected
+class RecordReader {
+  const char *pos;
+  const char *end;
+
+public:
+  bool failed = false;
+
+  explicit RecordReader(llvm::StringRef data)
+      : pos(data.begin()), end(data.end()) {}
+
+  std::uint64_t readInt();
+  std::string readString();
+  void readBytes(void *data, std::size_t size);
+  bool atEnd() const { return pos == end; }
+};
+
+struct RecordHeader {
+  std::uint32_t size; ///< payload size
+  /// Truncated xxHash64 of the payload, detects records torn by a crash
+  std::uint32_t payloadHash;
+};
+
+/// Appends a header and the payload to file
+void appendRecord(std::string &file, llvm::StringRef payload);
+
+/// Reads the record at offset pos of the size bytes at data and advances pos
+/// past it.
+/// \return false if no complete and undamaged record starts at pos
+bool readRecord(const char *data, std::size_t size, std::size_t &pos,
+                llvm::StringRef &payload);
+
+} // namespace klee
+
+#endif /* KLEE_RECORDFILE_H */
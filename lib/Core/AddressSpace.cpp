@@ -13,11 +13,16 @@
 #include "Memory.h"
 #include "TimingSolver.h"
 
+#include "klee/Expr/Constraints.h"
 #include "klee/Expr/Expr.h"
 #include "klee/Statistics/TimerStatIncrementer.h"
 
 #include "CoreStats.h"
 
+#include <algorithm>
+#include <cstring>
+#include <iterator>
+
 using namespace klee;
 
 ///
@@ -25,11 +30,13 @@ using namespace klee;
 void AddressSpace::bindObject(const MemoryObject *mo, ObjectState *os) {
   assert(os->copyOnWriteOwner==0 && "object already has owner");
   os->copyOnWriteOwner = cowKey;
-  objects = objects.replace(std::make_pair(mo, os));
+  objects.set(std::make_pair(mo, os));
+  ++bindingsVersion;
 }
 
 void AddressSpace::unbindObject(const MemoryObject *mo) {
-  objects = objects.remove(mo);
+  objects.erase(mo);
+  ++bindingsVersion;
 }
 
 const ObjectState *AddressSpace::findObject(const MemoryObject *mo) const {
@@ -48,7 +55,8 @@ ObjectState *AddressSpace::getWriteable(const MemoryObject *mo,
   // Add a copy of this object state that can be updated
   ref<ObjectState> newObjectState(new ObjectState(*os));
   newObjectState->copyOnWriteOwner = cowKey;
-  objects = objects.replace(std::make_pair(mo, newObjectState));
+  objects.set(std::make_pair(mo, newObjectState));
+  ++bindingsVersion;
   return newObjectState.get();
 }
 
@@ -104,104 +112,161 @@ bool AddressSpace::resolveOne(ExecutionState &state,
       }
     }
 
-    // didn't work, now we have to search
-       
-    MemoryMap::iterator oi = objects.upper_bound(&hack);
-    MemoryMap::iterator begin = objects.begin();
-    MemoryMap::iterator end = objects.end();
-      
-    MemoryMap::iterator start = oi;
-    while (oi!=begin) {
-      --oi;
-      const auto &mo = oi->first;
-
-      bool mayBeTrue;
-      if (!solver->mayBeTrue(state.constraints,
-                             mo->getBoundsCheckPointer(address), mayBeTrue,
-                             state.queryMetaData))
-        return false;
-      if (mayBeTrue) {
-        result.first = oi->first;
-        result.second = oi->second.get();
-        success = true;
-        return true;
-      } else {
-        bool mustBeTrue;
-        if (!solver->mustBeTrue(state.constraints,
-                                UgeExpr::create(address, mo->getBaseExpr()),
-                                mustBeTrue, state.queryMetaData))
-          return false;
-        if (mustBeTrue)
-          break;
-      }
-    }
+    // didn't work, bound the candidates and ask for one of them at once
+    ResolutionList candidates;
+    if (!boundCandidates(state, solver, address, example, candidates))
+      return false;
 
-    // search forwards
-    for (oi=start; oi!=end; ++oi) {
-      const auto &mo = oi->first;
+    std::vector<bool> found(candidates.size());
+    std::size_t index;
+    if (!findCandidate(state, solver, address, candidates, found, index,
+                       success))
+      return false;
+    if (success)
+      result = candidates[index];
+    return true;
+  }
+}
 
-      bool mustBeTrue;
-      if (!solver->mustBeTrue(state.constraints,
-                              UltExpr::create(address, mo->getBaseExpr()),
-                              mustBeTrue, state.queryMetaData))
-        return false;
-      if (mustBeTrue) {
-        break;
-      } else {
-        bool mayBeTrue;
-
-        if (!solver->mayBeTrue(state.constraints,
-                               mo->getBoundsCheckPointer(address), mayBeTrue,
-                               state.queryMetaData))
-          return false;
-        if (mayBeTrue) {
-          result.first = oi->first;
-          result.second = oi->second.get();
-          success = true;
-          return true;
-        }
-      }
+bool AddressSpace::boundCandidates(ExecutionState &state, TimingSolver *solver,
+                                   ref<Expr> p, uint64_t example,
+                                   ResolutionList &candidates) const {
+  auto mustBeAtLeast = [&](const MemoryMap::iterator &it, bool &result) {
+    return solver->mustBeTrue(state.constraints,
+                              UgeExpr::create(p, it->first->getBaseExpr()),
+                              result, state.queryMetaData);
+  };
+  auto mustBeBelow = [&](const MemoryMap::iterator &it, bool &result) {
+    return solver->mustBeTrue(state.constraints,
+                              UltExpr::create(p, it->first->getBaseExpr()),
+                              result, state.queryMetaData);
+  };
+
+  // The first object above the example. As `p` can take the example
+  // value, it need not be at least the base of this or any later object,
+  // and it need not be below the base of any earlier one.
+  const MemoryMap::iterator begin = objects.begin(), end = objects.end();
+  MemoryObject hack(example);
+  const MemoryMap::iterator start = objects.upper_bound(&hack);
+
+  // Search downwards for the last object `p` must be at least the base
+  // of, with steps doubling in size until one is found, then bisect. The
+  // iterators only move over the candidates and at most as many objects
+  // beyond them, not over the whole address space.
+  // Invariant: mustBeAtLeast is false for all objects from `upper` on,
+  // which is `distance` objects after `first`.
+  MemoryMap::iterator first = begin, upper = start;
+  std::size_t distance = 0;
+  for (std::size_t step = 1; upper != begin; step *= 2) {
+    MemoryMap::iterator i = upper;
+    std::size_t moved = 0;
+    for (; moved < step && i != begin; ++moved)
+      --i;
+    bool result;
+    if (!mustBeAtLeast(i, result))
+      return false;
+    if (result) {
+      first = i;
+      distance = moved;
+      break;
+    }
+    upper = i;
+  }
+  while (distance > 1) {
+    MemoryMap::iterator mid = first;
+    std::advance(mid, distance / 2);
+    bool result;
+    if (!mustBeAtLeast(mid, result))
+      return false;
+    if (result) {
+      first = mid;
+      distance -= distance / 2;
+    } else {
+      distance /= 2;
     }
+  }
 
-    success = false;
-    return true;
+  // Likewise upwards for the first object `p` must be below the base of.
+  // Invariant: mustBeBelow is false for all objects before `lower`, which
+  // is `distance` objects before `last`.
+  MemoryMap::iterator last = end, lower = start;
+  distance = 0;
+  for (std::size_t step = 1; lower != end; step *= 2) {
+    MemoryMap::iterator i = lower;
+    std::size_t moved = 0;
+    for (MemoryMap::iterator next = std::next(i);
+         moved + 1 < step && next != end; ++next, ++moved)
+      i = next;
+    bool result;
+    if (!mustBeBelow(i, result))
+      return false;
+    if (result) {
+      last = i;
+      distance = moved;
+      break;
+    }
+    lower = std::next(i);
   }
+  while (distance > 0) {
+    MemoryMap::iterator mid = lower;
+    std::advance(mid, distance / 2);
+    bool result;
+    if (!mustBeBelow(mid, result))
+      return false;
+    if (result) {
+      last = mid;
+      distance /= 2;
+    } else {
+      lower = std::next(mid);
+      distance -= distance / 2 + 1;
+    }
+  }
+
+  for (MemoryMap::iterator it = first; it != last; ++it)
+    candidates.emplace_back(it->first, it->second.get());
+  return true;
 }
 
-int AddressSpace::checkPointerInObject(ExecutionState &state,
-                                       TimingSolver *solver, ref<Expr> p,
-                                       const ObjectPair &op, ResolutionList &rl,
-                                       unsigned maxResolutions) const {
-  // XXX in the common case we can save one query if we ask
-  // mustBeTrue before mayBeTrue for the first result. easy
-  // to add I just want to have a nice symbolic test case first.
-  const MemoryObject *mo = op.first;
-  ref<Expr> inBounds = mo->getBoundsCheckPointer(p);
+bool AddressSpace::findCandidate(ExecutionState &state, TimingSolver *solver,
+                                 ref<Expr> p, const ResolutionList &candidates,
+                                 const std::vector<bool> &found,
+                                 std::size_t &index, bool &success) const {
+  success = false;
+
+  ref<Expr> inCandidate = ConstantExpr::alloc(0, Expr::Bool);
+  for (std::size_t i = 0; i < candidates.size(); ++i)
+    if (!found[i])
+      inCandidate = OrExpr::create(
+          inCandidate, candidates[i].first->getBoundsCheckPointer(p));
+  if (inCandidate->isFalse())
+    return true;
+
   bool mayBeTrue;
-  if (!solver->mayBeTrue(state.constraints, inBounds, mayBeTrue,
-                         state.queryMetaData)) {
-    return 1;
-  }
+  if (!solver->mayBeTrue(state.constraints, inCandidate, mayBeTrue,
+                         state.queryMetaData))
+    return false;
+  if (!mayBeTrue)
+    return true;
 
-  if (mayBeTrue) {
-    rl.push_back(op);
+  // The model of the query above normally answers this one from the cache
+  ConstraintSet constraints(state.constraints);
+  ConstraintManager(constraints).addConstraint(inCandidate);
+  ref<ConstantExpr> value;
+  if (!solver->getValue(constraints, p, value, state.queryMetaData))
+    return false;
 
-    // fast path check
-    auto size = rl.size();
-    if (size == 1) {
-      bool mustBeTrue;
-      if (!solver->mustBeTrue(state.constraints, inBounds, mustBeTrue,
-                              state.queryMetaData))
-        return 1;
-      if (mustBeTrue)
-        return 0;
+  uint64_t address = value->getZExtValue();
+  for (std::size_t i = 0; i < candidates.size(); ++i) {
+    const MemoryObject *mo = candidates[i].first;
+    if (!found[i] && ((mo->size == 0 && address == mo->address) ||
+                      address - mo->address < mo->size)) {
+      index = i;
+      success = true;
+      return true;
     }
-    else
-      if (size == maxResolutions)
-        return 1;
   }
-
-  return 2;
+  assert(0 && "value outside of the candidates");
+  return false;
 }
 
 bool AddressSpace::resolve(ExecutionState &state, TimingSolver *solver,
@@ -215,76 +280,55 @@ bool AddressSpace::resolve(ExecutionState &state, TimingSolver *solver,
   } else {
     TimerStatIncrementer timer(stats::resolveTime);
 
-    // XXX in general this isn't exactly what we want... for
-    // a multiple resolution case (or for example, a \in {b,c,0})
-    // we want to find the first object, find a cex assuming
-    // not the first, find a cex assuming not the second...
-    // etc.
-
-    // XXX how do we smartly amortize the cost of checking to
-    // see if we need to keep searching up/down, in bad cases?
-    // maybe we don't care?
-
-    // XXX we really just need a smart place to start (although
-    // if its a known solution then the code below is guaranteed
-    // to hit the fast path with exactly 2 queries). we could also
-    // just get this by inspection of the expr.
-
     ref<ConstantExpr> cex;
     if (!solver->getValue(state.constraints, p, cex, state.queryMetaData))
       return true;
     uint64_t example = cex->getZExtValue();
-    MemoryObject hack(example);
-
-    MemoryMap::iterator oi = objects.upper_bound(&hack);
-    MemoryMap::iterator begin = objects.begin();
-    MemoryMap::iterator end = objects.end();
-
-    MemoryMap::iterator start = oi;
-    // search backwards, start with one minus because this
-    // is the object that p *should* be within, which means we
-    // get write off the end with 4 queries
-    while (oi != begin) {
-      --oi;
-      const MemoryObject *mo = oi->first;
-      if (timeout && timeout < timer.delta())
-        return true;
-
-      auto op = std::make_pair<>(mo, oi->second.get());
-
-      int incomplete =
-          checkPointerInObject(state, solver, p, op, rl, maxResolutions);
-      if (incomplete != 2)
-        return incomplete ? true : false;
 
+    // fast path, for any pointer that must be in bounds of one object
+    ObjectPair op;
+    bool exampleResolved = resolveOne(cex, op);
+    if (exampleResolved) {
+      rl.push_back(op);
       bool mustBeTrue;
       if (!solver->mustBeTrue(state.constraints,
-                              UgeExpr::create(p, mo->getBaseExpr()), mustBeTrue,
+                              op.first->getBoundsCheckPointer(p), mustBeTrue,
                               state.queryMetaData))
         return true;
       if (mustBeTrue)
-        break;
+        return false;
+      if (rl.size() == maxResolutions)
+        return true;
     }
 
-    // search forwards
-    for (oi = start; oi != end; ++oi) {
-      const MemoryObject *mo = oi->first;
+    // Bound the candidates by binary search over the objects ordered by
+    // address, then find the feasible ones one query each, rather than
+    // testing every object in between.
+    ResolutionList candidates;
+    if (!boundCandidates(state, solver, p, example, candidates))
+      return true;
+
+    std::vector<bool> found(candidates.size());
+    if (exampleResolved)
+      for (std::size_t i = 0; i < candidates.size(); ++i)
+        if (candidates[i].first == op.first)
+          found[i] = true;
+
+    while (true) {
       if (timeout && timeout < timer.delta())
         return true;
 
-      bool mustBeTrue;
-      if (!solver->mustBeTrue(state.constraints,
-                              UltExpr::create(p, mo->getBaseExpr()), mustBeTrue,
-                              state.queryMetaData))
+      std::size_t index;
+      bool success;
+      if (!findCandidate(state, solver, p, candidates, found, index, success))
         return true;
-      if (mustBeTrue)
+      if (!success)
         break;
-      auto op = std::make_pair<>(mo, oi->second.get());
 
-      int incomplete =
-          checkPointerInObject(state, solver, p, op, rl, maxResolutions);
-      if (incomplete != 2)
-        return incomplete ? true : false;
+      found[index] = true;
+      rl.push_back(candidates[index]);
+      if (rl.size() == maxResolutions)
+        return true;
     }
   }
 
@@ -306,36 +350,144 @@ void AddressSpace::copyOutConcretes() {
       const auto &os = it->second;
       auto address = reinterpret_cast<std::uint8_t*>(mo->address);
 
-      if (!os->readOnly)
-        memcpy(address, os->concreteStore, mo->size);
+      // Skip objects whose contents are in native memory already. Objects
+      // at fixed addresses belong to the process and may change anytime.
+      if (!os->readOnly &&
+          (mo->isFixed || os->concreteVersion != mo->nativeVersion)) {
+        os->concreteStore.read(0, mo->size, address);
+        mo->nativeVersion = os->concreteVersion;
+      }
     }
   }
 }
 
-bool AddressSpace::copyInConcretes() {
+bool AddressSpace::copyInConcretes(const std::vector<std::uint64_t> *pages,
+                                   std::uint64_t pageSize) {
   for (auto &obj : objects) {
     const MemoryObject *mo = obj.first;
 
     if (!mo->isUserSpecified) {
       const auto &os = obj.second;
 
-      if (!copyInConcrete(mo, os.get(), mo->address))
+      bool success = pages && !mo->isFixed
+                         ? copyInConcretePages(mo, os.get(), *pages, pageSize)
+                         : copyInConcrete(mo, os.get(), mo->address);
+      if (!success) {
+        // native memory may differ from the objects that were not copied
+        invalidateNativeCopies();
         return false;
+      }
     }
   }
 
   return true;
 }
 
+bool AddressSpace::copyInConcretePages(const MemoryObject *mo,
+                                       const ObjectState *os,
+                                       const std::vector<std::uint64_t> &pages,
+                                       std::uint64_t pageSize) {
+  // Only the parts of the object on the given pages may have changed, as
+  // the rest of the native memory still holds the copied out contents.
+  std::uint64_t begin = mo->address, end = mo->address + mo->size;
+  ObjectState *wos = nullptr;
+  for (auto it = std::lower_bound(pages.begin(), pages.end(),
+                                  begin & ~(pageSize - 1));
+       it != pages.end() && *it < end; ++it) {
+    std::uint64_t from = std::max(*it, begin);
+    std::uint64_t to = std::min(*it + pageSize, end);
+    auto address = reinterpret_cast<std::uint8_t *>(from);
+    std::uint64_t offset = from - begin;
+    const ObjectState *current = wos ? wos : os;
+    if (current->concreteStore.equals(offset, to - from, address))
+      continue;
+    if (os->readOnly)
+      return false;
+    if (!wos)
+      wos = getWriteable(mo, os);
+    wos->concreteStore.write(offset, to - from, address);
+  }
+  if (wos) {
+    wos->markConcreteStoreChanged();
+    mo->nativeVersion = wos->concreteVersion;
+  }
+  return true;
+}
+
+void AddressSpace::invalidateNativeCopies() {
+  for (auto &obj : objects) {
+    const MemoryObject *mo = obj.first;
+    mo->nativeVersion = 0;
+
+    // read-only objects are never copied out again
+    const auto &os = obj.second;
+    auto address = reinterpret_cast<std::uint8_t *>(mo->address);
+    if (!mo->isUserSpecified && os->readOnly &&
+        !os->concreteStore.equals(0, mo->size, address))
+      os->concreteStore.read(0, mo->size, address);
+  }
+}
+
+static void appendPages(const MemoryObject *mo, std::uint64_t pageSize,
+                        std::vector<std::uint64_t> &pages) {
+  std::uint64_t first = mo->address & ~(pageSize - 1);
+  std::uint64_t last = (mo->address + mo->size - 1) & ~(pageSize - 1);
+  for (std::uint64_t page = first; page <= last; page += pageSize)
+    pages.push_back(page);
+}
+
+void AddressSpace::getConcretePages(std::vector<std::uint64_t> &pages,
+                                    std::uint64_t pageSize) const {
+  for (auto &obj : objects) {
+    const MemoryObject *mo = obj.first;
+    if (mo->isUserSpecified || mo->isFixed || !mo->size)
+      continue;
+    appendPages(mo, pageSize, pages);
+  }
+  std::sort(pages.begin(), pages.end());
+  pages.erase(std::unique(pages.begin(), pages.end()), pages.end());
+}
+
+bool AddressSpace::getSymbolicPages(std::vector<std::uint64_t> &pages,
+                                    std::uint64_t pageSize) const {
+  for (auto &obj : objects) {
+    const MemoryObject *mo = obj.first;
+    if (mo->isUserSpecified || !mo->size || obj.second->isAllConcrete())
+      continue;
+    if (mo->isFixed)
+      return false;
+    appendPages(mo, pageSize, pages);
+  }
+  std::sort(pages.begin(), pages.end());
+  pages.erase(std::unique(pages.begin(), pages.end()), pages.end());
+  return true;
+}
+
+bool AddressSpace::readOnlyConcretesUnchanged() const {
+  for (auto &obj : objects) {
+    const MemoryObject *mo = obj.first;
+    const auto &os = obj.second;
+    if (!mo->isUserSpecified && os->readOnly &&
+        !os->concreteStore.equals(
+            0, mo->size, reinterpret_cast<const std::uint8_t *>(mo->address)))
+      return false;
+  }
+  return true;
+}
+
 bool AddressSpace::copyInConcrete(const MemoryObject *mo, const ObjectState *os,
                                   uint64_t src_address) {
   auto address = reinterpret_cast<std::uint8_t*>(src_address);
-  if (memcmp(address, os->concreteStore, mo->size) != 0) {
+  if (!os->concreteStore.equals(0, mo->size, address)) {
     if (os->readOnly) {
       return false;
     } else {
+      // only the pages that differ stop being shared with other states
       ObjectState *wos = getWriteable(mo, os);
-      memcpy(wos->concreteStore, address, mo->size);
+      wos->concreteStore.write(0, mo->size, address);
+      wos->markConcreteStoreChanged();
+      if (src_address == mo->address)
+        mo->nativeVersion = wos->concreteVersion;
     }
   }
   return true;
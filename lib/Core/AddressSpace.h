@@ -13,7 +13,7 @@
 #include "Memory.h"
 
 #include "klee/Expr/Expr.h"
-#include "klee/ADT/ImmutableMap.h"
+#include "klee/ADT/ImmutableBTreeMap.h"
 #include "klee/System/Time.h"
 
 namespace klee {
@@ -32,7 +32,8 @@ namespace klee {
     bool operator()(const MemoryObject *a, const MemoryObject *b) const;
   };
 
-  typedef ImmutableMap<const MemoryObject *, ref<ObjectState>, MemoryObjectLT>
+  typedef ImmutableBTreeMap<const MemoryObject *, ref<ObjectState>,
+                            MemoryObjectLT>
       MemoryMap;
 
   class AddressSpace {
@@ -43,16 +44,25 @@ namespace klee {
     /// Unsupported, use copy constructor
     AddressSpace &operator=(const AddressSpace &);
 
-    /// Check if pointer `p` can point to the memory object in the
-    /// given object pair.  If so, add it to the given resolution list.
+    /// Narrow down the objects pointer `p` can point to, using binary
+    /// search over the objects of this address space ordered by address.
+    /// `example` is a possible value of `p`.
     ///
-    /// \return 1 iff the resolution is incomplete (`maxResolutions`
-    /// is non-zero and it was reached, or a query timed out), 0 iff
-    /// the resolution is complete (`p` can only point to the given
-    /// memory object), and 2 otherwise.
-    int checkPointerInObject(ExecutionState &state, TimingSolver *solver,
-                             ref<Expr> p, const ObjectPair &op,
-                             ResolutionList &rl, unsigned maxResolutions) const;
+    /// On success, `candidates` holds the objects `p` can point to, ordered
+    /// by address.
+    /// \return false iff a query failed.
+    bool boundCandidates(ExecutionState &state, TimingSolver *solver,
+                         ref<Expr> p, uint64_t example,
+                         ResolutionList &candidates) const;
+
+    /// Find an object pointer `p` can point to among the `candidates`
+    /// whose entry in `found` is not set, with a single query.
+    ///
+    /// \return false iff a query failed.
+    bool findCandidate(ExecutionState &state, TimingSolver *solver,
+                       ref<Expr> p, const ResolutionList &candidates,
+                       const std::vector<bool> &found, std::size_t &index,
+                       bool &success) const;
 
   public:
     /// The MemoryObject -> ObjectState map that constitutes the
@@ -64,8 +74,14 @@ namespace klee {
     /// \invariant forall o in objects, o->copyOnWriteOwner <= cowKey
     MemoryMap objects;
 
-    AddressSpace() : cowKey(1) {}
-    AddressSpace(const AddressSpace &b) : cowKey(++b.cowKey), objects(b.objects) { }
+    /// Incremented whenever an object is bound, unbound or replaced by
+    /// a copy, so that cached ObjectPairs can be validated cheaply.
+    std::uint64_t bindingsVersion;
+
+    AddressSpace() : cowKey(1), bindingsVersion(0) {}
+    AddressSpace(const AddressSpace &b)
+        : cowKey(++b.cowKey), objects(b.objects),
+          bindingsVersion(b.bindingsVersion) {}
     ~AddressSpace() {}
 
     /// Resolve address to an ObjectPair in result.
@@ -125,7 +141,8 @@ namespace klee {
     ObjectState *getWriteable(const MemoryObject *mo, const ObjectState *os);
 
     /// Copy the concrete values of all managed ObjectStates into the
-    /// actual system memory location they were allocated at.
+    /// actual system memory location they were allocated at. Objects whose
+    /// current contents were copied there before are skipped.
     void copyOutConcretes();
 
     /// Copy the concrete values of all managed ObjectStates back from
@@ -134,9 +151,37 @@ namespace klee {
     /// potentially copied) if the memory values are different from
     /// the current concrete values.
     ///
+    /// If pages is given, only the parts of objects on these pages (sorted,
+    /// given by their addresses) and objects at fixed addresses are copied
+    /// back.
+    ///
     /// \retval true The copy succeeded. 
     /// \retval false The copy failed because a read-only object was modified.
-    bool copyInConcretes();
+    bool copyInConcretes(const std::vector<std::uint64_t> *pages = nullptr,
+                         std::uint64_t pageSize = 0);
+
+    /// Collect the addresses of all native memory pages that hold objects
+    /// copied by copyOutConcretes and copyInConcretes (sorted), except for
+    /// objects at fixed addresses.
+    void getConcretePages(std::vector<std::uint64_t> &pages,
+                          std::uint64_t pageSize) const;
+
+    /// Collect the addresses of all native memory pages that hold objects
+    /// copied by copyOutConcretes whose contents are not entirely concrete
+    /// (sorted).
+    ///
+    /// \retval false An object at a fixed address has symbolic contents.
+    bool getSymbolicPages(std::vector<std::uint64_t> &pages,
+                          std::uint64_t pageSize) const;
+
+    /// Check that the native memory of all read-only objects still holds
+    /// their contents, as copyInConcretes fails otherwise.
+    bool readOnlyConcretesUnchanged() const;
+
+    /// Forget which objects have their contents in native memory, e.g.
+    /// after native memory was modified without copying it back. The native
+    /// memory of read-only objects is restored from their contents.
+    void invalidateNativeCopies();
 
     /// Updates the memory object with the raw memory from the address
     ///
@@ -146,6 +191,12 @@ namespace klee {
     /// @return
     bool copyInConcrete(const MemoryObject *mo, const ObjectState *os,
                         uint64_t src_address);
+
+    /// Updates the parts of the memory object on the given pages (sorted,
+    /// given by their addresses) from native memory
+    bool copyInConcretePages(const MemoryObject *mo, const ObjectState *os,
+                             const std::vector<std::uint64_t> &pages,
+                             std::uint64_t pageSize);
   };
 } // End klee namespace
 
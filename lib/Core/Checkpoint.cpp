@@ -0,0 +1,331 @@
+//===-- Checkpoint.cpp ----------------------------------------------------===//
+//
+//                     The KLEE Symbolic Virtual Machine
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// A checkpoint file starts with a magic string, followed by records that are
+// only ever appended (see klee/Support/RecordFile.h). The payload of a
+// record is a sequence of LEB128 integers, starting with its type:
+//
+//   Path:       parent record, decisions taken from it, n, n decisions
+//   Coverage:   n, n pairs of instruction id and coverage flags
+//   Checkpoint: n, n pairs of path record and number of decisions,
+//               RNG state, statistics
+//
+// A path record extends a prefix of the path of an earlier record (or of
+// the empty path, record 0). A checkpoint record completes a checkpoint;
+// the records following the last one, e.g. left by a crash while writing,
+// are ignored.
+//
+//===----------------------------------------------------------------------===//
+
+#include "Checkpoint.h"
+
+#include "ExecutionState.h"
+#include "StatsTracker.h"
+
+#include "klee/ADT/RNG.h"
+#include "klee/Statistics/Statistics.h"
+#include "klee/Support/ErrorHandling.h"
+#include "klee/Support/RecordFile.h"
+
+#include "llvm/Support/MemoryBuffer.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+using namespace klee;
+
+namespace {
+
+const char CheckpointMagic[8] = {'K', 'L', 'E', 'E', 'C', 'P', '0', '2'};
+
+enum RecordType : std::uint32_t {
+  PathRecord = 'P',
+  CoverageRecord = 'C',
+  CheckpointRecord = 'S'
+};
+
+/// Rewrite the file once it is more than this much larger than needed
+const std::uint64_t CompactionSlack = 1 << 20;
+
+/// Appends the record built by w to file
+void finishRecord(std::string &file, RecordWriter &w) {
+  appendRecord(file, w.buffer);
+  w.buffer.clear();
+}
+
+bool writeAll(int fd, const char *data, std::size_t size) {
+  while (size) {
+    ssize_t n = ::write(fd, data, size);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return false;
+    data += n;
+    size -= n;
+  }
+  return true;
+}
+
+} // namespace
+
+CheckpointWriter::CheckpointWriter(std::string path) : path(std::move(path)) {}
+
+CheckpointWriter::~CheckpointWriter() {
+  if (fd >= 0)
+    close(fd);
+}
+
+void CheckpointWriter::write(const std::vector<ExecutionState *> &states,
+                             const StatsTracker *statsTracker,
+                             const RNG &rng) {
+  // A complete checkpoint needs about a byte per decision of the states
+  std::uint64_t neededSize = CompactionSlack;
+  for (const auto *es : states)
+    neededSize += es->branchDecisions.size() + 8;
+
+  // Start a new file if there is none yet or most of it is garbage. It is
+  // written next to the old one, which stays valid until it is replaced.
+  const bool rewrite = fd < 0 || fileSize > 2 * neededSize;
+  int out = fd;
+  const std::string tmpPath = path + ".tmp";
+  std::string buffer;
+  RecordWriter w;
+  if (rewrite) {
+    out = ::open(tmpPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+                 0644);
+    if (out < 0) {
+      klee_warning("unable to create checkpoint %s: %s", tmpPath.c_str(),
+                   strerror(errno));
+      return;
+    }
+    buffer.append(CheckpointMagic, sizeof(CheckpointMagic));
+    numRecords = 0;
+    writtenCoverage.clear();
+    for (auto *es : states)
+      es->checkpointRecord = 0;
+  }
+
+  for (auto *es : states) {
+    const std::size_t size = es->branchDecisions.size();
+    if (es->checkpointRecord && es->checkpointedDecisions == size)
+      continue;
+    const std::uint32_t from = es->checkpointRecord ? es->checkpointedDecisions
+                                                    : 0;
+    w.writeInt(PathRecord);
+    w.writeInt(es->checkpointRecord);
+    w.writeInt(from);
+    w.writeInt(size - from);
+    for (std::size_t i = from; i < size; ++i)
+      w.writeInt(es->branchDecisions[i]);
+    finishRecord(buffer, w);
+    es->checkpointRecord = ++numRecords;
+    es->checkpointedDecisions = size;
+  }
+
+  if (statsTracker) {
+    const unsigned numIDs = statsTracker->getNumInstructionIDs();
+    writtenCoverage.resize(numIDs);
+    std::vector<std::pair<unsigned, unsigned>> newCoverage;
+    for (unsigned id = 0; id < numIDs; ++id) {
+      const unsigned coverage = statsTracker->getCoverage(id);
+      if (coverage & ~writtenCoverage[id]) {
+        newCoverage.emplace_back(id, coverage);
+        writtenCoverage[id] = coverage;
+      }
+    }
+    if (!newCoverage.empty()) {
+      w.writeInt(CoverageRecord);
+      w.writeInt(newCoverage.size());
+      for (const auto &c : newCoverage) {
+        w.writeInt(c.first);
+        w.writeInt(c.second);
+      }
+      finishRecord(buffer, w);
+    }
+  }
+
+  w.writeInt(CheckpointRecord);
+  w.writeInt(states.size());
+  for (const auto *es : states) {
+    w.writeInt(es->checkpointRecord);
+    w.writeInt(es->checkpointedDecisions);
+  }
+  const std::vector<unsigned> rngState = rng.getState();
+  w.writeInt(rngState.size());
+  for (unsigned value : rngState)
+    w.writeInt(value);
+  StatisticManager &sm = *theStatisticManager;
+  w.writeInt(sm.getNumStatistics());
+  for (unsigned i = 0; i < sm.getNumStatistics(); ++i) {
+    const Statistic &s = sm.getStatistic(i);
+    w.writeString(s.getName());
+    w.writeInt(sm.getValue(s));
+  }
+  finishRecord(buffer, w);
+
+  if (!writeAll(out, buffer.data(), buffer.size()) || fdatasync(out) < 0 ||
+      (rewrite && rename(tmpPath.c_str(), path.c_str()) < 0)) {
+    klee_warning("unable to write checkpoint %s: %s", path.c_str(),
+                 strerror(errno));
+    // the records the states refer to may be missing, start over next time
+    close(out);
+    if (fd >= 0 && fd != out)
+      close(fd);
+    fd = -1;
+    return;
+  }
+
+  if (rewrite) {
+    if (fd >= 0)
+      close(fd);
+    fd = out;
+    fileSize = 0;
+  }
+  fileSize += buffer.size();
+}
+
+bool Checkpoint::load(const std::string &path, Checkpoint &checkpoint,
+                      std::string &error) {
+  auto bufferOrError = llvm::MemoryBuffer::getFile(path);
+  if (!bufferOrError) {
+    error = bufferOrError.getError().message();
+    return false;
+  }
+  const char *data = (*bufferOrError)->getBufferStart();
+  const std::size_t size = (*bufferOrError)->getBufferSize();
+  if (size < sizeof(CheckpointMagic) ||
+      memcmp(data, CheckpointMagic, sizeof(CheckpointMagic)) != 0) {
+    error = "not a checkpoint file";
+    return false;
+  }
+
+  struct PathSegment {
+    std::uint32_t parent;
+    std::uint32_t parentLength;
+    std::vector<std::uint32_t> decisions;
+    std::uint64_t getLength() const { return parentLength + decisions.size(); }
+  };
+  std::vector<PathSegment> segments(1); // the empty path
+  std::vector<std::pair<std::uint32_t, std::uint32_t>> states;
+  std::size_t coverageAtCheckpoint = 0;
+  bool complete = false;
+
+  std::size_t pos = sizeof(CheckpointMagic);
+  llvm::StringRef payload;
+  while (readRecord(data, size, pos, payload)) {
+    RecordReader r(payload);
+    const std::uint64_t type = r.readInt();
+    if (type == PathRecord) {
+      PathSegment segment;
+      segment.parent = r.readInt();
+      segment.parentLength = r.readInt();
+      if (segment.parent >= segments.size() ||
+          segment.parentLength > segments[segment.parent].getLength())
+        r.failed = true;
+      for (std::uint64_t n = r.readInt(); n && !r.failed; --n)
+        segment.decisions.push_back(r.readInt());
+      segments.push_back(std::move(segment));
+    } else if (type == CoverageRecord) {
+      for (std::uint64_t n = r.readInt(); n && !r.failed; --n) {
+        std::uint32_t id = r.readInt();
+        checkpoint.coverage.emplace_back(id, r.readInt());
+      }
+    } else if (type == CheckpointRecord) {
+      states.clear();
+      for (std::uint64_t n = r.readInt(); n && !r.failed; --n) {
+        std::uint32_t record = r.readInt();
+        std::uint32_t length = r.readInt();
+        if (record >= segments.size() || length > segments[record].getLength())
+          r.failed = true;
+        states.emplace_back(record, length);
+      }
+      checkpoint.rngState.clear();
+      for (std::uint64_t n = r.readInt(); n && !r.failed; --n)
+        checkpoint.rngState.push_back(r.readInt());
+      checkpoint.statistics.clear();
+      for (std::uint64_t n = r.readInt(); n && !r.failed; --n) {
+        std::string name = r.readString();
+        checkpoint.statistics.emplace_back(std::move(name), r.readInt());
+      }
+      coverageAtCheckpoint = checkpoint.coverage.size();
+      complete = !r.failed;
+    }
+    if (r.failed) {
+      error = "damaged record in checkpoint file";
+      return false;
+    }
+  }
+
+  if (!complete) {
+    error = "no complete checkpoint in file";
+    return false;
+  }
+  checkpoint.coverage.resize(coverageAtCheckpoint);
+
+  checkpoint.paths.clear();
+  for (const auto &state : states) {
+    // collect the segments from the root down to the state's record
+    std::vector<std::pair<std::uint32_t, std::uint64_t>> chain;
+    for (std::uint32_t record = state.first, length = state.second; record;) {
+      const PathSegment &segment = segments[record];
+      if (length > segment.parentLength)
+        chain.emplace_back(record, length - segment.parentLength);
+      length = std::min<std::uint64_t>(length, segment.parentLength);
+      record = segment.parent;
+    }
+    std::vector<std::uint32_t> path;
+    path.reserve(state.second);
+    for (auto it = chain.rbegin(); it != chain.rend(); ++it) {
+      const auto &decisions = segments[it->first].decisions;
+      path.insert(path.end(), decisions.begin(), decisions.begin() + it->second);
+    }
+    checkpoint.paths.push_back(std::move(path));
+  }
+  return true;
+}
+
+DecisionTree::DecisionTree() : nodes(2) {}
+
+void DecisionTree::insert(const std::vector<std::uint32_t> &path) {
+  std::uint32_t node = getRoot();
+  for (std::uint32_t decision : path) {
+    std::uint32_t child = getChild(node, decision);
+    if (!child) {
+      child = nodes.size();
+      nodes.emplace_back();
+      nodes[child].decision = decision;
+      nodes[child].nextSibling = nodes[node].firstChild;
+      nodes[node].firstChild = child;
+    }
+    node = child;
+  }
+}
+
+std::uint32_t DecisionTree::getChild(std::uint32_t node,
+                                     std::uint32_t decision) const {
+  for (std::uint32_t child = nodes[node].firstChild; child;
+       child = nodes[child].nextSibling)
+    if (nodes[child].decision == decision)
+      return child;
+  return 0;
+}
+
+bool DecisionTree::getOnlyChild(std::uint32_t node,
+                                std::uint32_t &decision) const {
+  const std::uint32_t child = nodes[node].firstChild;
+  if (!child || nodes[child].nextSibling)
+    return false;
+  decision = nodes[child].decision;
+  return true;
+}
@@ -0,0 +1,94 @@
+//===-- Checkpoint.h --------------------------------------------*- C++ -*-===//
+//
+//                     The KLEE Symbolic Virtual Machine
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef KLEE_CHECKPOINT_H
+#define KLEE_CHECKPOINT_H
+
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace klee {
+class ExecutionState;
+class RNG;
+class StatsTracker;
+
+/// What is needed to continue an exploration run: the branch decisions
+/// leading to every state that was still to be explored (see
+/// ExecutionState::branchDecisions), the statistics, the coverage and the
+/// state of the random number generator.
+struct Checkpoint {
+  std::vector<std::vector<std::uint32_t>> paths;
+  /// Pairs of instruction id and StatsTracker::CoverageFlags
+  std::vector<std::pair<std::uint32_t, std::uint32_t>> coverage;
+  std::vector<std::pair<std::string, std::uint64_t>> statistics;
+  std::vector<unsigned> rngState;
+
+  /// Reads the last complete checkpoint written to \p path
+  static bool load(const std::string &path, Checkpoint &checkpoint,
+                   std::string &error);
+};
+
+/// Writes checkpoints to an append-only file.
+///
+/// Checkpoints are written incrementally: every state remembers the record
+/// holding the decisions it had taken by the previous checkpoint, so only
+/// the decisions taken since then are appended. Likewise only new coverage
+/// is written. Once most of the file describes states that are gone, it is
+/// rewritten from scratch.
+class CheckpointWriter {
+  std::string path;
+  int fd = -1;
+  std::uint64_t fileSize = 0;
+  std::uint32_t numRecords = 0;
+  /// Coverage flags written so far, by instruction id
+  std::vector<std::uint8_t> writtenCoverage;
+
+public:
+  explicit CheckpointWriter(std::string path);
+  ~CheckpointWriter();
+
+  CheckpointWriter(const CheckpointWriter &) = delete;
+  CheckpointWriter &operator=(const CheckpointWriter &) = delete;
+
+  /// Writes a checkpoint in which \p states are left to be explored
+  void write(const std::vector<ExecutionState *> &states,
+             const StatsTracker *statsTracker, const RNG &rng);
+};
+
+/// Branch decision paths, merged where they share a prefix.
+class DecisionTree {
+  struct Node {
+    std::uint32_t decision;
+    std::uint32_t firstChild = 0;
+    std::uint32_t nextSibling = 0;
+  };
+
+  /// Node 0 is unused, so that 0 can denote no node
+  std::vector<Node> nodes;
+
+public:
+  DecisionTree();
+
+  void insert(const std::vector<std::uint32_t> &path);
+
+  std::uint32_t getRoot() const { return 1; }
+  bool isLeaf(std::uint32_t node) const { return !nodes[node].firstChild; }
+
+  /// The child reached by \p decision, 0 if there is none
+  std::uint32_t getChild(std::uint32_t node, std::uint32_t decision) const;
+
+  /// Returns true if all paths through \p node continue with the same
+  /// decision, which is stored in \p decision
+  bool getOnlyChild(std::uint32_t node, std::uint32_t &decision) const;
+};
+} // namespace klee
+
+#endif /* KLEE_CHECKPOINT_H */
@@ -27,6 +27,11 @@ namespace stats {
   extern Statistic forkTime;
   extern Statistic solverTime;
 
+  /// Memory operations on a concrete address that did, or did not, find
+  /// the object in the resolution cache of their stack frame.
+  extern Statistic resolutionCacheHits;
+  extern Statistic resolutionCacheMisses;
+
   /// The number of process forks.
   extern Statistic forks;
 
@@ -58,7 +58,8 @@ StackFrame::StackFrame(const StackFrame &s)
     callPathNode(s.callPathNode),
     allocas(s.allocas),
     minDistToUncoveredOnReturn(s.minDistToUncoveredOnReturn),
-    varargs(s.varargs) {
+    varargs(s.varargs),
+    resolutionCache(s.resolutionCache) {
   locals = new Cell[s.kf->numRegisters];
   for (unsigned i=0; i<s.kf->numRegisters; i++)
     locals[i] = s.locals[i];
@@ -101,13 +102,18 @@ ExecutionState::ExecutionState(const ExecutionState& state):
     constraints(state.constraints),
     pathOS(state.pathOS),
     symPathOS(state.symPathOS),
-    coveredLines(state.coveredLines),
+    branchDecisions(state.branchDecisions),
+    pendingDecisions(state.pendingDecisions),
+    checkpointRecord(state.checkpointRecord),
+    checkpointedDecisions(state.checkpointedDecisions),
+    resumeNode(state.resumeNode),
     symbolics(state.symbolics),
     cexPreferences(state.cexPreferences),
     arrayNames(state.arrayNames),
     openMergeStack(state.openMergeStack),
     steppedInstructions(state.steppedInstructions),
     instsSinceCovNew(state.instsSinceCovNew),
+    lastSelected(state.lastSelected),
     unwindingInformation(state.unwindingInformation
                              ? state.unwindingInformation->clone()
                              : nullptr),
@@ -123,11 +129,29 @@ ExecutionState *ExecutionState::branch() {
   auto *falseState = new ExecutionState(*this);
   falseState->setID();
   falseState->coveredNew = false;
-  falseState->coveredLines.clear();
 
   return falseState;
 }
 
+std::uint32_t ExecutionState::takeReplayDecision() {
+  assert(!pendingDecisions.empty() && "no branch decision left to replay");
+  std::uint32_t decision = pendingDecisions.back();
+  pendingDecisions.pop_back();
+  return decision;
+}
+
+void ExecutionState::setReplayDecisions(
+    const std::vector<std::uint32_t> &decisions) {
+  pendingDecisions.assign(decisions.rbegin(), decisions.rend());
+}
+
+std::vector<std::uint32_t> ExecutionState::getDecisionPrefix() const {
+  std::vector<std::uint32_t> prefix(branchDecisions);
+  prefix.insert(prefix.end(), pendingDecisions.rbegin(),
+                pendingDecisions.rend());
+  return prefix;
+}
+
 void ExecutionState::pushFrame(KInstIterator caller, KFunction *kf) {
   stack.emplace_back(StackFrame(caller, kf));
 }
@@ -21,15 +21,21 @@
 #include "klee/Solver/Solver.h"
 #include "klee/System/Time.h"
 
+#include "llvm/ADT/SmallVector.h"
+
+#include <array>
+#include <cstdint>
 #include <map>
 #include <memory>
 #include <set>
+#include <utility>
 #include <vector>
 
 namespace klee {
 class Array;
 class CallPathNode;
 struct Cell;
+struct InstructionInfo;
 struct KFunction;
 struct KInstruction;
 class MemoryObject;
@@ -38,6 +44,14 @@ struct InstructionInfo;
 
 llvm::raw_ostream &operator<<(llvm::raw_ostream &os, const MemoryMap &mm);
 
+/// The object a memory operation resolved to last, valid as long as the
+/// bindings of the address space are unchanged
+struct ResolutionCacheEntry {
+  const KInstruction *ki = nullptr;
+  ObjectPair op;
+  std::uint64_t bindingsVersion = 0;
+};
+
 struct StackFrame {
   KInstIterator caller;
   KFunction *kf;
@@ -60,6 +74,10 @@ struct StackFrame {
   // of intrinsic lowering.
   MemoryObject *varargs;
 
+  /// Objects the memory operations in this frame resolved to last,
+  /// indexed by KInstruction::dest. See Executor::executeMemoryOperation.
+  std::array<ResolutionCacheEntry, 8> resolutionCache;
+
   StackFrame(KInstIterator caller, KFunction *kf);
   StackFrame(const StackFrame &s);
   ~StackFrame();
@@ -196,8 +214,30 @@ public:
   /// taken to reach/create this state
   TreeOStream symPathOS;
 
-  /// @brief Set containing which lines in which files are covered by this state
-  std::map<const std::string *, std::set<std::uint32_t>> coveredLines;
+  /// @brief Decisions taken at every point where this state's path could
+  /// have split: 0/1 for the false/true side of a fork, or the index of the
+  /// chosen condition for a multi-way branch. Unlike pathOS, internal forks
+  /// are included, so replaying these decisions from the initial state
+  /// re-creates this state. Only recorded with --parallel-workers or
+  /// --checkpoint-interval.
+  std::vector<std::uint32_t> branchDecisions;
+
+  /// @brief Recorded decisions this state still has to follow before it
+  /// explores both sides of a branch again (stored in reverse order)
+  std::vector<std::uint32_t> pendingDecisions;
+
+  /// @brief Checkpoint record holding the first checkpointedDecisions
+  /// entries of branchDecisions, 0 if none was written yet
+  std::uint32_t checkpointRecord = 0;
+  std::uint32_t checkpointedDecisions = 0;
+
+  /// @brief Node of the resumed checkpoint's decision tree this state
+  /// follows, 0 once it explores on its own
+  std::uint32_t resumeNode = 0;
+
+  /// @brief Instructions this state was the first to cover since it last
+  /// branched off. Copies of ExecutionState start out with none
+  std::vector<const InstructionInfo *> coveredInstructions;
 
   /// @brief Pointer to the process tree of the current state
   /// Copies of ExecutionState should not copy ptreeNode
@@ -225,6 +265,14 @@ public:
   /// instruction was covered.
   std::uint32_t instsSinceCovNew;
 
+  /// @brief Value of stats::instructions when the state was last selected
+  /// for execution, used to find dormant states to offload
+  std::uint64_t lastSelected = 0;
+
+  /// @brief Positions of this state in the sequences of the searchers that
+  /// hold it (see StateSequence), by sequence
+  llvm::SmallVector<std::pair<const void *, std::size_t>, 2> searcherSlots;
+
   /// @brief Keep track of unwinding state while unwinding, otherwise empty
   std::unique_ptr<UnwindingInformation> unwindingInformation;
 
@@ -269,6 +317,16 @@ public:
   bool merge(const ExecutionState &b);
   void dumpStack(llvm::raw_ostream &out) const;
 
+  /// @brief Returns true while the state replays recorded branch decisions
+  bool isReplayingDecisions() const { return !pendingDecisions.empty(); }
+  /// @brief Consumes the next recorded branch decision
+  std::uint32_t takeReplayDecision();
+  /// @brief Makes the state follow \p decisions before branching again
+  void setReplayDecisions(const std::vector<std::uint32_t> &decisions);
+  /// @brief Returns the decisions leading from the initial state to the
+  /// point where this state starts exploring on its own
+  std::vector<std::uint32_t> getDecisionPrefix() const;
+
   std::uint32_t getID() const { return id; };
   void setID() { id = nextID++; };
 };
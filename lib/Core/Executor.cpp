@@ -9,6 +9,7 @@
 
 #include "Executor.h"
 
+#include "Checkpoint.h"
 #include "Context.h"
 #include "CoreStats.h"
 #include "ExecutionState.h"
@@ -21,6 +22,7 @@
 #include "Searcher.h"
 #include "SeedInfo.h"
 #include "SpecialFunctionHandler.h"
+#include "StateOffloader.h"
 #include "StatsTracker.h"
 #include "TimingSolver.h"
 #include "UserSearcher.h"
@@ -82,6 +84,8 @@ typedef unsigned TypeSize;
 #include <algorithm>
 #include <cassert>
 #include <cerrno>
+#include <chrono>
+#include <csignal>
 #include <cstring>
 #include <cxxabi.h>
 #include <fstream>
@@ -107,6 +111,11 @@ cl::OptionCategory SeedingCat(
     "Seeding options",
     "These options are related to the use of seeds to start exploration.");
 
+cl::OptionCategory
+    CheckpointCat("Checkpoint options",
+                  "These options control writing checkpoints of the "
+                  "exploration and continuing from them.");
+
 cl::OptionCategory
     TerminationCat("State and overall termination options",
                    "These options control termination of the overall KLEE "
@@ -169,6 +178,20 @@ cl::opt<bool>
                                   "querying the solver (default=true)"),
                          cl::cat(SolvingCat));
 
+cl::opt<unsigned> AsyncSolverQueries(
+    "async-solver-queries", cl::init(0),
+    cl::desc("Maximum number of branch queries answered by solver processes "
+             "in the background while other states keep executing. Set to 0 "
+             "to always wait for the solver (default=0)"),
+    cl::cat(SolvingCat));
+
+cl::opt<std::string> AsyncSolverThreshold(
+    "async-solver-threshold", cl::init("100ms"),
+    cl::desc("Branch queries taking longer than this are moved to a "
+             "background solver process, see --async-solver-queries "
+             "(default=100ms)"),
+    cl::cat(SolvingCat));
+
 
 /*** External call policy options ***/
 
@@ -210,6 +233,32 @@ cl::opt<bool> AllExternalWarnings(
              "as opposed to once per function (default=false)"),
     cl::cat(ExtCallsCat));
 
+cl::opt<bool> ExternalCallsWatchWrites(
+    "external-calls-watch-writes",
+    cl::init(false),
+    cl::desc("Write-protect memory objects during external calls and only "
+             "copy back those on pages the call wrote to. Objects passed by "
+             "pointer are always copied back. Requires --allocate-determ. "
+             "Unsafe for calls that make the kernel write through pointers "
+             "stored in memory (default=false)"),
+    cl::cat(ExtCallsCat));
+
+cl::opt<bool> RunConcreteNatively(
+    "run-concrete-natively",
+    cl::init(false),
+    cl::desc("Run calls to module functions that contain loops natively if "
+             "their arguments are concrete. Calls that access symbolic memory "
+             "are interpreted instead. Memory errors are not detected and "
+             "coverage is not tracked in natively run code (default=false)"),
+    cl::cat(ExtCallsCat));
+
+cl::opt<std::string> NativeCallTimeout(
+    "native-call-timeout",
+    cl::init("1s"),
+    cl::desc("Interpret calls that run natively for longer than this, and "
+             "stop running the function natively (default=1s)"),
+    cl::cat(ExtCallsCat));
+
 
 /*** Seeding options ***/
 
@@ -330,6 +379,15 @@ cl::opt<bool> MaxMemoryInhibit(
     cl::init(true),
     cl::cat(TerminationCat));
 
+cl::opt<bool> OffloadStates(
+    "offload-states",
+    cl::desc("Move dormant states to disk instead of terminating states when "
+             "above the memory cap (see -max-memory). States are terminated "
+             "only if offloading does not free enough memory "
+             "(default=false)"),
+    cl::init(false),
+    cl::cat(TerminationCat));
+
 cl::opt<unsigned> RuntimeMaxStackFrames(
     "max-stack-frames",
     cl::desc("Terminate a state after this many stack frames.  Set to 0 to "
@@ -378,6 +436,24 @@ cl::opt<std::string> TimerInterval(
     cl::cat(TerminationCat));
 
 
+/*** Checkpoint options ***/
+
+cl::opt<std::string> CheckpointInterval(
+    "checkpoint-interval",
+    cl::desc("Write a checkpoint of the states left to explore, the "
+             "statistics and the coverage to the output directory at this "
+             "interval (see --resume-from).  "
+             "Set to 0s to disable (default=0s)"),
+    cl::init("0s"),
+    cl::cat(CheckpointCat));
+
+cl::opt<std::string> ResumeFrom(
+    "resume-from",
+    cl::desc("Continue the exploration from the last checkpoint written to "
+             "the given output directory or checkpoint file"),
+    cl::cat(CheckpointCat));
+
+
 /*** Debugging options ***/
 
 /// The different query logging solvers that can switched on/off
@@ -429,6 +505,12 @@ cl::opt<bool> DebugCheckForImpliedValues(
     cl::desc("Debug the implied value optimization"),
     cl::cat(DebugCat));
 
+cl::opt<bool> DumpPTreeDot(
+    "dump-ptree-dot", cl::init(false),
+    cl::desc("Write process tree dumps in DOT format instead of the binary "
+             "format read by klee-ptree (default=false)"),
+    cl::cat(DebugCat));
+
 } // namespace
 
 // XXX hack
@@ -440,7 +522,7 @@ Executor::Executor(LLVMContext &ctx, const InterpreterOptions &opts,
     : Interpreter(opts), interpreterHandler(ih), searcher(0),
       externalDispatcher(new ExternalDispatcher(ctx)), statsTracker(0),
       pathWriter(0), symPathWriter(0), specialFunctionHandler(0), timers{time::Span(TimerInterval)},
-      replayKTest(0), replayPath(0), usingSeeds(0),
+      replayKTest(0), replayPath(0), replayDecisions(0), usingSeeds(0),
       atMemoryLimit(false), inhibitForking(false), haltExecution(false),
       ivcEnabled(false), debugLogBuffer(debugBufferString) {
 
@@ -452,8 +534,15 @@ Executor::Executor(LLVMContext &ctx, const InterpreterOptions &opts,
         setHaltExecution(true);
       }));
 
+  // let the handler share work with other KLEE processes
+  timers.add(std::make_unique<Timer>(time::Span(TimerInterval), [&]{
+    interpreterHandler->handleWorkRequests();
+  }));
+
   coreSolverTimeout = time::Span{MaxCoreSolverTime};
   if (coreSolverTimeout) UseForkedCoreSolver = true;
+  asyncSolverThreshold = time::Span{AsyncSolverThreshold};
+  nativeCallTimeout = time::Span{NativeCallTimeout};
   Solver *coreSolver = klee::createCoreSolver(CoreSolverToUse);
   if (!coreSolver) {
     klee_error("Failed to create core solver\n");
@@ -469,6 +558,32 @@ Executor::Executor(LLVMContext &ctx, const InterpreterOptions &opts,
   this->solver = new TimingSolver(solver, EqualitySubstitution);
   memory = new MemoryManager(&arrayCache);
 
+  if (OffloadStates && MaxMemory)
+    stateOffloader = std::make_unique<StateOffloader>(
+        interpreterHandler->getOutputFilename("offloaded-states"));
+
+  const time::Span checkpointInterval(CheckpointInterval);
+  if (checkpointInterval) {
+    checkpointWriter = std::make_unique<CheckpointWriter>(
+        interpreterHandler->getOutputFilename("checkpoint"));
+    timers.add(std::make_unique<Timer>(checkpointInterval, [&] {
+      writeCheckpoint();
+    }));
+  }
+
+  if (!ResumeFrom.empty()) {
+    std::string path = ResumeFrom;
+    if (llvm::sys::fs::is_directory(path))
+      path += "/checkpoint";
+    resumeCheckpoint = std::make_unique<Checkpoint>();
+    std::string error;
+    if (!Checkpoint::load(path, *resumeCheckpoint, error))
+      klee_error("Unable to resume from %s: %s", path.c_str(), error.c_str());
+    resumeTree = std::make_unique<DecisionTree>();
+    for (const auto &decisions : resumeCheckpoint->paths)
+      resumeTree->insert(decisions);
+  }
+
   initializeSearchOptions();
 
   if (OnlyOutputStatesCoveringNew && !StatsTracker::useIStats())
@@ -876,8 +991,30 @@ void Executor::branch(ExecutionState &state,
   unsigned N = conditions.size();
   assert(N);
 
-  if (!branchingPermitted(state)) {
-    unsigned next = theRNG.getInt32() % N;
+  // A resumed state only explores the alternatives leading to states of
+  // the checkpoint
+  std::vector<unsigned> alternatives;
+  for (unsigned i=0; i<N; ++i)
+    if (!state.resumeNode || resumeTree->getChild(state.resumeNode, i))
+      alternatives.push_back(i);
+
+  if (state.isReplayingDecisions() ||
+      (state.resumeNode && alternatives.size() < 2) ||
+      !branchingPermitted(state)) {
+    unsigned next;
+    if (state.isReplayingDecisions())
+      next = state.takeReplayDecision();
+    else if (alternatives.empty())
+      next = N;
+    else
+      next = alternatives[theRNG.getInt32() % alternatives.size()];
+    if (next >= N) {
+      // the replayed path does not match this execution any more
+      result.assign(N, nullptr);
+      terminateStateEarly(state, "Replayed branch decision out of range",
+                          StateTerminationType::Replay);
+      return;
+    }
     for (unsigned i=0; i<N; ++i) {
       if (i == next) {
         result.push_back(&state);
@@ -885,18 +1022,25 @@ void Executor::branch(ExecutionState &state,
         result.push_back(nullptr);
       }
     }
+    recordDecision(state, next);
   } else {
-    stats::forks += N-1;
+    unsigned M = alternatives.size();
+    stats::forks += M-1;
 
     // XXX do proper balance or keep random?
-    result.push_back(&state);
-    for (unsigned i=1; i<N; ++i) {
-      ExecutionState *es = result[theRNG.getInt32() % i];
+    std::vector<ExecutionState *> forked(1, &state);
+    for (unsigned i=1; i<M; ++i) {
+      ExecutionState *es = forked[theRNG.getInt32() % i];
       ExecutionState *ns = es->branch();
       addedStates.push_back(ns);
-      result.push_back(ns);
+      forked.push_back(ns);
       processTree->attach(es->ptreeNode, ns, es, reason);
     }
+    result.assign(N, nullptr);
+    for (unsigned i=0; i<M; ++i) {
+      result[alternatives[i]] = forked[i];
+      recordDecision(*forked[i], alternatives[i]);
+    }
   }
 
   // If necessary redistribute seeds to match conditions, killing
@@ -1009,6 +1153,24 @@ ref<Expr> Executor::maxStaticPctChecks(ExecutionState &current,
 
 Executor::StatePair Executor::fork(ExecutionState &current, ref<Expr> condition,
                                    bool isInternal, BranchType reason) {
+  // Concrete conditions are by far the most common; they need neither the
+  // solver nor any of the branching policies below.
+  if (auto CE = dyn_cast<ConstantExpr>(condition)) {
+    const bool branch = CE->isTrue();
+    if (!isInternal) {
+      if (replayPath) {
+        assert(replayPosition < replayPath->size() &&
+               "ran out of branches in replay path mode");
+        assert((*replayPath)[replayPosition] == branch &&
+               "hit invalid branch in replay path mode");
+        ++replayPosition;
+      }
+      if (pathWriter)
+        current.pathOS << (branch ? "1" : "0");
+    }
+    return branch ? StatePair(&current, nullptr) : StatePair(nullptr, &current);
+  }
+
   Solver::Validity res;
   std::map< ExecutionState*, std::vector<SeedInfo> >::iterator it = 
     seedMap.find(&current);
@@ -1020,18 +1182,72 @@ Executor::StatePair Executor::fork(ExecutionState &current, ref<Expr> condition,
   time::Span timeout = coreSolverTimeout;
   if (isSeeding)
     timeout *= static_cast<unsigned>(it->second.size());
-  solver->setTimeout(timeout);
-  bool success = solver->evaluate(current.constraints, condition, res,
-                                  current.queryMetaData);
-  solver->setTimeout(time::Span());
+
+  bool success;
+  auto solved = solvedBranches.find(&current);
+  if (solved != solvedBranches.end() && solved->second.first == condition) {
+    // re-executing a branch that was answered in the background
+    success = solved->second.second.success;
+    res = solved->second.second.result;
+    solvedBranches.erase(solved);
+  } else {
+    if (solved != solvedBranches.end())
+      solvedBranches.erase(solved);
+
+    // Give the solver a short time first; only queries that take longer
+    // are worth a solver process of their own.
+    const bool mayAnswerAsync =
+        AsyncSolverQueries && searcher && !isSeeding && !isInternal &&
+        reason == BranchType::ConditionalBranch &&
+        pendingBranches.size() < AsyncSolverQueries &&
+        (!timeout || timeout > asyncSolverThreshold);
+
+    solver->setTimeout(mayAnswerAsync ? asyncSolverThreshold : timeout);
+    success = solver->evaluate(current.constraints, condition, res,
+                               current.queryMetaData);
+    solver->setTimeout(time::Span());
+
+    if (!success && mayAnswerAsync) {
+      pid_t solverProcess;
+      auto answer = solver->evaluateAsync(current.constraints, condition,
+                                          timeout, solverProcess);
+      pendingBranches.push_back(
+          {&current, condition, solverProcess, std::move(answer)});
+      parkedStates.push_back(&current);
+      return StatePair(nullptr, nullptr);
+    }
+  }
   if (!success) {
     current.pc = current.prevPC;
     terminateStateOnSolverError(current, "Query timed out (fork).");
     return StatePair(nullptr, nullptr);
   }
 
+  // Both sides are feasible; whichever way this is resolved is a decision
+  // that has to be recorded for replaying the state's path later on.
+  const bool isBranchPoint = res == Solver::Unknown;
+
   if (!isSeeding) {
-    if (replayPath && !isInternal) {
+    std::uint32_t resumedDecision;
+    if (isBranchPoint && current.isReplayingDecisions()) {
+      if (current.takeReplayDecision()) {
+        res = Solver::True;
+        addConstraint(current, condition);
+      } else {
+        res = Solver::False;
+        addConstraint(current, Expr::createIsZero(condition));
+      }
+    } else if (isBranchPoint && current.resumeNode &&
+               resumeTree->getOnlyChild(current.resumeNode, resumedDecision)) {
+      // only one side leads to states of the resumed checkpoint
+      if (resumedDecision) {
+        res = Solver::True;
+        addConstraint(current, condition);
+      } else {
+        res = Solver::False;
+        addConstraint(current, Expr::createIsZero(condition));
+      }
+    } else if (replayPath && !isInternal) {
       assert(replayPosition<replayPath->size() &&
              "ran out of branches in replay path mode");
       bool branch = (*replayPath)[replayPosition++];
@@ -1106,6 +1322,8 @@ Executor::StatePair Executor::fork(ExecutionState &current, ref<Expr> condition,
   // hint to just use the single constraint instead of all the binary
   // search ones. If that makes sense.
   if (res==Solver::True) {
+    if (isBranchPoint)
+      recordDecision(current, 1);
     if (!isInternal) {
       if (pathWriter) {
         current.pathOS << "1";
@@ -1114,6 +1332,8 @@ Executor::StatePair Executor::fork(ExecutionState &current, ref<Expr> condition,
 
     return StatePair(&current, nullptr);
   } else if (res==Solver::False) {
+    if (isBranchPoint)
+      recordDecision(current, 0);
     if (!isInternal) {
       if (pathWriter) {
         current.pathOS << "0";
@@ -1161,7 +1381,8 @@ Executor::StatePair Executor::fork(ExecutionState &current, ref<Expr> condition,
       }
       if (swapInfo) {
         std::swap(trueState->coveredNew, falseState->coveredNew);
-        std::swap(trueState->coveredLines, falseState->coveredLines);
+        std::swap(trueState->coveredInstructions,
+                  falseState->coveredInstructions);
       }
     }
 
@@ -1184,6 +1405,9 @@ Executor::StatePair Executor::fork(ExecutionState &current, ref<Expr> condition,
       }
     }
 
+    recordDecision(*trueState, 1);
+    recordDecision(*falseState, 0);
+
     addConstraint(*trueState, condition);
     addConstraint(*falseState, Expr::createIsZero(condition));
 
@@ -1860,6 +2084,9 @@ void Executor::executeCall(ExecutionState &state, KInstruction *ki, Function *f,
       transferToBasicBlock(ii->getNormalDest(), i->getParent(), state);
     }
   } else {
+    if (RunConcreteNatively && callNatively(state, ki, f, arguments))
+      return;
+
     // Check if maximum stack size was reached.
     // We currently only count the number of stack frames
     if (RuntimeMaxStackFrames && state.stack.size() > RuntimeMaxStackFrames) {
@@ -2798,40 +3025,31 @@ void Executor::executeInstruction(ExecutionState &state, KInstruction *ki) {
 
     // Conversion
   case Instruction::Trunc: {
-    CastInst *ci = cast<CastInst>(i);
     ref<Expr> result = ExtractExpr::create(eval(ki, 0, state).value,
                                            0,
-                                           getWidthForLLVMType(ci->getType()));
+                                           ki->width);
     bindLocal(ki, state, result);
     break;
   }
   case Instruction::ZExt: {
-    CastInst *ci = cast<CastInst>(i);
-    ref<Expr> result = ZExtExpr::create(eval(ki, 0, state).value,
-                                        getWidthForLLVMType(ci->getType()));
+    ref<Expr> result = ZExtExpr::create(eval(ki, 0, state).value, ki->width);
     bindLocal(ki, state, result);
     break;
   }
   case Instruction::SExt: {
-    CastInst *ci = cast<CastInst>(i);
-    ref<Expr> result = SExtExpr::create(eval(ki, 0, state).value,
-                                        getWidthForLLVMType(ci->getType()));
+    ref<Expr> result = SExtExpr::create(eval(ki, 0, state).value, ki->width);
     bindLocal(ki, state, result);
     break;
   }
 
   case Instruction::IntToPtr: {
-    CastInst *ci = cast<CastInst>(i);
-    Expr::Width pType = getWidthForLLVMType(ci->getType());
     ref<Expr> arg = eval(ki, 0, state).value;
-    bindLocal(ki, state, ZExtExpr::create(arg, pType));
+    bindLocal(ki, state, ZExtExpr::create(arg, ki->width));
     break;
   }
   case Instruction::PtrToInt: {
-    CastInst *ci = cast<CastInst>(i);
-    Expr::Width iType = getWidthForLLVMType(ci->getType());
     ref<Expr> arg = eval(ki, 0, state).value;
-    bindLocal(ki, state, ZExtExpr::create(arg, iType));
+    bindLocal(ki, state, ZExtExpr::create(arg, ki->width));
     break;
   }
 
@@ -2932,8 +3150,7 @@ void Executor::executeInstruction(ExecutionState &state, KInstruction *ki) {
   }
 
   case Instruction::FPTrunc: {
-    FPTruncInst *fi = cast<FPTruncInst>(i);
-    Expr::Width resultType = getWidthForLLVMType(fi->getType());
+    Expr::Width resultType = ki->width;
     ref<ConstantExpr> arg = toConstant(state, eval(ki, 0, state).value,
                                        "floating point");
     if (!fpWidthToSemantics(arg->getWidth()) || resultType > arg->getWidth())
@@ -2949,8 +3166,7 @@ void Executor::executeInstruction(ExecutionState &state, KInstruction *ki) {
   }
 
   case Instruction::FPExt: {
-    FPExtInst *fi = cast<FPExtInst>(i);
-    Expr::Width resultType = getWidthForLLVMType(fi->getType());
+    Expr::Width resultType = ki->width;
     ref<ConstantExpr> arg = toConstant(state, eval(ki, 0, state).value,
                                         "floating point");
     if (!fpWidthToSemantics(arg->getWidth()) || arg->getWidth() > resultType)
@@ -2965,8 +3181,7 @@ void Executor::executeInstruction(ExecutionState &state, KInstruction *ki) {
   }
 
   case Instruction::FPToUI: {
-    FPToUIInst *fi = cast<FPToUIInst>(i);
-    Expr::Width resultType = getWidthForLLVMType(fi->getType());
+    Expr::Width resultType = ki->width;
     ref<ConstantExpr> arg = toConstant(state, eval(ki, 0, state).value,
                                        "floating point");
     if (!fpWidthToSemantics(arg->getWidth()) || resultType > 64)
@@ -2987,8 +3202,7 @@ void Executor::executeInstruction(ExecutionState &state, KInstruction *ki) {
   }
 
   case Instruction::FPToSI: {
-    FPToSIInst *fi = cast<FPToSIInst>(i);
-    Expr::Width resultType = getWidthForLLVMType(fi->getType());
+    Expr::Width resultType = ki->width;
     ref<ConstantExpr> arg = toConstant(state, eval(ki, 0, state).value,
                                        "floating point");
     if (!fpWidthToSemantics(arg->getWidth()) || resultType > 64)
@@ -3009,8 +3223,7 @@ void Executor::executeInstruction(ExecutionState &state, KInstruction *ki) {
   }
 
   case Instruction::UIToFP: {
-    UIToFPInst *fi = cast<UIToFPInst>(i);
-    Expr::Width resultType = getWidthForLLVMType(fi->getType());
+    Expr::Width resultType = ki->width;
     ref<ConstantExpr> arg = toConstant(state, eval(ki, 0, state).value,
                                        "floating point");
     const llvm::fltSemantics *semantics = fpWidthToSemantics(resultType);
@@ -3025,8 +3238,7 @@ void Executor::executeInstruction(ExecutionState &state, KInstruction *ki) {
   }
 
   case Instruction::SIToFP: {
-    SIToFPInst *fi = cast<SIToFPInst>(i);
-    Expr::Width resultType = getWidthForLLVMType(fi->getType());
+    Expr::Width resultType = ki->width;
     ref<ConstantExpr> arg = toConstant(state, eval(ki, 0, state).value,
                                        "floating point");
     const llvm::fltSemantics *semantics = fpWidthToSemantics(resultType);
@@ -3155,7 +3367,7 @@ void Executor::executeInstruction(ExecutionState &state, KInstruction *ki) {
 
     ref<Expr> agg = eval(ki, 0, state).value;
 
-    ref<Expr> result = ExtractExpr::create(agg, kgepi->offset*8, getWidthForLLVMType(i->getType()));
+    ref<Expr> result = ExtractExpr::create(agg, kgepi->offset*8, ki->width);
 
     bindLocal(ki, state, result);
     break;
@@ -3343,8 +3555,18 @@ void Executor::executeInstruction(ExecutionState &state, KInstruction *ki) {
 
 void Executor::updateStates(ExecutionState *current) {
   if (searcher) {
-    searcher->update(current, addedStates, removedStates);
+    // states waiting for the solver are unknown to the searcher
+    std::vector<ExecutionState *> searcherRemoved;
+    for (ExecutionState *es : removedStates) {
+      solvedBranches.erase(es);
+      if (!cancelPendingBranch(es))
+        searcherRemoved.push_back(es);
+    }
+    searcherRemoved.insert(searcherRemoved.end(), parkedStates.begin(),
+                           parkedStates.end());
+    searcher->update(current, addedStates, searcherRemoved);
   }
+  parkedStates.clear();
   
   states.insert(addedStates.begin(), addedStates.end());
   addedStates.clear();
@@ -3361,6 +3583,8 @@ void Executor::updateStates(ExecutionState *current) {
     if (it3 != seedMap.end())
       seedMap.erase(it3);
     processTree->remove(es->ptreeNode);
+    if (stateOffloader)
+      stateOffloader->discard(*es);
     delete es;
   }
   removedStates.clear();
@@ -3387,6 +3611,8 @@ void Executor::computeOffsetsSeqTy(KGEPInstruction *kgepi,
 
 template <typename TypeIt>
 void Executor::computeOffsets(KGEPInstruction *kgepi, TypeIt ib, TypeIt ie) {
+  // constants are rebound for every run, do not accumulate indices
+  kgepi->indices.clear();
   ref<ConstantExpr> constantOffset =
     ConstantExpr::alloc(0, Context::get().getPointerWidth());
   uint64_t index = 1;
@@ -3455,13 +3681,25 @@ bool Executor::checkMemoryUsage() {
     return true;
 
   // check memory limit
-  const auto mallocUsage = util::GetTotalMallocUsage() >> 20U;
-  const auto mmapUsage = memory->getUsedDeterministicSize() >> 20U;
-  const auto totalUsage = mallocUsage + mmapUsage;
+  auto getTotalUsage = [this]() {
+    const auto mallocUsage = util::GetTotalMallocUsage() >> 20U;
+    const auto mmapUsage = memory->getUsedDeterministicSize() >> 20U;
+    return mallocUsage + mmapUsage;
+  };
+  auto totalUsage = getTotalUsage();
   atMemoryLimit = totalUsage > MaxMemory; // inhibit forking
   if (!atMemoryLimit)
     return true;
 
+  // make room by offloading dormant states first
+  if (stateOffloader) {
+    offloadDormantStates(totalUsage);
+    totalUsage = getTotalUsage();
+    atMemoryLimit = totalUsage > MaxMemory;
+    if (!atMemoryLimit)
+      return true;
+  }
+
   // only terminate states when threshold (+100MB) exceeded
   if (totalUsage <= MaxMemory + 100)
     return true;
@@ -3481,12 +3719,39 @@ bool Executor::checkMemoryUsage() {
       idx = theRNG.getInt32() % N;
 
     std::swap(arr[idx], arr[N - 1]);
+    if (stateOffloader)
+      stateOffloader->restore(*arr[N - 1]);
     terminateStateEarly(*arr[N - 1], "Memory limit exceeded.", StateTerminationType::OutOfMemory);
   }
 
   return false;
 }
 
+void Executor::offloadDormantStates(std::size_t totalUsage) {
+  // Only offload the states that did not run since the last check (memory
+  // is checked every 65536 instructions), states that run regularly would
+  // be restored right away.
+  const std::uint64_t instructions = stats::instructions;
+  std::size_t offloaded = 0;
+  std::uint64_t written = 0;
+  for (ExecutionState *es : states) {
+    // paused states may be merged into others at any time
+    if (es->lastSelected + 0x10000U > instructions ||
+        !es->openMergeStack.empty() || isWaitingForSolver(es))
+      continue;
+    if (std::uint64_t bytes = stateOffloader->offload(*es)) {
+      written += bytes;
+      ++offloaded;
+    }
+  }
+  if (!offloaded)
+    return;
+  klee_message("offloaded %zu states (%luKB) to disk, %zu in total "
+               "(over memory cap: %zuMB)",
+               offloaded, static_cast<unsigned long>(written >> 10U),
+               stateOffloader->getNumOffloaded(), totalUsage);
+}
+
 void Executor::doDumpStates() {
   if (!DumpStatesOnHalt || states.empty()) {
     interpreterHandler->incPathsExplored(states.size());
@@ -3494,8 +3759,11 @@ void Executor::doDumpStates() {
   }
 
   klee_message("halting execution, dumping remaining states");
-  for (const auto &state : states)
+  for (const auto &state : states) {
+    if (stateOffloader)
+      stateOffloader->restore(*state);
     terminateStateEarly(*state, "Execution halting.", StateTerminationType::Interrupted);
+  }
   updateStates(nullptr);
 }
 
@@ -3507,6 +3775,9 @@ void Executor::run(ExecutionState &initialState) {
 
   states.insert(&initialState);
 
+  if (resumeTree)
+    resumeStates(initialState);
+
   if (usingSeeds) {
     std::vector<SeedInfo> &v = seedMap[&initialState];
     
@@ -3577,9 +3848,25 @@ void Executor::run(ExecutionState &initialState) {
 
   // main interpreter loop
   while (!states.empty() && !haltExecution) {
+    if (!pendingBranches.empty()) {
+      resumeSolvedBranches(/*block=*/searcher->empty());
+      if (searcher->empty())
+        continue;
+    }
+
     ExecutionState &state = searcher->selectState();
-    KInstruction *ki = state.pc;
-    stepInstruction(state);
+    if (stateOffloader) {
+      stateOffloader->restore(state);
+      state.lastSelected = stats::instructions;
+    }
+    KInstruction *ki;
+    if (solvedBranches.count(&state)) {
+      // the branch was stepped over before the state waited for the solver
+      ki = state.prevPC;
+    } else {
+      ki = state.pc;
+      stepInstruction(state);
+    }
 
     executeInstruction(state, ki);
     timers.invoke();
@@ -3594,12 +3881,172 @@ void Executor::run(ExecutionState &initialState) {
     }
   }
 
+  // the waiting states are terminated with all others
+  while (!pendingBranches.empty())
+    cancelPendingBranch(pendingBranches.front().state);
+  solvedBranches.clear();
+
   delete searcher;
   searcher = nullptr;
 
+  // allows continuing the exploration if it was halted
+  if (checkpointWriter)
+    writeCheckpoint();
+
   doDumpStates();
 }
 
+void Executor::resumeSolvedBranches(bool block) {
+  std::vector<ExecutionState *> resumed;
+  for (;;) {
+    for (auto it = pendingBranches.begin(); it != pendingBranches.end();) {
+      if (it->answer.wait_for(std::chrono::seconds(0)) !=
+          std::future_status::ready) {
+        ++it;
+        continue;
+      }
+      // A failed query is reported when the branch is re-executed
+      TimingSolver::AsyncValidity answer = it->answer.get();
+      it->state->queryMetaData.queryCost += answer.time;
+      solvedBranches[it->state] = std::make_pair(it->condition, answer);
+      resumed.push_back(it->state);
+      it = pendingBranches.erase(it);
+    }
+    if (!block || !resumed.empty() || pendingBranches.empty())
+      break;
+    pendingBranches.front().answer.wait_for(std::chrono::milliseconds(10));
+  }
+
+  if (!resumed.empty())
+    searcher->update(nullptr, resumed, std::vector<ExecutionState *>());
+}
+
+bool Executor::cancelPendingBranch(ExecutionState *state) {
+  auto it = std::find_if(
+      pendingBranches.begin(), pendingBranches.end(),
+      [state](const PendingBranch &pb) { return pb.state == state; });
+  if (it == pendingBranches.end())
+    return false;
+  if (it->solverProcess > 0)
+    kill(it->solverProcess, SIGKILL);
+  it->answer.wait();
+  pendingBranches.erase(it);
+  return true;
+}
+
+bool Executor::isWaitingForSolver(const ExecutionState *state) const {
+  return std::any_of(
+      pendingBranches.begin(), pendingBranches.end(),
+      [state](const PendingBranch &pb) { return pb.state == state; });
+}
+
+bool Executor::donateState(std::vector<std::uint32_t> &decisions) {
+  // Give away the shallowest state, as it is likely to root the largest
+  // unexplored subtree. Keep at least one state for ourselves.
+  const llvm::SmallPtrSet<ExecutionState *, 8> removed(removedStates.begin(),
+                                                       removedStates.end());
+  ExecutionState *donated = nullptr;
+  std::size_t remaining = 0;
+  for (const auto &es : states) {
+    if (removed.count(es) || isWaitingForSolver(es))
+      continue;
+    ++remaining;
+    if (!donated || es->depth < donated->depth)
+      donated = es;
+  }
+  if (remaining < 2 || !donated)
+    return false;
+
+  decisions = donated->getDecisionPrefix();
+  removedStates.push_back(donated);
+  return true;
+}
+
+void Executor::writeCheckpoint() {
+  std::vector<ExecutionState *> liveStates;
+  for (auto *es : states)
+    liveStates.push_back(es);
+  liveStates.insert(liveStates.end(), addedStates.begin(), addedStates.end());
+  liveStates.erase(std::remove_if(liveStates.begin(), liveStates.end(),
+                                  [this](ExecutionState *es) {
+                                    return std::find(removedStates.begin(),
+                                                     removedStates.end(),
+                                                     es) != removedStates.end();
+                                  }),
+                   liveStates.end());
+
+  // A resumed state that did not reach the end of its recorded path yet
+  // stands for all states of the old checkpoint below it
+  for (const auto *es : liveStates)
+    if (es->resumeNode)
+      return;
+
+  checkpointWriter->write(liveStates, statsTracker, theRNG);
+}
+
+void Executor::resumeStates(ExecutionState &initialState) {
+  if (statsTracker) {
+    const unsigned numIDs = statsTracker->getNumInstructionIDs();
+    for (const auto &coverage : resumeCheckpoint->coverage)
+      if (coverage.first < numIDs)
+        statsTracker->restoreCoverage(coverage.first, coverage.second);
+  }
+
+  if (resumeCheckpoint->paths.empty()) {
+    klee_message("checkpoint has no states left to explore");
+    terminateState(initialState);
+    updateStates(nullptr);
+  } else if (!resumeTree->isLeaf(resumeTree->getRoot())) {
+    initialState.resumeNode = resumeTree->getRoot();
+  }
+
+  // Replay depth-first, so that states which reached the end of their
+  // path wait for the searcher.
+  std::vector<ExecutionState *> resuming;
+  if (initialState.resumeNode)
+    resuming.push_back(&initialState);
+  while (!resuming.empty() && !haltExecution) {
+    ExecutionState &state = *resuming.back();
+    KInstruction *ki = state.pc;
+    stepInstruction(state);
+
+    executeInstruction(state, ki);
+    timers.invoke();
+    if (::dumpStates) dumpStates();
+    if (::dumpPTree) dumpPTree();
+
+    if (!state.resumeNode ||
+        std::find(removedStates.begin(), removedStates.end(), &state) !=
+            removedStates.end())
+      resuming.pop_back();
+    for (auto *es : addedStates)
+      if (es->resumeNode)
+        resuming.push_back(es);
+    updateStates(&state);
+  }
+
+  // continue counting from where the checkpointed run stopped
+  for (const auto &value : resumeCheckpoint->statistics)
+    if (Statistic *s = theStatisticManager->getStatisticByName(value.first))
+      theStatisticManager->setValue(*s, value.second);
+  if (!theRNG.setState(resumeCheckpoint->rngState))
+    klee_warning("ignoring the random number generator state of the checkpoint");
+
+  klee_message("resumed %zu of %zu states from the checkpoint", states.size(),
+               resumeCheckpoint->paths.size());
+}
+
+void Executor::recordDecision(ExecutionState &state, std::uint32_t decision) {
+  // only needed to re-create states in another worker or from a checkpoint
+  if (replayDecisions || checkpointWriter)
+    state.branchDecisions.push_back(decision);
+  if (state.resumeNode) {
+    state.resumeNode = resumeTree->getChild(state.resumeNode, decision);
+    if (state.resumeNode && resumeTree->isLeaf(state.resumeNode))
+      state.resumeNode = 0;
+  }
+}
+
 std::string Executor::getAddressInfo(ExecutionState &state, 
                                      ref<Expr> address) const{
   std::string Str;
@@ -3861,6 +4308,8 @@ void Executor::callExternalFunction(ExecutionState &state,
   uint64_t *args = (uint64_t*) alloca(2*sizeof(*args) * (arguments.size() + 1));
   memset(args, 0, 2 * sizeof(*args) * (arguments.size() + 1));
   unsigned wordIndex = 2;
+  // objects the arguments point to
+  std::vector<const MemoryObject *> argumentObjects;
   for (std::vector<ref<Expr> >::iterator ai = arguments.begin(), 
        ae = arguments.end(); ai!=ae; ++ai) {
     if (ExternalCalls == ExternalCallPolicy::All) { // don't bother checking uniqueness
@@ -3876,6 +4325,7 @@ void Executor::callExternalFunction(ExecutionState &state,
       if (ce->getWidth() == Context::get().getPointerWidth() &&
           state.addressSpace.resolveOne(ce, op)) {
         op.second->flushToConcreteStore(solver, state);
+        argumentObjects.push_back(op.first);
       }
       wordIndex += (ce->getWidth()+63)/64;
     } else {
@@ -3884,6 +4334,11 @@ void Executor::callExternalFunction(ExecutionState &state,
         // XXX kick toMemory functions from here
         ce->toMemory(&args[wordIndex]);
         wordIndex += (ce->getWidth()+63)/64;
+        ObjectPair op;
+        if (ExternalCallsWatchWrites &&
+            ce->getWidth() == Context::get().getPointerWidth() &&
+            state.addressSpace.resolveOne(ce, op))
+          argumentObjects.push_back(op.first);
       } else {
         terminateStateOnExecError(state,
                                   "external call with symbolic argument: " +
@@ -3934,14 +4389,54 @@ void Executor::callExternalFunction(ExecutionState &state,
       klee_warning_once(function, "%s", os.str().c_str());
   }
 
+  // Watch which pages the call writes to. Objects passed by pointer are
+  // not watched, as the kernel might write to them in a system call.
+  std::vector<std::uint64_t> unwatchedPages;
+  const std::uint64_t pageSize = sys::Process::getPageSizeEstimate();
+  bool watchWrites = ExternalCallsWatchWrites && memory->isDeterministic();
+  if (ExternalCallsWatchWrites && !watchWrites)
+    klee_warning_once(0, "--external-calls-watch-writes requires "
+                         "--allocate-determ, copying back all objects");
+  if (watchWrites) {
+    for (const MemoryObject *mo : argumentObjects) {
+      if (!mo->size)
+        continue;
+      std::uint64_t first = mo->address & ~(pageSize - 1);
+      std::uint64_t last = (mo->address + mo->size - 1) & ~(pageSize - 1);
+      for (std::uint64_t page = first; page <= last; page += pageSize)
+        unwatchedPages.push_back(page);
+    }
+    std::sort(unwatchedPages.begin(), unwatchedPages.end());
+    unwatchedPages.erase(
+        std::unique(unwatchedPages.begin(), unwatchedPages.end()),
+        unwatchedPages.end());
+
+    std::vector<std::uint64_t> pages, watchedPages;
+    state.addressSpace.getConcretePages(pages, pageSize);
+    std::set_difference(pages.begin(), pages.end(), unwatchedPages.begin(),
+                        unwatchedPages.end(), std::back_inserter(watchedPages));
+    externalDispatcher->setWatchedPages(std::move(watchedPages));
+  }
+
   bool success = externalDispatcher->executeCall(function, target->inst, args);
   if (!success) {
+    state.addressSpace.invalidateNativeCopies();
     terminateStateOnError(state, "failed external call: " + function->getName(),
                           StateTerminationType::External);
     return;
   }
 
-  if (!state.addressSpace.copyInConcretes()) {
+  bool copiedIn;
+  if (watchWrites) {
+    const auto &written = externalDispatcher->getWrittenPages();
+    std::vector<std::uint64_t> pages;
+    std::merge(written.begin(), written.end(), unwatchedPages.begin(),
+               unwatchedPages.end(), std::back_inserter(pages));
+    copiedIn = state.addressSpace.copyInConcretes(&pages, pageSize);
+  } else {
+    copiedIn = state.addressSpace.copyInConcretes();
+  }
+  if (!copiedIn) {
     terminateStateOnError(state, "external modified read-only object",
                           StateTerminationType::External);
     return;
@@ -3962,6 +4457,56 @@ void Executor::callExternalFunction(ExecutionState &state,
   }
 }
 
+bool Executor::callNatively(ExecutionState &state, KInstruction *target,
+                            Function *function,
+                            const std::vector<ref<Expr>> &arguments) {
+  if (!isa<CallInst>(target->inst) ||
+      !externalDispatcher->isNativeCandidate(function))
+    return false;
+
+  // same layout as for external calls
+  uint64_t *args = (uint64_t*) alloca(2*sizeof(*args) * (arguments.size() + 1));
+  memset(args, 0, 2 * sizeof(*args) * (arguments.size() + 1));
+  unsigned wordIndex = 2;
+  for (const auto &arg : arguments) {
+    auto ce = dyn_cast<ConstantExpr>(arg);
+    if (!ce)
+      return false;
+    ce->toMemory(&args[wordIndex]);
+    wordIndex += (ce->getWidth() + 63) / 64;
+  }
+
+  // Objects with symbolic contents are made inaccessible, so that the call
+  // fails if it needs them.
+  const std::uint64_t pageSize = sys::Process::getPageSizeEstimate();
+  std::vector<std::uint64_t> symbolicPages;
+  if (!state.addressSpace.getSymbolicPages(symbolicPages, pageSize))
+    return false;
+
+  state.addressSpace.copyOutConcretes();
+  auto getAddress = [this](const GlobalValue *gv) -> std::uint64_t {
+    auto it = globalAddresses.find(gv);
+    return it != globalAddresses.end() ? it->second->getZExtValue() : 0;
+  };
+  if (!externalDispatcher->executeNativeCall(function, target->inst, args,
+                                             getAddress, symbolicPages,
+                                             nativeCallTimeout) ||
+      !state.addressSpace.readOnlyConcretesUnchanged()) {
+    state.addressSpace.invalidateNativeCopies();
+    return false;
+  }
+
+  bool copiedIn = state.addressSpace.copyInConcretes();
+  assert(copiedIn && "read-only objects were checked");
+  (void) copiedIn;
+
+  Type *resultType = target->inst->getType();
+  if (!resultType->isVoidTy())
+    bindLocal(target, state,
+              ConstantExpr::fromMemory((void *)args, target->width));
+  return true;
+}
+
 /***/
 
 ref<Expr> Executor::replaceReadWithSymbolic(ExecutionState &state, 
@@ -4199,8 +4744,7 @@ void Executor::executeMemoryOperation(ExecutionState &state,
                                       ref<Expr> address,
                                       ref<Expr> value /* undef if read */,
                                       KInstruction *target /* undef if write */) {
-  Expr::Width type = (isWrite ? value->getWidth() : 
-                     getWidthForLLVMType(target->inst->getType()));
+  Expr::Width type = (isWrite ? value->getWidth() : target->width);
   unsigned bytes = Expr::getMinBytesForWidth(type);
 
   if (SimplifySymIndices) {
@@ -4214,13 +4758,37 @@ void Executor::executeMemoryOperation(ExecutionState &state,
 
   // fast path: single in-bounds resolution
   ObjectPair op;
-  bool success;
-  solver->setTimeout(coreSolverTimeout);
-  if (!state.addressSpace.resolveOne(state, solver, address, op, success)) {
-    address = toConstant(state, address, "resolveOne failure");
-    success = state.addressSpace.resolveOne(cast<ConstantExpr>(address), op);
+  bool success = false;
+
+  // A concrete address is looked up in the resolution cache of the stack
+  // frame first; the entry is only filled in for in-bounds accesses.
+  ResolutionCacheEntry *cached = nullptr;
+  if (ConstantExpr *CE = dyn_cast<ConstantExpr>(address)) {
+    StackFrame &sf = state.stack.back();
+    cached = &sf.resolutionCache[state.prevPC->dest % sf.resolutionCache.size()];
+    if (cached->ki == state.prevPC &&
+        cached->bindingsVersion == state.addressSpace.bindingsVersion) {
+      const MemoryObject *mo = cached->op.first;
+      uint64_t offset = CE->getZExtValue() - mo->address;
+      if (offset < mo->size && bytes <= mo->size - offset) {
+        op = cached->op;
+        success = true;
+      }
+    }
+    if (success)
+      ++stats::resolutionCacheHits;
+    else
+      ++stats::resolutionCacheMisses;
+  }
+
+  if (!success) {
+    solver->setTimeout(coreSolverTimeout);
+    if (!state.addressSpace.resolveOne(state, solver, address, op, success)) {
+      address = toConstant(state, address, "resolveOne failure");
+      success = state.addressSpace.resolveOne(cast<ConstantExpr>(address), op);
+    }
+    solver->setTimeout(time::Span());
   }
-  solver->setTimeout(time::Span());
 
   if (success) {
     const MemoryObject *mo = op.first;
@@ -4253,6 +4821,7 @@ void Executor::executeMemoryOperation(ExecutionState &state,
         } else {
           ObjectState *wos = state.addressSpace.getWriteable(mo, os);
           wos->write(offset, value);
+          os = wos;
         }          
       } else {
         ref<Expr> result = os->read(offset, type);
@@ -4263,6 +4832,12 @@ void Executor::executeMemoryOperation(ExecutionState &state,
         bindLocal(target, state, result);
       }
 
+      if (cached) {
+        cached->ki = state.prevPC;
+        cached->op = ObjectPair(mo, os);
+        cached->bindingsVersion = state.addressSpace.bindingsVersion;
+      }
+
       return;
     }
   } 
@@ -4403,6 +4978,14 @@ void Executor::runFunctionAsMain(Function *f,
 				 char **envp) {
   std::vector<ref<Expr> > arguments;
 
+  if (resumeTree && (replayKTest || replayPath || replayDecisions || usingSeeds))
+    klee_error("--resume-from cannot be used when replaying or seeding");
+  if (checkpointWriter && replayDecisions)
+    klee_error("--checkpoint-interval cannot be used with --parallel-workers");
+  if (RunConcreteNatively && AsyncSolverQueries)
+    klee_error("--run-concrete-natively cannot be used with "
+               "--async-solver-queries");
+
   // force deterministic initialization of memory objects
   srand(1);
   srandom(1);
@@ -4451,6 +5034,8 @@ void Executor::runFunctionAsMain(Function *f,
     state->pathOS = pathWriter->open();
   if (symPathWriter) 
     state->symPathOS = symPathWriter->open();
+  if (replayDecisions)
+    state->setReplayDecisions(*replayDecisions);
 
 
   if (statsTracker)
@@ -4600,7 +5185,9 @@ bool Executor::getSymbolicSolution(const ExecutionState &state,
 
 void Executor::getCoveredLines(const ExecutionState &state,
                                std::map<const std::string*, std::set<unsigned> > &res) {
-  res = state.coveredLines;
+  res.clear();
+  for (const InstructionInfo *info : state.coveredInstructions)
+    res[&info->file].insert(info->line);
 }
 
 void Executor::doImpliedValueConcretization(ExecutionState &state,
@@ -4734,10 +5321,14 @@ void Executor::dumpPTree() {
   if (!::dumpPTree) return;
 
   char name[32];
-  snprintf(name, sizeof(name),"ptree%08d.dot", (int) stats::instructions);
+  snprintf(name, sizeof(name), "ptree%08d.%s", (int)stats::instructions,
+           DumpPTreeDot ? "dot" : "ptree");
   auto os = interpreterHandler->openOutputFile(name);
   if (os) {
-    processTree->dump(*os);
+    if (DumpPTreeDot)
+      processTree->dump(*os);
+    else
+      processTree->write(*os);
   }
 
   ::dumpPTree = 0;
@@ -16,6 +16,7 @@
 #define KLEE_EXECUTOR_H
 
 #include "ExecutionState.h"
+#include "TimingSolver.h"
 #include "UserSearcher.h"
 
 #include "klee/ADT/RNG.h"
@@ -60,6 +61,9 @@ namespace llvm {
 namespace klee {  
   class Array;
   struct Cell;
+  struct Checkpoint;
+  class CheckpointWriter;
+  class DecisionTree;
   class ExecutionState;
   class ExternalDispatcher;
   class Expr;
@@ -76,6 +80,7 @@ namespace klee {
   class SeedInfo;
   class SpecialFunctionHandler;
   struct StackFrame;
+  class StateOffloader;
   class StatsTracker;
   class TimingSolver;
   class TreeStreamWriter;
@@ -118,6 +123,18 @@ private:
   TimerGroup timers;
   std::unique_ptr<PTree> processTree;
 
+  /// Keeps dormant states on disk when above the memory cap, null unless
+  /// --offload-states is set
+  std::unique_ptr<StateOffloader> stateOffloader;
+
+  /// Writes checkpoints of the exploration, null unless
+  /// --checkpoint-interval is set
+  std::unique_ptr<CheckpointWriter> checkpointWriter;
+
+  /// The checkpoint given by --resume-from and the paths of its states
+  std::unique_ptr<Checkpoint> resumeCheckpoint;
+  std::unique_ptr<DecisionTree> resumeTree;
+
   /// Used to track states that have been added during the current
   /// instructions step. 
   /// \invariant \ref addedStates is a subset of \ref states. 
@@ -129,6 +146,26 @@ private:
   /// \invariant \ref addedStates and \ref removedStates are disjoint.
   std::vector<ExecutionState *> removedStates;
 
+  /// A conditional branch whose query is answered by a solver process
+  /// while other states keep running. The state is hidden from the
+  /// searcher and re-executes the branch once the answer arrived.
+  struct PendingBranch {
+    ExecutionState *state;
+    ref<Expr> condition;
+    pid_t solverProcess;
+    std::future<TimingSolver::AsyncValidity> answer;
+  };
+  std::vector<PendingBranch> pendingBranches;
+
+  /// States that started waiting for the solver during the current
+  /// instruction step.
+  std::vector<ExecutionState *> parkedStates;
+
+  /// Answers for branches of states that are about to re-execute them.
+  std::map<const ExecutionState *,
+           std::pair<ref<Expr>, TimingSolver::AsyncValidity>>
+      solvedBranches;
+
   /// When non-empty the Executor is running in "seed" mode. The
   /// states in this map will be executed in an arbitrary order
   /// (outside the normal search interface) until they terminate. When
@@ -160,6 +197,10 @@ private:
   /// object.
   unsigned replayPosition;
 
+  /// When non-null the branch decisions the initial state follows before
+  /// exploring on its own (see ExecutionState::branchDecisions).
+  const std::vector<std::uint32_t> *replayDecisions;
+
   /// When non-null a list of "seed" inputs which will be used to
   /// drive execution.
   const std::vector<struct KTest *> *usingSeeds;  
@@ -183,6 +224,12 @@ private:
   /// (e.g. for a single STP query)
   time::Span coreSolverTimeout;
 
+  /// Branch queries taking longer than this are answered in the background.
+  time::Span asyncSolverThreshold;
+
+  /// Calls run natively for longer than this are interpreted instead.
+  time::Span nativeCallTimeout;
+
   /// Maximum time to allow for a single instruction.
   time::Span maxInstructionTime;
 
@@ -234,6 +281,14 @@ private:
 
   void stepInstruction(ExecutionState &state);
   void updateStates(ExecutionState *current);
+
+  /// Moves states whose branch queries have been answered back to the
+  /// searcher. With \p block, waits until at least one answer arrived.
+  void resumeSolvedBranches(bool block);
+  /// Kills the solver process of the state's pending branch, if any.
+  /// Returns false if the state was not waiting for the solver.
+  bool cancelPendingBranch(ExecutionState *state);
+  bool isWaitingForSolver(const ExecutionState *state) const;
   void transferToBasicBlock(llvm::BasicBlock *dst, 
 			    llvm::BasicBlock *src,
 			    ExecutionState &state);
@@ -243,6 +298,13 @@ private:
                             llvm::Function *function,
                             std::vector< ref<Expr> > &arguments);
 
+  /// Run a call to a module function natively if possible, see
+  /// --run-concrete-natively. Returns false if the call is to be
+  /// interpreted.
+  bool callNatively(ExecutionState &state, KInstruction *target,
+                    llvm::Function *function,
+                    const std::vector<ref<Expr>> &arguments);
+
   ObjectState *bindObjectInState(ExecutionState &state, const MemoryObject *mo,
                                  bool isLocal, const Array *array = 0);
 
@@ -469,6 +531,20 @@ private:
   /// \return true if below threshold, false otherwise (states were terminated)
   bool checkMemoryUsage();
 
+  /// Offloads the states that did not run recently to disk
+  /// \param totalUsage current memory usage in MB
+  void offloadDormantStates(std::size_t totalUsage);
+
+  /// Writes a checkpoint of the states left to explore
+  void writeCheckpoint();
+
+  /// Re-creates the states of the checkpoint given by --resume-from by
+  /// replaying their paths from the initial state
+  void resumeStates(ExecutionState &initialState);
+
+  /// Appends \p decision to the branch decisions of \p state
+  void recordDecision(ExecutionState &state, std::uint32_t decision);
+
   /// check if branching/forking is allowed
   bool branchingPermitted(const ExecutionState &state) const;
 
@@ -506,6 +582,12 @@ public:
     replayPosition = 0;
   }
 
+  void setReplayDecisions(const std::vector<std::uint32_t> *decisions) override {
+    replayDecisions = decisions;
+  }
+
+  bool donateState(std::vector<std::uint32_t> &decisions) override;
+
   llvm::Module *setModule(std::vector<std::unique_ptr<llvm::Module>> &modules,
                           const ModuleOptions &opts) override;
 
@@ -13,20 +13,34 @@
 #if LLVM_VERSION_CODE < LLVM_VERSION(8, 0)
 #include "llvm/IR/CallSite.h"
 #endif
+#include "llvm/ADT/SCCIterator.h"
+#include "llvm/IR/CFG.h"
 #include "llvm/IR/Constants.h"
+#include "llvm/IR/DebugInfo.h"
 #include "llvm/IR/DerivedTypes.h"
+#include "llvm/IR/InstIterator.h"
 #include "llvm/IR/IRBuilder.h"
 #include "llvm/IR/Instructions.h"
+#include "llvm/IR/IntrinsicInst.h"
 #include "llvm/IR/LLVMContext.h"
 #include "llvm/IR/Module.h"
 #include "llvm/ExecutionEngine/GenericValue.h"
 #include "llvm/ExecutionEngine/MCJIT.h"
 #include "llvm/Support/DynamicLibrary.h"
+#include "llvm/Support/Process.h"
 #include "llvm/Support/raw_ostream.h"
 #include "llvm/Support/TargetSelect.h"
+#include "llvm/Target/TargetOptions.h"
+#include "llvm/Transforms/Utils/Cloning.h"
 
+#include <algorithm>
 #include <csetjmp>
 #include <csignal>
+#include <set>
+#include <unordered_map>
+
+#include <sys/mman.h>
+#include <sys/time.h>
 
 using namespace llvm;
 using namespace klee;
@@ -34,10 +48,30 @@ using namespace klee;
 /***/
 
 static sigjmp_buf escapeCallJmpBuf;
+static volatile sig_atomic_t gCaughtSignal;
+
+// Write-protected pages during a call (sorted) and whether they were written
+static const uint64_t *gWatchedPages;
+static std::size_t gNumWatchedPages;
+static char *gWrittenPages;
+static uint64_t gPageSize;
 
 extern "C" {
 
 static void sigsegv_handler(int signal, siginfo_t *info, void *context) {
+  if (gNumWatchedPages) {
+    uint64_t page = reinterpret_cast<uint64_t>(info->si_addr) & ~(gPageSize - 1);
+    const uint64_t *end = gWatchedPages + gNumWatchedPages;
+    const uint64_t *it = std::lower_bound(gWatchedPages, end, page);
+    if (it != end && *it == page && !gWrittenPages[it - gWatchedPages]) {
+      // record the write and let it proceed
+      gWrittenPages[it - gWatchedPages] = 1;
+      if (mprotect(reinterpret_cast<void *>(page), gPageSize,
+                   PROT_READ | PROT_WRITE) == 0)
+        return;
+    }
+  }
+  gCaughtSignal = signal;
   siglongjmp(escapeCallJmpBuf, 1);
 }
 }
@@ -50,6 +84,38 @@ private:
   dispatchers_ty dispatchers;
   llvm::Function *createDispatcher(llvm::Function *f, llvm::Instruction *i,
                                    llvm::Module *module);
+
+  /// What has to be compiled to run a module function natively
+  struct NativeCode {
+    bool candidate = false;
+    /// The function and the module functions it calls
+    std::vector<llvm::Function *> functions;
+    std::vector<llvm::Function *> intrinsics;
+    /// Global values referred to by address
+    std::vector<llvm::GlobalValue *> globals;
+  };
+  std::unordered_map<const llvm::Function *, NativeCode> nativeCode;
+  /// Addresses of the dispatchers for native calls, by call site and callee
+  std::map<std::pair<const llvm::Instruction *, const llvm::Function *>,
+           uint64_t>
+      nativeDispatchers;
+  static bool collectNativeCode(llvm::Function *f, NativeCode &code);
+  llvm::Function *createNativeDispatcher(
+      llvm::Function *f, llvm::Instruction *i, const NativeCode &code,
+      const std::function<uint64_t(const llvm::GlobalValue *)> &getAddress,
+      llvm::Module *module);
+  /// Pairs of first page and number of pages to protect during a native
+  /// call, mapped separately so that the call cannot make them inaccessible
+  uint64_t *protectedRuns = nullptr;
+  std::size_t protectedRunsSize = 0;
+  /// Stack for the signal handler, so that it can also abandon a native
+  /// call that overflowed the stack
+  void *signalStack = nullptr;
+  static const std::size_t signalStackSize = 1 << 16;
+  /// Returns 0 if the call completed, the signal that stopped it otherwise
+  int runNativeCall(uint64_t dispatcher, uint64_t *args,
+                    const std::vector<uint64_t> &protectedPages,
+                    time::Span timeout);
   llvm::ExecutionEngine *executionEngine;
   LLVMContext &ctx;
   std::map<std::string, void *> preboundFunctions;
@@ -58,6 +124,15 @@ private:
   std::vector<std::string> moduleIDs;
   std::string &getFreshModuleID();
   int lastErrno;
+  std::vector<uint64_t> watchedPages;
+  std::vector<uint64_t> writtenPages;
+  /// Flags for the watched pages, mapped separately so that the signal
+  /// handler never writes to a watched page
+  char *writtenFlags = nullptr;
+  std::size_t writtenFlagsSize = 0;
+
+  /// Change the protection of the watched pages not marked as written
+  void protectWatchedPages(int prot);
 
 public:
   ExternalDispatcherImpl(llvm::LLVMContext &ctx);
@@ -67,6 +142,15 @@ public:
   void *resolveSymbol(const std::string &name);
   int getLastErrno();
   void setLastErrno(int newErrno);
+  void setWatchedPages(std::vector<uint64_t> pages) {
+    watchedPages = std::move(pages);
+  }
+  const std::vector<uint64_t> &getWrittenPages() const { return writtenPages; }
+  bool isNativeCandidate(llvm::Function *f);
+  bool executeNativeCall(
+      llvm::Function *f, llvm::Instruction *i, uint64_t *args,
+      const std::function<uint64_t(const llvm::GlobalValue *)> &getAddress,
+      const std::vector<uint64_t> &protectedPages, time::Span timeout);
 };
 
 std::string &ExternalDispatcherImpl::getFreshModuleID() {
@@ -118,9 +202,14 @@ ExternalDispatcherImpl::ExternalDispatcherImpl(LLVMContext &ctx)
   // Note that we don't do anything with `singleDispatchModule`. This is just
   // so we can use the EngineBuilder API.
   auto dispatchModuleUniq = std::unique_ptr<Module>(singleDispatchModule);
+  // Reaching unreachable code in natively run module functions has to trap
+  // rather than run into whatever code follows.
+  TargetOptions targetOptions;
+  targetOptions.TrapUnreachable = true;
   executionEngine = EngineBuilder(std::move(dispatchModuleUniq))
                         .setErrorStr(&error)
                         .setEngineKind(EngineKind::JIT)
+                        .setTargetOptions(targetOptions)
                         .create();
 
   if (!executionEngine) {
@@ -151,6 +240,12 @@ ExternalDispatcherImpl::ExternalDispatcherImpl(LLVMContext &ctx)
 }
 
 ExternalDispatcherImpl::~ExternalDispatcherImpl() {
+  if (writtenFlags)
+    munmap(writtenFlags, writtenFlagsSize);
+  if (protectedRuns)
+    munmap(protectedRuns, protectedRunsSize * sizeof(*protectedRuns));
+  if (signalStack)
+    munmap(signalStack, signalStackSize);
   delete executionEngine;
   // NOTE: the `executionEngine` owns all modules so
   // we don't need to delete any of them.
@@ -183,7 +278,9 @@ bool ExternalDispatcherImpl::executeCall(Function *f, Instruction *i,
   // The MCJIT generates whole modules at a time so for every call that we
   // haven't made before we need to create a new Module.
   dispatchModule = new Module(getFreshModuleID(), ctx);
-  dispatcher = createDispatcher(f, i, dispatchModule);
+  dispatcher = resolveSymbol(f->getName().str())
+                   ? createDispatcher(f, i, dispatchModule)
+                   : nullptr;
   dispatchers.insert(std::make_pair(i, dispatcher));
 
   // Force the JIT execution engine to go ahead and build the function. This
@@ -228,6 +325,33 @@ bool ExternalDispatcherImpl::runProtectedCall(Function *f, uint64_t *args) {
   segvAction.sa_sigaction = ::sigsegv_handler;
   sigaction(SIGSEGV, &segvAction, &segvActionOld);
 
+  // Write-protect the watched pages. The handler unprotects a page on the
+  // first write to it, so that afterwards only written pages have to be
+  // inspected.
+  writtenPages.clear();
+  if (!watchedPages.empty() && watchedPages.size() > writtenFlagsSize) {
+    if (writtenFlags)
+      munmap(writtenFlags, writtenFlagsSize);
+    writtenFlagsSize = watchedPages.size() * 2;
+    void *flags = mmap(nullptr, writtenFlagsSize, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (flags == MAP_FAILED) {
+      writtenFlags = nullptr;
+      writtenFlagsSize = 0;
+      watchedPages.clear();
+    } else {
+      writtenFlags = static_cast<char *>(flags);
+    }
+  }
+  if (!watchedPages.empty()) {
+    std::fill(writtenFlags, writtenFlags + watchedPages.size(), 0);
+    gPageSize = llvm::sys::Process::getPageSizeEstimate();
+    gWatchedPages = watchedPages.data();
+    gWrittenPages = writtenFlags;
+    gNumWatchedPages = watchedPages.size();
+    protectWatchedPages(PROT_READ);
+  }
+
   if (sigsetjmp(escapeCallJmpBuf, 1)) {
     res = false;
   } else {
@@ -238,10 +362,39 @@ bool ExternalDispatcherImpl::runProtectedCall(Function *f, uint64_t *args) {
     res = true;
   }
 
+  if (!watchedPages.empty()) {
+    protectWatchedPages(PROT_READ | PROT_WRITE);
+    gNumWatchedPages = 0;
+    for (std::size_t i = 0; i < watchedPages.size(); ++i)
+      if (writtenFlags[i])
+        writtenPages.push_back(watchedPages[i]);
+    watchedPages.clear();
+  }
+
   sigaction(SIGSEGV, &segvActionOld, nullptr);
   return res;
 }
 
+void ExternalDispatcherImpl::protectWatchedPages(int prot) {
+  // change contiguous runs of pages at once
+  for (std::size_t i = 0; i < watchedPages.size();) {
+    if (writtenFlags[i]) {
+      ++i;
+      continue;
+    }
+    std::size_t j = i + 1;
+    while (j < watchedPages.size() && !writtenFlags[j] &&
+           watchedPages[j] == watchedPages[j - 1] + gPageSize)
+      ++j;
+    if (mprotect(reinterpret_cast<void *>(watchedPages[i]),
+                 (j - i) * gPageSize, prot) != 0) {
+      // treat pages that cannot be watched as written
+      std::fill(writtenFlags + i, writtenFlags + j, 1);
+    }
+    i = j;
+  }
+}
+
 // FIXME: This might have been relevant for the old JIT but the MCJIT
 // has a completly different implementation so this comment below is
 // likely irrelevant and misleading.
@@ -255,9 +408,6 @@ bool ExternalDispatcherImpl::runProtectedCall(Function *f, uint64_t *args) {
 Function *ExternalDispatcherImpl::createDispatcher(Function *target,
                                                    Instruction *inst,
                                                    Module *module) {
-  if (!resolveSymbol(target->getName().str()))
-    return 0;
-
 #if LLVM_VERSION_CODE >= LLVM_VERSION(8, 0)
   const CallBase &cs = cast<CallBase>(*inst);
 #else
@@ -331,6 +481,281 @@ Function *ExternalDispatcherImpl::createDispatcher(Function *target,
   return dispatcher;
 }
 
+/// Intrinsics that the Executor implements and that may thus appear in
+/// natively run code
+static bool isNativeIntrinsic(Intrinsic::ID id) {
+  switch (id) {
+  case Intrinsic::dbg_declare:
+  case Intrinsic::dbg_value:
+  case Intrinsic::dbg_label:
+  case Intrinsic::fabs:
+#if LLVM_VERSION_CODE >= LLVM_VERSION(12, 0)
+  case Intrinsic::abs:
+  case Intrinsic::smax:
+  case Intrinsic::smin:
+  case Intrinsic::umax:
+  case Intrinsic::umin:
+#endif
+#if LLVM_VERSION_CODE >= LLVM_VERSION(7, 0)
+  case Intrinsic::fshr:
+  case Intrinsic::fshl:
+#endif
+    return true;
+  default:
+    return false;
+  }
+}
+
+/// Collect the global values a constant refers to, returns false if it
+/// refers to something that cannot be mapped to native code
+static bool collectGlobals(const Constant *c,
+                           std::set<GlobalValue *> &globals) {
+  if (isa<BlockAddress>(c) || isa<GlobalIFunc>(c))
+    return false;
+  if (auto *gv = dyn_cast<GlobalValue>(c)) {
+    if (gv->isThreadLocal())
+      return false;
+    globals.insert(const_cast<GlobalValue *>(gv));
+    return true;
+  }
+  for (const Use &op : c->operands())
+    if (!collectGlobals(cast<Constant>(op.get()), globals))
+      return false;
+  return true;
+}
+
+bool ExternalDispatcherImpl::collectNativeCode(Function *root,
+                                               NativeCode &code) {
+  std::set<Function *> called{root}, intrinsics;
+  std::set<GlobalValue *> globals;
+  std::vector<Function *> worklist{root};
+  bool hasLoop = false;
+  while (!worklist.empty()) {
+    Function *f = worklist.back();
+    worklist.pop_back();
+    if (f->isVarArg() || f->hasPersonalityFn())
+      return false;
+    code.functions.push_back(f);
+
+    for (auto scc = scc_begin(f); !hasLoop && !scc.isAtEnd(); ++scc)
+      hasLoop = scc.hasCycle();
+
+    for (Instruction &inst : instructions(f)) {
+      if (isa<InvokeInst>(inst) || isa<VAArgInst>(inst) || inst.isEHPad())
+        return false;
+      const Use *calledOperand = nullptr;
+      if (auto *call = dyn_cast<CallInst>(&inst)) {
+        Function *callee = call->getCalledFunction();
+        if (!callee)
+          return false;
+        if (callee->isDeclaration()) {
+          if (!isNativeIntrinsic(callee->getIntrinsicID()))
+            return false;
+          intrinsics.insert(callee);
+        } else if (called.insert(callee).second) {
+          worklist.push_back(callee);
+        }
+#if LLVM_VERSION_CODE >= LLVM_VERSION(8, 0)
+        calledOperand = &call->getCalledOperandUse();
+#else
+        calledOperand = &call->getOperandUse(call->getNumOperands() - 1);
+#endif
+      }
+      for (const Use &op : inst.operands()) {
+        if (&op == calledOperand)
+          continue;
+        if (auto *c = dyn_cast<Constant>(op.get()))
+          if (!collectGlobals(c, globals))
+            return false;
+      }
+    }
+  }
+
+  // Each function is either cloned or referred to by its address
+  for (Function *f : called)
+    if (globals.count(f))
+      return false;
+
+  code.intrinsics.assign(intrinsics.begin(), intrinsics.end());
+  code.globals.assign(globals.begin(), globals.end());
+  return hasLoop;
+}
+
+bool ExternalDispatcherImpl::isNativeCandidate(Function *f) {
+  auto it = nativeCode.find(f);
+  if (it == nativeCode.end()) {
+    NativeCode code;
+    code.candidate = collectNativeCode(f, code);
+    it = nativeCode.emplace(f, std::move(code)).first;
+  }
+  return it->second.candidate;
+}
+
+Function *ExternalDispatcherImpl::createNativeDispatcher(
+    Function *f, Instruction *i, const NativeCode &code,
+    const std::function<uint64_t(const GlobalValue *)> &getAddress,
+    Module *module) {
+  const Module &original = *f->getParent();
+  module->setDataLayout(original.getDataLayout());
+  module->setTargetTriple(original.getTargetTriple());
+
+  ValueToValueMapTy vmap;
+  for (Function *g : code.functions)
+    vmap[g] = Function::Create(g->getFunctionType(),
+                               GlobalValue::InternalLinkage, g->getName(),
+                               module);
+  for (Function *g : code.intrinsics)
+    vmap[g] = Function::Create(g->getFunctionType(),
+                               GlobalValue::ExternalLinkage, g->getName(),
+                               module);
+  Type *intPtrType = module->getDataLayout().getIntPtrType(ctx);
+  for (GlobalValue *gv : code.globals)
+    vmap[gv] = llvm::ConstantExpr::getIntToPtr(
+        ConstantInt::get(intPtrType, getAddress(gv)), gv->getType());
+
+  for (Function *g : code.functions) {
+    auto *clone = cast<Function>(vmap[g]);
+    auto arg = clone->arg_begin();
+    for (Argument &a : g->args()) {
+      arg->setName(a.getName());
+      vmap[&a] = &*arg++;
+    }
+    SmallVector<ReturnInst *, 8> returns;
+#if LLVM_VERSION_CODE >= LLVM_VERSION(13, 0)
+    CloneFunctionInto(clone, g, vmap,
+                      CloneFunctionChangeType::DifferentModule, returns);
+#else
+    CloneFunctionInto(clone, g, vmap, true, returns);
+#endif
+  }
+  StripDebugInfo(*module);
+
+  return createDispatcher(f, i, module);
+}
+
+bool ExternalDispatcherImpl::executeNativeCall(
+    Function *f, Instruction *i, uint64_t *args,
+    const std::function<uint64_t(const GlobalValue *)> &getAddress,
+    const std::vector<uint64_t> &protectedPages, time::Span timeout) {
+  if (!isNativeCandidate(f))
+    return false;
+
+  auto key = std::make_pair(i, f);
+  auto it = nativeDispatchers.find(key);
+  if (it == nativeDispatchers.end()) {
+    auto module = std::make_unique<Module>(getFreshModuleID(), ctx);
+    Function *dispatcher = createNativeDispatcher(f, i, nativeCode[f],
+                                                  getAddress, module.get());
+    std::string name = dispatcher->getName().str();
+    executionEngine->addModule(std::move(module)); // MCJIT takes ownership
+    uint64_t fnAddr = executionEngine->getFunctionAddress(name);
+    executionEngine->finalizeObject();
+    assert(fnAddr && "failed to get function address");
+    it = nativeDispatchers.emplace(key, fnAddr).first;
+  }
+
+  int signal = runNativeCall(it->second, args, protectedPages, timeout);
+  if (signal == SIGALRM) {
+    // interpreting it is hardly going to be quicker, but at least limited
+    nativeCode[f].candidate = false;
+  }
+  return !signal;
+}
+
+int ExternalDispatcherImpl::runNativeCall(
+    uint64_t dispatcher, uint64_t *args,
+    const std::vector<uint64_t> &protectedPages, time::Span timeout) {
+  const uint64_t pageSize = llvm::sys::Process::getPageSizeEstimate();
+
+  // Merge the pages into runs of contiguous pages. Only the runs and the
+  // stack are used while the pages are protected, as any other memory might
+  // be on one of them.
+  if (protectedPages.size() * 2 > protectedRunsSize) {
+    if (protectedRuns)
+      munmap(protectedRuns, protectedRunsSize * sizeof(*protectedRuns));
+    protectedRunsSize = protectedPages.size() * 4;
+    void *runs = mmap(nullptr, protectedRunsSize * sizeof(*protectedRuns),
+                      PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1,
+                      0);
+    if (runs == MAP_FAILED) {
+      protectedRuns = nullptr;
+      protectedRunsSize = 0;
+      return SIGSEGV;
+    }
+    protectedRuns = static_cast<uint64_t *>(runs);
+  }
+  uint64_t *runs = protectedRuns;
+  std::size_t numRuns = 0;
+  for (std::size_t j = 0; j < protectedPages.size(); ++j) {
+    if (numRuns &&
+        protectedPages[j] == runs[2 * numRuns - 2] +
+                                 runs[2 * numRuns - 1] * pageSize) {
+      ++runs[2 * numRuns - 1];
+    } else {
+      runs[2 * numRuns] = protectedPages[j];
+      runs[2 * numRuns + 1] = 1;
+      ++numRuns;
+    }
+  }
+
+  if (!signalStack) {
+    void *stack = mmap(nullptr, signalStackSize, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (stack == MAP_FAILED)
+      return SIGSEGV;
+    signalStack = stack;
+  }
+  stack_t altStack, oldAltStack;
+  altStack.ss_sp = signalStack;
+  altStack.ss_size = signalStackSize;
+  altStack.ss_flags = 0;
+  if (sigaltstack(&altStack, &oldAltStack))
+    return SIGSEGV;
+
+  const int signals[] = {SIGSEGV, SIGBUS, SIGFPE, SIGILL, SIGALRM};
+  const std::size_t numSignals = sizeof(signals) / sizeof(*signals);
+  struct sigaction action, oldActions[numSignals];
+  action.sa_handler = nullptr;
+  sigemptyset(&action.sa_mask);
+  for (int signal : signals)
+    sigaddset(&action.sa_mask, signal);
+  action.sa_flags = SA_SIGINFO | SA_ONSTACK;
+  action.sa_sigaction = ::sigsegv_handler;
+  for (std::size_t j = 0; j < numSignals; ++j)
+    sigaction(signals[j], &action, &oldActions[j]);
+
+  gTheArgsP = args;
+  gNumWatchedPages = 0;
+  gCaughtSignal = 0;
+
+  std::size_t numProtected = 0;
+  while (numProtected < numRuns &&
+         mprotect(reinterpret_cast<void *>(runs[2 * numProtected]),
+                  runs[2 * numProtected + 1] * pageSize, PROT_NONE) == 0)
+    ++numProtected;
+
+  struct itimerval timer = {}, noTimer = {};
+  if (timeout)
+    timer.it_value = static_cast<timeval>(timeout);
+
+  if (numProtected < numRuns) {
+    gCaughtSignal = SIGSEGV;
+  } else if (!sigsetjmp(escapeCallJmpBuf, 1)) {
+    setitimer(ITIMER_REAL, &timer, nullptr);
+    reinterpret_cast<void (*)()>(dispatcher)();
+  }
+  setitimer(ITIMER_REAL, &noTimer, nullptr);
+
+  for (std::size_t j = 0; j < numProtected; ++j)
+    mprotect(reinterpret_cast<void *>(runs[2 * j]), runs[2 * j + 1] * pageSize,
+             PROT_READ | PROT_WRITE);
+
+  for (std::size_t j = 0; j < numSignals; ++j)
+    sigaction(signals[j], &oldActions[j], nullptr);
+  sigaltstack(&oldAltStack, nullptr);
+  return gCaughtSignal;
+}
+
 int ExternalDispatcherImpl::getLastErrno() { return lastErrno; }
 void ExternalDispatcherImpl::setLastErrno(int newErrno) {
   lastErrno = newErrno;
@@ -350,6 +775,26 @@ void *ExternalDispatcher::resolveSymbol(const std::string &name) {
   return impl->resolveSymbol(name);
 }
 
+bool ExternalDispatcher::isNativeCandidate(llvm::Function *f) {
+  return impl->isNativeCandidate(f);
+}
+
+bool ExternalDispatcher::executeNativeCall(
+    llvm::Function *f, llvm::Instruction *i, uint64_t *args,
+    const std::function<uint64_t(const llvm::GlobalValue *)> &getAddress,
+    const std::vector<uint64_t> &protectedPages, time::Span timeout) {
+  return impl->executeNativeCall(f, i, args, getAddress, protectedPages,
+                                 timeout);
+}
+
+void ExternalDispatcher::setWatchedPages(std::vector<uint64_t> pages) {
+  impl->setWatchedPages(std::move(pages));
+}
+
+const std::vector<uint64_t> &ExternalDispatcher::getWrittenPages() const {
+  return impl->getWrittenPages();
+}
+
 int ExternalDispatcher::getLastErrno() { return impl->getLastErrno(); }
 void ExternalDispatcher::setLastErrno(int newErrno) {
   impl->setLastErrno(newErrno);
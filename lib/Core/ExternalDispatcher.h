@@ -11,16 +11,20 @@
 #define KLEE_EXTERNALDISPATCHER_H
 
 #include "klee/Config/Version.h"
+#include "klee/System/Time.h"
 
+#include <functional>
 #include <map>
 #include <memory>
 #include <stdint.h>
 #include <string>
+#include <vector>
 
 namespace llvm {
 class Instruction;
 class LLVMContext;
 class Function;
+class GlobalValue;
 }
 
 namespace klee {
@@ -41,6 +45,36 @@ public:
                    uint64_t *args);
   void *resolveSymbol(const std::string &name);
 
+  /// Whether calls to the module function \p f can be run by
+  /// executeNativeCall: neither it nor the functions it calls may call
+  /// functions other than the module's and some intrinsics, or use
+  /// variadic arguments, exceptions or inline assembly. Also, one of them
+  /// has to contain a loop, as running short functions natively does not
+  /// pay off.
+  bool isNativeCandidate(llvm::Function *f);
+
+  /// Compile the module function \p f, together with the functions it
+  /// calls, and call it like executeCall. Global values are placed at the
+  /// addresses given by \p getAddress. The native memory pages
+  /// \p protectedPages (sorted, given by their addresses) are inaccessible
+  /// during the call.
+  ///
+  /// \return false if the call faulted, e.g. by accessing a protected page,
+  /// or took longer than \p timeout, in which case \p f is no longer
+  /// considered a candidate.
+  bool executeNativeCall(
+      llvm::Function *f, llvm::Instruction *i, uint64_t *args,
+      const std::function<uint64_t(const llvm::GlobalValue *)> &getAddress,
+      const std::vector<uint64_t> &protectedPages, time::Span timeout);
+
+  /// Write-protect the given native memory pages (sorted, given by their
+  /// addresses) during the next call and record which of them it writes to.
+  /// Writes by the kernel, e.g. in system calls, fail instead of being
+  /// recorded, so pages that might be written that way must not be watched.
+  void setWatchedPages(std::vector<uint64_t> pages);
+  /// Watched pages written to by the last call
+  const std::vector<uint64_t> &getWrittenPages() const;
+
   int getLastErrno();
   void setLastErrno(int newErrno);
 };
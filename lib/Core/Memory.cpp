@@ -13,7 +13,6 @@
 #include "ExecutionState.h"
 #include "MemoryManager.h"
 
-#include "klee/ADT/BitArray.h"
 #include "klee/Expr/ArrayCache.h"
 #include "klee/Expr/Expr.h"
 #include "klee/Support/OptionCategories.h"
@@ -44,6 +43,8 @@ namespace {
 
 int MemoryObject::counter = 0;
 
+static std::uint64_t lastConcreteVersion = 0;
+
 MemoryObject::~MemoryObject() {
   if (parent)
     parent->markFreed(this);
@@ -76,7 +77,8 @@ void MemoryObject::getAllocInfo(std::string &result) const {
 ObjectState::ObjectState(const MemoryObject *mo)
   : copyOnWriteOwner(0),
     object(mo),
-    concreteStore(new uint8_t[mo->size]),
+    concreteStore(mo->size),
+    concreteVersion(++lastConcreteVersion),
     concreteMask(nullptr),
     knownSymbolics(nullptr),
     unflushedMask(nullptr),
@@ -89,14 +91,14 @@ ObjectState::ObjectState(const MemoryObject *mo)
         getArrayCache()->CreateArray("tmp_arr" + llvm::utostr(++id), size);
     updates = UpdateList(array, 0);
   }
-  memset(concreteStore, 0, size);
 }
 
 
 ObjectState::ObjectState(const MemoryObject *mo, const Array *array)
   : copyOnWriteOwner(0),
     object(mo),
-    concreteStore(new uint8_t[mo->size]),
+    concreteStore(mo->size),
+    concreteVersion(++lastConcreteVersion),
     concreteMask(nullptr),
     knownSymbolics(nullptr),
     unflushedMask(nullptr),
@@ -104,34 +106,28 @@ ObjectState::ObjectState(const MemoryObject *mo, const Array *array)
     size(mo->size),
     readOnly(false) {
   makeSymbolic();
-  memset(concreteStore, 0, size);
 }
 
 ObjectState::ObjectState(const ObjectState &os) 
   : copyOnWriteOwner(0),
     object(os.object),
-    concreteStore(new uint8_t[os.size]),
-    concreteMask(os.concreteMask ? new BitArray(*os.concreteMask, os.size) : nullptr),
-    knownSymbolics(nullptr),
-    unflushedMask(os.unflushedMask ? new BitArray(*os.unflushedMask, os.size) : nullptr),
+    concreteStore(os.concreteStore),
+    concreteVersion(os.concreteVersion),
+    concreteMask(os.concreteMask ? new PagedBitArray(*os.concreteMask) : nullptr),
+    knownSymbolics(os.knownSymbolics
+                       ? new PagedArray<ref<Expr>, 512>(*os.knownSymbolics)
+                       : nullptr),
+    unflushedMask(os.unflushedMask ? new PagedBitArray(*os.unflushedMask) : nullptr),
     updates(os.updates),
     size(os.size),
     readOnly(false) {
   assert(!os.readOnly && "no need to copy read only object?");
-  if (os.knownSymbolics) {
-    knownSymbolics = new ref<Expr>[size];
-    for (unsigned i=0; i<size; i++)
-      knownSymbolics[i] = os.knownSymbolics[i];
-  }
-
-  memcpy(concreteStore, os.concreteStore, size*sizeof(*concreteStore));
 }
 
 ObjectState::~ObjectState() {
   delete concreteMask;
   delete unflushedMask;
-  delete[] knownSymbolics;
-  delete[] concreteStore;
+  delete knownSymbolics;
 }
 
 ArrayCache *ObjectState::getArrayCache() const {
@@ -141,6 +137,10 @@ ArrayCache *ObjectState::getArrayCache() const {
 
 /***/
 
+void ObjectState::markConcreteStoreChanged() const {
+  concreteVersion = ++lastConcreteVersion;
+}
+
 const UpdateList &ObjectState::getUpdates() const {
   // Constant arrays are created lazily.
   if (!updates.root) {
@@ -203,8 +203,10 @@ void ObjectState::flushToConcreteStore(TimingSolver *solver,
         klee_warning("Solver timed out when getting a value for external call, "
                      "byte %p+%u will have random value",
                      (void *)object->address, i);
-      else
-        ce->toMemory(concreteStore + i);
+      else {
+        concreteStore.set(i, ce->getZExtValue(8));
+        markConcreteStoreChanged();
+      }
     }
   }
 }
@@ -212,7 +214,7 @@ void ObjectState::flushToConcreteStore(TimingSolver *solver,
 void ObjectState::makeConcrete() {
   delete concreteMask;
   delete unflushedMask;
-  delete[] knownSymbolics;
+  delete knownSymbolics;
   concreteMask = nullptr;
   unflushedMask = nullptr;
   knownSymbolics = nullptr;
@@ -232,15 +234,15 @@ void ObjectState::makeSymbolic() {
 
 void ObjectState::initializeToZero() {
   makeConcrete();
-  memset(concreteStore, 0, size);
+  concreteStore.fill(0);
+  markConcreteStoreChanged();
 }
 
 void ObjectState::initializeToRandom() {  
   makeConcrete();
-  for (unsigned i=0; i<size; i++) {
-    // randomly selected by 256 sided die
-    concreteStore[i] = 0xAB;
-  }
+  // randomly selected by 256 sided die
+  concreteStore.fill(0xAB);
+  markConcreteStoreChanged();
 }
 
 /*
@@ -261,7 +263,7 @@ void ObjectState::fastRangeCheckOffset(ref<Expr> offset,
 void ObjectState::flushRangeForRead(unsigned rangeBase,
                                     unsigned rangeSize) const {
   if (!unflushedMask)
-    unflushedMask = new BitArray(size, true);
+    unflushedMask = new PagedBitArray(size, true);
 
   for (unsigned offset = rangeBase; offset < rangeBase + rangeSize; offset++) {
     if (isByteUnflushed(offset)) {
@@ -272,7 +274,7 @@ void ObjectState::flushRangeForRead(unsigned rangeBase,
         assert(isByteKnownSymbolic(offset) &&
                "invalid bit set in unflushedMask");
         updates.extend(ConstantExpr::create(offset, Expr::Int32),
-                       knownSymbolics[offset]);
+                       (*knownSymbolics)[offset]);
       }
 
       unflushedMask->unset(offset);
@@ -282,7 +284,7 @@ void ObjectState::flushRangeForRead(unsigned rangeBase,
 
 void ObjectState::flushRangeForWrite(unsigned rangeBase, unsigned rangeSize) {
   if (!unflushedMask)
-    unflushedMask = new BitArray(size, true);
+    unflushedMask = new PagedBitArray(size, true);
 
   for (unsigned offset = rangeBase; offset < rangeBase + rangeSize; offset++) {
     if (isByteUnflushed(offset)) {
@@ -294,7 +296,7 @@ void ObjectState::flushRangeForWrite(unsigned rangeBase, unsigned rangeSize) {
         assert(isByteKnownSymbolic(offset) &&
                "invalid bit set in unflushedMask");
         updates.extend(ConstantExpr::create(offset, Expr::Int32),
-                       knownSymbolics[offset]);
+                       (*knownSymbolics)[offset]);
         setKnownSymbolic(offset, 0);
       }
 
@@ -311,6 +313,15 @@ void ObjectState::flushRangeForWrite(unsigned rangeBase, unsigned rangeSize) {
   }
 }
 
+bool ObjectState::isAllConcrete() const {
+  if (!concreteMask)
+    return true;
+  for (unsigned i = 0; i < size; ++i)
+    if (!concreteMask->get(i))
+      return false;
+  return true;
+}
+
 bool ObjectState::isByteConcrete(unsigned offset) const {
   return !concreteMask || concreteMask->get(offset);
 }
@@ -320,7 +331,7 @@ bool ObjectState::isByteUnflushed(unsigned offset) const {
 }
 
 bool ObjectState::isByteKnownSymbolic(unsigned offset) const {
-  return knownSymbolics && knownSymbolics[offset].get();
+  return knownSymbolics && (*knownSymbolics)[offset].get();
 }
 
 void ObjectState::markByteConcrete(unsigned offset) {
@@ -330,7 +341,7 @@ void ObjectState::markByteConcrete(unsigned offset) {
 
 void ObjectState::markByteSymbolic(unsigned offset) {
   if (!concreteMask)
-    concreteMask = new BitArray(size, true);
+    concreteMask = new PagedBitArray(size, true);
   concreteMask->unset(offset);
 }
 
@@ -341,7 +352,7 @@ void ObjectState::markByteUnflushed(unsigned offset) {
 
 void ObjectState::markByteFlushed(unsigned offset) {
   if (!unflushedMask) {
-    unflushedMask = new BitArray(size, false);
+    unflushedMask = new PagedBitArray(size, false);
   } else {
     unflushedMask->unset(offset);
   }
@@ -350,11 +361,13 @@ void ObjectState::markByteFlushed(unsigned offset) {
 void ObjectState::setKnownSymbolic(unsigned offset, 
                                    Expr *value /* can be null */) {
   if (knownSymbolics) {
-    knownSymbolics[offset] = value;
+    // avoid duplicating a shared page for clearing an unset entry
+    if (value || (*knownSymbolics)[offset].get())
+      knownSymbolics->set(offset, value);
   } else {
     if (value) {
-      knownSymbolics = new ref<Expr>[size];
-      knownSymbolics[offset] = value;
+      knownSymbolics = new PagedArray<ref<Expr>, 512>(size);
+      knownSymbolics->set(offset, value);
     }
   }
 }
@@ -365,7 +378,7 @@ ref<Expr> ObjectState::read8(unsigned offset) const {
   if (isByteConcrete(offset)) {
     return ConstantExpr::create(concreteStore[offset], Expr::Int8);
   } else if (isByteKnownSymbolic(offset)) {
-    return knownSymbolics[offset];
+    return (*knownSymbolics)[offset];
   } else {
     assert(!isByteUnflushed(offset) && "unflushed byte without cache value");
     
@@ -393,7 +406,10 @@ ref<Expr> ObjectState::read8(ref<Expr> offset) const {
 
 void ObjectState::write8(unsigned offset, uint8_t value) {
   //assert(read_only == false && "writing to read-only object!");
-  concreteStore[offset] = value;
+  if (concreteStore[offset] != value) {
+    concreteStore.set(offset, value);
+    markConcreteStoreChanged();
+  }
   setKnownSymbolic(offset, 0);
 
   markByteConcrete(offset);
@@ -13,10 +13,12 @@
 #include "Context.h"
 #include "TimingSolver.h"
 
+#include "klee/ADT/PagedArray.h"
 #include "klee/Expr/Expr.h"
 
 #include "llvm/ADT/StringExtras.h"
 
+#include <cstdint>
 #include <string>
 #include <vector>
 
@@ -27,7 +29,6 @@ namespace llvm {
 namespace klee {
 
 class ArrayCache;
-class BitArray;
 class ExecutionState;
 class MemoryManager;
 class Solver;
@@ -58,6 +59,10 @@ public:
 
   bool isUserSpecified;
 
+  /// Version of the concrete store last copied to or from the native memory
+  /// at address (see ObjectState::concreteVersion), 0 if unknown
+  mutable std::uint64_t nativeVersion = 0;
+
   MemoryManager *parent;
 
   /// "Location" for which this memory object was allocated. This
@@ -163,6 +168,7 @@ public:
 class ObjectState {
 private:
   friend class AddressSpace;
+  friend class StateOffloader;
   friend class ref<ObjectState>;
 
   unsigned copyOnWriteOwner; // exclusively for AddressSpace
@@ -173,18 +179,25 @@ private:
   ref<const MemoryObject> object;
 
   /// @brief Holds all known concrete bytes
-  uint8_t *concreteStore;
+  /// mutable because flushToConcreteStore() of a const object fills in
+  /// values for its symbolic bytes
+  mutable PagedArray<uint8_t, 4096> concreteStore;
+
+  /// @brief Identifies the contents of concreteStore: changed on every
+  /// modification, kept by copies. Used to skip copying unmodified objects
+  /// to native memory before external calls.
+  mutable std::uint64_t concreteVersion;
 
   /// @brief concreteMask[byte] is set if byte is known to be concrete
-  BitArray *concreteMask;
+  PagedBitArray *concreteMask;
 
   /// knownSymbolics[byte] holds the symbolic expression for byte,
   /// if byte is known to be symbolic
-  ref<Expr> *knownSymbolics;
+  PagedArray<ref<Expr>, 512> *knownSymbolics;
 
   /// unflushedMask[byte] is set if byte is unflushed
   /// mutable because may need flushed during read of const
-  mutable BitArray *unflushedMask;
+  mutable PagedBitArray *unflushedMask;
 
   // mutable because we may need flush during read of const
   mutable UpdateList updates;
@@ -211,6 +224,9 @@ public:
 
   void setReadOnly(bool ro) { readOnly = ro; }
 
+  /// Whether all bytes are concrete
+  bool isAllConcrete() const;
+
   /// Make contents all concrete and zero
   void initializeToZero();
 
@@ -240,6 +256,9 @@ public:
 private:
   const UpdateList &getUpdates() const;
 
+  /// Record that concreteStore was modified
+  void markConcreteStoreChanged() const;
+
   void makeConcrete();
 
   void makeSymbolic();
@@ -48,6 +48,10 @@ public:
   void markFreed(MemoryObject *mo);
   ArrayCache *getArrayCache() const { return arrayCache; }
 
+  /// Returns true if objects are allocated in a dedicated memory region
+  /// instead of the heap of the process
+  bool isDeterministic() const { return deterministicSpace != nullptr; }
+
   /*
    * Returns the size used by deterministic allocation in bytes
    */
@@ -15,7 +15,9 @@
 #include "klee/Expr/ExprPPrinter.h"
 #include "klee/Support/OptionCategories.h"
 
-#include <bitset>
+#include "llvm/Support/LEB128.h"
+
+#include <algorithm>
 #include <vector>
 
 using namespace klee;
@@ -26,69 +28,91 @@ namespace {
 cl::opt<bool>
     CompressProcessTree("compress-process-tree",
                         cl::desc("Remove intermediate nodes in the process "
-                                 "tree whenever possible (default=false)"),
-                        cl::init(false), cl::cat(MiscCat));
+                                 "tree whenever possible (default=true)"),
+                        cl::init(true), cl::cat(MiscCat));
+
+const char *getBranchTypeName(BranchType type) {
+  switch (type) {
+#define BTYPE(N, I)                                                            \
+  case BranchType::N:                                                          \
+    return #N;
+#define MARK(N, I)
+    BRANCH_TYPES
+#undef BTYPE
+#undef MARK
+  }
+  return "unknown";
+}
 
 } // namespace
 
 PTree::PTree(ExecutionState *initialState)
-    : root(PTreeNodePtr(new PTreeNode(nullptr, initialState))) {
-  initialState->ptreeNode = root.getPointer();
+    : root(createNode(nullptr, initialState)) {
+  initialState->ptreeNode = root;
+}
+
+PTreeNode *PTree::createNode(PTreeNode *parent, ExecutionState *state) {
+  return new (allocator.Allocate()) PTreeNode(parent, state);
+}
+
+void PTree::destroyNode(PTreeNode *node) {
+  node->~PTreeNode();
+  allocator.Deallocate(node);
 }
 
 void PTree::attach(PTreeNode *node, ExecutionState *leftState,
                    ExecutionState *rightState, BranchType reason) {
-  assert(node && !node->left.getPointer() && !node->right.getPointer());
+  assert(node && !node->left && !node->right);
   assert(node == rightState->ptreeNode &&
          "Attach assumes the right state is the current state");
   node->state = nullptr;
-  node->left = PTreeNodePtr(new PTreeNode(node, leftState));
-  // The current node inherits the tag
-  uint8_t currentNodeTag = root.getInt();
-  if (node->parent)
-    currentNodeTag = node->parent->left.getPointer() == node
-                         ? node->parent->left.getInt()
-                         : node->parent->right.getInt();
-  node->right = PTreeNodePtr(new PTreeNode(node, rightState), currentNodeTag);
+  node->branchType = reason;
+  node->left = createNode(node, leftState);
+  node->right = createNode(node, rightState);
+  // The current state stays with the searchers holding it
+  node->right->owners = node->owners;
 }
 
 void PTree::remove(PTreeNode *n) {
-  assert(!n->left.getPointer() && !n->right.getPointer());
+  assert(!n->left && !n->right);
   do {
     PTreeNode *p = n->parent;
     if (p) {
-      if (n == p->left.getPointer()) {
-        p->left = PTreeNodePtr(nullptr);
+      if (n == p->left) {
+        p->left = nullptr;
       } else {
-        assert(n == p->right.getPointer());
-        p->right = PTreeNodePtr(nullptr);
+        assert(n == p->right);
+        p->right = nullptr;
       }
     }
-    delete n;
+    destroyNode(n);
     n = p;
-  } while (n && !n->left.getPointer() && !n->right.getPointer());
+  } while (n && !n->left && !n->right);
 
   if (n && CompressProcessTree) {
     // We're now at a node that has exactly one child; we've just deleted the
     // other one. Eliminate the node and connect its child to the parent
     // directly (if it's not the root).
-    PTreeNodePtr child = n->left.getPointer() ? n->left : n->right;
+    PTreeNode *child = n->left ? n->left : n->right;
     PTreeNode *parent = n->parent;
 
-    child.getPointer()->parent = parent;
+    child->parent = parent;
+    child->collapsed += n->collapsed + 1;
+    child->collapsedTypes |= n->collapsedTypes |
+                             (1U << static_cast<unsigned>(n->branchType));
     if (!parent) {
       // We're at the root.
       root = child;
     } else {
-      if (n == parent->left.getPointer()) {
+      if (n == parent->left) {
         parent->left = child;
       } else {
-        assert(n == parent->right.getPointer());
+        assert(n == parent->right);
         parent->right = child;
       }
     }
 
-    delete n;
+    destroyNode(n);
   }
 }
 
@@ -103,33 +127,68 @@ void PTree::dump(llvm::raw_ostream &os) {
   os << "\tnode [style=\"filled\",width=.1,height=.1,fontname=\"Terminus\"]\n";
   os << "\tedge [arrowsize=.3]\n";
   std::vector<const PTreeNode*> stack;
-  stack.push_back(root.getPointer());
+  stack.push_back(root);
   while (!stack.empty()) {
     const PTreeNode *n = stack.back();
     stack.pop_back();
     os << "\tn" << n << " [shape=diamond";
     if (n->state)
       os << ",fillcolor=green";
+    else if (n->branchType != BranchType::NONE)
+      os << ",xlabel=" << getBranchTypeName(n->branchType);
     os << "];\n";
-    if (n->left.getPointer()) {
-      os << "\tn" << n << " -> n" << n->left.getPointer();
-      os << " [label=0b"
-         << std::bitset<PtrBitCount>(n->left.getInt()).to_string() << "];\n";
-      stack.push_back(n->left.getPointer());
-    }
-    if (n->right.getPointer()) {
-      os << "\tn" << n << " -> n" << n->right.getPointer();
-      os << " [label=0b"
-         << std::bitset<PtrBitCount>(n->right.getInt()).to_string() << "];\n";
-      stack.push_back(n->right.getPointer());
+    for (const PTreeNode *child : {n->left, n->right}) {
+      if (!child)
+        continue;
+      // label the edge with the owners of the child, highest id first, and
+      // the nodes collapsed into it
+      os << "\tn" << n << " -> n" << child << " [label=";
+      if (child->collapsed)
+        os << '"';
+      os << "0b";
+      for (unsigned id = std::max(registeredIds, 1u); id-- > 0;)
+        os << (child->isOwnedBy(id) ? '1' : '0');
+      if (child->collapsed) {
+        os << " +" << child->collapsed << " (";
+        const char *separator = "";
+        for (unsigned type = 0; type <= static_cast<unsigned>(BranchType::END);
+             ++type) {
+          if (child->collapsedTypes & (1U << type)) {
+            os << separator
+               << getBranchTypeName(static_cast<BranchType>(type));
+            separator = ",";
+          }
+        }
+        os << ")\"";
+      }
+      os << "];\n";
+      stack.push_back(child);
     }
   }
   os << "}\n";
   delete pp;
 }
 
+void PTree::write(llvm::raw_ostream &os) {
+  os << "KPTREE" << static_cast<char>(1);
+  std::vector<const PTreeNode *> stack = {root};
+  while (!stack.empty()) {
+    const PTreeNode *n = stack.back();
+    stack.pop_back();
+    os << static_cast<char>((n->left ? 1 : 0) | (n->right ? 2 : 0) |
+                            (n->state ? 4 : 0))
+       << static_cast<char>(n->branchType);
+    encodeULEB128(n->collapsed, os);
+    if (n->collapsed)
+      os << static_cast<char>(n->collapsedTypes & 0xff)
+         << static_cast<char>(n->collapsedTypes >> 8);
+    if (n->right)
+      stack.push_back(n->right);
+    if (n->left)
+      stack.push_back(n->left);
+  }
+}
+
 PTreeNode::PTreeNode(PTreeNode *parent, ExecutionState *state) : parent{parent}, state{state} {
   state->ptreeNode = this;
-  left = PTreeNodePtr(nullptr);
-  right = PTreeNodePtr(nullptr);
 }
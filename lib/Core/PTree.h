@@ -12,54 +12,83 @@
 
 #include "klee/Core/BranchTypes.h"
 #include "klee/Expr/Expr.h"
-#include "klee/Support/ErrorHandling.h"
-#include "llvm/ADT/PointerIntPair.h"
+#include "llvm/ADT/SmallBitVector.h"
+#include "llvm/Support/Allocator.h"
+#include "llvm/Support/RecyclingAllocator.h"
+
+#include <cstdint>
 
 namespace klee {
   class ExecutionState;
-  class PTreeNode;
-  /* PTreeNodePtr is used by the Random Path Searcher object to efficiently
-  record which PTreeNode belongs to it. PTree is a global structure that
-  captures all  states, whereas a Random Path Searcher might only care about
-  a subset. The integer part of PTreeNodePtr is a bitmask (a "tag") of which
-  Random Path Searchers PTreeNode belongs to. */
-  constexpr int PtrBitCount = 3;
-  using PTreeNodePtr = llvm::PointerIntPair<PTreeNode *, PtrBitCount, uint8_t>;
 
   class PTreeNode {
   public:
     PTreeNode *parent = nullptr;
 
-    PTreeNodePtr left; 
-    PTreeNodePtr right;
+    PTreeNode *left = nullptr;
+    PTreeNode *right = nullptr;
     ExecutionState *state = nullptr;
 
+    /// PTree is a global structure that captures all states, whereas a
+    /// RandomPathSearcher might only care about a subset. Bit i is set if
+    /// the searcher with id i (see PTree::getNextId) holds a state in the
+    /// subtree rooted at this node.
+    llvm::SmallBitVector owners;
+
+    /// Why the state forked at this node, for an inner node
+    BranchType branchType = BranchType::NONE;
+    /// Number of single-child nodes removed between this node and its parent
+    /// (see PTree::remove)
+    std::uint32_t collapsed = 0;
+    /// Bitmask of the branch types of these removed nodes
+    std::uint16_t collapsedTypes = 0;
+
     PTreeNode(const PTreeNode&) = delete;
     PTreeNode(PTreeNode *parent, ExecutionState *state);
     ~PTreeNode() = default;
+
+    bool isOwnedBy(unsigned id) const {
+      return id < owners.size() && owners.test(id);
+    }
+    void setOwner(unsigned id) {
+      if (id >= owners.size())
+        owners.resize(id + 1);
+      owners.set(id);
+    }
+    void resetOwner(unsigned id) {
+      if (id < owners.size())
+        owners.reset(id);
+    }
   };
 
   class PTree {
     // Number of registered ID
-    int registeredIds = 0;
+    unsigned registeredIds = 0;
+
+    /// Nodes are allocated from slabs, and reused once removed
+    llvm::RecyclingAllocator<llvm::BumpPtrAllocator, PTreeNode> allocator;
+
+    PTreeNode *createNode(PTreeNode *parent, ExecutionState *state);
+    void destroyNode(PTreeNode *node);
 
   public:
-    PTreeNodePtr root;
+    PTreeNode *root;
     explicit PTree(ExecutionState *initialState);
     ~PTree() = default;
 
     void attach(PTreeNode *node, ExecutionState *leftState,
                 ExecutionState *rightState, BranchType reason);
     void remove(PTreeNode *node);
+    /// Write the tree in DOT format
     void dump(llvm::raw_ostream &os);
-    std::uint8_t getNextId() {
-      std::uint8_t id = 1 << registeredIds++;
-      if (registeredIds > PtrBitCount) {
-        klee_error("PTree cannot support more than %d RandomPathSearchers",
-                   PtrBitCount);
-      }
-      return id;
-    }
+    /// Write the tree in the compact binary format read by klee-ptree: the
+    /// magic "KPTREE", a version byte, and then the nodes in pre-order, each
+    /// as a byte of flags (1: has a left child, 2: has a right child, 4: has
+    /// a state), a byte with its BranchType, and the number of collapsed
+    /// nodes above it as ULEB128, followed by their 16-bit little-endian
+    /// collapsedTypes if that number is non-zero.
+    void write(llvm::raw_ostream &os);
+    unsigned getNextId() { return registeredIds++; }
   };
 }
 
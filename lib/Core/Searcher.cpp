@@ -30,6 +30,7 @@
 #include "llvm/IR/Module.h"
 #include "llvm/Support/CommandLine.h"
 
+#include <algorithm>
 #include <cassert>
 #include <cmath>
 
@@ -37,6 +38,62 @@ using namespace klee;
 using namespace llvm;
 
 
+///
+
+/// The position of `es` in `sequence`, see ExecutionState::searcherSlots
+static std::size_t &getSlot(ExecutionState &es, const void *sequence) {
+  auto slot = std::find_if(
+      es.searcherSlots.begin(), es.searcherSlots.end(),
+      [sequence](const std::pair<const void *, std::size_t> &s) {
+        return s.first == sequence;
+      });
+  assert(slot != es.searcherSlots.end() && "invalid state removed");
+  return slot->second;
+}
+
+static std::size_t takeSlot(ExecutionState &es, const void *sequence) {
+  auto slot = std::find_if(
+      es.searcherSlots.begin(), es.searcherSlots.end(),
+      [sequence](const std::pair<const void *, std::size_t> &s) {
+        return s.first == sequence;
+      });
+  assert(slot != es.searcherSlots.end() && "invalid state removed");
+  std::size_t position = slot->second;
+  *slot = es.searcherSlots.back();
+  es.searcherSlots.pop_back();
+  return position;
+}
+
+void StateSequence::push_back(ExecutionState *es) {
+  es->searcherSlots.emplace_back(this, first + states.size());
+  states.push_back(es);
+}
+
+void StateSequence::remove(ExecutionState *es) {
+  states[takeSlot(*es, this) - first] = nullptr;
+  ++holes;
+
+  while (!states.empty() && !states.front()) {
+    states.pop_front();
+    ++first;
+    --holes;
+  }
+  while (!states.empty() && !states.back()) {
+    states.pop_back();
+    --holes;
+  }
+  if (2 * holes > states.size())
+    compact();
+}
+
+void StateSequence::compact() {
+  states.erase(std::remove(states.begin(), states.end(), nullptr),
+               states.end());
+  for (std::size_t i = 0; i < states.size(); ++i)
+    getSlot(*states[i], this) = first + i;
+  holes = 0;
+}
+
 ///
 
 ExecutionState &DFSSearcher::selectState() {
@@ -47,18 +104,12 @@ void DFSSearcher::update(ExecutionState *current,
                          const std::vector<ExecutionState *> &addedStates,
                          const std::vector<ExecutionState *> &removedStates) {
   // insert states
-  states.insert(states.end(), addedStates.begin(), addedStates.end());
+  for (const auto state : addedStates)
+    states.push_back(state);
 
   // remove states
-  for (const auto state : removedStates) {
-    if (state == states.back()) {
-      states.pop_back();
-    } else {
-      auto it = std::find(states.begin(), states.end(), state);
-      assert(it != states.end() && "invalid state removed");
-      states.erase(it);
-    }
-  }
+  for (const auto state : removedStates)
+    states.remove(state);
 }
 
 bool DFSSearcher::empty() {
@@ -84,25 +135,17 @@ void BFSSearcher::update(ExecutionState *current,
   // constraints were added to the current state, it evolved.
   if (!addedStates.empty() && current &&
       std::find(removedStates.begin(), removedStates.end(), current) == removedStates.end()) {
-    auto pos = std::find(states.begin(), states.end(), current);
-    assert(pos != states.end());
-    states.erase(pos);
+    states.remove(current);
     states.push_back(current);
   }
 
   // insert states
-  states.insert(states.end(), addedStates.begin(), addedStates.end());
+  for (const auto state : addedStates)
+    states.push_back(state);
 
   // remove states
-  for (const auto state : removedStates) {
-    if (state == states.front()) {
-      states.pop_front();
-    } else {
-      auto it = std::find(states.begin(), states.end(), state);
-      assert(it != states.end() && "invalid state removed");
-      states.erase(it);
-    }
-  }
+  for (const auto state : removedStates)
+    states.remove(state);
 }
 
 bool BFSSearcher::empty() {
@@ -126,13 +169,20 @@ void RandomSearcher::update(ExecutionState *current,
                             const std::vector<ExecutionState *> &addedStates,
                             const std::vector<ExecutionState *> &removedStates) {
   // insert states
-  states.insert(states.end(), addedStates.begin(), addedStates.end());
+  for (const auto state : addedStates) {
+    state->searcherSlots.emplace_back(this, states.size());
+    states.push_back(state);
+  }
 
   // remove states
   for (const auto state : removedStates) {
-    auto it = std::find(states.begin(), states.end(), state);
-    assert(it != states.end() && "invalid state removed");
-    states.erase(it);
+    std::size_t position = takeSlot(*state, this);
+    ExecutionState *last = states.back();
+    if (last != state) {
+      states[position] = last;
+      getSlot(*last, this) = position;
+    }
+    states.pop_back();
   }
 }
 
@@ -254,85 +304,137 @@ void WeightedRandomSearcher::printName(llvm::raw_ostream &os) {
 ///
 
 // Check if n is a valid pointer and a node belonging to us
-#define IS_OUR_NODE_VALID(n)                                                   \
-  (((n).getPointer() != nullptr) && (((n).getInt() & idBitMask) != 0))
+constexpr std::size_t RandomPathSearcher::none;
 
 RandomPathSearcher::RandomPathSearcher(PTree &processTree, RNG &rng)
   : processTree{processTree},
     theRNG{rng},
-    idBitMask{processTree.getNextId()} {};
+    id{processTree.getNextId()} {};
 
 ExecutionState &RandomPathSearcher::selectState() {
   unsigned flips=0, bits=0;
-  assert(processTree.root.getInt() & idBitMask && "Root should belong to the searcher");
-  PTreeNode *n = processTree.root.getPointer();
-  while (!n->state) {
-    if (!IS_OUR_NODE_VALID(n->left)) {
-      assert(IS_OUR_NODE_VALID(n->right) && "Both left and right nodes invalid");
-      assert(n != n->right.getPointer());
-      n = n->right.getPointer();
-    } else if (!IS_OUR_NODE_VALID(n->right)) {
-      assert(IS_OUR_NODE_VALID(n->left) && "Both right and left nodes invalid");
-      assert(n != n->left.getPointer());
-      n = n->left.getPointer();
-    } else {
-      if (bits==0) {
-        flips = theRNG.getInt32();
-        bits = 32;
-      }
-      --bits;
-      n = ((flips & (1U << bits)) ? n->left : n->right).getPointer();
+  assert(root != none && processTree.root->isOwnedBy(id) &&
+         "Root should belong to the searcher");
+  std::size_t n = root;
+  while (!nodes[n].state) {
+    if (bits==0) {
+      flips = theRNG.getInt32();
+      bits = 32;
     }
+    --bits;
+    n = nodes[n].children[(flips & (1U << bits)) ? 0 : 1];
   }
 
-  return *n->state;
+  return *nodes[n].state;
+}
+
+std::size_t RandomPathSearcher::allocateNode(const Node &node) {
+  if (freeNodes.empty()) {
+    nodes.push_back(node);
+    return nodes.size() - 1;
+  }
+  std::size_t index = freeNodes.back();
+  freeNodes.pop_back();
+  nodes[index] = node;
+  return index;
+}
+
+void RandomPathSearcher::replaceChild(std::size_t parent, std::size_t child,
+                                      std::size_t replacement) {
+  nodes[replacement].parent = parent;
+  if (parent == none) {
+    root = replacement;
+    return;
+  }
+  std::size_t *children = nodes[parent].children;
+  children[children[0] == child ? 0 : 1] = replacement;
+}
+
+void RandomPathSearcher::insertState(ExecutionState *es) {
+  std::size_t leaf = allocateNode({none, {none, none}, nullptr, es});
+  es->searcherSlots.emplace_back(this, leaf);
+
+  // mark the path up to the first node that was already ours
+  PTreeNode *pnode = es->ptreeNode;
+  assert(!pnode->isOwnedBy(id) && "state added twice");
+  pnode->setOwner(id);
+  PTreeNode *parent = pnode->parent;
+  while (parent && !parent->isOwnedBy(id)) {
+    parent->setOwner(id);
+    pnode = parent;
+    parent = pnode->parent;
+  }
+  if (!parent) {
+    assert(root == none);
+    root = leaf;
+    return;
+  }
+
+  // parent now branches between the new state and the part of the compressed
+  // tree below the other child
+  PTreeNode *sibling = parent->left == pnode ? parent->right : parent->left;
+  while (!sibling->state &&
+         !(sibling->left && sibling->left->isOwnedBy(id) &&
+           sibling->right && sibling->right->isOwnedBy(id)))
+    sibling = (sibling->left && sibling->left->isOwnedBy(id)) ? sibling->left
+                                                              : sibling->right;
+  std::size_t other = sibling->state ? getSlot(*sibling->state, this)
+                                     : branches.find(sibling)->second;
+
+  bool left = parent->left == pnode;
+  std::size_t branch = allocateNode(
+      {none, {left ? leaf : other, left ? other : leaf}, parent, nullptr});
+  branches[parent] = branch;
+  replaceChild(nodes[other].parent, other, branch);
+  nodes[leaf].parent = branch;
+  nodes[other].parent = branch;
+}
+
+void RandomPathSearcher::removeState(ExecutionState *es) {
+  std::size_t leaf = takeSlot(*es, this);
+
+  // unmark the path up to the first node that remains ours
+  PTreeNode *pnode = es->ptreeNode;
+  assert(pnode->isOwnedBy(id) && "Removing pTree child not ours");
+  pnode->resetOwner(id);
+  PTreeNode *parent = pnode->parent;
+  while (parent) {
+    PTreeNode *sibling = parent->left == pnode ? parent->right : parent->left;
+    if (sibling && sibling->isOwnedBy(id))
+      break;
+    parent->resetOwner(id);
+    pnode = parent;
+    parent = pnode->parent;
+  }
+
+  std::size_t branch = nodes[leaf].parent;
+  freeNodes.push_back(leaf);
+  if (branch == none) {
+    root = none;
+    return;
+  }
+  assert(nodes[branch].branch == parent);
+  std::size_t *children = nodes[branch].children;
+  replaceChild(nodes[branch].parent, branch,
+               children[children[0] == leaf ? 1 : 0]);
+  branches.erase(parent);
+  freeNodes.push_back(branch);
 }
 
 void RandomPathSearcher::update(ExecutionState *current,
                                 const std::vector<ExecutionState *> &addedStates,
                                 const std::vector<ExecutionState *> &removedStates) {
   // insert states
-  for (auto es : addedStates) {
-    PTreeNode *pnode = es->ptreeNode, *parent = pnode->parent;
-    PTreeNodePtr *childPtr;
-
-    childPtr = parent ? ((parent->left.getPointer() == pnode) ? &parent->left
-                                                              : &parent->right)
-                      : &processTree.root;
-    while (pnode && !IS_OUR_NODE_VALID(*childPtr)) {
-      childPtr->setInt(childPtr->getInt() | idBitMask);
-      pnode = parent;
-      if (pnode)
-        parent = pnode->parent;
-
-      childPtr = parent
-                     ? ((parent->left.getPointer() == pnode) ? &parent->left
-                                                             : &parent->right)
-                     : &processTree.root;
-    }
-  }
+  for (auto es : addedStates)
+    insertState(es);
 
   // remove states
-  for (auto es : removedStates) {
-    PTreeNode *pnode = es->ptreeNode, *parent = pnode->parent;
-
-    while (pnode && !IS_OUR_NODE_VALID(pnode->left) &&
-           !IS_OUR_NODE_VALID(pnode->right)) {
-      auto childPtr =
-          parent ? ((parent->left.getPointer() == pnode) ? &parent->left
-                                                         : &parent->right)
-                 : &processTree.root;
-      assert(IS_OUR_NODE_VALID(*childPtr) && "Removing pTree child not ours");
-      childPtr->setInt(childPtr->getInt() & ~idBitMask);
-      pnode = parent;
-      if (pnode)
-        parent = pnode->parent;
-    }
-  }
+  for (auto es : removedStates)
+    removeState(es);
 }
 
 bool RandomPathSearcher::empty() {
-  return !IS_OUR_NODE_VALID(processTree.root);
+  return root == none;
 }
 
 void RandomPathSearcher::printName(llvm::raw_ostream &os) {
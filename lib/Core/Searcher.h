@@ -15,9 +15,11 @@
 #include "klee/ADT/RNG.h"
 #include "klee/System/Time.h"
 
+#include "llvm/ADT/DenseMap.h"
 #include "llvm/Support/CommandLine.h"
 #include "llvm/Support/raw_ostream.h"
 
+#include <deque>
 #include <map>
 #include <queue>
 #include <set>
@@ -75,10 +77,34 @@ namespace klee {
     };
   };
 
+  /// States in the order they were added, supporting removal in constant
+  /// (amortized) time. A removed state leaves a hole, so that the positions
+  /// of the others, which they record in ExecutionState::searcherSlots, stay
+  /// valid. Holes are compacted away once they make up half the sequence.
+  class StateSequence {
+    std::deque<ExecutionState *> states;
+    /// Position of the first element of `states`
+    std::size_t first = 0;
+    std::size_t holes = 0;
+
+    void compact();
+
+  public:
+    StateSequence() = default;
+    StateSequence(const StateSequence &) = delete;
+    StateSequence &operator=(const StateSequence &) = delete;
+
+    void push_back(ExecutionState *es);
+    void remove(ExecutionState *es);
+    ExecutionState *front() const { return states.front(); }
+    ExecutionState *back() const { return states.back(); }
+    bool empty() const { return states.empty(); }
+  };
+
   /// DFSSearcher implements depth-first exploration. All states are kept in
   /// insertion order. The last state is selected for further exploration.
   class DFSSearcher final : public Searcher {
-    std::vector<ExecutionState*> states;
+    StateSequence states;
 
   public:
     ExecutionState &selectState() override;
@@ -94,7 +120,7 @@ namespace klee {
   /// mind that the process tree (PTree) is a binary tree and hence the depth of
   /// a state in that tree and its branch depth during BFS are different.
   class BFSSearcher final : public Searcher {
-    std::deque<ExecutionState*> states;
+    StateSequence states;
 
   public:
     ExecutionState &selectState() override;
@@ -105,7 +131,8 @@ namespace klee {
     void printName(llvm::raw_ostream &os) override;
   };
 
-  /// RandomSearcher picks a state randomly.
+  /// RandomSearcher picks a state randomly. States are removed by moving the
+  /// last state into their place.
   class RandomSearcher final : public Searcher {
     std::vector<ExecutionState*> states;
     RNG &theRNG;
@@ -160,23 +187,46 @@ namespace klee {
   /// PTree is a global data structure, however, a searcher can sometimes only
   /// select from a subset of all states (depending on the update calls).
   ///
-  /// To support this, RandomPathSearcher has a subgraph view of PTree, in that it
-  /// only walks the PTreeNodes that it "owns". Ownership is stored in the
-  /// getInt method of the PTreeNodePtr class (which hides it in the pointer itself).
-  ///
-  /// The current implementation of PTreeNodePtr supports only 3 instances of the
-  /// RandomPathSearcher. This is because the current PTreeNodePtr implementation
-  /// conforms to C++ and only steals the last 3 alignment bits. This restriction
-  /// could be relaxed slightly by an architecture-specific implementation of
-  /// PTreeNodePtr that also steals the top bits of the pointer.
+  /// To support this, RandomPathSearcher marks the PTreeNodes that it "owns",
+  /// i.e. that have one of its states below them, in PTreeNode::owners. These
+  /// ownership bits are maintained in the update method.
   ///
-  /// The ownership bits are maintained in the update method.
+  /// The walk itself does not visit the PTree, but a compressed copy of the
+  /// owned part, which only has the PTreeNodes where both children are owned
+  /// (the points where the walk flips a coin) and the leaves. Its expected
+  /// length is thus bounded by the logarithm of the number of states, rather
+  /// than by the depth of the PTree.
   class RandomPathSearcher final : public Searcher {
+    /// A node of the compressed tree, referenced by its index in `nodes`
+    struct Node {
+      std::size_t parent;
+      /// The left and right child, for an inner node
+      std::size_t children[2];
+      /// The PTreeNode of an inner node
+      PTreeNode *branch;
+      /// The state of a leaf, null for an inner node
+      ExecutionState *state;
+    };
+    static constexpr std::size_t none = ~std::size_t(0);
+
     PTree &processTree;
     RNG &theRNG;
 
-    // Unique bitmask of this searcher
-    const uint8_t idBitMask;
+    // Unique id of this searcher
+    const unsigned id;
+
+    std::vector<Node> nodes;
+    std::vector<std::size_t> freeNodes;
+    std::size_t root = none;
+    /// The inner nodes, by their PTreeNode. The leaves are found through
+    /// ExecutionState::searcherSlots.
+    llvm::DenseMap<const PTreeNode *, std::size_t> branches;
+
+    std::size_t allocateNode(const Node &node);
+    void replaceChild(std::size_t parent, std::size_t child,
+                      std::size_t replacement);
+    void insertState(ExecutionState *es);
+    void removeState(ExecutionState *es);
 
   public:
     /// \param processTree The process tree.
@@ -0,0 +1,712 @@
+//===-- StateOffloader.cpp ------------------------------------------------===//
+//
+//                     The KLEE Symbolic Virtual Machine
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+
+#include "StateOffloader.h"
+
+#include "ExecutionState.h"
+#include "Memory.h"
+
+#include "klee/Config/config.h"
+#include "klee/Expr/Constraints.h"
+#include "klee/Expr/Expr.h"
+#include "klee/Module/Cell.h"
+#include "klee/Module/KModule.h"
+#include "klee/Support/ErrorHandling.h"
+#include "klee/Support/RecordFile.h"
+
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/PointerUnion.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <iterator>
+#include <fcntl.h>
+#include <unistd.h>
+#ifdef HAVE_ZLIB_H
+#include <zlib.h>
+#endif
+
+using namespace klee;
+
+namespace {
+
+using NodePtr = llvm::PointerUnion<const Expr *, const UpdateNode *>;
+
+/// The expression and update nodes reachable from the data of a state.
+///
+/// A node can be offloaded if all its references come from the roots or
+/// from other offloaded nodes: once the roots are dropped, nothing else
+/// keeps it alive. The remaining nodes are "external": they are referenced
+/// from memory that stays, and the offloaded data refers to them by
+/// pointer.
+class NodeGraph {
+  struct Node {
+    NodePtr ptr;
+    /// References from the roots and from offloaded nodes
+    unsigned references = 0;
+    /// Position among the offloaded or among the external nodes
+    unsigned id = 0;
+    bool visited = false;
+    bool offloaded = false;
+    bool isExternal = false;
+  };
+
+  llvm::DenseMap<void *, unsigned> indices;
+  std::vector<Node> nodes;
+  std::vector<unsigned> roots;
+  /// Offloaded nodes, kids before their parents
+  std::vector<unsigned> offloaded;
+
+  unsigned getIndex(NodePtr ptr) {
+    auto it = indices.insert(std::make_pair(ptr.getOpaqueValue(), 0u));
+    if (it.second) {
+      it.first->second = nodes.size();
+      nodes.emplace_back();
+      nodes.back().ptr = ptr;
+    }
+    return it.first->second;
+  }
+
+  static unsigned getRefCount(NodePtr ptr) {
+    if (auto e = ptr.dyn_cast<const Expr *>())
+      return const_cast<Expr *>(e)->_refCount.getCount();
+    return ptr.get<const UpdateNode *>()->_refCount.getCount();
+  }
+
+  template <typename Fn> static void forEachKid(NodePtr ptr, Fn fn) {
+    if (auto e = ptr.dyn_cast<const Expr *>()) {
+      for (unsigned i = 0, n = e->getNumKids(); i != n; ++i)
+        fn(NodePtr(e->getKid(i).get()));
+      if (auto re = dyn_cast<ReadExpr>(e))
+        if (re->updates.head)
+          fn(NodePtr(re->updates.head.get()));
+      return;
+    }
+    auto un = ptr.get<const UpdateNode *>();
+    if (un->next)
+      fn(NodePtr(un->next.get()));
+    fn(NodePtr(un->index.get()));
+    fn(NodePtr(un->value.get()));
+  }
+
+  void writeNode(RecordWriter &w, NodePtr ptr);
+
+public:
+  /// Nodes that stay in memory, in the order of their ids
+  std::vector<ref<Expr>> externalExprs;
+  std::vector<ref<UpdateNode>> externalUpdates;
+
+  /// Registers one reference held by the offloaded data
+  void addRoot(NodePtr ptr) {
+    if (ptr.isNull())
+      return;
+    unsigned index = getIndex(ptr);
+    ++nodes[index].references;
+    roots.push_back(index);
+  }
+
+  /// Determines the nodes to offload
+  void analyze();
+
+  /// Writes the offloaded nodes, kids first
+  void writeNodes(RecordWriter &w);
+
+  /// Writes a reference to a node
+  void writeRef(RecordWriter &w, NodePtr ptr);
+};
+
+void NodeGraph::analyze() {
+  // Order the nodes so that every node comes after its kids
+  std::vector<unsigned> postOrder;
+  std::vector<std::pair<unsigned, bool>> stack;
+  for (unsigned root : roots)
+    stack.emplace_back(root, false);
+  while (!stack.empty()) {
+    auto top = stack.back();
+    stack.pop_back();
+    if (top.second) {
+      postOrder.push_back(top.first);
+      continue;
+    }
+    if (nodes[top.first].visited)
+      continue;
+    nodes[top.first].visited = true;
+    stack.emplace_back(top.first, true);
+    forEachKid(nodes[top.first].ptr, [&](NodePtr kid) {
+      unsigned index = getIndex(kid);
+      if (!nodes[index].visited)
+        stack.emplace_back(index, false);
+    });
+  }
+
+  // Parents come first, so the references of a node are complete when it
+  // is reached
+  for (auto it = postOrder.rbegin(), ie = postOrder.rend(); it != ie; ++it) {
+    Node &node = nodes[*it];
+    if (node.references != getRefCount(node.ptr))
+      continue;
+    node.offloaded = true;
+    forEachKid(node.ptr,
+               [&](NodePtr kid) { ++nodes[getIndex(kid)].references; });
+  }
+
+  for (unsigned index : postOrder) {
+    if (nodes[index].offloaded) {
+      nodes[index].id = offloaded.size();
+      offloaded.push_back(index);
+    }
+  }
+}
+
+void NodeGraph::writeRef(RecordWriter &w, NodePtr ptr) {
+  // 0 is null, otherwise the low two bits select offloaded, external
+  // expression or external update node
+  if (ptr.isNull()) {
+    w.writeInt(0);
+    return;
+  }
+  Node &node = nodes[getIndex(ptr)];
+  if (node.offloaded) {
+    w.writeInt(std::uint64_t(node.id) << 2 | 1);
+    return;
+  }
+  bool isExpr = ptr.is<const Expr *>();
+  if (!node.isExternal) {
+    node.isExternal = true;
+    if (isExpr) {
+      node.id = externalExprs.size();
+      externalExprs.push_back(const_cast<Expr *>(ptr.get<const Expr *>()));
+    } else {
+      node.id = externalUpdates.size();
+      externalUpdates.push_back(
+          const_cast<UpdateNode *>(ptr.get<const UpdateNode *>()));
+    }
+  }
+  w.writeInt(std::uint64_t(node.id) << 2 | (isExpr ? 2 : 3));
+}
+
+void NodeGraph::writeNode(RecordWriter &w, NodePtr ptr) {
+  auto e = ptr.dyn_cast<const Expr *>();
+  if (!e) {
+    auto un = ptr.get<const UpdateNode *>();
+    w.writeInt(0);
+    writeRef(w, un->next.get());
+    writeRef(w, un->index.get());
+    writeRef(w, un->value.get());
+    return;
+  }
+
+  w.writeInt(e->getKind() + 1);
+  for (unsigned i = 0, n = e->getNumKids(); i != n; ++i)
+    writeRef(w, e->getKid(i).get());
+  switch (e->getKind()) {
+  case Expr::Constant: {
+    const llvm::APInt &value = cast<ConstantExpr>(e)->getAPValue();
+    w.writeInt(value.getBitWidth());
+    for (unsigned i = 0; i < value.getNumWords(); ++i)
+      w.writeInt(value.getRawData()[i]);
+    break;
+  }
+  case Expr::Read: {
+    const ReadExpr *re = cast<ReadExpr>(e);
+    w.writeInt(reinterpret_cast<std::uintptr_t>(re->updates.root));
+    writeRef(w, re->updates.head.get());
+    break;
+  }
+  case Expr::Extract: {
+    const ExtractExpr *ee = cast<ExtractExpr>(e);
+    w.writeInt(ee->offset);
+    w.writeInt(ee->width);
+    break;
+  }
+  case Expr::ZExt:
+  case Expr::SExt:
+    w.writeInt(e->getWidth());
+    break;
+  default:
+    break;
+  }
+}
+
+void NodeGraph::writeNodes(RecordWriter &w) {
+  w.writeInt(offloaded.size());
+  for (unsigned index : offloaded)
+    writeNode(w, nodes[index].ptr);
+}
+
+/// Rebuilds the nodes written by NodeGraph
+class NodeReader {
+  std::vector<ref<Expr>> exprs;
+  std::vector<ref<UpdateNode>> updates;
+  const std::vector<ref<Expr>> &externalExprs;
+  const std::vector<ref<UpdateNode>> &externalUpdates;
+
+  ref<Expr> readNode(RecordReader &r, Expr::Kind kind);
+
+public:
+  NodeReader(const std::vector<ref<Expr>> &externalExprs,
+             const std::vector<ref<UpdateNode>> &externalUpdates)
+      : externalExprs(externalExprs), externalUpdates(externalUpdates) {}
+
+  void readNodes(RecordReader &r);
+  ref<Expr> readExpr(RecordReader &r);
+  ref<UpdateNode> readUpdate(RecordReader &r);
+};
+
+void NodeReader::readNodes(RecordReader &r) {
+  std::uint64_t count = r.readInt();
+  exprs.resize(count);
+  updates.resize(count);
+  for (std::uint64_t i = 0; i < count; ++i) {
+    std::uint64_t tag = r.readInt();
+    if (tag) {
+      exprs[i] = readNode(r, static_cast<Expr::Kind>(tag - 1));
+      continue;
+    }
+    ref<UpdateNode> next = readUpdate(r);
+    ref<Expr> index = readExpr(r);
+    ref<Expr> value = readExpr(r);
+    updates[i] = new UpdateNode(next, index, value);
+  }
+}
+
+ref<Expr> NodeReader::readExpr(RecordReader &r) {
+  std::uint64_t value = r.readInt();
+  if (!value)
+    return nullptr;
+  if ((value & 3) == 1)
+    return exprs[value >> 2];
+  assert((value & 3) == 2 && "expected an expression");
+  return externalExprs[value >> 2];
+}
+
+ref<UpdateNode> NodeReader::readUpdate(RecordReader &r) {
+  std::uint64_t value = r.readInt();
+  if (!value)
+    return nullptr;
+  if ((value & 3) == 1)
+    return updates[value >> 2];
+  assert((value & 3) == 3 && "expected an update node");
+  return externalUpdates[value >> 2];
+}
+
+ref<Expr> NodeReader::readNode(RecordReader &r, Expr::Kind kind) {
+  ref<Expr> kids[3];
+  unsigned numKids = 0;
+  switch (kind) {
+  case Expr::Constant:
+    break;
+  case Expr::Select:
+    numKids = 3;
+    break;
+  case Expr::Concat:
+    numKids = 2;
+    break;
+  default:
+    numKids = kind >= Expr::BinaryKindFirst ? 2 : 1;
+    break;
+  }
+  for (unsigned i = 0; i < numKids; ++i)
+    kids[i] = readExpr(r);
+
+  switch (kind) {
+  case Expr::Constant: {
+    unsigned width = r.readInt();
+    llvm::SmallVector<std::uint64_t, 2> words((width + 63) / 64);
+    for (auto &word : words)
+      word = r.readInt();
+    return ConstantExpr::alloc(llvm::APInt(width, words));
+  }
+  case Expr::NotOptimized:
+    return NotOptimizedExpr::alloc(kids[0]);
+  case Expr::Read: {
+    auto root = reinterpret_cast<const Array *>(
+        static_cast<std::uintptr_t>(r.readInt()));
+    ref<UpdateNode> head = readUpdate(r);
+    return ReadExpr::alloc(UpdateList(root, head), kids[0]);
+  }
+  case Expr::Select:
+    return SelectExpr::alloc(kids[0], kids[1], kids[2]);
+  case Expr::Concat:
+    return ConcatExpr::alloc(kids[0], kids[1]);
+  case Expr::Extract: {
+    unsigned offset = r.readInt();
+    Expr::Width width = r.readInt();
+    return ExtractExpr::alloc(kids[0], offset, width);
+  }
+  case Expr::ZExt:
+    return ZExtExpr::alloc(kids[0], r.readInt());
+  case Expr::SExt:
+    return SExtExpr::alloc(kids[0], r.readInt());
+  case Expr::Not:
+    return NotExpr::alloc(kids[0]);
+#define BINARY_EXPR_CASE(_kind)                                                \
+  case Expr::_kind:                                                            \
+    return _kind##Expr::alloc(kids[0], kids[1]);
+    BINARY_EXPR_CASE(Add)
+    BINARY_EXPR_CASE(Sub)
+    BINARY_EXPR_CASE(Mul)
+    BINARY_EXPR_CASE(UDiv)
+    BINARY_EXPR_CASE(SDiv)
+    BINARY_EXPR_CASE(URem)
+    BINARY_EXPR_CASE(SRem)
+    BINARY_EXPR_CASE(And)
+    BINARY_EXPR_CASE(Or)
+    BINARY_EXPR_CASE(Xor)
+    BINARY_EXPR_CASE(Shl)
+    BINARY_EXPR_CASE(LShr)
+    BINARY_EXPR_CASE(AShr)
+    BINARY_EXPR_CASE(Eq)
+    BINARY_EXPR_CASE(Ne)
+    BINARY_EXPR_CASE(Ult)
+    BINARY_EXPR_CASE(Ule)
+    BINARY_EXPR_CASE(Ugt)
+    BINARY_EXPR_CASE(Uge)
+    BINARY_EXPR_CASE(Slt)
+    BINARY_EXPR_CASE(Sle)
+    BINARY_EXPR_CASE(Sgt)
+    BINARY_EXPR_CASE(Sge)
+#undef BINARY_EXPR_CASE
+  default:
+    assert(0 && "invalid kind in offloaded state");
+    return nullptr;
+  }
+}
+
+/// Calls fn(index, contents) for the unshared pages of an array
+template <typename T, unsigned PageSize, typename Fn>
+unsigned forEachExclusivePage(const PagedArray<T, PageSize> &array, Fn fn) {
+  unsigned count = 0;
+  for (unsigned i = 0, n = array.getNumPages(); i != n; ++i) {
+    if (array.isPageExclusive(i)) {
+      fn(i, array.getPage(i));
+      ++count;
+    }
+  }
+  return count;
+}
+
+template <typename T, unsigned PageSize>
+void releaseExclusivePages(PagedArray<T, PageSize> &array) {
+  for (unsigned i = 0, n = array.getNumPages(); i != n; ++i)
+    if (array.isPageExclusive(i))
+      array.releasePage(i);
+}
+
+/// Writes the unshared pages of an array of plain values
+template <typename T, unsigned PageSize>
+void writePages(RecordWriter &w, const PagedArray<T, PageSize> &array) {
+  unsigned count = forEachExclusivePage(array, [](unsigned, const T *) {});
+  w.writeInt(count);
+  forEachExclusivePage(array, [&](unsigned index, const T *data) {
+    w.writeInt(index);
+    w.writeBytes(data, array.pageSize(index) * sizeof(T));
+  });
+}
+
+template <typename T, unsigned PageSize>
+void readPages(RecordReader &r, PagedArray<T, PageSize> &array) {
+  for (std::uint64_t count = r.readInt(); count; --count) {
+    unsigned index = r.readInt();
+    r.readBytes(array.getWritablePage(index), array.pageSize(index) * sizeof(T));
+  }
+}
+
+bool writeAll(int fd, const char *data, std::size_t size, off_t offset) {
+  while (size) {
+    ssize_t n = pwrite(fd, data, size, offset);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return false;
+    data += n;
+    size -= n;
+    offset += n;
+  }
+  return true;
+}
+
+bool readAll(int fd, char *data, std::size_t size, off_t offset) {
+  while (size) {
+    ssize_t n = pread(fd, data, size, offset);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return false;
+    data += n;
+    size -= n;
+    offset += n;
+  }
+  return true;
+}
+
+} // namespace
+
+StateOffloader::StateOffloader(std::string path) : path(std::move(path)) {
+  fd = open(this->path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0600);
+  if (fd < 0)
+    klee_error("Unable to create spill file %s: %s", this->path.c_str(),
+               strerror(errno));
+  // The file is only accessed through the descriptor, removing it right away
+  // makes sure it does not outlive the process.
+  unlink(this->path.c_str());
+}
+
+StateOffloader::~StateOffloader() { close(fd); }
+
+std::uint64_t StateOffloader::allocate(std::uint64_t size) {
+  // first fit, the rest of the extent stays free
+  for (auto it = freeExtents.begin(), ie = freeExtents.end(); it != ie;
+       ++it) {
+    if (it->second < size)
+      continue;
+    std::uint64_t offset = it->first;
+    std::uint64_t left = it->second - size;
+    freeExtents.erase(it);
+    if (left)
+      freeExtents.emplace(offset + size, left);
+    return offset;
+  }
+  std::uint64_t offset = fileSize;
+  fileSize += size;
+  return offset;
+}
+
+void StateOffloader::release(std::uint64_t offset, std::uint64_t size) {
+  if (!size)
+    return;
+  auto next = freeExtents.lower_bound(offset);
+  if (next != freeExtents.end() && offset + size == next->first) {
+    size += next->second;
+    next = freeExtents.erase(next);
+  }
+  if (next != freeExtents.begin()) {
+    auto prev = std::prev(next);
+    if (prev->first + prev->second == offset) {
+      offset = prev->first;
+      size += prev->second;
+      freeExtents.erase(prev);
+    }
+  }
+
+  if (offset + size == fileSize) {
+    // give the end of the file back
+    fileSize = offset;
+    if (ftruncate(fd, fileSize) != 0)
+      klee_warning("Unable to truncate spill file %s: %s", path.c_str(),
+                   strerror(errno));
+  } else {
+    freeExtents.emplace(offset, size);
+  }
+}
+
+std::vector<ObjectState *>
+StateOffloader::getUnsharedObjects(ExecutionState &state) {
+  // whether or not this state wrote to them since it last forked
+  std::vector<ObjectState *> objects;
+  state.addressSpace.objects.forEachUnshared([&](const auto &object) {
+    ObjectState *os = const_cast<ObjectState *>(object.second.get());
+    if (os->_refCount.getCount() == 1)
+      objects.push_back(os);
+  });
+  return objects;
+}
+
+bool StateOffloader::hasExclusivePages(const ObjectState *os) {
+  auto hasPages = [](const auto &array) {
+    for (unsigned i = 0, n = array.getNumPages(); i != n; ++i)
+      if (array.isPageExclusive(i))
+        return true;
+    return false;
+  };
+  return hasPages(os->concreteStore) ||
+         (os->concreteMask && hasPages(os->concreteMask->getWords())) ||
+         (os->unflushedMask && hasPages(os->unflushedMask->getWords())) ||
+         (os->knownSymbolics && hasPages(*os->knownSymbolics));
+}
+
+std::uint64_t StateOffloader::offload(ExecutionState &state) {
+  std::vector<ObjectState *> objects = getUnsharedObjects(state);
+
+  if (isOffloaded(state)) {
+    // Pages the state shared when it was offloaded may have been unshared
+    // by the other states since. Offload the state again if so.
+    if (std::none_of(objects.begin(), objects.end(), hasExclusivePages))
+      return 0;
+    restore(state);
+  }
+
+  std::vector<ref<Expr>> constraints = state.constraints.takeUnsharedSuffix();
+
+  // Collect the references held by the data that is offloaded
+  NodeGraph graph;
+  for (const StackFrame &sf : state.stack)
+    for (unsigned i = 0; i < sf.kf->numRegisters; ++i)
+      graph.addRoot(sf.locals[i].value.get());
+  for (const auto &constraint : constraints)
+    graph.addRoot(constraint.get());
+  for (ObjectState *os : objects) {
+    graph.addRoot(os->updates.head.get());
+    if (os->knownSymbolics)
+      forEachExclusivePage(*os->knownSymbolics,
+                           [&](unsigned index, const ref<Expr> *data) {
+                             for (unsigned i = 0,
+                                           n = os->knownSymbolics->pageSize(index);
+                                  i != n; ++i)
+                               graph.addRoot(data[i].get());
+                           });
+  }
+  graph.analyze();
+
+  RecordWriter w;
+  graph.writeNodes(w);
+  for (const StackFrame &sf : state.stack)
+    for (unsigned i = 0; i < sf.kf->numRegisters; ++i)
+      graph.writeRef(w, sf.locals[i].value.get());
+  w.writeInt(constraints.size());
+  for (const auto &constraint : constraints)
+    graph.writeRef(w, constraint.get());
+  w.writeInt(objects.size());
+  for (ObjectState *os : objects) {
+    w.writeInt(reinterpret_cast<std::uintptr_t>(os));
+    graph.writeRef(w, os->updates.head.get());
+    writePages(w, os->concreteStore);
+    if (os->concreteMask)
+      writePages(w, os->concreteMask->getWords());
+    if (os->unflushedMask)
+      writePages(w, os->unflushedMask->getWords());
+    if (os->knownSymbolics) {
+      const auto &symbolics = *os->knownSymbolics;
+      unsigned count = forEachExclusivePage(
+          symbolics, [](unsigned, const ref<Expr> *) {});
+      w.writeInt(count);
+      forEachExclusivePage(symbolics,
+                           [&](unsigned index, const ref<Expr> *data) {
+                             w.writeInt(index);
+                             for (unsigned i = 0,
+                                           n = symbolics.pageSize(index);
+                                  i != n; ++i)
+                               graph.writeRef(w, data[i].get());
+                           });
+    }
+  }
+
+  Record record;
+  record.rawSize = w.buffer.size();
+#ifdef HAVE_ZLIB_H
+  std::string compressed(compressBound(w.buffer.size()), '\0');
+  uLongf compressedSize = compressed.size();
+  if (compress2(reinterpret_cast<Bytef *>(&compressed[0]), &compressedSize,
+                reinterpret_cast<const Bytef *>(w.buffer.data()),
+                w.buffer.size(), Z_BEST_SPEED) != Z_OK)
+    klee_error("Unable to compress offloaded state");
+  compressed.resize(compressedSize);
+  std::swap(compressed, w.buffer);
+#endif
+  record.size = w.buffer.size();
+  record.offset = allocate(record.size);
+
+  if (!writeAll(fd, w.buffer.data(), w.buffer.size(), record.offset)) {
+    klee_warning_once(nullptr, "Unable to write to spill file %s: %s",
+                      path.c_str(), strerror(errno));
+    release(record.offset, record.size);
+    for (const auto &constraint : constraints)
+      state.constraints.push_back(constraint);
+    return 0;
+  }
+  std::uint64_t written = record.size;
+  record.externalExprs = std::move(graph.externalExprs);
+  record.externalUpdates = std::move(graph.externalUpdates);
+  records.emplace(&state, std::move(record));
+
+  // Drop the offloaded data
+  for (StackFrame &sf : state.stack)
+    for (unsigned i = 0; i < sf.kf->numRegisters; ++i)
+      sf.locals[i].value = nullptr;
+  constraints.clear();
+  for (ObjectState *os : objects) {
+    os->updates = UpdateList(os->updates.root, nullptr);
+    releaseExclusivePages(os->concreteStore);
+    if (os->concreteMask)
+      releaseExclusivePages(os->concreteMask->getWords());
+    if (os->unflushedMask)
+      releaseExclusivePages(os->unflushedMask->getWords());
+    if (os->knownSymbolics)
+      releaseExclusivePages(*os->knownSymbolics);
+  }
+
+  return written;
+}
+
+void StateOffloader::restore(ExecutionState &state) {
+  if (records.empty())
+    return;
+  auto it = records.find(&state);
+  if (it == records.end())
+    return;
+  const Record &record = it->second;
+
+  std::string buffer(record.size, '\0');
+  if (!readAll(fd, &buffer[0], record.size, record.offset))
+    klee_error("Unable to read spill file %s: %s", path.c_str(),
+               strerror(errno));
+#ifdef HAVE_ZLIB_H
+  std::string raw(record.rawSize, '\0');
+  uLongf rawSize = raw.size();
+  if (uncompress(reinterpret_cast<Bytef *>(&raw[0]), &rawSize,
+                 reinterpret_cast<const Bytef *>(buffer.data()),
+                 buffer.size()) != Z_OK ||
+      rawSize != record.rawSize)
+    klee_error("Corrupted spill file %s", path.c_str());
+  std::swap(raw, buffer);
+#endif
+
+  RecordReader r(buffer);
+  NodeReader nodes(record.externalExprs, record.externalUpdates);
+  nodes.readNodes(r);
+  for (StackFrame &sf : state.stack)
+    for (unsigned i = 0; i < sf.kf->numRegisters; ++i)
+      sf.locals[i].value = nodes.readExpr(r);
+  for (std::uint64_t count = r.readInt(); count; --count)
+    state.constraints.push_back(nodes.readExpr(r));
+  // rebuilds the independent groups dropped with the offloaded constraints
+  ConstraintManager manager(state.constraints);
+  for (std::uint64_t count = r.readInt(); count; --count) {
+    auto os = reinterpret_cast<ObjectState *>(
+        static_cast<std::uintptr_t>(r.readInt()));
+    os->updates = UpdateList(os->updates.root, nodes.readUpdate(r));
+    readPages(r, os->concreteStore);
+    if (os->concreteMask)
+      readPages(r, os->concreteMask->getWords());
+    if (os->unflushedMask)
+      readPages(r, os->unflushedMask->getWords());
+    if (os->knownSymbolics) {
+      auto &symbolics = *os->knownSymbolics;
+      for (std::uint64_t pages = r.readInt(); pages; --pages) {
+        unsigned index = r.readInt();
+        ref<Expr> *data = symbolics.getWritablePage(index);
+        for (unsigned i = 0, n = symbolics.pageSize(index); i != n; ++i)
+          data[i] = nodes.readExpr(r);
+      }
+    }
+  }
+  assert(!r.failed && "truncated offloaded state");
+  assert(r.atEnd() && "offloaded state not fully restored");
+
+  discard(state);
+}
+
+void StateOffloader::discard(const ExecutionState &state) {
+  auto it = records.find(&state);
+  if (it == records.end())
+    return;
+  release(it->second.offset, it->second.size);
+  records.erase(it);
+}
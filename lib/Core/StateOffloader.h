@@ -0,0 +1,89 @@
+//===-- StateOffloader.h ----------------------------------------*- C++ -*-===//
+//
+//                     The KLEE Symbolic Virtual Machine
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef KLEE_STATEOFFLOADER_H
+#define KLEE_STATEOFFLOADER_H
+
+#include "klee/ADT/Ref.h"
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace klee {
+class ExecutionState;
+class Expr;
+class ObjectState;
+class UpdateNode;
+
+/// Moves the contents of dormant execution states into a compressed spill
+/// file and brings them back before the states run again.
+///
+/// Only data that no other state refers to is offloaded: the locals of the
+/// stack frames, the constraints added since the state last forked, and the
+/// unshared pages of the objects only this state refers to. Expressions
+/// that are still referenced from memory are kept by reference instead of
+/// being written out, so a restored state shares them with the other states
+/// again.
+class StateOffloader {
+  struct Record {
+    std::uint64_t offset;
+    std::uint64_t size;
+    std::uint64_t rawSize;
+    /// Nodes referenced by the offloaded data that stay in memory
+    std::vector<ref<Expr>> externalExprs;
+    std::vector<ref<UpdateNode>> externalUpdates;
+  };
+
+  std::string path;
+  int fd;
+  std::uint64_t fileSize = 0;
+  std::unordered_map<const ExecutionState *, Record> records;
+  /// Unused extents of the spill file before fileSize (offset to size),
+  /// adjacent extents are merged
+  std::map<std::uint64_t, std::uint64_t> freeExtents;
+
+  /// Returns the offset of an unused extent of \p size bytes
+  std::uint64_t allocate(std::uint64_t size);
+  void release(std::uint64_t offset, std::uint64_t size);
+
+  /// Objects of the state that no other state refers to
+  static std::vector<ObjectState *> getUnsharedObjects(ExecutionState &state);
+  static bool hasExclusivePages(const ObjectState *os);
+
+public:
+  /// Creates the spill file at \p path
+  explicit StateOffloader(std::string path);
+  ~StateOffloader();
+
+  StateOffloader(const StateOffloader &) = delete;
+  StateOffloader &operator=(const StateOffloader &) = delete;
+
+  /// Moves the unshared contents of \p state to disk. An offloaded state is
+  /// offloaded again if more of its contents became unshared.
+  /// \return the number of bytes written, 0 if nothing was written
+  std::uint64_t offload(ExecutionState &state);
+
+  /// Brings the contents of \p state back if it was offloaded
+  void restore(ExecutionState &state);
+
+  /// Forgets the offloaded contents of a state that is being destroyed
+  void discard(const ExecutionState &state);
+
+  bool isOffloaded(const ExecutionState &state) const {
+    return records.count(&state) != 0;
+  }
+
+  std::size_t getNumOffloaded() const { return records.size(); }
+};
+} // namespace klee
+
+#endif /* KLEE_STATEOFFLOADER_H */
@@ -35,6 +35,7 @@
 #include "llvm/IR/CFG.h"
 #include "llvm/IR/Function.h"
 #include "llvm/IR/InlineAsm.h"
+#include "llvm/IR/InstIterator.h"
 #include "llvm/IR/Instructions.h"
 #include "llvm/IR/IntrinsicInst.h"
 #include "llvm/IR/Module.h"
@@ -45,7 +46,10 @@
 #include "llvm/Support/Process.h"
 
 #include <fstream>
+#include <functional>
+#include <queue>
 #include <unistd.h>
+#include <vector>
 
 using namespace klee;
 using namespace llvm;
@@ -204,6 +208,8 @@ StatsTracker::StatsTracker(Executor &_executor, std::string _objectFilename,
 
   if (useStatistics() || userSearcherRequiresMD2U())
     theStatisticManager->useIndexedStats(km->infos->getMaxID());
+  if (OutputIStats)
+    covered.assign(km->infos->getMaxID(), false);
 
   for (auto &kfp : km->functions) {
     KFunction *kf = kfp.get();
@@ -355,19 +361,21 @@ void StatsTracker::stepInstruction(ExecutionState &es) {
     if (es.instsSinceCovNew)
       ++es.instsSinceCovNew;
 
-    if (sf.kf->trackCoverage && instructionIsCoverable(inst)) {
-      if (!theStatisticManager->getIndexedValue(stats::coveredInstructions, ii.id)) {
-        // Checking for actual stoppoints avoids inconsistencies due
-        // to line number propogation.
-        //
-        // FIXME: This trick no longer works, we should fix this in the line
-        // number propogation.
-          es.coveredLines[&ii.file].insert(ii.line);
-	es.coveredNew = true;
-        es.instsSinceCovNew = 1;
-	++stats::coveredInstructions;
-	stats::uncoveredInstructions += (uint64_t)-1;
-      }
+    if (!covered[ii.id] && sf.kf->trackCoverage &&
+        instructionIsCoverable(inst)) {
+      // Checking for actual stoppoints avoids inconsistencies due
+      // to line number propogation.
+      //
+      // FIXME: This trick no longer works, we should fix this in the line
+      // number propogation.
+      covered[ii.id] = true;
+      es.coveredInstructions.push_back(&ii);
+      es.coveredNew = true;
+      es.instsSinceCovNew = 1;
+      ++stats::coveredInstructions;
+      stats::uncoveredInstructions += (uint64_t)-1;
+      if (updateMinDistToUncovered)
+        newlyCovered.push_back(ii.id);
     }
   }
 
@@ -380,6 +388,45 @@ void StatsTracker::stepInstruction(ExecutionState &es) {
     writeIStats();
 }
 
+unsigned StatsTracker::getNumInstructionIDs() const {
+  return OutputIStats ? executor.kmodule->infos->getMaxID() : 0;
+}
+
+unsigned StatsTracker::getCoverage(unsigned id) const {
+  const StatisticManager &sm = *theStatisticManager;
+  unsigned coverage = 0;
+  if (sm.getIndexedValue(stats::coveredInstructions, id))
+    coverage |= CoveredInstruction;
+  if (sm.getIndexedValue(stats::trueBranches, id))
+    coverage |= CoveredTrueBranch;
+  if (sm.getIndexedValue(stats::falseBranches, id))
+    coverage |= CoveredFalseBranch;
+  return coverage;
+}
+
+void StatsTracker::restoreCoverage(unsigned id, unsigned coverage) {
+  StatisticManager &sm = *theStatisticManager;
+  if ((coverage & CoveredInstruction) &&
+      !sm.getIndexedValue(stats::coveredInstructions, id)) {
+    sm.setIndexedValue(stats::coveredInstructions, id, 1);
+    sm.setIndexedValue(stats::uncoveredInstructions, id, 0);
+    covered[id] = true;
+    if (updateMinDistToUncovered)
+      newlyCovered.push_back(id);
+  }
+
+  const bool hadTrue = sm.getIndexedValue(stats::trueBranches, id);
+  const bool hadFalse = sm.getIndexedValue(stats::falseBranches, id);
+  const bool hasTrue = hadTrue || (coverage & CoveredTrueBranch);
+  const bool hasFalse = hadFalse || (coverage & CoveredFalseBranch);
+  if (hadTrue || hadFalse)
+    --(hadTrue && hadFalse ? fullBranches : partialBranches);
+  if (hasTrue || hasFalse)
+    ++(hasTrue && hasFalse ? fullBranches : partialBranches);
+  sm.setIndexedValue(stats::trueBranches, id, hasTrue);
+  sm.setIndexedValue(stats::falseBranches, id, hasFalse);
+}
+
 ///
 
 /* Should be called _after_ the es->pushFrame() */
@@ -460,7 +507,9 @@ void StatsTracker::writeStatsHeader() {
              << "ResolveTime INTEGER,"
              << "QueryCexCacheMisses INTEGER,"
              << "QueryCexCacheHits INTEGER,"
-             << "ArrayHashTime INTEGER"
+             << "ArrayHashTime INTEGER,"
+             << "ResolutionCacheHits INTEGER,"
+             << "ResolutionCacheMisses INTEGER"
          << ')';
   char *zErrMsg = nullptr;
   if(sqlite3_exec(statsFile, create.str().c_str(), nullptr, nullptr, &zErrMsg)) {
@@ -493,7 +542,9 @@ void StatsTracker::writeStatsHeader() {
              << "ResolveTime,"
              << "QueryCexCacheMisses,"
              << "QueryCexCacheHits,"
-             << "ArrayHashTime"
+             << "ArrayHashTime,"
+             << "ResolutionCacheHits,"
+             << "ResolutionCacheMisses"
          << ") VALUES ("
              << "?,"
              << "?,"
@@ -514,6 +565,8 @@ void StatsTracker::writeStatsHeader() {
              << "?,"
              << "?,"
              << "?,"
+             << "?,"
+             << "?,"
              << "? "
          << ')';
 
@@ -551,6 +604,8 @@ void StatsTracker::writeStatsLine() {
 #else
   sqlite3_bind_int64(insertStmt, 20, -1LL);
 #endif
+  sqlite3_bind_int64(insertStmt, 21, stats::resolutionCacheHits);
+  sqlite3_bind_int64(insertStmt, 22, stats::resolutionCacheMisses);
   int errCode = sqlite3_step(insertStmt);
   if(errCode != SQLITE_DONE) klee_error("Error writing stats data: %s", sqlite3_errmsg(statsFile));
   sqlite3_reset(insertStmt);
@@ -777,13 +832,10 @@ uint64_t klee::computeMinDistToUncovered(const KInstruction *ki,
 void StatsTracker::computeReachableUncovered() {
   KModule *km = executor.kmodule.get();
   const auto m = km->module.get();
-  static bool init = true;
   const InstructionInfoTable &infos = *km->infos;
   StatisticManager &sm = *theStatisticManager;
   
-  if (init) {
-    init = false;
-
+  if (successorsBegin.empty()) {
     // Compute call targets. It would be nice to use alias information
     // instead of assuming all indirect calls hit all escaping
     // functions, eh?
@@ -917,84 +969,12 @@ void StatsTracker::computeReachableUncovered() {
     } while (changed);
   }
 
-  // compute minDistToUncovered, 0 is unreachable
-  std::vector<Instruction *> instructions;
-  for (Module::iterator fnIt = m->begin(), fn_ie = m->end(); 
-       fnIt != fn_ie; ++fnIt) {
-    // Not sure if I should bother to preorder here.
-    for (Function::iterator bbIt = fnIt->begin(), bb_ie = fnIt->end(); 
-         bbIt != bb_ie; ++bbIt) {
-      for (BasicBlock::iterator it = bbIt->begin(), ie = bbIt->end(); 
-           it != ie; ++it) {
-        Instruction *inst = &*it;
-        unsigned id = infos.getInfo(*inst).id;
-        instructions.push_back(inst);
-        sm.setIndexedValue(stats::minDistToUncovered, 
-                           id, 
-                           sm.getIndexedValue(stats::uncoveredInstructions, id));
-      }
-    }
+  if (successorsBegin.empty()) {
+    buildDistanceGraph();
+    computeAllDistances();
+  } else {
+    updateDistances();
   }
-  
-  std::reverse(instructions.begin(), instructions.end());
-  
-  // I'm so lazy it's not even worklisted.
-  bool changed;
-  do {
-    changed = false;
-    for (std::vector<Instruction*>::iterator it = instructions.begin(),
-           ie = instructions.end(); it != ie; ++it) {
-      Instruction *inst = *it;
-      uint64_t best, cur = best = sm.getIndexedValue(stats::minDistToUncovered,
-                                                     infos.getInfo(*inst).id);
-      unsigned bestThrough = 0;
-      
-      if (isa<CallInst>(inst) || isa<InvokeInst>(inst)) {
-        std::vector<Function*> &targets = callTargets[inst];
-        for (std::vector<Function*>::iterator fnIt = targets.begin(),
-               ie = targets.end(); fnIt != ie; ++fnIt) {
-          uint64_t dist = functionShortestPath[*fnIt];
-          if (dist) {
-            dist = 1+dist; // count instruction itself
-            if (bestThrough==0 || dist<bestThrough)
-              bestThrough = dist;
-          }
-
-          if (!(*fnIt)->isDeclaration()) {
-            uint64_t calleeDist = sm.getIndexedValue(
-                stats::minDistToUncovered, infos.getFunctionInfo(*(*fnIt)).id);
-            if (calleeDist) {
-              calleeDist = 1+calleeDist; // count instruction itself
-              if (best==0 || calleeDist<best)
-                best = calleeDist;
-            }
-          }
-        }
-      } else {
-        bestThrough = 1;
-      }
-      
-      if (bestThrough) {
-        std::vector<Instruction*> succs = getSuccs(inst);
-        for (std::vector<Instruction*>::iterator it2 = succs.begin(),
-               ie = succs.end(); it2 != ie; ++it2) {
-          uint64_t dist = sm.getIndexedValue(stats::minDistToUncovered,
-                                             infos.getInfo(*(*it2)).id);
-          if (dist) {
-            uint64_t val = bestThrough + dist;
-            if (best==0 || val<best)
-              best = val;
-          }
-        }
-      }
-
-      if (best != cur) {
-        sm.setIndexedValue(stats::minDistToUncovered, infos.getInfo(*inst).id,
-                           best);
-        changed = true;
-      }
-    }
-  } while (changed);
 
   for (std::set<ExecutionState*>::iterator it = executor.states.begin(),
          ie = executor.states.end(); it != ie; ++it) {
@@ -1018,3 +998,189 @@ void StatsTracker::computeReachableUncovered() {
     }
   }
 }
+
+void StatsTracker::buildDistanceGraph() {
+  KModule *km = executor.kmodule.get();
+  const InstructionInfoTable &infos = *km->infos;
+  const unsigned numIds = infos.getMaxID();
+
+  throughLength.assign(numIds, 0);
+  std::vector<std::pair<unsigned, unsigned>> edges;
+  for (Function &fn : *km->module) {
+    for (Instruction &inst : instructions(fn)) {
+      unsigned id = infos.getInfo(inst).id;
+
+      // Calls continue after the shortest way through any of their targets.
+      // The distance through a callee's body is not taken into account: it
+      // would be read from the index of the function itself, which never
+      // holds a distance.
+      std::uint64_t bestThrough = 0;
+      if (isa<CallInst>(inst) || isa<InvokeInst>(inst)) {
+        for (Function *target : callTargets[&inst]) {
+          uint64_t dist = functionShortestPath[target];
+          if (dist) {
+            dist = 1 + dist; // count instruction itself
+            if (bestThrough == 0 || dist < bestThrough)
+              bestThrough = dist;
+          }
+        }
+      } else {
+        bestThrough = 1;
+      }
+      throughLength[id] = bestThrough;
+
+      if (bestThrough)
+        for (Instruction *succ : getSuccs(&inst))
+          edges.emplace_back(id, infos.getInfo(*succ).id);
+    }
+  }
+
+  // lay the edges out by source and by target
+  auto layOut = [numIds, &edges](std::vector<unsigned> &begin,
+                                 std::vector<unsigned> &targets,
+                                 bool forward) {
+    begin.assign(numIds + 1, 0);
+    for (const auto &edge : edges)
+      ++begin[(forward ? edge.first : edge.second) + 1];
+    for (unsigned id = 0; id < numIds; ++id)
+      begin[id + 1] += begin[id];
+    targets.resize(edges.size());
+    std::vector<unsigned> next(begin.begin(), begin.end() - 1);
+    for (const auto &edge : edges)
+      targets[next[forward ? edge.first : edge.second]++] =
+          forward ? edge.second : edge.first;
+  };
+  layOut(successorsBegin, successors, true);
+  layOut(predecessorsBegin, predecessors, false);
+}
+
+void StatsTracker::setMinDistToUncovered(unsigned id, std::uint64_t dist) {
+  minDistToUncovered[id] = dist;
+  theStatisticManager->setIndexedValue(stats::minDistToUncovered, id, dist);
+}
+
+namespace {
+/// Pending (distance, instruction id) pairs, closest first
+typedef std::priority_queue<std::pair<std::uint64_t, unsigned>,
+                            std::vector<std::pair<std::uint64_t, unsigned>>,
+                            std::greater<std::pair<std::uint64_t, unsigned>>>
+    DistanceQueue;
+} // namespace
+
+void StatsTracker::computeAllDistances() {
+  const StatisticManager &sm = *theStatisticManager;
+  const unsigned numIds = throughLength.size();
+  minDistToUncovered.assign(numIds, 0);
+
+  // shortest paths backwards from the uncovered instructions
+  DistanceQueue queue;
+  for (unsigned id = 0; id < numIds; ++id) {
+    std::uint64_t dist = sm.getIndexedValue(stats::uncoveredInstructions, id);
+    setMinDistToUncovered(id, dist);
+    if (dist)
+      queue.emplace(dist, id);
+  }
+
+  while (!queue.empty()) {
+    std::uint64_t dist = queue.top().first;
+    unsigned id = queue.top().second;
+    queue.pop();
+    if (dist != minDistToUncovered[id])
+      continue;
+    for (unsigned i = predecessorsBegin[id]; i < predecessorsBegin[id + 1];
+         ++i) {
+      unsigned pred = predecessors[i];
+      std::uint64_t val = dist + throughLength[pred];
+      if (!minDistToUncovered[pred] || val < minDistToUncovered[pred]) {
+        setMinDistToUncovered(pred, val);
+        queue.emplace(val, pred);
+      }
+    }
+  }
+}
+
+void StatsTracker::updateDistances() {
+  if (newlyCovered.empty())
+    return;
+
+  // Covering instructions only makes distances grow. First find the
+  // instructions whose shortest path led to a newly covered instruction and
+  // that have no other path of the same length.
+  std::vector<bool> affected(throughLength.size());
+  std::vector<unsigned> worklist, affectedIds;
+  for (unsigned id : newlyCovered) {
+    if (minDistToUncovered[id] == 1 && !affected[id]) {
+      affected[id] = true;
+      worklist.push_back(id);
+    }
+  }
+  newlyCovered.clear();
+
+  auto keepsDistance = [this, &affected](unsigned id) {
+    for (unsigned i = successorsBegin[id]; i < successorsBegin[id + 1]; ++i) {
+      unsigned succ = successors[i];
+      if (!affected[succ] && minDistToUncovered[succ] &&
+          throughLength[id] + minDistToUncovered[succ] ==
+              minDistToUncovered[id])
+        return true;
+    }
+    return false;
+  };
+
+  while (!worklist.empty()) {
+    unsigned id = worklist.back();
+    worklist.pop_back();
+    affectedIds.push_back(id);
+    for (unsigned i = predecessorsBegin[id]; i < predecessorsBegin[id + 1];
+         ++i) {
+      unsigned pred = predecessors[i];
+      if (!affected[pred] &&
+          minDistToUncovered[pred] ==
+              throughLength[pred] + minDistToUncovered[id] &&
+          !keepsDistance(pred)) {
+        affected[pred] = true;
+        worklist.push_back(pred);
+      }
+    }
+  }
+
+  // Then recompute their distances from those of their unaffected
+  // successors, and propagate them backwards among the affected ones.
+  DistanceQueue queue;
+  for (unsigned id : affectedIds) {
+    std::uint64_t best = 0;
+    for (unsigned i = successorsBegin[id]; i < successorsBegin[id + 1]; ++i) {
+      unsigned succ = successors[i];
+      if (!affected[succ] && minDistToUncovered[succ]) {
+        std::uint64_t val = throughLength[id] + minDistToUncovered[succ];
+        if (!best || val < best)
+          best = val;
+      }
+    }
+    minDistToUncovered[id] = best;
+    if (best)
+      queue.emplace(best, id);
+  }
+
+  while (!queue.empty()) {
+    std::uint64_t dist = queue.top().first;
+    unsigned id = queue.top().second;
+    queue.pop();
+    if (dist != minDistToUncovered[id])
+      continue;
+    for (unsigned i = predecessorsBegin[id]; i < predecessorsBegin[id + 1];
+         ++i) {
+      unsigned pred = predecessors[i];
+      if (!affected[pred])
+        continue;
+      std::uint64_t val = dist + throughLength[pred];
+      if (!minDistToUncovered[pred] || val < minDistToUncovered[pred]) {
+        minDistToUncovered[pred] = val;
+        queue.emplace(val, pred);
+      }
+    }
+  }
+
+  for (unsigned id : affectedIds)
+    setMinDistToUncovered(id, minDistToUncovered[id]);
+}
@@ -13,8 +13,10 @@
 #include "CallPathManager.h"
 #include "klee/System/Time.h"
 
+#include <cstdint>
 #include <memory>
 #include <set>
+#include <vector>
 #include <sqlite3.h>
 
 namespace llvm {
@@ -53,8 +55,29 @@ namespace klee {
 
     CallPathManager callPathManager;
 
+    /// Whether each instruction has been covered, by instruction id, as also
+    /// stored in stats::coveredInstructions
+    std::vector<bool> covered;
+
     bool updateMinDistToUncovered;
 
+    /// Instruction-level control flow graph over which the distances to
+    /// uncovered instructions are computed, by instruction id. The
+    /// successors of instruction i are
+    /// successors[successorsBegin[i] .. successorsBegin[i + 1]], and each of
+    /// these edges has length throughLength[i] (0 if execution cannot
+    /// continue past i, e.g. a call to functions that never return).
+    /// Predecessors are stored likewise.
+    std::vector<unsigned> successorsBegin, successors;
+    std::vector<unsigned> predecessorsBegin, predecessors;
+    std::vector<std::uint64_t> throughLength;
+    /// The distance of each instruction to the closest uncovered
+    /// instruction, by instruction id (0 if none is reachable), as also
+    /// stored in stats::minDistToUncovered
+    std::vector<std::uint64_t> minDistToUncovered;
+    /// Instructions covered since minDistToUncovered was last updated
+    std::vector<unsigned> newlyCovered;
+
   public:
     static bool useStatistics();
     static bool useIStats();
@@ -65,6 +88,11 @@ namespace klee {
     void writeStatsLine();
     void writeIStats();
 
+    void buildDistanceGraph();
+    void setMinDistToUncovered(unsigned id, std::uint64_t dist);
+    void computeAllDistances();
+    void updateDistances();
+
   public:
     StatsTracker(Executor &_executor, std::string _objectFilename,
                  bool _updateMinDistToUncovered);
@@ -97,6 +125,24 @@ namespace klee {
     /// Return duration since execution start.
     time::Span elapsed();
 
+    /// Coverage of a single instruction, as saved in checkpoints
+    enum CoverageFlags : unsigned {
+      CoveredInstruction = 1,
+      CoveredTrueBranch = 2,
+      CoveredFalseBranch = 4
+    };
+
+    // number of instruction ids coverage is tracked for (0 if coverage is
+    // not tracked)
+    unsigned getNumInstructionIDs() const;
+
+    // the CoverageFlags of the instruction with the given id
+    unsigned getCoverage(unsigned id) const;
+
+    // marks the instruction with the given id as covered. the global
+    // coverage statistics are not updated, they are restored separately.
+    void restoreCoverage(unsigned id, unsigned coverage);
+
     void computeReachableUncovered();
   };
 
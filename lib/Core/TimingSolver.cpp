@@ -18,6 +18,12 @@
 
 #include "CoreStats.h"
 
+#include <cerrno>
+#include <cstdio>
+
+#include <sys/wait.h>
+#include <unistd.h>
+
 using namespace klee;
 using namespace llvm;
 
@@ -44,6 +50,72 @@ bool TimingSolver::evaluate(const ConstraintSet &constraints, ref<Expr> expr,
   return success;
 }
 
+std::future<TimingSolver::AsyncValidity>
+TimingSolver::evaluateAsync(const ConstraintSet &constraints, ref<Expr> expr,
+                            time::Span timeout, pid_t &solverProcess) {
+  solverProcess = -1;
+  int fds[2];
+  if (pipe(fds) < 0) {
+    std::promise<AsyncValidity> failed;
+    failed.set_value(AsyncValidity());
+    return failed.get_future();
+  }
+
+  fflush(stdout);
+  fflush(stderr);
+
+  pid_t pid = fork();
+  if (pid < 0) {
+    close(fds[0]);
+    close(fds[1]);
+    std::promise<AsyncValidity> failed;
+    failed.set_value(AsyncValidity());
+    return failed.get_future();
+  }
+
+  if (pid == 0) {
+    close(fds[0]);
+    AsyncValidity answer;
+    SolverQueryMetaData metaData;
+    setTimeout(timeout);
+    answer.success = evaluate(constraints, expr, answer.result, metaData);
+    answer.time = metaData.queryCost;
+    ssize_t n;
+    do {
+      n = write(fds[1], &answer, sizeof(answer));
+    } while (n < 0 && errno == EINTR);
+    _exit(0);
+  }
+
+  close(fds[1]);
+  solverProcess = pid;
+
+  // The waiting thread only touches the pipe and the process, nothing it
+  // does interferes with the interpreter.
+  int fd = fds[0];
+  return std::async(std::launch::async, [fd, pid]() {
+    AsyncValidity answer;
+    char *pos = reinterpret_cast<char *>(&answer);
+    std::size_t left = sizeof(answer);
+    while (left) {
+      ssize_t n = read(fd, pos, left);
+      if (n < 0 && errno == EINTR)
+        continue;
+      if (n <= 0)
+        break;
+      pos += n;
+      left -= n;
+    }
+    if (left)
+      answer = AsyncValidity();
+    close(fd);
+    int status;
+    while (waitpid(pid, &status, 0) < 0 && errno == EINTR)
+      ;
+    return answer;
+  });
+}
+
 bool TimingSolver::mustBeTrue(const ConstraintSet &constraints, ref<Expr> expr,
                               bool &result, SolverQueryMetaData &metaData) {
   // Fast path, to avoid timer and OS overhead.
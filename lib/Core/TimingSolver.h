@@ -15,9 +15,12 @@
 #include "klee/Solver/Solver.h"
 #include "klee/System/Time.h"
 
+#include <future>
 #include <memory>
 #include <vector>
 
+#include <sys/types.h>
+
 namespace klee {
 class ConstraintSet;
 class Solver;
@@ -47,6 +50,24 @@ public:
   bool evaluate(const ConstraintSet &, ref<Expr>, Solver::Validity &result,
                 SolverQueryMetaData &metaData);
 
+  /// Answer of a query evaluated by evaluateAsync.
+  struct AsyncValidity {
+    bool success = false;
+    Solver::Validity result = Solver::Unknown;
+    /// Time the solver spent on the query
+    time::Span time;
+  };
+
+  /// evaluateAsync - Evaluate the query in a forked solver process and
+  /// return immediately. The future becomes ready once the process exits.
+  ///
+  /// \param timeout - The core solver timeout used for the query.
+  /// \param solverProcess - Set to the pid of the solver process, which
+  /// can be killed to cancel the query; the answer is then a failure.
+  std::future<AsyncValidity> evaluateAsync(const ConstraintSet &, ref<Expr>,
+                                           time::Span timeout,
+                                           pid_t &solverProcess);
+
   bool mustBeTrue(const ConstraintSet &, ref<Expr>, bool &result,
                   SolverQueryMetaData &metaData);
 
@@ -10,12 +10,16 @@
 #include "klee/Expr/Constraints.h"
 
 #include "klee/Expr/ExprVisitor.h"
+#include "klee/Expr/IndependentSet.h"
 #include "klee/Module/KModule.h"
+#include "klee/Solver/SolverCmdLine.h"
 #include "klee/Support/OptionCategories.h"
 
 #include "llvm/IR/Function.h"
 #include "llvm/Support/CommandLine.h"
 
+#include <algorithm>
+#include <iterator>
 #include <map>
 
 using namespace klee;
@@ -71,19 +75,30 @@ public:
 };
 
 bool ConstraintManager::rewriteConstraints(ExprVisitor &visitor) {
-  ConstraintSet old;
+  std::vector<ref<Expr>> rewritten;
+  rewritten.reserve(constraints.size());
   bool changed = false;
 
-  std::swap(constraints, old);
-  for (auto &ce : old) {
-    ref<Expr> e = visitor.visit(ce);
+  for (auto &ce : constraints) {
+    rewritten.push_back(visitor.visit(ce));
+    if (rewritten.back() != ce)
+      changed = true;
+  }
+  // keep the independent groups unless they have to be rebuilt
+  if (!changed)
+    return false;
 
-    if (e!=ce) {
+  ConstraintSet old;
+  std::swap(constraints, old);
+  constraints.trackIndependence();
+  auto it = old.begin();
+  for (auto &e : rewritten) {
+    if (e != *it) {
       addConstraintInternal(e); // enable further reductions
-      changed = true;
     } else {
-      constraints.push_back(ce);
+      constraints.push_back(e);
     }
+    ++it;
   }
 
   return changed;
@@ -161,18 +176,99 @@ void ConstraintManager::addConstraint(const ref<Expr> &e) {
 }
 
 ConstraintManager::ConstraintManager(ConstraintSet &_constraints)
-    : constraints(_constraints) {}
+    : constraints(_constraints) {
+  constraints.trackIndependence();
+}
+
+ConstraintSet::Chunk::~Chunk() {
+  // release long chains of chunks iteratively instead of recursively
+  std::shared_ptr<Chunk> p = std::move(parent);
+  while (p && p.use_count() == 1)
+    p = std::move(p->parent);
+}
 
-bool ConstraintSet::empty() const { return constraints.empty(); }
+ConstraintSet::ConstraintSet(constraints_ty cs) {
+  if (cs.empty())
+    return;
+  count = cs.size();
+  last = std::make_shared<Chunk>(nullptr, 0);
+  last->constraints = std::move(cs);
+}
+
+bool ConstraintSet::empty() const { return count == 0; }
 
 klee::ConstraintSet::constraint_iterator ConstraintSet::begin() const {
-  return constraints.begin();
+  const_iterator it;
+  if (!count)
+    return it;
+  it.chunks = std::make_shared<std::vector<const Chunk *>>();
+  for (const Chunk *c = last.get(); c; c = c->parent.get())
+    it.chunks->push_back(c);
+  std::reverse(it.chunks->begin(), it.chunks->end());
+  it.end = count;
+  return it;
 }
 
 klee::ConstraintSet::constraint_iterator ConstraintSet::end() const {
-  return constraints.end();
+  const_iterator it;
+  it.position = count;
+  return it;
+}
+
+size_t ConstraintSet::size() const noexcept { return count; }
+
+void ConstraintSet::push_back(const ref<Expr> &e) {
+  // Append in place unless another copy already appended to the chunk
+  if (!last || last->offset + last->constraints.size() != count)
+    last = std::make_shared<Chunk>(std::move(last), count);
+  last->constraints.push_back(e);
+  ++count;
+
+  if (!groups)
+    return;
+  // copying the groups is O(1)
+  if (groups.use_count() > 1)
+    groups = std::make_shared<IndependentConstraintGroups>(*groups);
+  groups->add(e);
+}
+
+bool ConstraintSet::operator==(const ConstraintSet &b) const {
+  return count == b.count && std::equal(begin(), end(), b.begin());
 }
 
-size_t ConstraintSet::size() const noexcept { return constraints.size(); }
+ConstraintSet::constraints_ty ConstraintSet::takeUnsharedSuffix() {
+  std::vector<Chunk *> unshared;
+  std::shared_ptr<Chunk> *holder = &last;
+  while (*holder && holder->use_count() == 1) {
+    unshared.push_back(holder->get());
+    holder = &(*holder)->parent;
+  }
+  constraints_ty suffix;
+  if (unshared.empty())
+    return suffix;
+
+  std::size_t end = count;
+  count = unshared.back()->offset;
+  suffix.reserve(end - count);
+  for (auto it = unshared.rbegin(), ie = unshared.rend(); it != ie; ++it) {
+    Chunk *c = *it;
+    std::size_t next = it + 1 != ie ? (*(it + 1))->offset : end;
+    std::move(c->constraints.begin(),
+              c->constraints.begin() + (next - c->offset),
+              std::back_inserter(suffix));
+  }
+  std::shared_ptr<Chunk> shared = *holder;
+  last = std::move(shared);
+  // the groups cover the removed constraints, they are rebuilt on demand
+  groups.reset();
+  return suffix;
+}
 
-void ConstraintSet::push_back(const ref<Expr> &e) { constraints.push_back(e); }
+void ConstraintSet::trackIndependence() {
+  // the groups are only used by the independent solver
+  if (groups || !UseIndependentSolver)
+    return;
+  groups = std::make_shared<IndependentConstraintGroups>();
+  for (const auto &constraint : *this)
+    groups->add(constraint);
+}
@@ -21,8 +21,11 @@
 #include "llvm/ADT/StringExtras.h"
 #endif
 #include "llvm/Support/CommandLine.h"
+#include "llvm/Support/ErrorHandling.h"
 #include "llvm/Support/raw_ostream.h"
 
+#include <cstdint>
+#include <cstdlib>
 #include <sstream>
 
 using namespace klee;
@@ -40,12 +43,246 @@ cl::opt<bool> ConstArrayOpt(
     cl::desc(
         "Enable an optimization involving all-constant arrays (default=false)"),
     cl::cat(klee::ExprCat));
+
+cl::opt<bool> ExprHashConsing(
+    "expr-hash-consing", cl::init(false),
+    cl::desc("Share a single node between structurally equal expressions "
+             "and allocate expression nodes from slabs (default=false)"),
+    cl::cat(klee::ExprCat));
 }
 
 /***/
 
 unsigned Expr::count = 0;
 
+namespace klee {
+
+/// Hashing and (shallow) equality of the nodes in the hash-consing table.
+/// Only nodes whose kids are cached are added to the table, so kids can be
+/// compared by address.
+struct ExprCacheInfo {
+  static Expr *getEmptyKey() { return DenseMapInfo<Expr *>::getEmptyKey(); }
+  static Expr *getTombstoneKey() {
+    return DenseMapInfo<Expr *>::getTombstoneKey();
+  }
+  static unsigned getHashValue(const Expr *e) { return e->hashValue; }
+
+
+  static bool isEqual(const Expr *a, const Expr *b) {
+    if (a == b)
+      return true;
+    if (a == getEmptyKey() || a == getTombstoneKey() || b == getEmptyKey() ||
+        b == getTombstoneKey())
+      return false;
+    // a node being destroyed only equals itself
+    if (a->toBeCleared || b->toBeCleared)
+      return false;
+    if (a->hashValue != b->hashValue || a->getKind() != b->getKind() ||
+        a->compareContents(*b))
+      return false;
+    for (unsigned i = 0, n = a->getNumKids(); i != n; ++i)
+      if (a->getKid(i).get() != b->getKid(i).get())
+        return false;
+    return true;
+  }
+};
+} // namespace klee
+
+namespace {
+/// Segregated free lists for the small expression nodes. Nodes are carved out
+/// of slabs aligned to their size, so that whether a node belongs to the
+/// arena can be decided from its address. Slabs are never returned to the
+/// system, but freed nodes are reused for nodes of the same size class.
+class ExprArena {
+  static constexpr std::size_t Granularity = 16;
+  static constexpr std::size_t MaxNodeSize = 128;
+  static constexpr std::size_t SlabSize = 1 << 20;
+
+  struct FreeNode {
+    FreeNode *next;
+  };
+  FreeNode *freeLists[MaxNodeSize / Granularity] = {};
+  char *next = nullptr;
+  char *end = nullptr;
+  llvm::DenseSet<std::uintptr_t> slabs;
+
+  static unsigned sizeClass(std::size_t size) {
+    return (size - 1) / Granularity;
+  }
+
+public:
+  static bool fits(std::size_t size) { return size <= MaxNodeSize; }
+
+  bool empty() const { return slabs.empty(); }
+
+  bool owns(const void *ptr) const {
+    return slabs.count(reinterpret_cast<std::uintptr_t>(ptr) &
+                       ~(std::uintptr_t)(SlabSize - 1));
+  }
+
+  void *allocate(std::size_t size) {
+    unsigned c = sizeClass(size);
+    if (FreeNode *node = freeLists[c]) {
+      freeLists[c] = node->next;
+      return node;
+    }
+    std::size_t rounded = (c + 1) * Granularity;
+    if ((std::size_t)(end - next) < rounded) {
+      void *slab = nullptr;
+      if (posix_memalign(&slab, SlabSize, SlabSize))
+        llvm::report_bad_alloc_error("Unable to allocate an expression slab");
+      slabs.insert(reinterpret_cast<std::uintptr_t>(slab));
+      next = static_cast<char *>(slab);
+      end = next + SlabSize;
+    }
+    void *ptr = next;
+    next += rounded;
+    return ptr;
+  }
+
+  void deallocate(void *ptr, std::size_t size) {
+    unsigned c = sizeClass(size);
+    FreeNode *node = static_cast<FreeNode *>(ptr);
+    node->next = freeLists[c];
+    freeLists[c] = node;
+  }
+};
+
+struct ExprCache {
+  llvm::DenseSet<Expr *, ExprCacheInfo> nodes;
+  ExprArena arena;
+};
+
+/// Never destroyed, as expressions may outlive static destructors.
+ExprCache &getExprCache() {
+  static ExprCache *cache = new ExprCache();
+  return *cache;
+}
+} // namespace
+
+Expr::~Expr() {
+  Expr::count--;
+  if (cached) {
+    ExprCache &cache = getExprCache();
+    toBeCleared = true;
+    cache.nodes.erase(this);
+  }
+}
+
+void *Expr::operator new(std::size_t size) {
+  if (!ExprHashConsing || !ExprArena::fits(size))
+    return ::operator new(size);
+  ExprCache &cache = getExprCache();
+  return cache.arena.allocate(size);
+}
+
+void Expr::operator delete(void *ptr, std::size_t size) {
+  ExprCache &cache = getExprCache();
+  if (!cache.arena.empty() && cache.arena.owns(ptr)) {
+    cache.arena.deallocate(ptr, size);
+    return;
+  }
+  ::operator delete(ptr);
+}
+
+ref<Expr> Expr::createCachedExpr(ref<Expr> e) {
+  e->computeHash();
+  if (!ExprHashConsing)
+    return e;
+  // Sharing a node whose kids are not shared would break the invariant that
+  // structurally equal cached nodes are identical.
+  for (unsigned i = 0, n = e->getNumKids(); i != n; ++i)
+    if (!e->getKid(i)->cached)
+      return e;
+
+  ExprCache &cache = getExprCache();
+  auto res = cache.nodes.insert(e.get());
+  if (!res.second)
+    return *res.first;
+  e->cached = true;
+  return e;
+}
+
+namespace {
+/// Nodes for constants of up to 64 bits. Small values of the common widths
+/// are preallocated once and shared by all their uses. Other values are
+/// looked up in a direct-mapped table of recently created constants, which
+/// keeps repeated values of concrete computations from being allocated again
+/// and again; an entry is replaced by the next value mapping to its slot.
+struct ConstantTable {
+  static constexpr uint64_t NumSmallValues = 256;
+  static constexpr unsigned NumRecentValues = 4096;
+  static constexpr unsigned NumSmallWidths = 5;
+
+  /// Small values of the widths Bool, Int8, Int16, Int32 and Int64
+  std::vector<ref<ConstantExpr>> small[NumSmallWidths];
+  std::vector<ref<ConstantExpr>> recent{NumRecentValues};
+
+  static int smallWidthIndex(Expr::Width w) {
+    switch (w) {
+    case Expr::Bool:
+      return 0;
+    case Expr::Int8:
+      return 1;
+    case Expr::Int16:
+      return 2;
+    case Expr::Int32:
+      return 3;
+    case Expr::Int64:
+      return 4;
+    default:
+      return -1;
+    }
+  }
+
+  static unsigned recentIndex(uint64_t v, Expr::Width w) {
+    return ((v ^ w) * UINT64_C(0x9e3779b97f4a7c15)) >> 52;
+  }
+};
+} // namespace
+
+ref<ConstantExpr> ConstantExpr::intern(uint64_t v, Width w) {
+  // Never destroyed, as constants may outlive static destructors.
+  static ConstantTable *table = [] {
+    auto *t = new ConstantTable();
+    const Width widths[] = {Bool, Int8, Int16, Int32, Int64};
+    static_assert(sizeof(widths) / sizeof(widths[0]) ==
+                      ConstantTable::NumSmallWidths,
+                  "one table per small width");
+    for (unsigned i = 0; i < ConstantTable::NumSmallWidths; ++i) {
+      Width width = widths[i];
+      assert(ConstantTable::smallWidthIndex(width) == static_cast<int>(i));
+      std::vector<ref<ConstantExpr>> &values = t->small[i];
+      uint64_t n = width == Bool ? 2 : ConstantTable::NumSmallValues;
+      for (uint64_t value = 0; value < n; ++value) {
+        ConstantExpr *ce = new ConstantExpr(llvm::APInt(width, value));
+        ce->computeHash();
+        ce->cached = true;
+        values.push_back(ce);
+      }
+    }
+    return t;
+  }();
+
+  int index = ConstantTable::smallWidthIndex(w);
+  if (index >= 0 && v < table->small[index].size())
+    return table->small[index][v];
+
+  // Constants must be unique among the hash-consed expressions
+  if (ExprHashConsing) {
+    ref<Expr> r = createCachedExpr(new ConstantExpr(llvm::APInt(w, v)));
+    return cast<ConstantExpr>(r.get());
+  }
+
+  ref<ConstantExpr> &entry = table->recent[ConstantTable::recentIndex(v, w)];
+  if (entry.isNull() || entry->getWidth() != w ||
+      entry->value.getZExtValue() != v) {
+    entry = new ConstantExpr(llvm::APInt(w, v));
+    entry->computeHash();
+  }
+  return entry;
+}
+
 ref<Expr> Expr::createTempRead(const Array *array, Expr::Width w) {
   UpdateList ul(array, 0);
 
@@ -0,0 +1,337 @@
+//===-- IndependentSet.cpp ------------------------------------------------===//
+//
+//                     The KLEE Symbolic Virtual Machine
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+
+#include "klee/Expr/IndependentSet.h"
+
+#include "klee/Expr/ExprUtil.h"
+
+#include <algorithm>
+#include <utility>
+
+using namespace klee;
+
+IndependentElementSet::IndependentElementSet(ref<Expr> e) {
+  exprs.push_back(e);
+  // Track all reads in the program.  Determines whether reads are
+  // concrete or symbolic.  If they are symbolic, "collapses" array
+  // by adding it to wholeObjects.  Otherwise, creates a mapping of
+  // the form Map<array, set<index>> which tracks which parts of the
+  // array are being accessed.
+  std::vector< ref<ReadExpr> > reads;
+  findReads(e, /* visitUpdates= */ true, reads);
+  for (unsigned i = 0; i != reads.size(); ++i) {
+    ReadExpr *re = reads[i].get();
+    const Array *array = re->updates.root;
+
+    // Reads of a constant array don't alias.
+    if (re->updates.root->isConstantArray() && !re->updates.head)
+      continue;
+
+    if (!wholeObjects.count(array)) {
+      if (ConstantExpr *CE = dyn_cast<ConstantExpr>(re->index)) {
+        // if index constant, then add to set of constraints operating
+        // on that array (actually, don't add constraint, just set index)
+        DenseSet<unsigned> &dis = elements[array];
+        dis.add((unsigned) CE->getZExtValue(32));
+      } else {
+        elements_ty::iterator it2 = elements.find(array);
+        if (it2!=elements.end())
+          elements.erase(it2);
+        wholeObjects.insert(array);
+      }
+    }
+  }
+}
+
+void IndependentElementSet::print(llvm::raw_ostream &os) const {
+  os << "{";
+  bool first = true;
+  for (std::set<const Array*>::iterator it = wholeObjects.begin(),
+         ie = wholeObjects.end(); it != ie; ++it) {
+    const Array *array = *it;
+
+    if (first) {
+      first = false;
+    } else {
+      os << ", ";
+    }
+
+    os << "MO" << array->name;
+  }
+  for (elements_ty::const_iterator it = elements.begin(), ie = elements.end();
+       it != ie; ++it) {
+    const Array *array = it->first;
+    const DenseSet<unsigned> &dis = it->second;
+
+    if (first) {
+      first = false;
+    } else {
+      os << ", ";
+    }
+
+    os << "MO" << array->name << " : " << dis;
+  }
+  os << "}";
+}
+
+bool IndependentElementSet::intersects(const IndependentElementSet &b) {
+  // If there are any symbolic arrays in our query that b accesses
+  for (std::set<const Array*>::iterator it = wholeObjects.begin(),
+         ie = wholeObjects.end(); it != ie; ++it) {
+    const Array *array = *it;
+    if (b.wholeObjects.count(array) ||
+        b.elements.find(array) != b.elements.end())
+      return true;
+  }
+  for (elements_ty::iterator it = elements.begin(), ie = elements.end();
+       it != ie; ++it) {
+    const Array *array = it->first;
+    // if the array we access is symbolic in b
+    if (b.wholeObjects.count(array))
+      return true;
+    elements_ty::const_iterator it2 = b.elements.find(array);
+    // if any of the elements we access are also accessed by b
+    if (it2 != b.elements.end()) {
+      if (it->second.intersects(it2->second))
+        return true;
+    }
+  }
+  return false;
+}
+
+bool IndependentElementSet::add(const IndependentElementSet &b) {
+  for(unsigned i = 0; i < b.exprs.size(); i ++){
+    ref<Expr> expr = b.exprs[i];
+    exprs.push_back(expr);
+  }
+
+  bool modified = false;
+  for (std::set<const Array*>::const_iterator it = b.wholeObjects.begin(),
+         ie = b.wholeObjects.end(); it != ie; ++it) {
+    const Array *array = *it;
+    elements_ty::iterator it2 = elements.find(array);
+    if (it2!=elements.end()) {
+      modified = true;
+      elements.erase(it2);
+      wholeObjects.insert(array);
+    } else {
+      if (!wholeObjects.count(array)) {
+        modified = true;
+        wholeObjects.insert(array);
+      }
+    }
+  }
+  for (elements_ty::const_iterator it = b.elements.begin(),
+         ie = b.elements.end(); it != ie; ++it) {
+    const Array *array = it->first;
+    if (!wholeObjects.count(array)) {
+      elements_ty::iterator it2 = elements.find(array);
+      if (it2==elements.end()) {
+        modified = true;
+        elements.insert(*it);
+      } else {
+        // Now need to see if there are any (z=?)'s
+        if (it2->second.add(it->second))
+          modified = true;
+      }
+    }
+  }
+  return modified;
+}
+
+/***/
+
+unsigned IndependentConstraintGroups::find(unsigned group) const {
+  // no path compression, so that copies can share the parents; union by
+  // size keeps the paths logarithmic
+  for (;;) {
+    unsigned parent = groups.lookup(group)->second.parent;
+    if (parent == group)
+      return group;
+    group = parent;
+  }
+}
+
+std::vector<unsigned> IndependentConstraintGroups::getGroups(
+    const IndependentElementSet &elements) const {
+  std::vector<unsigned> roots;
+  for (const Array *array : elements.wholeObjects) {
+    for (auto it = index.lower_bound(std::make_pair(array, 0u)),
+              ie = index.end();
+         it != ie && it->first.first == array; ++it)
+      roots.push_back(find(it->second));
+  }
+  for (const auto &element : elements.elements) {
+    if (auto whole = index.lookup(std::make_pair(element.first, WholeArray))) {
+      roots.push_back(find(whole->second));
+      continue;
+    }
+    for (unsigned byte : element.second) {
+      if (auto entry = index.lookup(std::make_pair(element.first, byte)))
+        roots.push_back(find(entry->second));
+    }
+  }
+  std::sort(roots.begin(), roots.end());
+  roots.erase(std::unique(roots.begin(), roots.end()), roots.end());
+  return roots;
+}
+
+void IndependentConstraintGroups::merge(unsigned from, unsigned to) {
+  std::vector<std::pair<unsigned, ref<Expr>>> moved;
+  for (auto it = members.lower_bound(std::make_pair(from, 0u)),
+            ie = members.end();
+       it != ie && it->first.first == from; ++it)
+    moved.emplace_back(it->first.second, it->second);
+  for (const auto &m : moved) {
+    members.erase(std::make_pair(from, m.first));
+    members.set(std::make_pair(std::make_pair(to, m.first), m.second));
+  }
+
+  std::vector<element_ty> movedElements;
+  for (auto it = elements.lower_bound(element_ty(from, nullptr, 0)),
+            ie = elements.end();
+       it != ie && std::get<0>(it->first) == from; ++it)
+    movedElements.push_back(it->first);
+  for (const auto &e : movedElements) {
+    elements.erase(e);
+    elements.set(std::make_pair(
+        element_ty(to, std::get<1>(e), std::get<2>(e)), true));
+  }
+
+  GroupInfo info = groups.lookup(to)->second;
+  info.size += groups.lookup(from)->second.size;
+  groups.set(std::make_pair(to, info));
+  groups.set(std::make_pair(from, GroupInfo{to, 0}));
+}
+
+void IndependentConstraintGroups::add(const ref<Expr> &constraint) {
+  unsigned position = numConstraints++;
+  IndependentElementSet accessed(constraint);
+  std::vector<unsigned> roots = getGroups(accessed);
+
+  // merge everything into the largest group
+  unsigned root;
+  if (roots.empty()) {
+    root = groups.size();
+    groups.set(std::make_pair(root, GroupInfo{root, 0}));
+  } else {
+    root = *std::max_element(roots.begin(), roots.end(),
+                             [this](unsigned a, unsigned b) {
+                               return groups.lookup(a)->second.size <
+                                      groups.lookup(b)->second.size;
+                             });
+    for (unsigned r : roots) {
+      if (r != root)
+        merge(r, root);
+    }
+  }
+  GroupInfo info = groups.lookup(root)->second;
+  ++info.size;
+  groups.set(std::make_pair(root, info));
+  members.set(std::make_pair(std::make_pair(root, position), constraint));
+
+  // The merged group covers all bytes of the accessed arrays that other
+  // groups already used, so only the new accesses need an index entry.
+  for (const Array *array : accessed.wholeObjects) {
+    std::vector<std::pair<const Array *, unsigned>> bytes;
+    for (auto it = index.lower_bound(std::make_pair(array, 0u)),
+              ie = index.end();
+         it != ie && it->first.first == array; ++it)
+      bytes.push_back(it->first);
+    for (const auto &byte : bytes)
+      index.erase(byte);
+    index.set(std::make_pair(std::make_pair(array, WholeArray), root));
+    elements.set(std::make_pair(element_ty(root, array, WholeArray), true));
+  }
+  for (const auto &element : accessed.elements) {
+    if (index.lookup(std::make_pair(element.first, WholeArray)))
+      continue;
+    for (unsigned byte : element.second) {
+      index.set(std::make_pair(std::make_pair(element.first, byte), root));
+      elements.set(std::make_pair(element_ty(root, element.first, byte), true));
+    }
+  }
+}
+
+void IndependentConstraintGroups::addElements(
+    unsigned root, IndependentElementSet &result) const {
+  // the bytes of an array come before its WholeArray entry
+  for (auto it = elements.lower_bound(element_ty(root, nullptr, 0)),
+            ie = elements.end();
+       it != ie && std::get<0>(it->first) == root; ++it) {
+    const Array *array = std::get<1>(it->first);
+    unsigned byte = std::get<2>(it->first);
+    if (byte == WholeArray) {
+      result.elements.erase(array);
+      result.wholeObjects.insert(array);
+    } else if (!result.wholeObjects.count(array)) {
+      result.elements[array].add(byte);
+    }
+  }
+}
+
+void IndependentConstraintGroups::collect(
+    const std::vector<unsigned> &roots, std::vector<ref<Expr>> &result) const {
+  // the members of a group are ordered by position
+  std::vector<std::pair<unsigned, ref<Expr>>> constraints;
+  for (unsigned r : roots) {
+    for (auto it = members.lower_bound(std::make_pair(r, 0u)),
+              ie = members.end();
+         it != ie && it->first.first == r; ++it) {
+      if (roots.size() == 1)
+        result.push_back(it->second);
+      else
+        constraints.emplace_back(it->first.second, it->second);
+    }
+  }
+  if (roots.size() == 1)
+    return;
+
+  std::sort(constraints.begin(), constraints.end(),
+            [](const std::pair<unsigned, ref<Expr>> &a,
+               const std::pair<unsigned, ref<Expr>> &b) {
+              return a.first < b.first;
+            });
+  for (const auto &c : constraints)
+    result.push_back(c.second);
+}
+
+IndependentElementSet IndependentConstraintGroups::getIndependentConstraints(
+    const ref<Expr> &expr, std::vector<ref<Expr>> &result) const {
+  IndependentElementSet eltsClosure(expr);
+  std::vector<unsigned> roots = getGroups(eltsClosure);
+  for (unsigned r : roots)
+    addElements(r, eltsClosure);
+  collect(roots, result);
+  return eltsClosure;
+}
+
+void IndependentConstraintGroups::getAllIndependentSets(
+    const ref<Expr> &expr, std::vector<IndependentElementSet> &result) const {
+  std::vector<unsigned> exprRoots;
+  if (!isa<ConstantExpr>(expr)) {
+    IndependentElementSet factor(expr);
+    exprRoots = getGroups(factor);
+    for (unsigned r : exprRoots)
+      addElements(r, factor);
+    factor.exprs.resize(1);
+    collect(exprRoots, factor.exprs);
+    result.push_back(std::move(factor));
+  }
+
+  for (const auto &group : groups) {
+    unsigned r = group.first;
+    if (group.second.parent != r ||
+        std::binary_search(exprRoots.begin(), exprRoots.end(), r))
+      continue;
+    result.emplace_back();
+    addElements(r, result.back());
+    collect({r}, result.back().exprs);
+  }
+}
@@ -40,6 +40,11 @@ Solver *constructSolverChain(Solver *coreSolver,
                  baseSolverQuerySMT2LogPath.c_str());
   }
 
+  if (!SolverCacheFile.empty()) {
+    solver = createPersistentCachingSolver(solver, SolverCacheFile);
+    klee_message("Caching solver results in %s\n", SolverCacheFile.c_str());
+  }
+
   if (UseAssignmentValidatingSolver)
     solver = createAssignmentValidatingSolver(solver);
 
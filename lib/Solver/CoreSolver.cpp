@@ -19,6 +19,7 @@
 #include "llvm/Support/raw_ostream.h"
 
 #include <string>
+#include <vector>
 
 namespace klee {
 
@@ -50,6 +51,25 @@ Solver *createCoreSolver(CoreSolverType cst) {
     klee_message("Not compiled with Z3 support");
     return NULL;
 #endif
+  case PORTFOLIO_SOLVER: {
+    if (PortfolioSolvers.size() < 2) {
+      klee_message("A solver portfolio needs at least two backends "
+                   "(--portfolio-solvers)");
+      return NULL;
+    }
+    std::vector<Solver *> solvers;
+    for (CoreSolverType type : PortfolioSolvers) {
+      Solver *s = createCoreSolver(type);
+      if (!s) {
+        for (Solver *created : solvers)
+          delete created;
+        return NULL;
+      }
+      solvers.push_back(s);
+    }
+    klee_message("Racing %zu solver backends", solvers.size());
+    return createPortfolioSolver(solvers);
+  }
   case NO_SOLVER:
     klee_message("Invalid solver");
     return NULL;
@@ -0,0 +1,411 @@
+//===-- PersistentCachingSolver.cpp - On-disk query cache -----------------===//
+//
+//                     The KLEE Symbolic Virtual Machine
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// A query cache kept in a file, so that it survives the KLEE run and can be
+// shared by several KLEE processes at the same time. Queries are keyed by a
+// hash of their KQuery representation, which only depends on the names and
+// contents of the arrays involved and is therefore stable across runs.
+//
+// The file starts with a magic string and is followed by records that are
+// only ever appended (see klee/Support/RecordFile.h). A record holds the
+// key of a query followed by its result. Each process maps the file and
+// indexes the records it has seen; records appended by other processes are
+// picked up on a miss. Appending and indexing are serialised by POSIX record
+// locks.
+//
+//===----------------------------------------------------------------------===//
+
+#include "klee/Solver/Solver.h"
+
+#include "klee/Expr/Constraints.h"
+#include "klee/Expr/Expr.h"
+#include "klee/Expr/ExprPPrinter.h"
+#include "klee/Solver/SolverImpl.h"
+#include "klee/Solver/SolverStats.h"
+#include "klee/Support/ErrorHandling.h"
+#include "klee/Support/RecordFile.h"
+
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Support/xxhash.h"
+
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <unordered_map>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace klee;
+
+namespace {
+
+const char CacheMagic[8] = {'K', 'L', 'E', 'E', 'Q', 'C', '0', '2'};
+
+struct CacheKey {
+  std::uint64_t hash;  ///< xxHash64 of the query text
+  std::uint64_t check; ///< FNV-1a of the query text
+
+  bool operator==(const CacheKey &b) const {
+    return hash == b.hash && check == b.check;
+  }
+};
+
+struct CacheKeyHash {
+  std::size_t operator()(const CacheKey &k) const { return k.hash; }
+};
+
+enum QueryKind : char {
+  TruthQuery = 'T',
+  ValidityQuery = 'V',
+  InitialValuesQuery = 'I'
+};
+
+std::uint64_t fnv1a(const std::string &s) {
+  std::uint64_t h = 14695981039346656037ULL;
+  for (unsigned char c : s) {
+    h ^= c;
+    h *= 1099511628211ULL;
+  }
+  return h;
+}
+
+/// Locks the whole file. In contrast to flock(), POSIX record locks are
+/// owned by the process and not shared with forked children.
+class FileLock {
+  int fd;
+
+public:
+  FileLock(int fd, bool exclusive) : fd(fd) {
+    struct flock fl;
+    memset(&fl, 0, sizeof(fl));
+    fl.l_type = exclusive ? F_WRLCK : F_RDLCK;
+    fl.l_whence = SEEK_SET;
+    while (fcntl(fd, F_SETLKW, &fl) < 0 && errno == EINTR)
+      ;
+  }
+  ~FileLock() {
+    struct flock fl;
+    memset(&fl, 0, sizeof(fl));
+    fl.l_type = F_UNLCK;
+    fl.l_whence = SEEK_SET;
+    fcntl(fd, F_SETLK, &fl);
+  }
+  FileLock(const FileLock &) = delete;
+  FileLock &operator=(const FileLock &) = delete;
+};
+
+class PersistentCachingSolver : public SolverImpl {
+private:
+  Solver *solver;
+  int fd = -1;
+  const char *mapping = nullptr;
+  std::size_t mappedSize = 0;
+  /// Offset up to which records have been indexed
+  std::size_t indexedSize = sizeof(CacheMagic);
+  /// Record offset for each known query
+  std::unordered_map<CacheKey, std::size_t, CacheKeyHash> index;
+
+  bool open(const std::string &path);
+  void disable();
+  void refresh();
+  void indexNewRecords();
+
+  CacheKey computeKey(QueryKind kind, const Query &query,
+                      const std::vector<const Array *> &objects = {}) const;
+  bool lookup(const CacheKey &key, std::string &payload);
+  void insert(const CacheKey &key, const std::string &payload);
+
+public:
+  PersistentCachingSolver(Solver *s, const std::string &path) : solver(s) {
+    if (!open(path))
+      disable();
+  }
+  ~PersistentCachingSolver();
+
+  bool computeValidity(const Query &, Solver::Validity &result);
+  bool computeTruth(const Query &, bool &isValid);
+  bool computeValue(const Query &query, ref<Expr> &result) {
+    return solver->impl->computeValue(query, result);
+  }
+  bool computeInitialValues(const Query &query,
+                            const std::vector<const Array *> &objects,
+                            std::vector<std::vector<unsigned char>> &values,
+                            bool &hasSolution);
+  SolverRunStatus getOperationStatusCode();
+  char *getConstraintLog(const Query &);
+  void setCoreSolverTimeout(time::Span timeout);
+};
+
+PersistentCachingSolver::~PersistentCachingSolver() {
+  disable();
+  delete solver;
+}
+
+bool PersistentCachingSolver::open(const std::string &path) {
+  fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+  if (fd < 0) {
+    klee_warning("unable to open solver cache %s: %s", path.c_str(),
+                 strerror(errno));
+    return false;
+  }
+
+  FileLock lock(fd, /*exclusive=*/true);
+  struct stat st;
+  if (fstat(fd, &st) < 0)
+    return false;
+  std::size_t size = st.st_size;
+
+  if (size == 0) {
+    if (write(fd, CacheMagic, sizeof(CacheMagic)) !=
+        static_cast<ssize_t>(sizeof(CacheMagic))) {
+      klee_warning("unable to initialise solver cache %s", path.c_str());
+      return false;
+    }
+    return true;
+  }
+
+  char magic[sizeof(CacheMagic)];
+  if (size < sizeof(magic) || pread(fd, magic, sizeof(magic), 0) !=
+                                  static_cast<ssize_t>(sizeof(magic)) ||
+      memcmp(magic, CacheMagic, sizeof(magic)) != 0) {
+    klee_warning("%s is not a solver cache, ignoring it", path.c_str());
+    return false;
+  }
+
+  // drop what a crashed process might have left at the end, so that later
+  // records stay reachable
+  indexNewRecords();
+  if (mapping && indexedSize < size) {
+    klee_warning("truncating damaged solver cache %s", path.c_str());
+    if (ftruncate(fd, indexedSize) < 0)
+      return false;
+  }
+  return true;
+}
+
+void PersistentCachingSolver::disable() {
+  if (mapping)
+    munmap(const_cast<char *>(mapping), mappedSize);
+  mapping = nullptr;
+  mappedSize = 0;
+  if (fd >= 0)
+    close(fd);
+  fd = -1;
+  index.clear();
+}
+
+void PersistentCachingSolver::refresh() {
+  if (fd < 0)
+    return;
+  FileLock lock(fd, /*exclusive=*/false);
+  indexNewRecords();
+}
+
+/// Maps the file and indexes the records appended since the last call. The
+/// caller holds a lock on the file.
+void PersistentCachingSolver::indexNewRecords() {
+  struct stat st;
+  if (fstat(fd, &st) < 0)
+    return;
+  std::size_t size = st.st_size;
+  if (size <= indexedSize)
+    return;
+
+  if (mapping)
+    munmap(const_cast<char *>(mapping), mappedSize);
+  void *m = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+  if (m == MAP_FAILED) {
+    klee_warning("unable to map solver cache: %s", strerror(errno));
+    mapping = nullptr;
+    mappedSize = 0;
+    return;
+  }
+  mapping = static_cast<const char *>(m);
+  mappedSize = size;
+
+  llvm::StringRef payload;
+  for (std::size_t pos = indexedSize;
+       readRecord(mapping, size, pos, payload);) {
+    RecordReader r(payload);
+    CacheKey key;
+    r.readBytes(&key.hash, sizeof(key.hash));
+    r.readBytes(&key.check, sizeof(key.check));
+    if (r.failed)
+      break;
+    index[key] = indexedSize;
+    indexedSize = pos;
+  }
+}
+
+CacheKey
+PersistentCachingSolver::computeKey(QueryKind kind, const Query &query,
+                                    const std::vector<const Array *> &objects)
+    const {
+  std::string text;
+  llvm::raw_string_ostream os(text);
+  os << static_cast<char>(kind) << '\n';
+  ExprPPrinter::printQuery(os, query.constraints, query.expr, nullptr, nullptr,
+                           objects.data(), objects.data() + objects.size());
+  os.flush();
+  return CacheKey{llvm::xxHash64(text), fnv1a(text)};
+}
+
+bool PersistentCachingSolver::lookup(const CacheKey &key,
+                                     std::string &payload) {
+  auto it = index.find(key);
+  if (it == index.end()) {
+    // other processes might have solved it in the meantime
+    refresh();
+    it = index.find(key);
+    if (it == index.end())
+      return false;
+  }
+
+  std::size_t pos = it->second;
+  llvm::StringRef record;
+  if (!readRecord(mapping, mappedSize, pos, record))
+    return false;
+  payload = record.drop_front(sizeof(key.hash) + sizeof(key.check)).str();
+  return true;
+}
+
+void PersistentCachingSolver::insert(const CacheKey &key,
+                                     const std::string &payload) {
+  if (fd < 0)
+    return;
+
+  RecordWriter w;
+  w.writeBytes(&key.hash, sizeof(key.hash));
+  w.writeBytes(&key.check, sizeof(key.check));
+  w.writeBytes(payload.data(), payload.size());
+  std::string record;
+  appendRecord(record, w.buffer);
+
+  FileLock lock(fd, /*exclusive=*/true);
+  const char *data = record.data();
+  std::size_t left = record.size();
+  while (left) {
+    ssize_t n = write(fd, data, left);
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      klee_warning("unable to write to solver cache: %s", strerror(errno));
+      return;
+    }
+    data += n;
+    left -= n;
+  }
+}
+
+bool PersistentCachingSolver::computeValidity(const Query &query,
+                                              Solver::Validity &result) {
+  if (fd < 0)
+    return solver->impl->computeValidity(query, result);
+
+  CacheKey key = computeKey(ValidityQuery, query);
+  std::string payload;
+  if (lookup(key, payload) && payload.size() == 1) {
+    ++stats::queryPersistentCacheHits;
+    result = static_cast<Solver::Validity>(static_cast<signed char>(payload[0]));
+    return true;
+  }
+
+  ++stats::queryPersistentCacheMisses;
+  if (!solver->impl->computeValidity(query, result))
+    return false;
+  insert(key, std::string(1, static_cast<char>(result)));
+  return true;
+}
+
+bool PersistentCachingSolver::computeTruth(const Query &query,
+                                           bool &isValid) {
+  if (fd < 0)
+    return solver->impl->computeTruth(query, isValid);
+
+  CacheKey key = computeKey(TruthQuery, query);
+  std::string payload;
+  if (lookup(key, payload) && payload.size() == 1) {
+    ++stats::queryPersistentCacheHits;
+    isValid = payload[0];
+    return true;
+  }
+
+  ++stats::queryPersistentCacheMisses;
+  if (!solver->impl->computeTruth(query, isValid))
+    return false;
+  insert(key, std::string(1, isValid));
+  return true;
+}
+
+bool PersistentCachingSolver::computeInitialValues(
+    const Query &query, const std::vector<const Array *> &objects,
+    std::vector<std::vector<unsigned char>> &values, bool &hasSolution) {
+  if (fd < 0)
+    return solver->impl->computeInitialValues(query, objects, values,
+                                              hasSolution);
+
+  // the payload is a flag followed by the contents of all objects
+  std::size_t solutionSize = 1;
+  for (const Array *object : objects)
+    solutionSize += object->size;
+
+  CacheKey key = computeKey(InitialValuesQuery, query, objects);
+  std::string payload;
+  if (lookup(key, payload) &&
+      ((payload.size() == 1 && !payload[0]) ||
+       (payload.size() == solutionSize && payload[0]))) {
+    ++stats::queryPersistentCacheHits;
+    hasSolution = payload[0];
+    if (hasSolution) {
+      const char *pos = payload.data() + 1;
+      values.reserve(objects.size());
+      for (const Array *object : objects) {
+        values.emplace_back(pos, pos + object->size);
+        pos += object->size;
+      }
+    }
+    return true;
+  }
+
+  ++stats::queryPersistentCacheMisses;
+  if (!solver->impl->computeInitialValues(query, objects, values,
+                                          hasSolution))
+    return false;
+
+  payload.assign(1, hasSolution);
+  if (hasSolution)
+    for (const auto &value : values)
+      payload.append(value.begin(), value.end());
+  insert(key, payload);
+  return true;
+}
+
+SolverImpl::SolverRunStatus PersistentCachingSolver::getOperationStatusCode() {
+  return solver->impl->getOperationStatusCode();
+}
+
+char *PersistentCachingSolver::getConstraintLog(const Query &query) {
+  return solver->impl->getConstraintLog(query);
+}
+
+void PersistentCachingSolver::setCoreSolverTimeout(time::Span timeout) {
+  solver->impl->setCoreSolverTimeout(timeout);
+}
+
+} // namespace
+
+///
+
+Solver *klee::createPersistentCachingSolver(Solver *s, std::string path) {
+  return new Solver(new PersistentCachingSolver(s, path));
+}
@@ -0,0 +1,430 @@
+//===-- PortfolioSolver.cpp - Race several core solvers -------------------===//
+//
+//                     The KLEE Symbolic Virtual Machine
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// Runs each query on all member solvers at once, each in a forked process,
+// and takes the first answer. The remaining processes are killed.
+//
+// For every query shape (the kind of request, the number of constraints and
+// the kind of the queried expression) the solver records which member won.
+// Once a member clearly dominates a shape, queries of that shape are sent
+// to it directly without forking, apart from an occasional race to notice
+// when the picture changes. The same happens for shapes whose queries are
+// solved so quickly that forking would cost more than the race gains. A
+// query that fails when sent to a single member is raced among the others.
+//
+//===----------------------------------------------------------------------===//
+
+#include "klee/Solver/Solver.h"
+
+#include "klee/Expr/Constraints.h"
+#include "klee/Expr/Expr.h"
+#include "klee/Solver/SolverImpl.h"
+#include "klee/Solver/SolverStats.h"
+#include "klee/Support/ErrorHandling.h"
+#include "klee/Support/OptionCategories.h"
+#include "klee/System/Time.h"
+
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Errno.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <string>
+#include <unordered_map>
+
+#include <poll.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+using namespace klee;
+
+namespace {
+llvm::cl::opt<unsigned> PortfolioLearnAfter(
+    "portfolio-learn-after", llvm::cl::init(16),
+    llvm::cl::desc("Stop racing the portfolio solvers on a query shape after "
+                   "this many races if one solver won at least 90% of them. "
+                   "Set to 0 to always race (default=16)"),
+    llvm::cl::cat(klee::SolvingCat));
+
+llvm::cl::opt<std::string> PortfolioRaceMinTime(
+    "portfolio-race-min-time", llvm::cl::init("10ms"),
+    llvm::cl::desc("Do not race the portfolio solvers on a query shape whose "
+                   "queries take less than this on average, but use the "
+                   "solver that won most of its races (default=10ms)"),
+    llvm::cl::cat(klee::SolvingCat));
+
+/// Every this many queries of a shape with a dominating solver are raced
+/// nonetheless
+const unsigned RecheckInterval = 64;
+
+class PortfolioSolver : public SolverImpl {
+private:
+  enum Operation { ValidityOp, TruthOp, ValueOp, InitialValuesOp };
+
+  struct ShapeStats {
+    unsigned races = 0;
+    unsigned direct = 0;
+    std::vector<unsigned> wins;
+    /// Moving average of the solving time of recent queries
+    time::Span averageTime;
+  };
+
+  /// Runs the query on the given solver, encoding the answer into a string
+  using SolveFn = std::function<bool(Solver *, std::string &)>;
+
+  std::vector<Solver *> solvers;
+  std::unordered_map<std::uint64_t, ShapeStats> shapes;
+  time::Span minRaceTime;
+  SolverRunStatus runStatusCode = SOLVER_RUN_STATUS_FAILURE;
+
+  std::uint64_t getShape(Operation op, const Query &query) const;
+  int getDirect(ShapeStats &shape) const;
+  bool solve(Operation op, const Query &query, const SolveFn &fn,
+             std::string &answer);
+  int race(const SolveFn &fn, std::string &answer, int skip,
+           time::Span &solvingTime);
+
+public:
+  explicit PortfolioSolver(const std::vector<Solver *> &solvers)
+      : solvers(solvers), minRaceTime(PortfolioRaceMinTime) {}
+  ~PortfolioSolver();
+
+  bool computeValidity(const Query &, Solver::Validity &result);
+  bool computeTruth(const Query &, bool &isValid);
+  bool computeValue(const Query &, ref<Expr> &result);
+  bool computeInitialValues(const Query &query,
+                            const std::vector<const Array *> &objects,
+                            std::vector<std::vector<unsigned char>> &values,
+                            bool &hasSolution);
+  SolverRunStatus getOperationStatusCode();
+  char *getConstraintLog(const Query &);
+  void setCoreSolverTimeout(time::Span timeout);
+};
+
+PortfolioSolver::~PortfolioSolver() {
+  for (Solver *s : solvers)
+    delete s;
+}
+
+std::uint64_t PortfolioSolver::getShape(Operation op,
+                                        const Query &query) const {
+  unsigned constraintBucket = 0;
+  for (std::size_t n = query.constraints.size(); n; n >>= 1)
+    ++constraintBucket;
+  return (static_cast<std::uint64_t>(op) << 48) |
+         (static_cast<std::uint64_t>(constraintBucket) << 32) |
+         (static_cast<std::uint64_t>(query.expr->getKind()) << 16) |
+         query.expr->getWidth();
+}
+
+/// Returns the solver to send a query of the shape to without racing, or -1
+int PortfolioSolver::getDirect(ShapeStats &shape) const {
+  if (!shape.races)
+    return -1;
+  unsigned best = std::max_element(shape.wins.begin(), shape.wins.end()) -
+                  shape.wins.begin();
+  bool dominant = PortfolioLearnAfter && shape.races >= PortfolioLearnAfter &&
+                  shape.wins[best] * 10 >= shape.races * 9;
+  bool cheap = shape.averageTime < minRaceTime;
+  if ((!dominant && !cheap) || ++shape.direct % RecheckInterval == 0)
+    return -1;
+  return best;
+}
+
+bool PortfolioSolver::solve(Operation op, const Query &query,
+                            const SolveFn &fn, std::string &answer) {
+  ShapeStats &shape = shapes[getShape(op, query)];
+  if (shape.wins.empty())
+    shape.wins.resize(solvers.size());
+
+  auto recordTime = [&shape](time::Span t) {
+    shape.averageTime = shape.races ? (shape.averageTime * 7u + t) / 8u : t;
+  };
+
+  int direct = getDirect(shape);
+  if (direct >= 0) {
+    ++stats::portfolioDirectQueries;
+    Solver *s = solvers[direct];
+    auto start = time::getWallTime();
+    bool success = fn(s, answer);
+    recordTime(time::getWallTime() - start);
+    if (success) {
+      runStatusCode = s->impl->getOperationStatusCode();
+      return true;
+    }
+    // the others might still answer, and this one lost
+    ++shape.races;
+  }
+
+  ++stats::portfolioRaces;
+  time::Span solvingTime;
+  int winner = race(fn, answer, direct, solvingTime);
+  if (winner < 0)
+    return false;
+  recordTime(solvingTime);
+  ++shape.races;
+  ++shape.wins[winner];
+  return true;
+}
+
+/// Returns the index of the first solver to answer, or -1 if all of them
+/// failed. The solver with index \p skip (if any) does not take part.
+/// \p solvingTime is set to the time the winner took, not counting the
+/// fork.
+int PortfolioSolver::race(const SolveFn &fn, std::string &answer, int skip,
+                          time::Span &solvingTime) {
+  struct Contender {
+    pid_t pid = -1;
+    int fd = -1;
+    std::string message;
+  };
+  std::vector<Contender> contenders(solvers.size());
+
+  fflush(stdout);
+  fflush(stderr);
+
+  for (unsigned i = 0; i < solvers.size(); ++i) {
+    if (static_cast<int>(i) == skip)
+      continue;
+    int fds[2];
+    if (pipe(fds) < 0) {
+      klee_warning("pipe failed (for portfolio solver) - %s",
+                   llvm::sys::StrError(errno).c_str());
+      continue;
+    }
+    pid_t pid = fork();
+    if (pid < 0) {
+      klee_warning("fork failed (for portfolio solver) - %s",
+                   llvm::sys::StrError(errno).c_str());
+      close(fds[0]);
+      close(fds[1]);
+      continue;
+    }
+
+    if (pid == 0) {
+      // message: success flag, run status, solving time, encoded answer
+      close(fds[0]);
+      std::string result;
+      auto start = time::getWallTime();
+      bool success = fn(solvers[i], result);
+      std::uint64_t us = (time::getWallTime() - start).toMicroseconds();
+      std::int32_t status = solvers[i]->impl->getOperationStatusCode();
+      std::string message(1, success);
+      message.append(reinterpret_cast<const char *>(&status), sizeof(status));
+      message.append(reinterpret_cast<const char *>(&us), sizeof(us));
+      message += result;
+      const char *pos = message.data();
+      std::size_t left = message.size();
+      while (left) {
+        ssize_t n = write(fds[1], pos, left);
+        if (n < 0 && errno == EINTR)
+          continue;
+        if (n <= 0)
+          break;
+        pos += n;
+        left -= n;
+      }
+      _exit(0);
+    }
+
+    close(fds[1]);
+    contenders[i].pid = pid;
+    contenders[i].fd = fds[0];
+  }
+
+  int winner = -1;
+  runStatusCode = SOLVER_RUN_STATUS_FAILURE;
+  for (;;) {
+    std::vector<struct pollfd> pfds;
+    std::vector<unsigned> ids;
+    for (unsigned i = 0; i < contenders.size(); ++i) {
+      if (contenders[i].fd < 0)
+        continue;
+      pfds.push_back({contenders[i].fd, POLLIN, 0});
+      ids.push_back(i);
+    }
+    if (pfds.empty() || winner >= 0)
+      break;
+
+    if (poll(pfds.data(), pfds.size(), -1) < 0) {
+      if (errno == EINTR)
+        continue;
+      klee_warning("poll failed (for portfolio solver) - %s",
+                   llvm::sys::StrError(errno).c_str());
+      break;
+    }
+
+    for (unsigned k = 0; k < pfds.size() && winner < 0; ++k) {
+      if (!(pfds[k].revents & (POLLIN | POLLHUP | POLLERR)))
+        continue;
+      Contender &c = contenders[ids[k]];
+      char chunk[4096];
+      ssize_t n = read(c.fd, chunk, sizeof(chunk));
+      if (n < 0 && errno == EINTR)
+        continue;
+      if (n > 0) {
+        c.message.append(chunk, n);
+        continue;
+      }
+
+      // the contender is done
+      close(c.fd);
+      c.fd = -1;
+      std::int32_t status;
+      std::uint64_t us;
+      const std::size_t header = 1 + sizeof(status) + sizeof(us);
+      if (c.message.size() < header)
+        continue; // crashed
+      memcpy(&status, c.message.data() + 1, sizeof(status));
+      memcpy(&us, c.message.data() + 1 + sizeof(status), sizeof(us));
+      runStatusCode = static_cast<SolverRunStatus>(status);
+      if (c.message[0]) {
+        winner = ids[k];
+        answer = c.message.substr(header);
+        solvingTime = time::microseconds(us);
+      }
+    }
+  }
+
+  // cancel everybody else
+  for (auto &c : contenders) {
+    if (c.pid < 0)
+      continue;
+    if (c.fd >= 0) {
+      kill(c.pid, SIGKILL);
+      close(c.fd);
+    }
+    int status;
+    while (waitpid(c.pid, &status, 0) < 0 && errno == EINTR)
+      ;
+  }
+
+  return winner;
+}
+
+bool PortfolioSolver::computeValidity(const Query &query,
+                                      Solver::Validity &result) {
+  std::string answer;
+  if (!solve(ValidityOp, query,
+             [&query](Solver *s, std::string &out) {
+               Solver::Validity v;
+               if (!s->impl->computeValidity(query, v))
+                 return false;
+               out.assign(1, static_cast<char>(v));
+               return true;
+             },
+             answer))
+    return false;
+  result = static_cast<Solver::Validity>(static_cast<signed char>(answer[0]));
+  return true;
+}
+
+bool PortfolioSolver::computeTruth(const Query &query, bool &isValid) {
+  std::string answer;
+  if (!solve(TruthOp, query,
+             [&query](Solver *s, std::string &out) {
+               bool valid;
+               if (!s->impl->computeTruth(query, valid))
+                 return false;
+               out.assign(1, valid);
+               return true;
+             },
+             answer))
+    return false;
+  isValid = answer[0];
+  return true;
+}
+
+bool PortfolioSolver::computeValue(const Query &query, ref<Expr> &result) {
+  // encoded as the width followed by the words of the value
+  std::string answer;
+  if (!solve(ValueOp, query,
+             [&query](Solver *s, std::string &out) {
+               ref<Expr> value;
+               if (!s->impl->computeValue(query, value))
+                 return false;
+               const llvm::APInt &v = cast<ConstantExpr>(value)->getAPValue();
+               std::uint32_t width = v.getBitWidth();
+               out.assign(reinterpret_cast<const char *>(&width),
+                          sizeof(width));
+               out.append(reinterpret_cast<const char *>(v.getRawData()),
+                          v.getNumWords() * sizeof(std::uint64_t));
+               return true;
+             },
+             answer))
+    return false;
+
+  std::uint32_t width;
+  memcpy(&width, answer.data(), sizeof(width));
+  std::vector<std::uint64_t> words((answer.size() - sizeof(width)) /
+                                   sizeof(std::uint64_t));
+  memcpy(words.data(), answer.data() + sizeof(width),
+         words.size() * sizeof(std::uint64_t));
+  result = ConstantExpr::alloc(llvm::APInt(width, words));
+  return true;
+}
+
+bool PortfolioSolver::computeInitialValues(
+    const Query &query, const std::vector<const Array *> &objects,
+    std::vector<std::vector<unsigned char>> &values, bool &hasSolution) {
+  // encoded as a flag followed by the contents of all objects
+  std::string answer;
+  if (!solve(InitialValuesOp, query,
+             [&query, &objects](Solver *s, std::string &out) {
+               std::vector<std::vector<unsigned char>> v;
+               bool solution;
+               if (!s->impl->computeInitialValues(query, objects, v,
+                                                  solution))
+                 return false;
+               out.assign(1, solution);
+               if (solution)
+                 for (const auto &value : v)
+                   out.append(value.begin(), value.end());
+               return true;
+             },
+             answer))
+    return false;
+
+  hasSolution = answer[0];
+  if (hasSolution) {
+    const char *pos = answer.data() + 1;
+    values.reserve(objects.size());
+    for (const Array *object : objects) {
+      values.emplace_back(pos, pos + object->size);
+      pos += object->size;
+    }
+  }
+  return true;
+}
+
+SolverImpl::SolverRunStatus PortfolioSolver::getOperationStatusCode() {
+  return runStatusCode;
+}
+
+char *PortfolioSolver::getConstraintLog(const Query &query) {
+  return solvers.front()->impl->getConstraintLog(query);
+}
+
+void PortfolioSolver::setCoreSolverTimeout(time::Span timeout) {
+  for (Solver *s : solvers)
+    s->impl->setCoreSolverTimeout(timeout);
+}
+} // namespace
+
+///
+
+Solver *klee::createPortfolioSolver(const std::vector<Solver *> &solvers) {
+  return new Solver(new PortfolioSolver(solvers));
+}
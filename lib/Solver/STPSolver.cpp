@@ -15,17 +15,31 @@
 
 #include "klee/Expr/Assignment.h"
 #include "klee/Expr/Constraints.h"
+#include "klee/Expr/ExprBuilder.h"
+#include "klee/Expr/ExprPPrinter.h"
 #include "klee/Expr/ExprUtil.h"
+#include "klee/Expr/Parser/Parser.h"
 #include "klee/Support/OptionCategories.h"
 #include "klee/Solver/SolverImpl.h"
 #include "klee/Support/ErrorHandling.h"
 
 #include "llvm/Support/CommandLine.h"
 #include "llvm/Support/Errno.h"
+#include "llvm/Support/MemoryBuffer.h"
 
+#include <algorithm>
+#include <cerrno>
 #include <csignal>
+#include <cstdint>
+#include <memory>
+#include <poll.h>
 #include <sys/ipc.h>
+#include <sys/mman.h>
+#ifdef __linux__
+#include <sys/prctl.h>
+#endif
 #include <sys/shm.h>
+#include <sys/socket.h>
 #include <sys/wait.h>
 #include <unistd.h>
 
@@ -40,12 +54,31 @@ llvm::cl::opt<bool> IgnoreSolverFailures(
     "ignore-solver-failures", llvm::cl::init(false),
     llvm::cl::desc("Ignore any STP solver failures (default=false)"),
     llvm::cl::cat(klee::SolvingCat));
+
+enum class STPRunMode { Fork, InProcess, Child };
+
+llvm::cl::opt<STPRunMode> STPRunModeOpt(
+    "stp-run-mode",
+    llvm::cl::desc("How STP is run when a forked solver or a solver timeout "
+                   "is requested (default=fork)"),
+    llvm::cl::values(
+        clEnumValN(STPRunMode::Fork, "fork",
+                   "Fork a new process for every query"),
+        clEnumValN(STPRunMode::InProcess, "in-process",
+                   "Run queries in KLEE's process and let STP enforce the "
+                   "timeout itself, which STP rounds up to whole seconds"),
+        clEnumValN(STPRunMode::Child, "child",
+                   "Send queries to a persistent child process that is "
+                   "killed and restarted on timeouts and crashes")),
+    llvm::cl::init(STPRunMode::Fork), llvm::cl::cat(klee::SolvingCat));
 }
 
 #define vc_bvBoolExtract IAMTHESPAWNOFSATAN
 
 static unsigned char *shared_memory_ptr = nullptr;
 static int shared_memory_id = 0;
+// Processes forked from KLEE share the region with it.
+static pid_t shared_memory_owner = -1;
 // Darwin by default has a very small limit on the maximum amount of shared
 // memory, which will quickly be exhausted by KLEE running its tests in
 // parallel. For now, we work around this by just requesting a smaller size --
@@ -64,6 +97,35 @@ static void stp_error_handler(const char *err_msg) {
 
 namespace klee {
 
+/// A persistent process serving STP queries, which are sent in KQuery
+/// format. A crashing or timed out query only costs restarting the process
+/// instead of forking KLEE for every query.
+///
+/// A process forked from KLEE after the server was started (such as an
+/// asynchronous query) must not talk to, or kill, the server of its parent:
+/// it forgets about it and starts a server of its own instead.
+class STPChildProcess {
+  pid_t pid = -1;
+  int fd = -1;
+  /// The process that started the server.
+  pid_t owner = -1;
+
+  bool start();
+  void detachIfForked();
+
+public:
+  STPChildProcess() = default;
+  STPChildProcess(const STPChildProcess &) = delete;
+  STPChildProcess &operator=(const STPChildProcess &) = delete;
+  ~STPChildProcess() { stop(); }
+
+  void stop();
+  SolverImpl::SolverRunStatus
+  run(const Query &query, const std::vector<const Array *> &objects,
+      std::vector<std::vector<unsigned char>> &values, bool &hasSolution,
+      time::Span timeout);
+};
+
 class STPSolverImpl : public SolverImpl {
 private:
   VC vc;
@@ -71,6 +133,7 @@ private:
   time::Span timeout;
   bool useForkedSTP;
   SolverRunStatus runStatusCode;
+  std::unique_ptr<STPChildProcess> child;
 
 public:
   explicit STPSolverImpl(bool useForkedSTP, bool optimizeDivides = true);
@@ -107,7 +170,7 @@ STPSolverImpl::STPSolverImpl(bool useForkedSTP, bool optimizeDivides)
 
   vc_registerErrorHandler(::stp_error_handler);
 
-  if (useForkedSTP) {
+  if (useForkedSTP && STPRunModeOpt == STPRunMode::Fork) {
     assert(shared_memory_id == 0 && "shared memory id already allocated");
     shared_memory_id =
         shmget(IPC_PRIVATE, shared_memory_size, IPC_CREAT | 0700);
@@ -117,14 +180,17 @@ STPSolverImpl::STPSolverImpl(bool useForkedSTP, bool optimizeDivides)
     if (shared_memory_ptr == (void *)-1)
       llvm::report_fatal_error("unable to attach shared memory region");
     shmctl(shared_memory_id, IPC_RMID, nullptr);
+    shared_memory_owner = getpid();
   }
 }
 
 STPSolverImpl::~STPSolverImpl() {
   // Detach the memory region.
-  shmdt(shared_memory_ptr);
-  shared_memory_ptr = nullptr;
-  shared_memory_id = 0;
+  if (shared_memory_ptr) {
+    shmdt(shared_memory_ptr);
+    shared_memory_ptr = nullptr;
+    shared_memory_id = 0;
+  }
 
   delete builder;
 
@@ -184,9 +250,29 @@ static SolverImpl::SolverRunStatus
 runAndGetCex(::VC vc, STPBuilder *builder, ::VCExpr q,
              const std::vector<const Array *> &objects,
              std::vector<std::vector<unsigned char>> &values,
-             bool &hasSolution) {
-  // XXX I want to be able to timeout here, safely
-  hasSolution = !vc_query(vc, q);
+             bool &hasSolution, time::Span timeout = {}) {
+  int res;
+  if (timeout) {
+    // STP checks the budget from within the SAT solver, so the query can
+    // be stopped without leaving the process. It only takes whole seconds,
+    // rounding up does not cut queries short.
+    int seconds = static_cast<int>((timeout.toMicroseconds() + 999999) /
+                                   1000000);
+    res = vc_query_with_timeout(vc, q, -1, seconds);
+  } else {
+    res = vc_query(vc, q);
+  }
+
+  // 0: invalid, 1: valid, 3: timeout
+  if (res == 3) {
+    klee_warning("STP timed out");
+    return SolverImpl::SOLVER_RUN_STATUS_TIMEOUT;
+  }
+  if (res != 0 && res != 1) {
+    klee_warning("STP did not return a recognized code");
+    return SolverImpl::SOLVER_RUN_STATUS_UNEXPECTED_EXIT_CODE;
+  }
+  hasSolution = !res;
 
   if (!hasSolution)
     return SolverImpl::SOLVER_RUN_STATUS_SUCCESS_UNSOLVABLE;
@@ -209,17 +295,51 @@ runAndGetCex(::VC vc, STPBuilder *builder, ::VCExpr q,
 
 static void stpTimeoutHandler(int x) { _exit(52); }
 
+namespace {
+/// Shared memory for counterexamples that do not fit into the preallocated
+/// segment, mapped for a single query.
+class LargeCexBuffer {
+  void *memory = MAP_FAILED;
+  std::size_t size = 0;
+
+public:
+  explicit LargeCexBuffer(std::size_t size) : size(size) {
+    memory = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                  MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  }
+  ~LargeCexBuffer() {
+    if (memory != MAP_FAILED)
+      munmap(memory, size);
+  }
+  LargeCexBuffer(const LargeCexBuffer &) = delete;
+  LargeCexBuffer &operator=(const LargeCexBuffer &) = delete;
+
+  unsigned char *get() const {
+    return memory == MAP_FAILED ? nullptr
+                                : static_cast<unsigned char *>(memory);
+  }
+};
+} // namespace
+
 static SolverImpl::SolverRunStatus
 runAndGetCexForked(::VC vc, STPBuilder *builder, ::VCExpr q,
                    const std::vector<const Array *> &objects,
                    std::vector<std::vector<unsigned char>> &values,
                    bool &hasSolution, time::Span timeout) {
   unsigned char *pos = shared_memory_ptr;
-  unsigned sum = 0;
+  std::size_t sum = 0;
   for (const auto object : objects)
     sum += object->size;
-  if (sum >= shared_memory_size)
-    llvm::report_fatal_error("not enough shared memory for counterexample");
+  std::unique_ptr<LargeCexBuffer> largeBuffer;
+  // a forked KLEE (e.g. an asynchronous query) must not write its
+  // counterexamples into the region its parent is using concurrently
+  if (sum >= shared_memory_size || shared_memory_owner != getpid()) {
+    largeBuffer =
+        std::make_unique<LargeCexBuffer>(std::max<std::size_t>(sum, 1));
+    pos = largeBuffer->get();
+    if (!pos)
+      llvm::report_fatal_error("not enough shared memory for counterexample");
+  }
 
   fflush(stdout);
   fflush(stderr);
@@ -340,15 +460,29 @@ bool STPSolverImpl::computeInitialValues(
   }
 
   bool success;
-  if (useForkedSTP) {
-    runStatusCode = runAndGetCexForked(vc, builder, stp_e, objects, values,
-                                       hasSolution, timeout);
-    success = ((SOLVER_RUN_STATUS_SUCCESS_SOLVABLE == runStatusCode) ||
-               (SOLVER_RUN_STATUS_SUCCESS_UNSOLVABLE == runStatusCode));
-  } else {
+  if (!useForkedSTP) {
     runStatusCode =
         runAndGetCex(vc, builder, stp_e, objects, values, hasSolution);
     success = true;
+  } else {
+    switch (STPRunModeOpt) {
+    case STPRunMode::Fork:
+      runStatusCode = runAndGetCexForked(vc, builder, stp_e, objects, values,
+                                         hasSolution, timeout);
+      break;
+    case STPRunMode::InProcess:
+      runStatusCode = runAndGetCex(vc, builder, stp_e, objects, values,
+                                   hasSolution, timeout);
+      break;
+    case STPRunMode::Child:
+      if (!child)
+        child = std::make_unique<STPChildProcess>();
+      runStatusCode =
+          child->run(query, objects, values, hasSolution, timeout);
+      break;
+    }
+    success = ((SOLVER_RUN_STATUS_SUCCESS_SOLVABLE == runStatusCode) ||
+               (SOLVER_RUN_STATUS_SUCCESS_UNSOLVABLE == runStatusCode));
   }
 
   if (success) {
@@ -367,6 +501,223 @@ SolverImpl::SolverRunStatus STPSolverImpl::getOperationStatusCode() {
   return runStatusCode;
 }
 
+/***/
+
+static bool writeAll(int fd, const void *data, std::size_t size) {
+  const char *pos = static_cast<const char *>(data);
+  while (size) {
+    // do not get killed by SIGPIPE if the other side is gone
+    ssize_t n = send(fd, pos, size, MSG_NOSIGNAL);
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      return false;
+    }
+    pos += n;
+    size -= n;
+  }
+  return true;
+}
+
+/// Reads exactly \p size bytes. Gives up once \p deadline (if set) passes,
+/// in which case \p timedOut is set.
+static bool readAll(int fd, void *data, std::size_t size, time::Point deadline,
+                    bool &timedOut) {
+  char *pos = static_cast<char *>(data);
+  timedOut = false;
+  while (size) {
+    if (deadline != time::Point()) {
+      const auto now = time::getWallTime();
+      if (now >= deadline) {
+        timedOut = true;
+        return false;
+      }
+      struct pollfd pfd = {fd, POLLIN, 0};
+      int res = poll(&pfd, 1,
+                     std::max<int>(1, (deadline - now).toMicroseconds() / 1000));
+      if (res < 0 && errno != EINTR)
+        return false;
+      if (res <= 0)
+        continue;
+    }
+    ssize_t n = read(fd, pos, size);
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      return false;
+    }
+    if (n == 0)
+      return false;
+    pos += n;
+    size -= n;
+  }
+  return true;
+}
+
+[[noreturn]] static void serveSTPQueries(int fd) {
+  // interrupts are handled by KLEE, which kills us if necessary
+  ::signal(SIGINT, SIG_IGN);
+
+  std::unique_ptr<ExprBuilder> exprBuilder(createDefaultExprBuilder());
+  bool timedOut;
+  for (;;) {
+    std::uint64_t length;
+    if (!readAll(fd, &length, sizeof(length), time::Point(), timedOut))
+      _exit(0);
+    std::string text(length, '\0');
+    if (!readAll(fd, &text[0], length, time::Point(), timedOut))
+      _exit(0);
+
+    auto buffer = llvm::MemoryBuffer::getMemBuffer(text, "query", false);
+    std::unique_ptr<expr::Parser> parser(expr::Parser::Create(
+        "query", buffer.get(), exprBuilder.get(), false));
+    std::unique_ptr<expr::Decl> decl;
+    while (expr::Decl *d = parser->ParseTopLevelDecl()) {
+      decl.reset(d);
+      if (llvm::isa<expr::QueryCommand>(d))
+        break;
+    }
+    auto *qc = llvm::dyn_cast_or_null<expr::QueryCommand>(decl.get());
+    if (parser->GetNumErrors() || !qc)
+      _exit(2);
+
+    // The arrays are owned by the parser and die with it, so a solver
+    // caching STP expressions per array must not outlive the query either.
+    STPSolverImpl solver(/*useForkedSTP=*/false);
+    std::vector<std::vector<unsigned char>> values;
+    bool hasSolution = false;
+    solver.computeInitialValues(
+        Query(ConstraintSet(qc->Constraints), qc->Query), qc->Objects,
+        values, hasSolution);
+    std::int32_t status = solver.getOperationStatusCode();
+    std::uint8_t solution = hasSolution;
+    if (!writeAll(fd, &status, sizeof(status)) ||
+        !writeAll(fd, &solution, sizeof(solution)))
+      _exit(0);
+    if (status == SolverImpl::SOLVER_RUN_STATUS_SUCCESS_SOLVABLE)
+      for (const auto &value : values)
+        if (!writeAll(fd, value.data(), value.size()))
+          _exit(0);
+  }
+}
+
+bool STPChildProcess::start() {
+  int fds[2];
+  if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0) {
+    klee_warning("socketpair failed (for STP) - %s",
+                 llvm::sys::StrError(errno).c_str());
+    return false;
+  }
+
+  fflush(stdout);
+  fflush(stderr);
+
+  pid = fork();
+  if (pid == -1) {
+    klee_warning("fork failed (for STP) - %s",
+                 llvm::sys::StrError(errno).c_str());
+    close(fds[0]);
+    close(fds[1]);
+    return false;
+  }
+  if (pid == 0) {
+    close(fds[0]);
+#ifdef __linux__
+    // a killed owner (e.g. a timed out asynchronous query) takes its
+    // server with it instead of leaving it solving an abandoned query
+    prctl(PR_SET_PDEATHSIG, SIGKILL);
+#endif
+    serveSTPQueries(fds[1]);
+  }
+
+  close(fds[1]);
+  fd = fds[0];
+  owner = getpid();
+  return true;
+}
+
+void STPChildProcess::detachIfForked() {
+  if (pid <= 0 || owner == getpid())
+    return;
+  // the server belongs to the process we were forked from
+  close(fd);
+  pid = -1;
+  fd = -1;
+}
+
+void STPChildProcess::stop() {
+  detachIfForked();
+  if (pid <= 0)
+    return;
+  close(fd);
+  kill(pid, SIGKILL);
+  int status;
+  while (waitpid(pid, &status, 0) < 0 && errno == EINTR)
+    ;
+  pid = -1;
+  fd = -1;
+}
+
+SolverImpl::SolverRunStatus
+STPChildProcess::run(const Query &query,
+                     const std::vector<const Array *> &objects,
+                     std::vector<std::vector<unsigned char>> &values,
+                     bool &hasSolution, time::Span timeout) {
+  detachIfForked();
+  if (pid <= 0 && !start()) {
+    if (!IgnoreSolverFailures)
+      exit(1);
+    return SolverImpl::SOLVER_RUN_STATUS_FORK_FAILED;
+  }
+
+  std::string text;
+  llvm::raw_string_ostream os(text);
+  ExprPPrinter::printQuery(os, query.constraints, query.expr, nullptr,
+                           nullptr, objects.data(),
+                           objects.data() + objects.size());
+  os.flush();
+
+  // the child is killed (and restarted for the next query) if it does not
+  // answer in time
+  const time::Point deadline =
+      timeout ? time::getWallTime() + timeout : time::Point();
+  std::uint64_t length = text.size();
+  std::int32_t status;
+  std::uint8_t solution;
+  bool timedOut = false;
+  bool ok = writeAll(fd, &length, sizeof(length)) &&
+            writeAll(fd, text.data(), text.size()) &&
+            readAll(fd, &status, sizeof(status), deadline, timedOut) &&
+            readAll(fd, &solution, sizeof(solution), deadline, timedOut);
+  if (ok && status == SolverImpl::SOLVER_RUN_STATUS_SUCCESS_SOLVABLE) {
+    values.reserve(objects.size());
+    for (const auto object : objects) {
+      values.emplace_back(object->size);
+      if (!readAll(fd, values.back().data(), object->size, deadline,
+                   timedOut)) {
+        ok = false;
+        break;
+      }
+    }
+  }
+
+  if (!ok) {
+    stop();
+    if (timedOut) {
+      klee_warning("STP timed out");
+      return SolverImpl::SOLVER_RUN_STATUS_TIMEOUT;
+    }
+    klee_warning("STP child process did not return successfully.  Most "
+                 "likely you forgot to run 'ulimit -s unlimited'");
+    if (!IgnoreSolverFailures)
+      exit(1);
+    return SolverImpl::SOLVER_RUN_STATUS_INTERRUPTED;
+  }
+
+  hasSolution = solution;
+  return static_cast<SolverImpl::SolverRunStatus>(status);
+}
+
 STPSolver::STPSolver(bool useForkedSTP, bool optimizeDivides)
     : Solver(new STPSolverImpl(useForkedSTP, optimizeDivides)) {}
 
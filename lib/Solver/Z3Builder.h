@@ -188,6 +188,7 @@ public:
   }
 
   void clearConstructCache() { constructed.clear(); }
+  std::size_t getConstructCacheSize() const { return constructed.size(); }
 };
 }
 
@@ -24,9 +24,13 @@
 #include "klee/Expr/ExprUtil.h"
 #include "klee/Solver/Solver.h"
 #include "klee/Solver/SolverImpl.h"
+#include "klee/Solver/SolverStats.h"
 #include "llvm/Support/CommandLine.h"
 #include "llvm/Support/raw_ostream.h"
 
+#include <algorithm>
+#include <unordered_set>
+
 namespace {
 // NOTE: Very useful for debugging Z3 behaviour. These files can be given to
 // the z3 binary to replay all Z3 API calls using its `-log` option.
@@ -49,6 +53,22 @@ llvm::cl::opt<unsigned>
     Z3VerbosityLevel("debug-z3-verbosity", llvm::cl::init(0),
                      llvm::cl::desc("Z3 verbosity level (default=0)"),
                      llvm::cl::cat(klee::SolvingCat));
+
+llvm::cl::opt<unsigned> Z3IncrementalSolvers(
+    "z3-incremental-solvers", llvm::cl::init(0),
+    llvm::cl::desc("Number of Z3 solvers kept alive across queries. A query "
+                   "reuses the solver sharing the longest constraint prefix "
+                   "with it and only asserts the remaining constraints, "
+                   "using one push/pop scope per constraint. Set to 0 to "
+                   "create a fresh solver for every query (default=0)"),
+    llvm::cl::cat(klee::SolvingCat));
+
+llvm::cl::opt<unsigned> Z3MaxConstructCacheSize(
+    "z3-max-construct-cache-size", llvm::cl::init(1U << 16),
+    llvm::cl::desc("With --z3-incremental-solvers, expressions translated to "
+                   "Z3 are cached across queries until the cache holds this "
+                   "many entries (default=65536)"),
+    llvm::cl::cat(klee::SolvingCat));
 }
 
 #include "llvm/Support/ErrorHandling.h"
@@ -57,6 +77,19 @@ namespace klee {
 
 class Z3SolverImpl : public SolverImpl {
 private:
+  /// A Z3 solver kept alive across queries, holding one push scope per
+  /// asserted constraint.
+  struct IncrementalSolver {
+    ::Z3_solver solver;
+    /// constraints[i] is asserted in scope i + 1
+    std::vector<ref<Expr>> constraints;
+    /// Constant arrays whose contents were asserted in the scope of the
+    /// respective constraint
+    std::vector<std::vector<const Array *>> scopeArrays;
+    std::unordered_set<const Array *> assertedArrays;
+    std::uint64_t lastUse;
+  };
+
   Z3Builder *builder;
   time::Span timeout;
   SolverRunStatus runStatusCode;
@@ -71,6 +104,13 @@ private:
                          bool &hasSolution);
   bool validateZ3Model(::Z3_solver &theSolver, ::Z3_model &theModel);
 
+  std::vector<IncrementalSolver> incrementalSolvers;
+  std::uint64_t incrementalUseCounter = 0;
+
+  IncrementalSolver &getIncrementalSolver(const ConstraintSet &constraints);
+  void assertConstantArrays(IncrementalSolver &is, const ref<Expr> &e,
+                            std::vector<const Array *> &newlyAsserted);
+
 public:
   Z3SolverImpl();
   ~Z3SolverImpl();
@@ -134,6 +174,8 @@ Z3SolverImpl::Z3SolverImpl()
 }
 
 Z3SolverImpl::~Z3SolverImpl() {
+  for (auto &is : incrementalSolvers)
+    Z3_solver_dec_ref(builder->ctx, is.solver);
   Z3_params_dec_ref(builder->ctx, solverParameters);
   delete builder;
 }
@@ -246,45 +288,143 @@ bool Z3SolverImpl::computeInitialValues(
   return internalRunSolver(query, &objects, &values, hasSolution);
 }
 
+void Z3SolverImpl::assertConstantArrays(
+    IncrementalSolver &is, const ref<Expr> &e,
+    std::vector<const Array *> &newlyAsserted) {
+  ConstantArrayFinder constant_arrays;
+  constant_arrays.visit(e);
+  for (auto const &constant_array : constant_arrays.results) {
+    if (!is.assertedArrays.insert(constant_array).second)
+      continue;
+    assert(builder->constant_array_assertions.count(constant_array) == 1 &&
+           "Constant array found in query, but not handled by Z3Builder");
+    for (auto const &arrayIndexValueExpr :
+         builder->constant_array_assertions[constant_array]) {
+      Z3_solver_assert(builder->ctx, is.solver, arrayIndexValueExpr);
+    }
+    newlyAsserted.push_back(constant_array);
+  }
+}
+
+Z3SolverImpl::IncrementalSolver &
+Z3SolverImpl::getIncrementalSolver(const ConstraintSet &constraints) {
+  // pick the solver sharing the longest prefix with the constraints,
+  // preferring the most recently used one
+  IncrementalSolver *best = nullptr;
+  std::size_t bestPrefix = 0;
+  for (auto &is : incrementalSolvers) {
+    std::size_t prefix = 0;
+    auto it = constraints.begin(), ie = constraints.end();
+    while (prefix < is.constraints.size() && it != ie &&
+           is.constraints[prefix] == *it) {
+      ++prefix;
+      ++it;
+    }
+    if (!best || prefix > bestPrefix ||
+        (prefix == bestPrefix && is.lastUse > best->lastUse)) {
+      best = &is;
+      bestPrefix = prefix;
+    }
+  }
+
+  if (!best || (bestPrefix == 0 &&
+                incrementalSolvers.size() < Z3IncrementalSolvers)) {
+    IncrementalSolver is;
+    is.solver = Z3_mk_solver(builder->ctx);
+    Z3_solver_inc_ref(builder->ctx, is.solver);
+    incrementalSolvers.push_back(std::move(is));
+    best = &incrementalSolvers.back();
+  } else if (bestPrefix == 0) {
+    // nothing in common, evict the least recently used solver
+    best = &*std::min_element(
+        incrementalSolvers.begin(), incrementalSolvers.end(),
+        [](const IncrementalSolver &a, const IncrementalSolver &b) {
+          return a.lastUse < b.lastUse;
+        });
+  }
+  best->lastUse = ++incrementalUseCounter;
+
+  // drop the constraints that differ
+  std::size_t numPops = best->constraints.size() - bestPrefix;
+  if (numPops) {
+    Z3_solver_pop(builder->ctx, best->solver, numPops);
+    for (std::size_t i = bestPrefix; i < best->constraints.size(); ++i)
+      for (const Array *array : best->scopeArrays[i])
+        best->assertedArrays.erase(array);
+    best->constraints.resize(bestPrefix);
+    best->scopeArrays.resize(bestPrefix);
+  }
+  stats::queryReusedConstraints += bestPrefix;
+
+  // and assert only the new ones
+  auto it = constraints.begin();
+  std::advance(it, bestPrefix);
+  for (auto ie = constraints.end(); it != ie; ++it) {
+    Z3_solver_push(builder->ctx, best->solver);
+    Z3_solver_assert(builder->ctx, best->solver, builder->construct(*it));
+    best->scopeArrays.emplace_back();
+    assertConstantArrays(*best, *it, best->scopeArrays.back());
+    best->constraints.push_back(*it);
+  }
+  return *best;
+}
+
 bool Z3SolverImpl::internalRunSolver(
     const Query &query, const std::vector<const Array *> *objects,
     std::vector<std::vector<unsigned char> > *values, bool &hasSolution) {
 
   TimerStatIncrementer t(stats::queryTime);
+  runStatusCode = SOLVER_RUN_STATUS_FAILURE;
+
   // NOTE: Z3 will switch to using a slower solver internally if push/pop are
-  // used so for now it is likely that creating a new solver each time is the
-  // right way to go until Z3 changes its behaviour.
+  // used, so by default a new solver is created for each query. On deep paths
+  // re-asserting all constraints can be more expensive than that, which is
+  // what the incremental solvers are for.
   //
   // TODO: Investigate using a custom tactic as described in
   // https://github.com/klee/klee/issues/653
-  Z3_solver theSolver = Z3_mk_solver(builder->ctx);
-  Z3_solver_inc_ref(builder->ctx, theSolver);
-  Z3_solver_set_params(builder->ctx, theSolver, solverParameters);
+  Z3_solver theSolver;
+  IncrementalSolver *incremental = nullptr;
+  Z3ASTHandle z3QueryExpr;
+  if (Z3IncrementalSolvers) {
+    incremental = &getIncrementalSolver(query.constraints);
+    theSolver = incremental->solver;
+    Z3_solver_set_params(builder->ctx, theSolver, solverParameters);
+
+    // the query itself lives in a scope of its own
+    Z3_solver_push(builder->ctx, theSolver);
+    z3QueryExpr = Z3ASTHandle(builder->construct(query.expr), builder->ctx);
+    std::vector<const Array *> queryArrays;
+    assertConstantArrays(*incremental, query.expr, queryArrays);
+    for (const Array *array : queryArrays)
+      incremental->assertedArrays.erase(array);
+  } else {
+    theSolver = Z3_mk_solver(builder->ctx);
+    Z3_solver_inc_ref(builder->ctx, theSolver);
+    Z3_solver_set_params(builder->ctx, theSolver, solverParameters);
+
+    ConstantArrayFinder constant_arrays_in_query;
+    for (auto const &constraint : query.constraints) {
+      Z3_solver_assert(builder->ctx, theSolver, builder->construct(constraint));
+      constant_arrays_in_query.visit(constraint);
+    }
 
-  runStatusCode = SOLVER_RUN_STATUS_FAILURE;
+    z3QueryExpr = Z3ASTHandle(builder->construct(query.expr), builder->ctx);
+    constant_arrays_in_query.visit(query.expr);
 
-  ConstantArrayFinder constant_arrays_in_query;
-  for (auto const &constraint : query.constraints) {
-    Z3_solver_assert(builder->ctx, theSolver, builder->construct(constraint));
-    constant_arrays_in_query.visit(constraint);
+    for (auto const &constant_array : constant_arrays_in_query.results) {
+      assert(builder->constant_array_assertions.count(constant_array) == 1 &&
+             "Constant array found in query, but not handled by Z3Builder");
+      for (auto const &arrayIndexValueExpr :
+           builder->constant_array_assertions[constant_array]) {
+        Z3_solver_assert(builder->ctx, theSolver, arrayIndexValueExpr);
+      }
+    }
   }
   ++stats::queries;
   if (objects)
     ++stats::queryCounterexamples;
 
-  Z3ASTHandle z3QueryExpr =
-      Z3ASTHandle(builder->construct(query.expr), builder->ctx);
-  constant_arrays_in_query.visit(query.expr);
-
-  for (auto const &constant_array : constant_arrays_in_query.results) {
-    assert(builder->constant_array_assertions.count(constant_array) == 1 &&
-           "Constant array found in query, but not handled by Z3Builder");
-    for (auto const &arrayIndexValueExpr :
-         builder->constant_array_assertions[constant_array]) {
-      Z3_solver_assert(builder->ctx, theSolver, arrayIndexValueExpr);
-    }
-  }
-
   // KLEE Queries are validity queries i.e.
   // ∀ X Constraints(X) → query(X)
   // but Z3 works in terms of satisfiability so instead we ask the
@@ -307,13 +447,29 @@ bool Z3SolverImpl::internalRunSolver(
   runStatusCode = handleSolverResponse(theSolver, satisfiable, objects, values,
                                        hasSolution);
 
-  Z3_solver_dec_ref(builder->ctx, theSolver);
-  // Clear the builder's cache to prevent memory usage exploding.
-  // By using ``autoClearConstructCache=false`` and clearning now
-  // we allow Z3_ast expressions to be shared from an entire
-  // ``Query`` rather than only sharing within a single call to
-  // ``builder->construct()``.
-  builder->clearConstructCache();
+  if (incremental) {
+    if (runStatusCode == SolverImpl::SOLVER_RUN_STATUS_SUCCESS_SOLVABLE ||
+        runStatusCode == SolverImpl::SOLVER_RUN_STATUS_SUCCESS_UNSOLVABLE) {
+      Z3_solver_pop(builder->ctx, theSolver, 1);
+    } else {
+      // do not rely on the state of a solver that gave up
+      Z3_solver_dec_ref(builder->ctx, theSolver);
+      incrementalSolvers.erase(incrementalSolvers.begin() +
+                               (incremental - incrementalSolvers.data()));
+    }
+    // Z3_ast expressions are shared across queries as long as the cache
+    // does not grow too large
+    if (builder->getConstructCacheSize() > Z3MaxConstructCacheSize)
+      builder->clearConstructCache();
+  } else {
+    Z3_solver_dec_ref(builder->ctx, theSolver);
+    // Clear the builder's cache to prevent memory usage exploding.
+    // By using ``autoClearConstructCache=false`` and clearning now
+    // we allow Z3_ast expressions to be shared from an entire
+    // ``Query`` rather than only sharing within a single call to
+    // ``builder->construct()``.
+    builder->clearConstructCache();
+  }
 
   if (runStatusCode == SolverImpl::SOLVER_RUN_STATUS_SUCCESS_SOLVABLE ||
       runStatusCode == SolverImpl::SOLVER_RUN_STATUS_SUCCESS_UNSOLVABLE) {
@@ -45,6 +45,8 @@
 #include "klee/ADT/RNG.h"
 #include "klee/Support/OptionCategories.h"
 
+#include <algorithm>
+
 using namespace klee;
 
 namespace {
@@ -78,6 +80,20 @@ void RNG::seed(unsigned int s) {
   }
 }
 
+std::vector<unsigned int> RNG::getState() const {
+  std::vector<unsigned int> state(mt, mt + N);
+  state.push_back(mti);
+  return state;
+}
+
+bool RNG::setState(const std::vector<unsigned int> &state) {
+  if (state.size() != N + 1 || state[N] > N)
+    return false;
+  std::copy(state.begin(), state.begin() + N, mt);
+  mti = state[N];
+  return true;
+}
+
 /* generates a random number on [0,0xffffffff]-interval */
 unsigned int RNG::getInt32() {
   unsigned int y;
@@ -0,0 +1,98 @@
+//===-- RecordFile.cpp ----------------------------------------------------===//
+//
+//                     The KLEE Symbolic Virtual Machine
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+
+#include "klee/Support/RecordFile.h"
+
+#include "llvm/Support/LEB128.h"
+#include "llvm/Support/xxhash.h"
+
+#include <cstring>
+
+using namespace klee;
+
+void RecordWriter::writeInt(std::uint64_t value) {
+  std::uint8_t bytes[10];
+  unsigned size = llvm::encodeULEB128(value, bytes);
+  buffer.append(reinterpret_cast<const char *>(bytes), size);
+}
+
+void RecordWriter::writeString(const std::string &s) {
+  writeInt(s.size());
+  buffer += s;
+}
+
+void RecordWriter::writeBytes(const void *data, std::size_t size) {
+  buffer.append(static_cast<const char *>(data), size);
+}
+
+std::uint64_t RecordReader::readInt() {
+  unsigned size = 0;
+  const char *error = nullptr;
+  std::uint64_t value = llvm::decodeULEB128(
+      reinterpret_cast<const std::uint8_t *>(pos), &size,
+      reinterpret_cast<const std::uint8_t *>(end), &error);
+  if (error) {
+    failed = true;
+    pos = end;
+    return 0;
+  }
+  pos += size;
+  return value;
+}
+
+std::string RecordReader::readString() {
+  std::uint64_t size = readInt();
+  if (size > std::uint64_t(end - pos)) {
+    failed = true;
+    pos = end;
+    return std::string();
+  }
+  std::string s(pos, size);
+  pos += size;
+  return s;
+}
+
+void RecordReader::readBytes(void *data, std::size_t size) {
+  if (size > std::size_t(end - pos)) {
+    failed = true;
+    pos = end;
+    std::memset(data, 0, size);
+    return;
+  }
+  std::memcpy(data, pos, size);
+  pos += size;
+}
+
+static std::uint32_t payloadHash(llvm::StringRef payload) {
+  return static_cast<std::uint32_t>(llvm::xxHash64(payload));
+}
+
+void klee::appendRecord(std::string &file, llvm::StringRef payload) {
+  RecordHeader header = {static_cast<std::uint32_t>(payload.size()),
+                         payloadHash(payload)};
+  file.append(reinterpret_cast<const char *>(&header), sizeof(header));
+  file.append(payload.begin(), payload.end());
+}
+
+bool klee::readRecord(const char *data, std::size_t size, std::size_t &pos,
+                      llvm::StringRef &payload) {
+  RecordHeader header;
+  if (pos > size || size - pos < sizeof(header))
+    return false;
+  std::memcpy(&header, data + pos, sizeof(header));
+  const std::size_t start = pos + sizeof(header);
+  if (header.size > size - start)
+    return false;
+  llvm::StringRef p(data + start, header.size);
+  if (payloadHash(p) != header.payloadHash)
+    return false;
+  payload = p;
+  pos = start + header.size;
+  return true;
+}
@@ -0,0 +1,21 @@
+// RUN: %clang %s -emit-llvm %O0opt -c -o %t.bc
+// RUN: rm -rf %t.klee-out
+// RUN: %klee --output-dir=%t.klee-out --async-solver-queries=4 --async-solver-threshold=1ms %t.bc 2>&1 | FileCheck %s
+
+#include "klee/klee.h"
+
+int main() {
+  unsigned x[2];
+  volatile int count = 0;
+
+  klee_make_symbolic(x, sizeof(x), "x");
+
+  // nonlinear conditions keep the solver busy for a while
+  for (unsigned i = 0; i < 3; ++i)
+    if ((x[0] + i) * x[1] % 1009 > 500)
+      ++count;
+
+  return 0;
+}
+
+// CHECK: KLEE: done: completed paths = 8
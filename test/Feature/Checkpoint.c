@@ -0,0 +1,32 @@
+// RUN: %clang %s -emit-llvm %O0opt -c -o %t.bc
+// RUN: rm -rf %t.klee-out %t.klee-resumed
+// RUN: %klee --output-dir=%t.klee-out --search=dfs --max-instructions=10000 --dump-states-on-halt=false --checkpoint-interval=1h %t.bc 2>&1 | FileCheck --check-prefix=CHECK-HALT %s
+// RUN: test -f %t.klee-out/checkpoint
+// RUN: %klee --output-dir=%t.klee-resumed --search=dfs --resume-from=%t.klee-out %t.bc 2>&1 | FileCheck --check-prefix=CHECK-RESUME %s
+// RUN: find %t.klee-out %t.klee-resumed -name '*.ktest' | wc -l | FileCheck --check-prefix=CHECK-TESTS %s
+
+#include "klee/klee.h"
+
+int main() {
+  char buf[4];
+  volatile int sum = 0;
+
+  klee_make_symbolic(buf, sizeof(buf), "buf");
+
+  for (int i = 0; i < 4; ++i) {
+    if (buf[i] > 50)
+      for (int j = 0; j < 50; ++j)
+        sum += j;
+    else
+      for (int j = 0; j < 50; ++j)
+        sum -= j;
+  }
+
+  return 0;
+}
+
+// CHECK-HALT: KLEE: done: total instructions = 10000
+// CHECK-RESUME: KLEE: resumed [[N:[0-9]+]] of [[N]] states from the checkpoint
+// CHECK-RESUME: KLEE: done: partially completed paths = 0
+// Every path is completed exactly once by one of the runs
+// CHECK-TESTS: {{^ *16$}}
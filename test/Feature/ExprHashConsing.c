@@ -0,0 +1,26 @@
+// RUN: %clang %s -emit-llvm %O0opt -c -o %t.bc
+// RUN: rm -rf %t.klee-out
+// RUN: %klee --output-dir=%t.klee-out --expr-hash-consing %t.bc 2>&1 | FileCheck %s
+
+#include "klee/klee.h"
+
+volatile int taken;
+
+int main() {
+  int x, y;
+  klee_make_symbolic(&x, sizeof(x), "x");
+  klee_make_symbolic(&y, sizeof(y), "y");
+
+  // the same expressions are built again on every path
+  int n = 0;
+  for (int i = 0; i < 4; ++i) {
+    if ((x >> i) & 1) {
+      taken = i;
+      n += y + i;
+    } else {
+      n -= y + i;
+    }
+  }
+  return n == 2 * y;
+}
+// CHECK: KLEE: done: completed paths = 16
@@ -0,0 +1,30 @@
+// RUN: %clang %s -emit-llvm %O0opt -c -o %t.bc
+// RUN: rm -rf %t.klee-out
+// RUN: %klee --output-dir=%t.klee-out --external-calls=all --allocate-determ --external-calls-watch-writes %t.bc 2>&1 | FileCheck %s
+
+#include <assert.h>
+#include <string.h>
+
+char big[1 << 20];
+
+int main() {
+  char buf[4];
+  char *p = buf;
+
+  // the unmodified object is neither copied out nor back in again
+  for (unsigned i = 0; i < 16; ++i)
+    assert(strlen("a,b") == 3);
+
+  // strsep writes to buf through a pointer stored in memory
+  strcpy(buf, "a,b");
+  strsep(&p, ",");
+  assert(buf[1] == 0 && p == buf + 2);
+
+  big[42] = 1;
+  assert(strlen(big + 42) == 1);
+
+  return 0;
+}
+
+// CHECK-NOT: ASSERTION FAIL
+// CHECK: KLEE: done: completed paths = 1
@@ -0,0 +1,30 @@
+// RUN: %clang %s -emit-llvm %O0opt -c -o %t.bc
+// RUN: rm -rf %t.klee-out
+// RUN: %klee --output-dir=%t.klee-out --search=nurs:md2u --uncovered-update-interval=1ms %t.bc 2>&1 | FileCheck %s
+
+// Distances to uncovered instructions are updated many times while the
+// branches below get covered one after the other
+
+#include "klee/klee.h"
+
+int classify(int x) {
+  if (x < 0)
+    return -1;
+  if (x == 0)
+    return 0;
+  if (x < 100)
+    return 1;
+  return 2;
+}
+
+int main() {
+  int a, b;
+  klee_make_symbolic(&a, sizeof(a), "a");
+  klee_make_symbolic(&b, sizeof(b), "b");
+
+  int sum = classify(a) + classify(b);
+  if (sum > 2)
+    return 1;
+  return 0;
+}
+// CHECK: KLEE: done: completed paths = 16
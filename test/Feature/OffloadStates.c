@@ -0,0 +1,29 @@
+// RUN: %clang %s -emit-llvm %O0opt -c -o %t.bc
+// RUN: rm -rf %t.klee-out
+// RUN: %klee --output-dir=%t.klee-out --search=dfs --max-memory=1 --max-memory-inhibit=false --offload-states %t.bc 2>&1 | FileCheck %s
+
+#include "klee/klee.h"
+
+#include <assert.h>
+
+char buf[4096];
+
+int main() {
+  unsigned char x;
+  klee_make_symbolic(&x, sizeof(x), "x");
+
+  // Every path overwrites the buffer, so the dormant states left behind by
+  // the depth-first search end up being the only ones referring to their
+  // contents, which are offloaded and restored when the states run again.
+  for (int i = 0; i < 4; ++i) {
+    unsigned char bit = (x >> i) & 1;
+    for (int j = 0; j < sizeof(buf); ++j)
+      buf[j] = bit ? x + j : j;
+    for (int j = 0; j < sizeof(buf); ++j)
+      assert(buf[j] == (char)(bit ? x + j : j));
+  }
+  return 0;
+}
+// CHECK: KLEE: offloaded
+// CHECK-NOT: ASSERTION FAIL
+// CHECK: KLEE: done: completed paths = 16
@@ -0,0 +1,26 @@
+// RUN: %clang %s -emit-llvm %O0opt -c -o %t.bc
+// RUN: rm -rf %t.klee-out
+// RUN: %klee --output-dir=%t.klee-out --parallel-workers=3 --timer-interval=1ms %t.bc 2>&1 | FileCheck %s
+// RUN: test -f %t.klee-out/test000256.ktest
+// RUN: not test -f %t.klee-out/test000257.ktest
+// RUN: test -f %t.klee-out/worker-0/run.stats
+// RUN: test -f %t.klee-out/worker-2/info
+
+#include "klee/klee.h"
+
+int main() {
+  char buf[8];
+  volatile int count = 0;
+
+  klee_make_symbolic(buf, sizeof(buf), "buf");
+
+  for (int i = 0; i < 8; ++i)
+    if (buf[i] > 50)
+      ++count;
+
+  return 0;
+}
+
+// CHECK: KLEE: started 3 worker processes
+// CHECK: KLEE: done: completed paths = 256
+// CHECK: KLEE: done: generated tests = 256
@@ -0,0 +1,22 @@
+// RUN: %clang %s -g -emit-llvm %O0opt -c -o %t.bc
+// RUN: rm -rf %t.klee-out
+// RUN: %klee --output-dir=%t.klee-out %t.bc 2>&1 | FileCheck %s
+// RUN: %klee-stats --print-columns 'RCacheHits,RCacheMisses' --table-format=csv %t.klee-out | FileCheck --check-prefix=CHECK-STATS %s
+
+#include <stdlib.h>
+
+int main() {
+  int *x = malloc(sizeof(int));
+
+  // After the first iteration, the store finds x in the resolution cache,
+  // until x is freed
+  for (int i = 0; i < 3; ++i) {
+    // CHECK: ResolutionCache.c:[[@LINE+1]]: memory error: out of bound pointer
+    *x = i;
+    if (i == 1)
+      free(x);
+  }
+  return 0;
+}
+// CHECK-STATS: RCacheHits,RCacheMisses
+// CHECK-STATS-NEXT: {{[1-9][0-9]*,[1-9][0-9]*}}
@@ -0,0 +1,63 @@
+// RUN: %clang %s -emit-llvm %O0opt -c -o %t.bc
+// RUN: rm -rf %t.klee-out
+// RUN: %klee --output-dir=%t.klee-out --run-concrete-natively --max-instructions=100000 %t.bc 2>&1 | FileCheck %s
+// RUN: %clang %s -emit-llvm %O0opt -c -DDEEP_RECURSION -o %t.deep.bc
+// RUN: rm -rf %t.deep.klee-out
+// RUN: %klee --output-dir=%t.deep.klee-out --run-concrete-natively %t.deep.bc 2>&1 | FileCheck -check-prefix=CHECK-DEEP %s
+
+#include "klee/klee.h"
+
+#include <assert.h>
+
+unsigned data[1024];
+
+unsigned scramble(unsigned *buf, unsigned n, unsigned rounds) {
+  unsigned h = 0;
+  for (unsigned r = 0; r < rounds; ++r) {
+    for (unsigned i = 0; i < n; ++i) {
+      buf[i] = buf[i] * 2654435761u + r;
+      h ^= buf[i];
+    }
+  }
+  return h;
+}
+
+unsigned recurse(unsigned depth) {
+  unsigned s = 0;
+  for (unsigned i = 0; i < 4; ++i)
+    s += i;
+  return depth ? recurse(depth - 1) + s : s;
+}
+
+int main() {
+#ifdef DEEP_RECURSION
+  assert(recurse(100) == 606);
+
+  // Overflows the stack when run natively and is interpreted instead
+  recurse(100000000);
+  return 0;
+#endif
+
+  for (unsigned i = 0; i < 1024; ++i)
+    data[i] = i;
+
+  // Interpreting this call would take far more instructions than allowed
+  assert(scramble(data, 1024, 100) == 3556472832u);
+  assert(data[1023] == 2052099669u);
+
+  // Runs into symbolic memory and is interpreted instead
+  unsigned x[4];
+  klee_make_symbolic(x, sizeof(x), "x");
+  if (scramble(x, 4, 1) == 0)
+    data[0] = 1;
+  else
+    data[0] = 2;
+
+  return 0;
+}
+// CHECK-NOT: ASSERTION FAIL
+// CHECK: KLEE: done: completed paths = 2
+// CHECK-DEEP-NOT: ASSERTION FAIL
+// CHECK-DEEP: Maximum stack size reached.
+// CHECK-DEEP: KLEE: done: completed paths = 0
+// CHECK-DEEP: KLEE: done: partially completed paths = 1
@@ -0,0 +1,35 @@
+// RUN: %clang %s -emit-llvm %O0opt -c -o %t.bc
+// RUN: rm -rf %t.klee-out
+// RUN: %klee --output-dir=%t.klee-out --run-concrete-natively --search=dfs %t.bc 2>&1 | FileCheck %s
+
+#include "klee/klee.h"
+
+#include <stdio.h>
+
+const char msg[] = "hello";
+
+void clobber(char *m, unsigned *x) {
+  unsigned i = 0;
+  // Natively, the write happens before the call faults on symbolic x
+  do {
+    m[0] = 'j';
+  } while (++i < *x);
+}
+
+int main() {
+  unsigned x, y;
+  klee_make_symbolic(&x, sizeof(x), "x");
+  klee_make_symbolic(&y, sizeof(y), "y");
+
+  // The abandoned native call must not leave msg modified for the external
+  // call on the other path
+  if (y)
+    puts(msg);
+  else
+    clobber((char *)msg, &x);
+
+  return 0;
+}
+// CHECK: memory error: object read only
+// CHECK-NOT: external modified read-only object
+// CHECK: KLEE: done: completed paths = 1
@@ -0,0 +1,33 @@
+// RUN: %clang %s -emit-llvm %O0opt -c -o %t.bc
+// RUN: rm -rf %t.klee-out
+// RUN: %klee --output-dir=%t.klee-out %t.bc 2>&1 | FileCheck %s
+
+#include "klee/klee.h"
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+int *objs[1000];
+
+int main() {
+  for (int i = 0; i < 1000; ++i) {
+    objs[i] = malloc(sizeof(int));
+    *objs[i] = i;
+  }
+
+  unsigned i;
+  klee_make_symbolic(&i, sizeof(i), "i");
+  klee_assume(i < 3);
+
+  // A pointer into one of three objects, with many objects in between
+  uintptr_t p = (uintptr_t)objs[0] * (i == 0) +
+                (uintptr_t)objs[500] * (i == 1) +
+                (uintptr_t)objs[999] * (i == 2);
+  int v = *(int *)p;
+  assert(v == 0 || v == 500 || v == 999);
+
+  return 0;
+}
+// CHECK-NOT: ASSERTION FAIL
+// CHECK: KLEE: done: completed paths = 3
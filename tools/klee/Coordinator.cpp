@@ -0,0 +1,352 @@
+//===-- Coordinator.cpp ---------------------------------------------------===//
+//
+//                     The KLEE Symbolic Virtual Machine
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+
+#include "Coordinator.h"
+
+#include "klee/Core/Interpreter.h"
+#include "klee/Support/ErrorHandling.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <new>
+#include <sstream>
+
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+using namespace klee;
+
+namespace {
+std::string encodeDecisions(const char *tag,
+                            const std::vector<std::uint32_t> &decisions) {
+  std::ostringstream os;
+  os << tag << ' ' << decisions.size();
+  for (auto d : decisions)
+    os << ' ' << d;
+  return os.str();
+}
+
+bool decodeDecisions(const std::string &line,
+                     std::vector<std::uint32_t> &decisions) {
+  std::istringstream is(line);
+  std::string tag;
+  std::size_t n;
+  if (!(is >> tag >> n))
+    return false;
+  decisions.clear();
+  decisions.reserve(n);
+  for (std::size_t i = 0; i < n; ++i) {
+    std::uint32_t d;
+    if (!(is >> d))
+      return false;
+    decisions.push_back(d);
+  }
+  return true;
+}
+
+bool hasTag(const std::string &line, const char *tag) {
+  std::size_t len = strlen(tag);
+  return line.compare(0, len, tag) == 0 &&
+         (line.size() == len || line[len] == ' ');
+}
+} // namespace
+
+/***/
+
+MessageChannel::~MessageChannel() { close(fd); }
+
+bool MessageChannel::receive(std::string &line, bool block, bool &closed) {
+  closed = false;
+  for (;;) {
+    std::size_t eol = buffer.find('\n');
+    if (eol != std::string::npos) {
+      line = buffer.substr(0, eol);
+      buffer.erase(0, eol + 1);
+      return true;
+    }
+
+    if (!block) {
+      struct pollfd pfd = {fd, POLLIN, 0};
+      int res = poll(&pfd, 1, 0);
+      if (res < 0 && errno != EINTR)
+        klee_error("poll on coordinator socket failed: %s", strerror(errno));
+      if (res <= 0)
+        return false;
+    }
+
+    char chunk[4096];
+    ssize_t n = read(fd, chunk, sizeof(chunk));
+    if (n < 0) {
+      if (errno == EINTR) {
+        if (!block)
+          return false;
+        continue;
+      }
+      klee_error("read from coordinator socket failed: %s", strerror(errno));
+    }
+    if (n == 0) {
+      closed = true;
+      return false;
+    }
+    buffer.append(chunk, n);
+  }
+}
+
+void MessageChannel::send(const std::string &line) {
+  std::string msg = line + '\n';
+  const char *data = msg.data();
+  std::size_t left = msg.size();
+  while (left) {
+    // a crashed peer must not take us down with SIGPIPE
+    ssize_t n = ::send(fd, data, left, MSG_NOSIGNAL);
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      if (errno != EPIPE && errno != ECONNRESET)
+        klee_warning("write to coordinator socket failed: %s",
+                     strerror(errno));
+      // the peer is gone, it will be noticed when reading
+      return;
+    }
+    data += n;
+    left -= n;
+  }
+}
+
+/***/
+
+bool WorkerChannel::requestWork(std::vector<std::uint32_t> &decisions) {
+  if (done)
+    return false;
+
+  channel.send("IDLE");
+  std::string line;
+  bool closed;
+  while (channel.receive(line, /*block=*/true, closed)) {
+    if (hasTag(line, "WORK")) {
+      if (!decodeDecisions(line, decisions))
+        klee_error("worker %u: malformed work item from coordinator", id);
+      return true;
+    } else if (hasTag(line, "STEAL")) {
+      // nothing to give away while idle
+      channel.send("NONE");
+    } else if (hasTag(line, "DONE")) {
+      break;
+    }
+  }
+  done = true;
+  return false;
+}
+
+bool WorkerChannel::handleRequests(Interpreter &interpreter) {
+  std::string line;
+  bool closed = false;
+  while (!done && channel.receive(line, /*block=*/false, closed)) {
+    if (hasTag(line, "STEAL")) {
+      std::vector<std::uint32_t> decisions;
+      if (interpreter.donateState(decisions))
+        channel.send(encodeDecisions("GIVE", decisions));
+      else
+        channel.send("NONE");
+    } else if (hasTag(line, "DONE")) {
+      done = true;
+    }
+  }
+  if (closed)
+    done = true;
+  return !done;
+}
+
+/***/
+
+Coordinator::Coordinator(unsigned numWorkers) : workers(numWorkers) {
+  void *mem = mmap(nullptr, sizeof(SharedCounters), PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (mem == MAP_FAILED)
+    klee_error("unable to map shared counters: %s", strerror(errno));
+  counters = new (mem) SharedCounters();
+}
+
+Coordinator::~Coordinator() {
+  counters->~SharedCounters();
+  munmap(counters, sizeof(SharedCounters));
+}
+
+std::unique_ptr<WorkerChannel> Coordinator::spawnWorkers() {
+  // do not duplicate buffered output into the children
+  fflush(nullptr);
+
+  for (unsigned i = 0; i < workers.size(); ++i) {
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0)
+      klee_error("unable to create worker socket: %s", strerror(errno));
+
+    pid_t pid = fork();
+    if (pid < 0)
+      klee_error("unable to fork worker %u: %s", i, strerror(errno));
+
+    if (pid == 0) {
+      close(fds[0]);
+      // drop the connections of the workers forked before us
+      for (unsigned j = 0; j < i; ++j)
+        workers[j].channel.reset();
+      return std::make_unique<WorkerChannel>(i, fds[1]);
+    }
+
+    close(fds[1]);
+    workers[i].pid = pid;
+    workers[i].channel = std::make_unique<MessageChannel>(fds[0]);
+  }
+
+  klee_message("started %zu worker processes", workers.size());
+  // the initial state roots the whole tree
+  pendingWork.emplace_back();
+  return nullptr;
+}
+
+bool Coordinator::allWorkersIdle() const {
+  return std::all_of(workers.begin(), workers.end(), [](const Worker &w) {
+    return w.exited || (w.idle && !w.stealPending);
+  });
+}
+
+void Coordinator::handleMessage(unsigned workerID, const std::string &line) {
+  Worker &w = workers[workerID];
+  if (hasTag(line, "IDLE")) {
+    w.idle = true;
+  } else if (hasTag(line, "GIVE")) {
+    std::vector<std::uint32_t> decisions;
+    if (decodeDecisions(line, decisions))
+      pendingWork.push_back(std::move(decisions));
+    else
+      klee_warning("malformed work item from worker %u", workerID);
+    w.stealPending = false;
+  } else if (hasTag(line, "NONE")) {
+    w.stealPending = false;
+  }
+}
+
+bool Coordinator::run(const time::Span &maxTime, unsigned maxTests) {
+  const auto startTime = time::getWallTime();
+  bool stopping = false;
+  unsigned nextVictim = 0;
+
+  for (;;) {
+    if (!stopping &&
+        (stopRequested ||
+         (maxTime && time::getWallTime() - startTime > maxTime) ||
+         (maxTests && counters->numGeneratedTests >= maxTests))) {
+      stopping = true;
+      if (!pendingWork.empty())
+        klee_warning("dropping %zu unexplored subtrees", pendingWork.size());
+      pendingWork.clear();
+    }
+
+    // exploration is complete once nobody has states left
+    if (!stopping && pendingWork.empty() && allWorkersIdle())
+      stopping = true;
+
+    if (stopping) {
+      for (auto &w : workers) {
+        if (!w.exited && !w.finished) {
+          w.channel->send("DONE");
+          w.finished = true;
+        }
+      }
+    } else {
+      // hand out work, stealing from busy workers if there is none
+      unsigned idle = 0, stealing = 0;
+      for (auto &w : workers) {
+        if (w.exited || !w.idle)
+          continue;
+        if (!pendingWork.empty()) {
+          w.subtree = std::move(pendingWork.front());
+          pendingWork.pop_front();
+          w.channel->send(encodeDecisions("WORK", w.subtree));
+          w.idle = false;
+        } else {
+          ++idle;
+        }
+      }
+      for (const auto &w : workers)
+        stealing += w.stealPending;
+      for (unsigned i = 0; i < workers.size() && stealing < idle; ++i) {
+        Worker &victim = workers[(nextVictim + i) % workers.size()];
+        if (victim.exited || victim.idle || victim.stealPending)
+          continue;
+        victim.channel->send("STEAL");
+        victim.stealPending = true;
+        ++stealing;
+        nextVictim = (nextVictim + i + 1) % workers.size();
+      }
+    }
+
+    // wait for messages
+    std::vector<struct pollfd> pfds;
+    std::vector<unsigned> ids;
+    for (unsigned i = 0; i < workers.size(); ++i) {
+      if (workers[i].exited)
+        continue;
+      pfds.push_back({workers[i].channel->getFD(), POLLIN, 0});
+      ids.push_back(i);
+    }
+    if (pfds.empty())
+      break;
+
+    int res = poll(pfds.data(), pfds.size(), 100);
+    if (res < 0 && errno != EINTR)
+      klee_error("poll on worker sockets failed: %s", strerror(errno));
+
+    for (unsigned k = 0; res > 0 && k < pfds.size(); ++k) {
+      if (!(pfds[k].revents & (POLLIN | POLLHUP | POLLERR)))
+        continue;
+      Worker &w = workers[ids[k]];
+      std::string line;
+      bool closed;
+      while (w.channel->receive(line, /*block=*/false, closed))
+        handleMessage(ids[k], line);
+      if (closed) {
+        if (!w.idle && !w.finished) {
+          // The subtree is explored again from its root, parts of it may
+          // already have been explored or given away.
+          if (retriedWork.insert(w.subtree).second) {
+            klee_warning("worker %u exited while exploring, handing out its "
+                         "subtree again (tests may be duplicated)",
+                         ids[k]);
+            pendingWork.push_back(w.subtree);
+          } else {
+            klee_warning("worker %u exited while exploring a subtree that "
+                         "already crashed a worker, dropping it",
+                         ids[k]);
+            ++lostSubtrees;
+          }
+        }
+        w.exited = true;
+        w.stealPending = false;
+        w.channel.reset();
+        int status;
+        waitpid(w.pid, &status, 0);
+      }
+    }
+  }
+
+  // work left over when no worker survived
+  if (!pendingWork.empty()) {
+    klee_warning("no workers left for %zu unexplored subtrees",
+                 pendingWork.size());
+    lostSubtrees += pendingWork.size();
+    pendingWork.clear();
+  }
+  return lostSubtrees == 0;
+}
@@ -0,0 +1,140 @@
+//===-- Coordinator.h -------------------------------------------*- C++ -*-===//
+//
+//                     The KLEE Symbolic Virtual Machine
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// Distributed exploration: a coordinator process forks several KLEE worker
+// processes and moves unexplored subtrees between them. A subtree is
+// identified by the branch decisions leading to its root state, which the
+// receiving worker replays from the initial state. Workers talk to the
+// coordinator over Unix-domain sockets using a line based protocol:
+//
+//   worker -> coordinator:  IDLE | GIVE <n> <d1> ... <dn> | NONE
+//   coordinator -> worker:  WORK <n> <d1> ... <dn> | STEAL | DONE
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef KLEE_COORDINATOR_H
+#define KLEE_COORDINATOR_H
+
+#include "klee/System/Time.h"
+
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <set>
+#include <string>
+#include <vector>
+
+#include <sys/types.h>
+
+namespace klee {
+class Interpreter;
+
+/// Counters shared between the coordinator and all workers, e.g. to number
+/// the test cases written into the common output directory consecutively.
+struct SharedCounters {
+  std::atomic<unsigned> numTotalTests;
+  std::atomic<unsigned> numGeneratedTests;
+  std::atomic<unsigned> pathsCompleted;
+  std::atomic<unsigned> pathsExplored;
+  std::atomic<std::uint64_t> instructions;
+};
+
+/// Line based message stream over a socket.
+class MessageChannel {
+  int fd;
+  std::string buffer;
+
+public:
+  explicit MessageChannel(int fd) : fd(fd) {}
+  ~MessageChannel();
+  MessageChannel(const MessageChannel &) = delete;
+  MessageChannel &operator=(const MessageChannel &) = delete;
+
+  int getFD() const { return fd; }
+
+  /// Reads the next complete line. When \p block is false, only data that
+  /// is already available is consumed. Returns false if no complete line
+  /// could be read; \p closed is set if the peer closed the connection.
+  bool receive(std::string &line, bool block, bool &closed);
+  void send(const std::string &line);
+};
+
+/// Worker end of the connection to the coordinator.
+class WorkerChannel {
+  MessageChannel channel;
+  unsigned id;
+  bool done = false;
+
+public:
+  WorkerChannel(unsigned id, int fd) : channel(fd), id(id) {}
+
+  unsigned getID() const { return id; }
+
+  /// Tells the coordinator that this worker ran out of states and waits for
+  /// the branch decisions of a new subtree. Returns false once the
+  /// exploration is over.
+  bool requestWork(std::vector<std::uint32_t> &decisions);
+
+  /// Serves requests that arrived while \p interpreter is exploring, i.e.
+  /// gives away a pending state when asked to. Returns false if the
+  /// coordinator requested to stop.
+  bool handleRequests(Interpreter &interpreter);
+};
+
+/// Coordinator end: forks the workers and balances work between them.
+class Coordinator {
+  struct Worker {
+    pid_t pid = 0;
+    std::unique_ptr<MessageChannel> channel;
+    bool idle = false;
+    bool stealPending = false;
+    bool finished = false; // DONE was sent
+    bool exited = false;
+    /// Root of the subtree handed to the worker by the last WORK message.
+    std::vector<std::uint32_t> subtree;
+  };
+
+  std::vector<Worker> workers;
+  std::deque<std::vector<std::uint32_t>> pendingWork;
+  /// Subtrees handed out again after their worker crashed. A subtree that
+  /// crashes a second worker is given up on.
+  std::set<std::vector<std::uint32_t>> retriedWork;
+  unsigned lostSubtrees = 0;
+  SharedCounters *counters;
+  volatile bool stopRequested = false;
+
+  void handleMessage(unsigned workerID, const std::string &line);
+  bool allWorkersIdle() const;
+
+public:
+  explicit Coordinator(unsigned numWorkers);
+  ~Coordinator();
+  Coordinator(const Coordinator &) = delete;
+  Coordinator &operator=(const Coordinator &) = delete;
+
+  /// Forks the worker processes. Returns the connection to the coordinator
+  /// in a worker and nullptr in the coordinator itself.
+  std::unique_ptr<WorkerChannel> spawnWorkers();
+
+  /// Hands out subtrees until the whole tree is explored (or exploration
+  /// is stopped, e.g. after \p maxTime or \p maxTests generated tests) and
+  /// all workers have exited. The subtree of a worker that crashes is
+  /// handed out again once. Returns false if parts of the tree were lost.
+  bool run(const time::Span &maxTime, unsigned maxTests);
+
+  /// Stops handing out work. Safe to call from a signal handler.
+  void stop() { stopRequested = true; }
+
+  SharedCounters &getCounters() { return *counters; }
+};
+
+} // namespace klee
+
+#endif /* KLEE_COORDINATOR_H */
@@ -9,6 +9,8 @@
 //
 //===----------------------------------------------------------------------===//
 
+#include "Coordinator.h"
+
 #include "klee/ADT/TreeStream.h"
 #include "klee/Config/Version.h"
 #include "klee/Core/Interpreter.h"
@@ -290,6 +292,24 @@ namespace {
            cl::desc("Link the llvm libc++ library into the bitcode (default=false)"),
            cl::init(false),
            cl::cat(LinkCat));
+
+
+  /*** Parallel exploration options ***/
+
+  cl::OptionCategory ParallelCat("Parallel exploration options",
+                                 "These options control exploring with several "
+                                 "worker processes.");
+
+  cl::opt<unsigned>
+  ParallelWorkers("parallel-workers",
+                  cl::desc("Fork the given number of worker processes that "
+                           "share the exploration by handing off unexplored "
+                           "subtrees to each other. Test cases of all workers "
+                           "are written to the output directory, other output "
+                           "files to one worker-<i> subdirectory per worker. "
+                           "Set to 0 to disable (default=0)"),
+                  cl::init(0),
+                  cl::cat(ParallelCat));
 }
 
 namespace klee {
@@ -306,6 +326,11 @@ private:
   std::unique_ptr<llvm::raw_ostream> m_infoFile;
 
   SmallString<128> m_outputDirectory;
+  SmallString<128> m_testDirectory; // differs from m_outputDirectory in workers
+
+  // set when running as a worker of a parallel exploration
+  SharedCounters *m_sharedCounters;
+  WorkerChannel *m_channel;
 
   unsigned m_numTotalTests;     // Number of tests received from the interpreter
   unsigned m_numGeneratedTests; // Number of tests successfully generated
@@ -316,8 +341,14 @@ private:
   int m_argc;
   char **m_argv;
 
+  void openLogFiles();
+
 public:
   KleeHandler(int argc, char **argv);
+  /// Handler for worker \p channel of a parallel exploration, writing its
+  /// test cases next to the ones of \p parent.
+  KleeHandler(int argc, char **argv, const KleeHandler &parent,
+              WorkerChannel &channel, SharedCounters &counters);
   ~KleeHandler();
 
   llvm::raw_ostream &getInfoStream() const { return *m_infoFile; }
@@ -335,6 +366,8 @@ public:
                        const char *errorMessage,
                        const char *errorSuffix);
 
+  void handleWorkRequests();
+
   std::string getOutputFilename(const std::string &filename);
   std::unique_ptr<llvm::raw_fd_ostream> openOutputFile(const std::string &filename);
   std::string getTestFilename(const std::string &suffix, unsigned id);
@@ -352,8 +385,9 @@ public:
 
 KleeHandler::KleeHandler(int argc, char **argv)
     : m_interpreter(0), m_pathWriter(0), m_symPathWriter(0),
-      m_outputDirectory(), m_numTotalTests(0), m_numGeneratedTests(0),
-      m_pathsCompleted(0), m_pathsExplored(0), m_argc(argc), m_argv(argv) {
+      m_outputDirectory(), m_sharedCounters(nullptr), m_channel(nullptr),
+      m_numTotalTests(0), m_numGeneratedTests(0), m_pathsCompleted(0),
+      m_pathsExplored(0), m_argc(argc), m_argv(argv) {
 
   // create output directory (OutputDir or "klee-out-<i>")
   bool dir_given = OutputDir != "";
@@ -405,7 +439,29 @@ KleeHandler::KleeHandler(int argc, char **argv)
   }
 
   klee_message("output directory is \"%s\"", m_outputDirectory.c_str());
+  m_testDirectory = m_outputDirectory;
+
+  openLogFiles();
+}
 
+KleeHandler::KleeHandler(int argc, char **argv, const KleeHandler &parent,
+                         WorkerChannel &channel, SharedCounters &counters)
+    : m_interpreter(0), m_pathWriter(0), m_symPathWriter(0),
+      m_outputDirectory(parent.m_outputDirectory),
+      m_testDirectory(parent.m_testDirectory), m_sharedCounters(&counters),
+      m_channel(&channel), m_numTotalTests(0), m_numGeneratedTests(0),
+      m_pathsCompleted(0), m_pathsExplored(0), m_argc(argc), m_argv(argv) {
+  sys::path::append(m_outputDirectory,
+                    "worker-" + std::to_string(channel.getID()));
+  if (mkdir(m_outputDirectory.c_str(), 0775) < 0)
+    klee_error("cannot create \"%s\": %s", m_outputDirectory.c_str(),
+               strerror(errno));
+
+  // the log files of the coordinator are not closed here, they belong to it
+  openLogFiles();
+}
+
+void KleeHandler::openLogFiles() {
   // open warnings.txt
   std::string file_path = getOutputFilename("warnings.txt");
   if ((klee_warning_file = fopen(file_path.c_str(), "w")) == NULL)
@@ -472,7 +528,17 @@ std::string KleeHandler::getTestFilename(const std::string &suffix, unsigned id)
 
 std::unique_ptr<llvm::raw_fd_ostream>
 KleeHandler::openTestFile(const std::string &suffix, unsigned id) {
-  return openOutputFile(getTestFilename(suffix, id));
+  if (m_testDirectory == m_outputDirectory)
+    return openOutputFile(getTestFilename(suffix, id));
+
+  SmallString<128> path = m_testDirectory;
+  sys::path::append(path, getTestFilename(suffix, id));
+  std::string Error;
+  auto f = klee_open_output_file(path.c_str(), Error);
+  if (!f)
+    klee_warning("error opening file \"%s\" (%s).", path.c_str(),
+                 Error.c_str());
+  return f;
 }
 
 
@@ -489,7 +555,10 @@ void KleeHandler::processTestCase(const ExecutionState &state,
 
     const auto start_time = time::getWallTime();
 
-    unsigned id = ++m_numTotalTests;
+    ++m_numTotalTests;
+    unsigned id = m_sharedCounters ? ++m_sharedCounters->numTotalTests
+                                   : m_numTotalTests;
+    unsigned numGeneratedTests = 0;
 
     if (success) {
       KTest b;
@@ -509,9 +578,14 @@ void KleeHandler::processTestCase(const ExecutionState &state,
         std::copy(out[i].second.begin(), out[i].second.end(), o->bytes);
       }
 
-      if (!kTest_toFile(&b, getOutputFilename(getTestFilename("ktest", id)).c_str())) {
+      SmallString<128> ktestPath = m_testDirectory;
+      sys::path::append(ktestPath, getTestFilename("ktest", id));
+      if (!kTest_toFile(&b, ktestPath.c_str())) {
         klee_warning("unable to write output test case, losing it");
       } else {
+        numGeneratedTests = m_sharedCounters
+                                ? ++m_sharedCounters->numGeneratedTests
+                                : m_numGeneratedTests + 1;
         ++m_numGeneratedTests;
       }
 
@@ -589,7 +663,7 @@ void KleeHandler::processTestCase(const ExecutionState &state,
       }
     }
 
-    if (m_numGeneratedTests == MaxTests)
+    if (numGeneratedTests == MaxTests)
       m_interpreter->setHaltExecution(true);
 
     if (WriteTestInfo) {
@@ -606,6 +680,15 @@ void KleeHandler::processTestCase(const ExecutionState &state,
   }
 }
 
+void KleeHandler::handleWorkRequests() {
+  if (!m_channel)
+    return;
+
+  if (!m_channel->handleRequests(*m_interpreter) ||
+      (MaxTests && m_sharedCounters->numGeneratedTests >= MaxTests))
+    m_interpreter->setHaltExecution(true);
+}
+
   // load a .path file
 void KleeHandler::loadPathFile(std::string name,
                                      std::vector<bool> &buffer) {
@@ -1014,6 +1097,89 @@ static void interrupt_handle_watchdog() {
   // just wait for the child to finish
 }
 
+static Coordinator *theCoordinator = nullptr;
+
+static void interrupt_handle_coordinator() {
+  // the workers got the signal as well, wait for them to halt
+  if (!interrupted) {
+    llvm::errs() << "KLEE: ctrl-c detected, waiting for workers to halt.\n";
+    theCoordinator->stop();
+    sys::SetInterruptFunction(interrupt_handle_coordinator);
+  } else {
+    llvm::errs() << "KLEE: ctrl-c detected, exiting.\n";
+    exit(1);
+  }
+  interrupted = true;
+}
+
+static void writeElapsedTime(KleeHandler &handler, std::time_t startTime) {
+  auto endTime = std::time(nullptr);
+  std::uint32_t h;
+  std::uint8_t m, s;
+  std::tie(h,m,s) = time::seconds(endTime - startTime).toHMS();
+  std::stringstream endInfo;
+  endInfo << "Finished: "
+          << std::put_time(std::localtime(&endTime), "%Y-%m-%d %H:%M:%S") << '\n'
+          << "Elapsed: "
+          << std::setfill('0') << std::setw(2) << h
+          << ':'
+          << std::setfill('0') << std::setw(2) << +m
+          << ':'
+          << std::setfill('0') << std::setw(2) << +s
+          << '\n';
+  handler.getInfoStream() << endInfo.str();
+  handler.getInfoStream().flush();
+}
+
+/// Main loop of the coordinator process of a parallel exploration: balances
+/// work between the workers and summarises their results.
+static int runCoordinator(Coordinator &coordinator, KleeHandler &handler,
+                          int argc, char **argv) {
+  theCoordinator = &coordinator;
+  sys::SetInterruptFunction(interrupt_handle_coordinator);
+
+  for (int i=0; i<argc; i++) {
+    handler.getInfoStream() << argv[i] << (i+1<argc ? " ":"\n");
+  }
+  handler.getInfoStream() << "PID: " << getpid() << "\n"
+                          << "Workers: " << ParallelWorkers << "\n";
+  auto startTime = std::time(nullptr);
+
+  bool complete = coordinator.run(time::Span(MaxTime), MaxTests);
+
+  writeElapsedTime(handler, startTime);
+
+  const SharedCounters &counters = coordinator.getCounters();
+  std::stringstream stats;
+  stats << '\n'
+        << "KLEE: done: total instructions = " << counters.instructions << '\n'
+        << "KLEE: done: completed paths = " << counters.pathsCompleted << '\n'
+        << "KLEE: done: partially completed paths = "
+        << counters.pathsExplored - counters.pathsCompleted << '\n'
+        << "KLEE: done: generated tests = " << counters.numGeneratedTests
+        << '\n';
+
+  bool useColors = llvm::errs().is_displayed();
+  if (useColors)
+    llvm::errs().changeColor(llvm::raw_ostream::GREEN,
+                             /*bold=*/true,
+                             /*bg=*/false);
+
+  llvm::errs() << stats.str();
+
+  if (useColors)
+    llvm::errs().resetColor();
+
+  handler.getInfoStream() << stats.str();
+  theCoordinator = nullptr;
+  if (!complete) {
+    klee_warning("exploration is incomplete, subtrees were lost with crashed "
+                 "workers");
+    return 1;
+  }
+  return 0;
+}
+
 // This is a temporary hack. If the running process has access to
 // externals then it can disable interrupts, which screws up the
 // normal "nice" watchdog termination process. We try to request the
@@ -1411,6 +1577,25 @@ int main(int argc, char **argv, char **envp) {
   Interpreter::InterpreterOptions IOpts;
   IOpts.MakeConcreteSymbolic = MakeConcreteSymbolic;
   KleeHandler *handler = new KleeHandler(pArgc, pArgv);
+
+  std::unique_ptr<Coordinator> coordinator;
+  std::unique_ptr<WorkerChannel> workerChannel;
+  if (ParallelWorkers) {
+    if (!ReplayKTestDir.empty() || !ReplayKTestFile.empty() ||
+        ReplayPathFile != "" || !SeedOutFile.empty() || !SeedOutDir.empty())
+      klee_error("--parallel-workers cannot be used when replaying or seeding");
+
+    coordinator = std::make_unique<Coordinator>(ParallelWorkers);
+    workerChannel = coordinator->spawnWorkers();
+    if (!workerChannel) {
+      int res = runCoordinator(*coordinator, *handler, argc, argv);
+      delete handler;
+      return res;
+    }
+    // the coordinator's handler stays with the coordinator
+    handler = new KleeHandler(pArgc, pArgv, *handler, *workerChannel,
+                              coordinator->getCounters());
+  }
   Interpreter *interpreter =
     theInterpreter = Interpreter::create(ctx, IOpts, handler);
   assert(interpreter);
@@ -1535,7 +1720,17 @@ int main(int argc, char **argv, char **envp) {
                    sys::StrError(errno).c_str());
       }
     }
-    interpreter->runFunctionAsMain(mainFn, pArgc, pArgv, pEnvp);
+    if (workerChannel) {
+      // explore subtrees handed out by the coordinator
+      std::vector<std::uint32_t> decisions;
+      while (!interrupted && workerChannel->requestWork(decisions)) {
+        interpreter->setReplayDecisions(&decisions);
+        interpreter->runFunctionAsMain(mainFn, pArgc, pArgv, pEnvp);
+      }
+      interpreter->setReplayDecisions(nullptr);
+    } else {
+      interpreter->runFunctionAsMain(mainFn, pArgc, pArgv, pEnvp);
+    }
 
     while (!seeds.empty()) {
       kTest_free(seeds.back());
@@ -1543,24 +1738,7 @@ int main(int argc, char **argv, char **envp) {
     }
   }
 
-  auto endTime = std::time(nullptr);
-  { // output end and elapsed time
-    std::uint32_t h;
-    std::uint8_t m, s;
-    std::tie(h,m,s) = time::seconds(endTime - startTime).toHMS();
-    std::stringstream endInfo;
-    endInfo << "Finished: "
-            << std::put_time(std::localtime(&endTime), "%Y-%m-%d %H:%M:%S") << '\n'
-            << "Elapsed: "
-            << std::setfill('0') << std::setw(2) << h
-            << ':'
-            << std::setfill('0') << std::setw(2) << +m
-            << ':'
-            << std::setfill('0') << std::setw(2) << +s
-            << '\n';
-            handler->getInfoStream() << endInfo.str();
-    handler->getInfoStream().flush();
-  }
+  writeElapsedTime(*handler, startTime);
 
   // Free all the args.
   for (unsigned i=0; i<InputArgv.size()+1; i++)
@@ -1610,6 +1788,17 @@ int main(int argc, char **argv, char **envp) {
         << "KLEE: done: generated tests = " << handler->getNumTestCases()
         << '\n';
 
+  if (workerChannel) {
+    // the coordinator reports the totals
+    SharedCounters &counters = coordinator->getCounters();
+    counters.instructions += instructions;
+    counters.pathsCompleted += handler->getNumPathsCompleted();
+    counters.pathsExplored += handler->getNumPathsExplored();
+    handler->getInfoStream() << stats.str();
+    delete handler;
+    return 0;
+  }
+
   bool useColors = llvm::errs().is_displayed();
   if (useColors)
     llvm::errs().changeColor(llvm::raw_ostream::GREEN,
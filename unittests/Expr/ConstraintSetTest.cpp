@@ -0,0 +1,98 @@
+//===-- ConstraintSetTest.cpp ---------------------------------------------===//
+//
+//                     The KLEE Symbolic Virtual Machine
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+
+#include "gtest/gtest.h"
+
+#include "klee/Expr/ArrayCache.h"
+#include "klee/Expr/Constraints.h"
+#include "klee/Expr/Expr.h"
+
+#include <vector>
+
+using namespace klee;
+
+namespace {
+
+std::vector<ref<Expr>> contents(const ConstraintSet &constraints) {
+  return std::vector<ref<Expr>>(constraints.begin(), constraints.end());
+}
+
+TEST(ConstraintSetTest, CopiesShareTheirPrefix) {
+  ArrayCache ac;
+  const Array *array = ac.CreateArray("arr", 8);
+  std::vector<ref<Expr>> c;
+  for (unsigned i = 0; i < 8; ++i) {
+    UpdateList ul(array, 0);
+    c.push_back(UgtExpr::create(
+        ReadExpr::create(ul, ConstantExpr::alloc(i, Expr::Int32)),
+        ConstantExpr::alloc(i, Expr::Int8)));
+  }
+
+  ConstraintSet a;
+  a.push_back(c[0]);
+  a.push_back(c[1]);
+
+  ConstraintSet b = a;
+  a.push_back(c[2]);
+  b.push_back(c[3]);
+  ConstraintSet d = b;
+  b.push_back(c[4]);
+  d.push_back(c[5]);
+  a.push_back(c[6]);
+
+  EXPECT_EQ(std::vector<ref<Expr>>({c[0], c[1], c[2], c[6]}), contents(a));
+  EXPECT_EQ(std::vector<ref<Expr>>({c[0], c[1], c[3], c[4]}), contents(b));
+  EXPECT_EQ(std::vector<ref<Expr>>({c[0], c[1], c[3], c[5]}), contents(d));
+  EXPECT_EQ(4u, d.size());
+
+  ConstraintSet e(std::vector<ref<Expr>>({c[0], c[1], c[3], c[5]}));
+  EXPECT_TRUE(d == e);
+  EXPECT_FALSE(b == e);
+
+  EXPECT_TRUE(ConstraintSet().empty());
+  EXPECT_TRUE(ConstraintSet().begin() == ConstraintSet().end());
+}
+
+TEST(ConstraintSetTest, TakeUnsharedSuffix) {
+  ArrayCache ac;
+  const Array *array = ac.CreateArray("arr", 8);
+  std::vector<ref<Expr>> c;
+  for (unsigned i = 0; i < 6; ++i) {
+    UpdateList ul(array, 0);
+    c.push_back(UgtExpr::create(
+        ReadExpr::create(ul, ConstantExpr::alloc(i, Expr::Int32)),
+        ConstantExpr::alloc(i, Expr::Int8)));
+  }
+
+  ConstraintSet a;
+  a.push_back(c[0]);
+  a.push_back(c[1]);
+  ConstraintSet b = a;
+  a.push_back(c[2]);
+  b.push_back(c[3]);
+  b.push_back(c[4]);
+
+  // b's constraints after the copy are its own, the prefix is shared
+  EXPECT_EQ(std::vector<ref<Expr>>({c[3], c[4]}), b.takeUnsharedSuffix());
+  EXPECT_EQ(std::vector<ref<Expr>>({c[0], c[1]}), contents(b));
+  EXPECT_TRUE(b.takeUnsharedSuffix().empty());
+
+  b.push_back(c[5]);
+  EXPECT_EQ(std::vector<ref<Expr>>({c[0], c[1], c[2]}), contents(a));
+  EXPECT_EQ(std::vector<ref<Expr>>({c[0], c[1], c[5]}), contents(b));
+
+  // without copies everything is unshared
+  ConstraintSet d;
+  d.push_back(c[0]);
+  d.push_back(c[1]);
+  EXPECT_EQ(std::vector<ref<Expr>>({c[0], c[1]}), d.takeUnsharedSuffix());
+  EXPECT_TRUE(d.empty());
+}
+
+} // namespace
@@ -13,6 +13,14 @@
 #include "klee/Expr/ArrayCache.h"
 #include "klee/Expr/Expr.h"
 
+#include "llvm/Support/CommandLine.h"
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <random>
+#include <vector>
+
 using namespace klee;
 
 namespace {
@@ -264,4 +272,122 @@ TEST(ExprTest, ReadExprFoldingSymbolicIndexUpdate) {
     EXPECT_EQ(Expr::Read, read.get()->getKind());
   }
 }
+
+TEST(ExprTest, HashConsing) {
+  auto *hashConsing = static_cast<llvm::cl::opt<bool> *>(
+      llvm::cl::getRegisteredOptions()["expr-hash-consing"]);
+  ASSERT_NE(nullptr, hashConsing);
+  *hashConsing = true;
+  {
+    ArrayCache ac;
+    const Array *array = ac.CreateArray("arr", 4);
+    ref<Expr> a = AddExpr::create(Expr::createTempRead(array, 32),
+                                  ConstantExpr::create(1, Expr::Int32));
+    ref<Expr> b = AddExpr::create(Expr::createTempRead(array, 32),
+                                  ConstantExpr::create(1, Expr::Int32));
+    EXPECT_TRUE(a->isCached());
+    EXPECT_EQ(a.get(), b.get());
+    EXPECT_NE(a.get(), AddExpr::create(Expr::createTempRead(array, 32),
+                                       ConstantExpr::create(2, Expr::Int32))
+                           .get());
+
+    // a node that is no longer referenced is removed from the table
+    unsigned count = Expr::count;
+    ref<Expr> c = NotExpr::create(a);
+    EXPECT_EQ(count + 1, Expr::count);
+    c = nullptr;
+    EXPECT_EQ(count, Expr::count);
+    ref<Expr> d = NotExpr::create(b);
+    EXPECT_TRUE(d->isCached());
+    EXPECT_EQ(NotExpr::create(a).get(), d.get());
+  }
+  *hashConsing = false;
+
+  ArrayCache ac;
+  const Array *array = ac.CreateArray("arr", 4);
+  EXPECT_FALSE(NotExpr::create(Expr::createTempRead(array, 32))->isCached());
+}
+
+TEST(ExprTest, ConstantInterning) {
+  ref<ConstantExpr> one = ConstantExpr::create(1, Expr::Int32);
+  EXPECT_TRUE(one->isCached());
+  EXPECT_EQ(one.get(), ConstantExpr::alloc(llvm::APInt(32, 1)).get());
+  EXPECT_NE(one.get(), ConstantExpr::create(1, Expr::Int64).get());
+  EXPECT_EQ(ConstantExpr::alloc(1, Expr::Bool).get(),
+            ConstantExpr::alloc(3, Expr::Bool).get());
+
+  // folding concrete values reuses the nodes of small and recent values
+  ref<ConstantExpr> big = ConstantExpr::create(123456789, Expr::Int32);
+  unsigned count = Expr::count;
+  for (unsigned i = 0; i < 1000; ++i) {
+    ref<ConstantExpr> v = ConstantExpr::create(i % 255, Expr::Int64);
+    ref<Expr> sum = AddExpr::create(v, ConstantExpr::create(1, Expr::Int64));
+    EXPECT_EQ(big.get(), ConstantExpr::create(123456789, Expr::Int32).get());
+  }
+  EXPECT_EQ(count, Expr::count);
+
+  ref<ConstantExpr> wide = ConstantExpr::alloc(llvm::APInt(128, 1));
+  EXPECT_FALSE(wide->isCached());
+}
+
+double secondsSince(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                       start)
+      .count();
+}
+
+struct FoldCost {
+  double ns;          // time per iteration
+  double allocations; // expression nodes allocated per iteration
+};
+
+// Folds additions of concrete values like an interpreted loop. Allocations
+// are counted in a second, shorter run that keeps every node alive, so that
+// the growth of Expr::count is the number of nodes allocated.
+template <class NextValue>
+FoldCost foldConstants(unsigned n, unsigned counted, NextValue nextValue) {
+  auto start = std::chrono::steady_clock::now();
+  std::uint64_t sum = 0;
+  for (unsigned i = 0; i < n; ++i) {
+    ref<ConstantExpr> value = ConstantExpr::create(nextValue(i), Expr::Int64);
+    ref<ConstantExpr> index = ConstantExpr::create(i % 256, Expr::Int32);
+    sum += value->Add(index->ZExt(Expr::Int64))->getZExtValue();
+  }
+  double seconds = secondsSince(start);
+  EXPECT_NE(0u, sum);
+
+  std::vector<ref<ConstantExpr>> kept;
+  kept.reserve(4 * counted);
+  unsigned count = Expr::count;
+  for (unsigned i = 0; i < counted; ++i) {
+    kept.push_back(ConstantExpr::create(nextValue(i), Expr::Int64));
+    kept.push_back(ConstantExpr::create(i % 256, Expr::Int32));
+    kept.push_back(kept[kept.size() - 1]->ZExt(Expr::Int64));
+    kept.push_back(kept[kept.size() - 3]->Add(kept.back()));
+  }
+  unsigned allocations = Expr::count - count;
+
+  return {seconds / n * 1e9, static_cast<double>(allocations) / counted};
+}
+
+TEST(ExprTest, DISABLED_ConstantInterningBenchmark) {
+  const unsigned n = 10000000, counted = 100000;
+  std::mt19937_64 rng(1);
+  std::vector<std::uint64_t> recurring(1000);
+  for (auto &value : recurring)
+    value = rng();
+
+  FoldCost small =
+      foldConstants(n, counted, [](unsigned i) { return i % 200; });
+  FoldCost recent = foldConstants(n, counted, [&](unsigned i) {
+    return recurring[i % recurring.size()];
+  });
+  FoldCost unique = foldConstants(n, counted, [&](unsigned) { return rng(); });
+  std::printf("%-10s %8s %14s\n", "values", "ns/iter", "allocs/iter");
+  std::printf("%-10s %8.2f %14.3f\n", "small", small.ns, small.allocations);
+  std::printf("%-10s %8.2f %14.3f\n", "recurring", recent.ns,
+              recent.allocations);
+  std::printf("%-10s %8.2f %14.3f\n", "unique", unique.ns,
+              unique.allocations);
+}
 }
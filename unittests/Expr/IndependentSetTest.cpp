@@ -0,0 +1,100 @@
+//===-- IndependentSetTest.cpp --------------------------------------------===//
+//
+//                     The KLEE Symbolic Virtual Machine
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+
+#include "gtest/gtest.h"
+
+#include "klee/Expr/ArrayCache.h"
+#include "klee/Expr/Constraints.h"
+#include "klee/Expr/Expr.h"
+#include "klee/Expr/IndependentSet.h"
+
+#include <vector>
+
+using namespace klee;
+
+namespace {
+
+ref<Expr> readByte(const Array *array, unsigned index) {
+  UpdateList ul(array, 0);
+  return ReadExpr::create(ul, ConstantExpr::alloc(index, Expr::Int32));
+}
+
+ref<Expr> isPositive(const ref<Expr> &e) {
+  return UgtExpr::create(e, ConstantExpr::alloc(0, e->getWidth()));
+}
+
+TEST(IndependentSetTest, GroupsByBytes) {
+  ArrayCache ac;
+  const Array *a = ac.CreateArray("a", 4);
+  const Array *b = ac.CreateArray("b", 4);
+
+  ref<Expr> c0 = isPositive(readByte(a, 0));
+  ref<Expr> c1 = isPositive(readByte(b, 0));
+  ref<Expr> c2 = isPositive(readByte(a, 1));
+  ref<Expr> c3 = isPositive(AddExpr::create(readByte(a, 1), readByte(b, 0)));
+
+  IndependentConstraintGroups groups;
+  groups.add(c0);
+  groups.add(c1);
+  groups.add(c2);
+
+  std::vector<ref<Expr>> result;
+  groups.getIndependentConstraints(isPositive(readByte(a, 1)), result);
+  EXPECT_EQ(std::vector<ref<Expr>>({c2}), result);
+
+  groups.add(c3);
+  result.clear();
+  groups.getIndependentConstraints(isPositive(readByte(a, 1)), result);
+  EXPECT_EQ(std::vector<ref<Expr>>({c1, c2, c3}), result);
+
+  result.clear();
+  groups.getIndependentConstraints(isPositive(readByte(a, 2)), result);
+  EXPECT_TRUE(result.empty());
+
+  // a symbolic index touches all bytes of the array
+  UpdateList ul(a, 0);
+  ref<Expr> symbolic =
+      ReadExpr::create(ul, ZExtExpr::create(readByte(b, 3), Expr::Int32));
+  result.clear();
+  groups.getIndependentConstraints(isPositive(symbolic), result);
+  EXPECT_EQ(std::vector<ref<Expr>>({c0, c1, c2, c3}), result);
+
+  std::vector<IndependentElementSet> factors;
+  groups.getAllIndependentSets(ConstantExpr::alloc(0, Expr::Bool), factors);
+  EXPECT_EQ(2u, factors.size());
+}
+
+TEST(IndependentSetTest, CopiesAreIndependent) {
+  ArrayCache ac;
+  const Array *a = ac.CreateArray("a", 4);
+
+  ConstraintSet constraints;
+  ConstraintManager m(constraints);
+  ref<Expr> c0 = isPositive(readByte(a, 0));
+  m.addConstraint(c0);
+
+  ConstraintSet copy = constraints;
+  ConstraintManager(copy).addConstraint(
+      isPositive(AddExpr::create(readByte(a, 0), readByte(a, 1))));
+
+  ASSERT_NE(nullptr, constraints.getIndependentGroups());
+  ASSERT_NE(nullptr, copy.getIndependentGroups());
+
+  std::vector<ref<Expr>> result;
+  constraints.getIndependentGroups()->getIndependentConstraints(
+      isPositive(readByte(a, 1)), result);
+  EXPECT_TRUE(result.empty());
+
+  result.clear();
+  copy.getIndependentGroups()->getIndependentConstraints(
+      isPositive(readByte(a, 1)), result);
+  EXPECT_EQ(2u, result.size());
+}
+
+} // namespace
@@ -0,0 +1,238 @@
+//===-- ImmutableBTreeMapTest.cpp -----------------------------------------===//
+//
+//                     The KLEE Symbolic Virtual Machine
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+
+#include "klee/ADT/ImmutableBTreeMap.h"
+#include "klee/ADT/ImmutableMap.h"
+#include "gtest/gtest.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <map>
+#include <memory>
+#include <random>
+#include <vector>
+
+using namespace klee;
+
+namespace {
+
+typedef ImmutableBTreeMap<unsigned, unsigned> Map;
+
+void expectEqual(const std::map<unsigned, unsigned> &expected, const Map &m) {
+  ASSERT_EQ(expected.size(), m.size());
+  auto it = m.begin();
+  for (const auto &e : expected) {
+    ASSERT_TRUE(it != m.end());
+    EXPECT_EQ(e.first, it->first);
+    EXPECT_EQ(e.second, it->second);
+    ++it;
+  }
+  EXPECT_TRUE(it == m.end());
+  // and backwards
+  for (auto rit = expected.rbegin(); rit != expected.rend(); ++rit)
+    EXPECT_EQ(rit->first, (--it)->first);
+  EXPECT_TRUE(it == m.begin());
+}
+
+TEST(ImmutableBTreeMapTest, MatchesStdMap) {
+  std::mt19937 rng(1);
+  std::map<unsigned, unsigned> expected;
+  Map m;
+  for (unsigned i = 0; i < 20000; ++i) {
+    unsigned key = rng() % 5000;
+    if (rng() % 3) {
+      expected[key] = i;
+      m.set(std::make_pair(key, i));
+    } else {
+      expected.erase(key);
+      m.erase(key);
+    }
+  }
+  expectEqual(expected, m);
+  EXPECT_LE(m.getDepth(), 3u);
+
+  for (unsigned key = 0; key < 5001; ++key) {
+    auto e = expected.find(key);
+    const auto *v = m.lookup(key);
+    ASSERT_EQ(e != expected.end(), v != nullptr);
+    if (v) {
+      EXPECT_EQ(e->second, v->second);
+    }
+
+    auto ub = expected.upper_bound(key);
+    auto mub = m.upper_bound(key);
+    ASSERT_EQ(ub == expected.end(), mub == m.end());
+    if (ub != expected.end()) {
+      EXPECT_EQ(ub->first, mub->first);
+    }
+
+    auto lb = expected.lower_bound(key);
+    auto mlb = m.lower_bound(key);
+    ASSERT_EQ(lb == expected.end(), mlb == m.end());
+    if (lb != expected.end()) {
+      EXPECT_EQ(lb->first, mlb->first);
+    }
+
+    const auto *prev = m.lookup_previous(key);
+    if (ub == expected.begin()) {
+      EXPECT_EQ(nullptr, prev);
+    } else {
+      ASSERT_NE(nullptr, prev);
+      EXPECT_EQ(std::prev(ub)->first, prev->first);
+    }
+  }
+
+  // removing everything leaves an empty map
+  for (const auto &e : expected)
+    m.erase(e.first);
+  EXPECT_TRUE(m.empty());
+  EXPECT_TRUE(m.begin() == m.end());
+}
+
+TEST(ImmutableBTreeMapTest, CopiesAreIndependent) {
+  Map a;
+  for (unsigned i = 0; i < 1000; ++i)
+    a.set(std::make_pair(i, i));
+
+  Map b = a;
+  b.set(std::make_pair(500u, 0u));
+  b.erase(10);
+  Map c = b.replace(std::make_pair(2000u, 1u)).remove(0);
+
+  EXPECT_EQ(500u, a.lookup(500)->second);
+  EXPECT_NE(nullptr, a.lookup(10));
+  EXPECT_EQ(0u, b.lookup(500)->second);
+  EXPECT_EQ(nullptr, b.lookup(10));
+  EXPECT_EQ(nullptr, b.lookup(2000));
+  EXPECT_NE(nullptr, c.lookup(2000));
+  EXPECT_EQ(nullptr, c.lookup(0));
+  EXPECT_EQ(1000u, a.size());
+  EXPECT_EQ(999u, b.size());
+  EXPECT_EQ(999u, c.size());
+
+  // insert does not overwrite
+  EXPECT_EQ(1u, c.insert(std::make_pair(2000u, 2u)).lookup(2000)->second);
+}
+
+TEST(ImmutableBTreeMapTest, IteratorsSeeSnapshot) {
+  Map m;
+  for (unsigned i = 0; i < 100; ++i)
+    m.set(std::make_pair(i, i));
+
+  unsigned n = 0;
+  for (auto it = m.begin(), ie = m.end(); it != ie; ++it, ++n) {
+    EXPECT_EQ(n, it->second);
+    m.erase(it->first);
+    m.set(std::make_pair(it->first + 1000, n));
+  }
+  EXPECT_EQ(100u, n);
+  EXPECT_EQ(100u, m.size());
+  EXPECT_EQ(1000u, m.begin()->first);
+}
+
+TEST(ImmutableBTreeMapTest, ForEachUnshared) {
+  Map a;
+  for (unsigned i = 0; i < 1000; ++i)
+    a.set(std::make_pair(i, i));
+
+  unsigned count = 0;
+  a.forEachUnshared([&](const Map::value_type &) { ++count; });
+  EXPECT_EQ(1000u, count);
+
+  // after a copy, only the leaf modified by a and its original, now only
+  // referenced by b, are unshared
+  Map b = a;
+  a.set(std::make_pair(500u, 0u));
+  std::vector<unsigned> keys;
+  a.forEachUnshared([&](const Map::value_type &v) { keys.push_back(v.first); });
+  EXPECT_FALSE(keys.empty());
+  EXPECT_LE(keys.size(), 32u);
+  EXPECT_NE(keys.end(), std::find(keys.begin(), keys.end(), 500u));
+
+  std::vector<unsigned> originalKeys;
+  b.forEachUnshared(
+      [&](const Map::value_type &v) { originalKeys.push_back(v.first); });
+  EXPECT_EQ(keys, originalKeys);
+}
+
+// Benchmarks of ImmutableBTreeMap against ImmutableMap, run with
+// --gtest_also_run_disabled_tests
+
+template <class M> struct Ops;
+
+template <> struct Ops<ImmutableMap<std::uint64_t, std::uint64_t>> {
+  typedef ImmutableMap<std::uint64_t, std::uint64_t> M;
+  static void set(M &m, std::uint64_t k) { m = m.replace(std::make_pair(k, k)); }
+};
+
+template <> struct Ops<ImmutableBTreeMap<std::uint64_t, std::uint64_t>> {
+  typedef ImmutableBTreeMap<std::uint64_t, std::uint64_t> M;
+  static void set(M &m, std::uint64_t k) { m.set(std::make_pair(k, k)); }
+};
+
+double secondsSince(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                       start)
+      .count();
+}
+
+template <class M> void benchmark(const char *name, unsigned n) {
+  std::mt19937_64 rng(1);
+  std::vector<std::uint64_t> keys(n);
+  for (auto &key : keys)
+    key = rng() & ~std::uint64_t(7);
+
+  auto start = std::chrono::steady_clock::now();
+  M m;
+  for (auto key : keys)
+    Ops<M>::set(m, key);
+  double insert = secondsSince(start);
+
+  start = std::chrono::steady_clock::now();
+  std::uint64_t found = 0;
+  for (unsigned round = 0; round < 10; ++round)
+    for (unsigned i = 0; i < n; ++i)
+      found += m.lookup_previous(keys[(i * 7919u) % n] + 4) != nullptr;
+  double lookup = secondsSince(start);
+  EXPECT_EQ(10u * n, found);
+
+  // fork, then modify one object in each copy
+  start = std::chrono::steady_clock::now();
+  std::vector<M> forks;
+  forks.reserve(1000);
+  for (unsigned i = 0; i < 1000; ++i) {
+    forks.push_back(m);
+    Ops<M>::set(forks.back(), keys[(i * 7919u) % n]);
+  }
+  double fork = secondsSince(start);
+
+  start = std::chrono::steady_clock::now();
+  std::uint64_t sum = 0;
+  for (const auto &e : m)
+    sum += e.second;
+  double iterate = secondsSince(start);
+  EXPECT_NE(0u, sum);
+
+  std::printf("%-18s n=%-8u insert %8.2f ns  lookup %8.2f ns  "
+              "fork+write %8.2f us  iterate %6.2f ns/element\n",
+              name, n, insert / n * 1e9, lookup / (10.0 * n) * 1e9,
+              fork / 1000 * 1e6, iterate / n * 1e9);
+}
+
+TEST(ImmutableBTreeMapTest, DISABLED_Benchmark) {
+  for (unsigned n : {10000u, 1000000u}) {
+    benchmark<ImmutableMap<std::uint64_t, std::uint64_t>>("ImmutableMap", n);
+    benchmark<ImmutableBTreeMap<std::uint64_t, std::uint64_t>>(
+        "ImmutableBTreeMap", n);
+  }
+}
+
+} // namespace
@@ -0,0 +1,144 @@
+//===-- PTreeTest.cpp -------------------------------------------------------===//
+//
+//                     The KLEE Symbolic Virtual Machine
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+#define KLEE_UNITTEST
+
+#include "gtest/gtest.h"
+
+#include "Core/ExecutionState.h"
+#include "Core/PTree.h"
+
+#include "llvm/Support/raw_ostream.h"
+
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace klee;
+
+namespace {
+
+TEST(PTreeTest, CollapsesChains) {
+  ExecutionState root, es1, es2, es3;
+  PTree processTree(&root);
+  PTreeNode *rootNode = root.ptreeNode;
+
+  // root forks three times, and the other side terminates every time but
+  // the first
+  processTree.attach(root.ptreeNode, &es1, &root, BranchType::Switch);
+  processTree.attach(root.ptreeNode, &es2, &root, BranchType::MemOp);
+  processTree.remove(es2.ptreeNode);
+  processTree.attach(root.ptreeNode, &es3, &root, BranchType::Free);
+  processTree.remove(es3.ptreeNode);
+
+  // only the first fork is left, with the other two collapsed into the edge
+  // to root
+  EXPECT_EQ(processTree.root, rootNode);
+  EXPECT_EQ(BranchType::Switch, rootNode->branchType);
+  EXPECT_EQ(rootNode->left, es1.ptreeNode);
+  EXPECT_EQ(rootNode->right, root.ptreeNode);
+  EXPECT_EQ(rootNode, root.ptreeNode->parent);
+  EXPECT_EQ(2u, root.ptreeNode->collapsed);
+  EXPECT_EQ((1U << static_cast<unsigned>(BranchType::MemOp)) |
+                (1U << static_cast<unsigned>(BranchType::Free)),
+            root.ptreeNode->collapsedTypes);
+  EXPECT_EQ(0u, es1.ptreeNode->collapsed);
+
+  // removing a child of the root makes the other child the root
+  processTree.remove(es1.ptreeNode);
+  EXPECT_EQ(processTree.root, root.ptreeNode);
+  EXPECT_EQ(nullptr, root.ptreeNode->parent);
+  EXPECT_EQ(3u, root.ptreeNode->collapsed);
+
+  processTree.remove(root.ptreeNode);
+}
+
+TEST(PTreeTest, ReusesNodes) {
+  ExecutionState root, es;
+  PTree processTree(&root);
+  processTree.attach(root.ptreeNode, &es, &root, BranchType::NONE);
+  PTreeNode *removed = es.ptreeNode;
+  processTree.remove(es.ptreeNode);
+
+  processTree.attach(root.ptreeNode, &es, &root, BranchType::NONE);
+  EXPECT_TRUE(es.ptreeNode == removed || root.ptreeNode == removed);
+  processTree.remove(es.ptreeNode);
+  processTree.remove(root.ptreeNode);
+}
+
+TEST(PTreeTest, Write) {
+  ExecutionState root, es1, es2;
+  PTree processTree(&root);
+  processTree.attach(root.ptreeNode, &es1, &root, BranchType::ConditionalBranch);
+  processTree.attach(root.ptreeNode, &es2, &root, BranchType::Alloc);
+  processTree.remove(es2.ptreeNode);
+
+  std::string binary;
+  llvm::raw_string_ostream os(binary);
+  processTree.write(os);
+  os.flush();
+
+  // the root, its left child es1, and its right child root, into which the
+  // Alloc fork collapsed
+  const char expected[] = "KPTREE\x01"
+                          "\x03\x01\x00"
+                          "\x04\x00\x00"
+                          "\x04\x00\x01\x80\x00";
+  EXPECT_EQ(std::string(expected, sizeof(expected) - 1), binary);
+
+  processTree.remove(es1.ptreeNode);
+  processTree.remove(root.ptreeNode);
+}
+
+// Benchmark of forking and terminating states, run with
+// --gtest_also_run_disabled_tests
+TEST(PTreeTest, DISABLED_Benchmark) {
+  const unsigned forks = 2000000;
+  std::unique_ptr<ExecutionState[]> es(new ExecutionState[forks + 1]);
+  PTree processTree(&es[0]);
+  std::vector<ExecutionState *> live = {&es[0]};
+
+  std::mt19937 rng(1);
+  auto start = std::chrono::steady_clock::now();
+  for (unsigned i = 1; i <= forks; ++i) {
+    ExecutionState *current = live[rng() % live.size()];
+    processTree.attach(current->ptreeNode, &es[i], current, BranchType::NONE);
+    live.push_back(&es[i]);
+    // terminate states at the same rate, keeping about 1000 alive
+    if (live.size() > 1000) {
+      std::size_t victim = rng() % live.size();
+      processTree.remove(live[victim]->ptreeNode);
+      live[victim] = live.back();
+      live.pop_back();
+    }
+  }
+  double seconds = std::chrono::duration<double>(
+                       std::chrono::steady_clock::now() - start)
+                       .count();
+  std::size_t nodes = 0, collapsed = 0;
+  std::vector<const PTreeNode *> stack = {processTree.root};
+  while (!stack.empty()) {
+    const PTreeNode *n = stack.back();
+    stack.pop_back();
+    ++nodes;
+    collapsed += n->collapsed;
+    for (const PTreeNode *child : {n->left, n->right})
+      if (child)
+        stack.push_back(child);
+  }
+  std::printf("fork+terminate %.2f ns, %zu nodes, %zu collapsed\n",
+              seconds / forks * 1e9, nodes, collapsed);
+
+  for (auto state : live)
+    processTree.remove(state->ptreeNode);
+}
+
+} // namespace
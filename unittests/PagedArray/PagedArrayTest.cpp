@@ -0,0 +1,122 @@
+//===-- PagedArrayTest.cpp ------------------------------------------------===//
+//
+//                     The KLEE Symbolic Virtual Machine
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+
+#include "klee/ADT/PagedArray.h"
+#include "klee/Expr/Expr.h"
+#include "gtest/gtest.h"
+
+#include <cstdint>
+#include <vector>
+
+using namespace klee;
+
+namespace {
+
+TEST(PagedArrayTest, CopiesShareUnmodifiedPages) {
+  PagedArray<std::uint8_t, 16> a(40);
+  EXPECT_EQ(0, a[39]);
+  a.set(1, 1);
+  a.set(20, 2);
+  a.set(39, 3);
+
+  PagedArray<std::uint8_t, 16> b = a;
+  b.set(21, 4);
+  EXPECT_EQ(0, a[21]);
+  EXPECT_EQ(4, b[21]);
+  EXPECT_EQ(2, b[20]);
+  // only the written page was duplicated
+  EXPECT_EQ(&a[1], &b[1]);
+  EXPECT_NE(&a[20], &b[20]);
+  EXPECT_EQ(&a[39], &b[39]);
+
+  a = b;
+  EXPECT_EQ(4, a[21]);
+  EXPECT_EQ(&a[21], &b[21]);
+
+  a.fill(7);
+  EXPECT_EQ(7, a[39]);
+  EXPECT_EQ(3, b[39]);
+}
+
+TEST(PagedArrayTest, PageAccess) {
+  PagedArray<std::uint8_t, 16> a(40, 9);
+  EXPECT_EQ(3u, a.getNumPages());
+  EXPECT_EQ(8u, a.pageSize(2));
+  a.set(1, 1);
+  a.set(39, 3);
+  EXPECT_EQ(nullptr, a.getPage(1));
+  EXPECT_TRUE(a.isPageExclusive(0));
+  EXPECT_FALSE(a.isPageExclusive(1));
+
+  PagedArray<std::uint8_t, 16> b = a;
+  b.set(1, 2);
+  EXPECT_TRUE(a.isPageExclusive(0));
+  EXPECT_FALSE(a.isPageExclusive(2));
+
+  a.releasePage(0);
+  EXPECT_EQ(9, a[1]);
+  EXPECT_EQ(2, b[1]);
+  a.getWritablePage(0)[1] = 1;
+  EXPECT_EQ(1, a.getPage(0)[1]);
+  EXPECT_EQ(9, a[0]);
+}
+
+TEST(PagedArrayTest, RangeAccess) {
+  PagedArray<std::uint8_t, 16> a(40);
+  std::vector<std::uint8_t> bytes(40);
+  for (unsigned i = 0; i < bytes.size(); ++i)
+    bytes[i] = i;
+  a.write(0, 40, bytes.data());
+  EXPECT_TRUE(a.equals(0, 40, bytes.data()));
+
+  PagedArray<std::uint8_t, 16> b = a;
+  bytes[30] = 0;
+  EXPECT_FALSE(b.equals(0, 40, bytes.data()));
+  EXPECT_TRUE(b.equals(0, 30, bytes.data()));
+  b.write(5, 30, bytes.data() + 5);
+  EXPECT_EQ(0, b[30]);
+  EXPECT_EQ(30, a[30]);
+  // pages that did not change stay shared
+  EXPECT_EQ(&a[5], &b[5]);
+  EXPECT_NE(&a[16], &b[16]);
+  EXPECT_EQ(&a[32], &b[32]);
+
+  std::vector<std::uint8_t> out(10);
+  b.read(28, 10, out.data());
+  EXPECT_EQ(std::vector<std::uint8_t>({28, 29, 0, 31, 32, 33, 34, 35, 36, 37}),
+            out);
+}
+
+TEST(PagedArrayTest, ReleasesElements) {
+  unsigned count = Expr::count;
+  {
+    ref<Expr> e = ConstantExpr::alloc(llvm::APInt(128, 1));
+    PagedArray<ref<Expr>, 4> a(10);
+    a.set(9, e);
+    PagedArray<ref<Expr>, 4> b = a;
+    b.set(8, e);
+    EXPECT_EQ(e.get(), b[9].get());
+    EXPECT_EQ(nullptr, a[8].get());
+    EXPECT_EQ(count + 1, Expr::count);
+  }
+  EXPECT_EQ(count, Expr::count);
+}
+
+TEST(PagedArrayTest, Bits) {
+  PagedBitArray a(10000, true);
+  PagedBitArray b = a;
+  b.unset(9999);
+  EXPECT_TRUE(a.get(9999));
+  EXPECT_FALSE(b.get(9999));
+  EXPECT_TRUE(b.get(9998));
+  b.set(9999, true);
+  EXPECT_TRUE(b.get(9999));
+}
+
+} // namespace
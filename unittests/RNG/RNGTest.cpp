@@ -47,3 +47,18 @@ TEST(RNG, SeedEquality) {
 
   ASSERT_EQ(noseed.getInt32(), seed.getInt32());
 }
+
+
+/* test that a restored state continues the same sequence */
+TEST(RNG, StateRestore) {
+  RNG rng(42U);
+  for (unsigned i = 0; i < 1000; ++i)
+    rng.getInt32();
+
+  RNG restored;
+  ASSERT_TRUE(restored.setState(rng.getState()));
+  for (unsigned i = 0; i < 1000; ++i)
+    ASSERT_EQ(rng.getInt32(), restored.getInt32());
+
+  ASSERT_FALSE(restored.setState(std::vector<unsigned int>(3)));
+}
@@ -0,0 +1,83 @@
+//===-- RecordFileTest.cpp ------------------------------------------------===//
+//
+//                     The KLEE Symbolic Virtual Machine
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+
+#include "klee/Support/RecordFile.h"
+
+#include "gtest/gtest.h"
+
+#include <cstdint>
+#include <string>
+
+using namespace klee;
+
+namespace {
+
+TEST(RecordFileTest, PayloadRoundTrip) {
+  RecordWriter w;
+  w.writeInt(0);
+  w.writeInt(127);
+  w.writeInt(128);
+  w.writeInt(UINT64_MAX);
+  w.writeString("klee");
+  const std::uint32_t raw = 0xdeadbeef;
+  w.writeBytes(&raw, sizeof(raw));
+
+  RecordReader r(w.buffer);
+  EXPECT_EQ(0u, r.readInt());
+  EXPECT_EQ(127u, r.readInt());
+  EXPECT_EQ(128u, r.readInt());
+  EXPECT_EQ(UINT64_MAX, r.readInt());
+  EXPECT_EQ("klee", r.readString());
+  std::uint32_t value = 0;
+  r.readBytes(&value, sizeof(value));
+  EXPECT_EQ(raw, value);
+  EXPECT_TRUE(r.atEnd());
+  EXPECT_FALSE(r.failed);
+
+  // reading past the end
+  EXPECT_EQ(0u, r.readInt());
+  EXPECT_TRUE(r.failed);
+}
+
+TEST(RecordFileTest, TruncatedPayload) {
+  RecordWriter w;
+  w.writeInt(300);
+  w.writeString("truncated");
+
+  RecordReader r(llvm::StringRef(w.buffer).drop_back(1));
+  EXPECT_EQ(300u, r.readInt());
+  EXPECT_EQ("", r.readString());
+  EXPECT_TRUE(r.failed);
+}
+
+TEST(RecordFileTest, TornRecords) {
+  std::string file;
+  appendRecord(file, "first");
+  appendRecord(file, "");
+  appendRecord(file, "third");
+
+  std::size_t pos = 0;
+  llvm::StringRef payload;
+  ASSERT_TRUE(readRecord(file.data(), file.size(), pos, payload));
+  EXPECT_EQ("first", payload);
+  ASSERT_TRUE(readRecord(file.data(), file.size(), pos, payload));
+  EXPECT_EQ("", payload);
+  const std::size_t third = pos;
+
+  // a record cut short by a crash
+  EXPECT_FALSE(readRecord(file.data(), file.size() - 1, pos, payload));
+  EXPECT_EQ(third, pos);
+
+  // a damaged payload
+  file.back() ^= 1;
+  EXPECT_FALSE(readRecord(file.data(), file.size(), pos, payload));
+  EXPECT_EQ(third, pos);
+}
+
+} // namespace
@@ -17,6 +17,13 @@
 
 #include "llvm/Support/raw_ostream.h"
 
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <random>
+#include <vector>
+
 using namespace klee;
 
 namespace {
@@ -25,7 +32,7 @@ TEST(SearcherTest, RandomPath) {
   // First state
   ExecutionState es;
   PTree processTree(&es);
-  es.ptreeNode = processTree.root.getPointer();
+  es.ptreeNode = processTree.root;
 
   RNG rng;
   RandomPathSearcher rp(processTree, rng);
@@ -65,7 +72,7 @@ TEST(SearcherTest, TwoRandomPath) {
   // Root state
   ExecutionState root;
   PTree processTree(&root);
-  root.ptreeNode = processTree.root.getPointer();
+  root.ptreeNode = processTree.root;
 
   ExecutionState es(root);
   processTree.attach(root.ptreeNode, &es, &root, BranchType::NONE);
@@ -123,7 +130,7 @@ TEST(SearcherTest, TwoRandomPathDot) {
   // Root state
   ExecutionState root;
   PTree processTree(&root);
-  root.ptreeNode = processTree.root.getPointer();
+  root.ptreeNode = processTree.root;
   rootPNode = root.ptreeNode;
 
   ExecutionState es(root);
@@ -155,13 +162,13 @@ TEST(SearcherTest, TwoRandomPathDot) {
       << "\tnode [style=\"filled\",width=.1,height=.1,fontname=\"Terminus\"]\n"
       << "\tedge [arrowsize=.3]\n"
       << "\tn" << rootPNode << " [shape=diamond];\n"
-      << "\tn" << rootPNode << " -> n" << esParentPNode << " [label=0b011];\n"
-      << "\tn" << rootPNode << " -> n" << rightLeafPNode << " [label=0b000];\n"
+      << "\tn" << rootPNode << " -> n" << esParentPNode << " [label=0b11];\n"
+      << "\tn" << rootPNode << " -> n" << rightLeafPNode << " [label=0b00];\n"
       << "\tn" << rightLeafPNode << " [shape=diamond,fillcolor=green];\n"
       << "\tn" << esParentPNode << " [shape=diamond];\n"
       << "\tn" << esParentPNode << " -> n" << es1LeafPNode
-      << " [label=0b010];\n"
-      << "\tn" << esParentPNode << " -> n" << esLeafPNode << " [label=0b001];\n"
+      << " [label=0b10];\n"
+      << "\tn" << esParentPNode << " -> n" << esLeafPNode << " [label=0b01];\n"
       << "\tn" << esLeafPNode << " [shape=diamond,fillcolor=green];\n"
       << "\tn" << es1LeafPNode << " [shape=diamond,fillcolor=green];\n"
       << "}\n";
@@ -186,12 +193,10 @@ TEST(SearcherTest, TwoRandomPathDot) {
       << "\tnode [style=\"filled\",width=.1,height=.1,fontname=\"Terminus\"]\n"
       << "\tedge [arrowsize=.3]\n"
       << "\tn" << rootPNode << " [shape=diamond];\n"
-      << "\tn" << rootPNode << " -> n" << esParentPNode << " [label=0b001];\n"
-      << "\tn" << rootPNode << " -> n" << rightLeafPNode << " [label=0b000];\n"
+      << "\tn" << rootPNode << " -> n" << es1LeafPNode
+      << " [label=\"0b01 +1 (NONE)\"];\n"
+      << "\tn" << rootPNode << " -> n" << rightLeafPNode << " [label=0b00];\n"
       << "\tn" << rightLeafPNode << " [shape=diamond,fillcolor=green];\n"
-      << "\tn" << esParentPNode << " [shape=diamond];\n"
-      << "\tn" << esParentPNode << " -> n" << es1LeafPNode
-      << " [label=0b001];\n"
       << "\tn" << es1LeafPNode << " [shape=diamond,fillcolor=green];\n"
       << "}\n";
 
@@ -201,17 +206,208 @@ TEST(SearcherTest, TwoRandomPathDot) {
   processTree.remove(es1.ptreeNode);
   processTree.remove(root.ptreeNode);
 }
-TEST(SearcherDeathTest, TooManyRandomPaths) {
-  // First state
-  ExecutionState es;
-  PTree processTree(&es);
-  es.ptreeNode = processTree.root.getPointer();
-  processTree.remove(es.ptreeNode); // Need to remove to avoid leaks
+TEST(SearcherTest, ManyRandomPaths) {
+  // Root state, forked into one state per searcher
+  ExecutionState root;
+  PTree processTree(&root);
+  std::vector<std::unique_ptr<ExecutionState>> states;
+  for (int i = 0; i < 100; ++i) {
+    states.emplace_back(new ExecutionState(root));
+    processTree.attach(root.ptreeNode, states.back().get(), &root,
+                       BranchType::NONE);
+  }
+
+  RNG rng;
+  std::vector<std::unique_ptr<RandomPathSearcher>> searchers;
+  for (auto &es : states) {
+    searchers.emplace_back(new RandomPathSearcher(processTree, rng));
+    searchers.back()->update(nullptr, {es.get()}, {});
+  }
+  for (std::size_t i = 0; i < states.size(); ++i)
+    EXPECT_EQ(&searchers[i]->selectState(), states[i].get());
+
+  // the last searcher also gets all other states
+  std::vector<ExecutionState *> others;
+  for (std::size_t i = 0; i + 1 < states.size(); ++i)
+    others.push_back(states[i].get());
+  searchers.back()->update(nullptr, others, {});
+  searchers.back()->update(nullptr, {}, {states.back().get()});
+  for (std::size_t i = 0; i + 1 < states.size(); ++i)
+    EXPECT_EQ(&searchers[i]->selectState(), states[i].get());
+
+  for (std::size_t i = 0; i + 1 < states.size(); ++i) {
+    searchers[i]->update(nullptr, {}, {states[i].get()});
+    EXPECT_TRUE(searchers[i]->empty());
+  }
+  searchers.back()->update(nullptr, {}, others);
+  EXPECT_TRUE(searchers.back()->empty());
+
+  for (auto &es : states)
+    processTree.remove(es->ptreeNode);
+  processTree.remove(root.ptreeNode);
+}
+
+TEST(SearcherTest, DFSRemoval) {
+  ExecutionState es[5];
+  DFSSearcher dfs;
+  dfs.update(nullptr, {&es[0], &es[1], &es[2], &es[3], &es[4]}, {});
+  EXPECT_EQ(&dfs.selectState(), &es[4]);
+
+  // holes are skipped
+  dfs.update(nullptr, {}, {&es[4], &es[3], &es[1]});
+  EXPECT_EQ(&dfs.selectState(), &es[2]);
+  dfs.update(nullptr, {}, {&es[2]});
+  EXPECT_EQ(&dfs.selectState(), &es[0]);
+
+  // states can be added again after removal
+  dfs.update(nullptr, {&es[1]}, {});
+  EXPECT_EQ(&dfs.selectState(), &es[1]);
+  dfs.update(nullptr, {}, {&es[1], &es[0]});
+  EXPECT_TRUE(dfs.empty());
+}
+
+TEST(SearcherTest, BFSRemoval) {
+  ExecutionState es[4];
+  BFSSearcher bfs;
+  bfs.update(nullptr, {&es[0], &es[1], &es[2]}, {});
+  EXPECT_EQ(&bfs.selectState(), &es[0]);
+
+  // a forking state moves to the back
+  bfs.update(&es[0], {&es[3]}, {});
+  EXPECT_EQ(&bfs.selectState(), &es[1]);
+  bfs.update(nullptr, {}, {&es[1], &es[2]});
+  EXPECT_EQ(&bfs.selectState(), &es[0]);
+  bfs.update(nullptr, {}, {&es[0]});
+  EXPECT_EQ(&bfs.selectState(), &es[3]);
+  bfs.update(nullptr, {}, {&es[3]});
+  EXPECT_TRUE(bfs.empty());
+}
+
+TEST(SearcherTest, SharedStates) {
+  // the same states in several searchers, as with InterleavedSearcher
+  std::vector<ExecutionState> es(100);
+  std::vector<ExecutionState *> added;
+  for (auto &state : es)
+    added.push_back(&state);
+
+  RNG rng;
+  DFSSearcher dfs;
+  BFSSearcher bfs;
+  RandomSearcher random(rng);
+  std::vector<Searcher *> searchers = {&dfs, &bfs, &random};
+  for (auto searcher : searchers)
+    searcher->update(nullptr, added, {});
+
+  // remove all but the states 10 and 50, in random order
+  std::vector<ExecutionState *> removed;
+  for (std::size_t i = 0; i < es.size(); ++i)
+    if (i != 10 && i != 50)
+      removed.push_back(&es[i]);
+  std::shuffle(removed.begin(), removed.end(), std::mt19937(1));
+  for (auto searcher : searchers)
+    searcher->update(nullptr, {}, removed);
+
+  EXPECT_EQ(&dfs.selectState(), &es[50]);
+  EXPECT_EQ(&bfs.selectState(), &es[10]);
+  for (int i = 0; i < 100; ++i) {
+    auto *selected = &random.selectState();
+    EXPECT_TRUE(selected == &es[10] || selected == &es[50]);
+  }
+
+  for (auto searcher : searchers) {
+    searcher->update(nullptr, {}, {&es[10], &es[50]});
+    EXPECT_TRUE(searcher->empty());
+  }
+  for (auto &state : es)
+    EXPECT_TRUE(state.searcherSlots.empty());
+}
+
+// Benchmark of state removal, run with --gtest_also_run_disabled_tests
+
+double secondsSince(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                       start)
+      .count();
+}
+
+void benchmarkRemoval(const char *name, Searcher &searcher,
+                      const std::vector<ExecutionState *> &states) {
+  auto start = std::chrono::steady_clock::now();
+  searcher.update(nullptr, states, {});
+  double add = secondsSince(start);
+
+  std::vector<ExecutionState *> removed(states);
+  std::shuffle(removed.begin(), removed.end(), std::mt19937(1));
+  start = std::chrono::steady_clock::now();
+  for (auto state : removed) {
+    searcher.selectState();
+    searcher.update(nullptr, {}, {state});
+  }
+  double remove = secondsSince(start);
+  EXPECT_TRUE(searcher.empty());
+
+  std::printf("%-14s n=%-8zu add %8.2f ns  select+remove %10.2f ns\n", name,
+              states.size(), add / states.size() * 1e9,
+              remove / states.size() * 1e9);
+}
+
+// Benchmark of selecting states at the end of a long path, where the other
+// side of each branch has terminated
+
+void benchmarkRandomPath(unsigned depth, unsigned n, unsigned selections) {
+  ExecutionState root, terminated;
+  PTree processTree(&root);
+  for (unsigned i = 0; i < depth; ++i) {
+    processTree.attach(root.ptreeNode, &terminated, &root, BranchType::NONE);
+    processTree.remove(terminated.ptreeNode);
+  }
+
+  // then fork randomly chosen states
+  std::mt19937 forks(1);
+  std::vector<std::unique_ptr<ExecutionState>> forked;
+  std::vector<ExecutionState *> states = {&root};
+  for (unsigned i = 1; i < n; ++i) {
+    ExecutionState *current = states[forks() % states.size()];
+    forked.emplace_back(new ExecutionState());
+    processTree.attach(current->ptreeNode, forked.back().get(), current,
+                       BranchType::NONE);
+    states.push_back(forked.back().get());
+  }
 
   RNG rng;
   RandomPathSearcher rp(processTree, rng);
-  RandomPathSearcher rp1(processTree, rng);
-  RandomPathSearcher rp2(processTree, rng);
-  ASSERT_DEATH({ RandomPathSearcher rp3(processTree, rng); }, "");
+  rp.update(nullptr, states, {});
+  auto start = std::chrono::steady_clock::now();
+  for (unsigned i = 0; i < selections; ++i)
+    rp.selectState();
+  double select = secondsSince(start);
+  std::printf("RandomPathSearcher depth=%-7u n=%-6u select %10.2f ns\n", depth,
+              n, select / selections * 1e9);
+
+  rp.update(nullptr, {}, states);
+  for (auto es : states)
+    processTree.remove(es->ptreeNode);
+}
+
+TEST(SearcherTest, DISABLED_RandomPathBenchmark) {
+  for (unsigned depth : {10u, 1000u, 100000u})
+    benchmarkRandomPath(depth, 1000, 100000);
+}
+
+TEST(SearcherTest, DISABLED_RemovalBenchmark) {
+  for (std::size_t n : {10000u, 100000u, 1000000u}) {
+    std::unique_ptr<ExecutionState[]> es(new ExecutionState[n]);
+    std::vector<ExecutionState *> states;
+    for (std::size_t i = 0; i < n; ++i)
+      states.push_back(&es[i]);
+
+    RNG rng;
+    DFSSearcher dfs;
+    BFSSearcher bfs;
+    RandomSearcher random(rng);
+    benchmarkRemoval("DFSSearcher", dfs, states);
+    benchmarkRemoval("BFSSearcher", bfs, states);
+    benchmarkRemoval("RandomSearcher", random, states);
+  }
 }
 }